@@ -0,0 +1,50 @@
+# Writes the C file for oclkit_add_kernels, run with cmake -P.
+#
+#  OUTPUT   generated C file
+#  ENTRIES  comma-separated list of name|source|binary, binary may be empty
+
+string(REPLACE "," ";" ENTRIES "${ENTRIES}")
+
+set(_content "/* generated by oclkit_add_kernels, do not edit */\n#include \"ocl.h\"\n\n")
+set(_table "")
+set(_index 0)
+
+foreach (_entry ${ENTRIES})
+    string(REGEX REPLACE "^([^|]*)\\|([^|]*)\\|(.*)$" "\\1" _name "${_entry}")
+    string(REGEX REPLACE "^([^|]*)\\|([^|]*)\\|(.*)$" "\\2" _source "${_entry}")
+    string(REGEX REPLACE "^([^|]*)\\|([^|]*)\\|(.*)$" "\\3" _binary "${_entry}")
+
+    # unsigned to keep bytes above 0x7f free of conversion warnings
+    file(READ ${_source} _hex HEX)
+    string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," _hex "${_hex}")
+    set(_content "${_content}static const unsigned char source_${_index}[] = { ${_hex}0x00 };\n")
+
+    set(_binaries "NULL, 0")
+
+    if (_binary AND EXISTS ${_binary})
+        file(READ ${_binary} _hex HEX)
+
+        if (_hex)
+            string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," _hex "${_hex}")
+            set(_content "${_content}static const unsigned char binaries_${_index}[] = { ${_hex} };\n")
+            set(_binaries "binaries_${_index}, sizeof (binaries_${_index})")
+        endif ()
+    endif ()
+
+    set(_table "${_table}    { \"${_name}\", (const char *) source_${_index}, ${_binaries} },\n")
+    math(EXPR _index "${_index} + 1")
+endforeach ()
+
+set(_content "${_content}
+static const OclEmbeddedProgram programs[] = {
+${_table}    { NULL, NULL, NULL, 0 }
+};
+
+static void __attribute__ ((constructor))
+register_programs (void)
+{
+    ocl_register_embedded_programs (programs);
+}
+")
+
+file(WRITE ${OUTPUT} "${_content}")
@@ -0,0 +1,75 @@
+# - Embed OpenCL kernel sources into binaries
+#
+#  oclkit_add_kernels(<var> [PRECOMPILE] [OPTIONS <build options>] <file.cl> ...)
+#
+# Generates a C file that embeds the given kernel sources and registers them
+# with ocl_register_embedded_programs() at startup, so that ocl_read_program()
+# and ocl_create_program_from_file() find them by file name without touching
+# the disk. The generated file is stored in <var> and has to be added to the
+# sources of an executable. When several targets share it, make them depend
+# on a custom target that DEPENDS on <var> so it is generated only once.
+#
+# With PRECOMPILE, the kernels are additionally built with oclkit-compile for
+# all devices of the build machine. These binaries are tried first and are
+# only used if platform, device and driver at runtime match; otherwise the
+# embedded source is built. OPTIONS are the build options the binaries are
+# compiled with and must match the options passed at runtime.
+
+get_filename_component(_OCLKIT_CMAKE_DIR ${CMAKE_CURRENT_LIST_FILE} PATH)
+set(OCLKIT_EMBED_SCRIPT ${_OCLKIT_CMAKE_DIR}/OclkitEmbed.cmake)
+
+function(oclkit_add_kernels VAR)
+    set(_precompile FALSE)
+    set(_options "")
+    set(_next_is_options FALSE)
+    set(_kernels)
+
+    foreach (_arg ${ARGN})
+        if (_next_is_options)
+            set(_options "${_arg}")
+            set(_next_is_options FALSE)
+        elseif (_arg STREQUAL "PRECOMPILE")
+            set(_precompile TRUE)
+        elseif (_arg STREQUAL "OPTIONS")
+            set(_next_is_options TRUE)
+        else ()
+            get_filename_component(_path ${_arg} ABSOLUTE)
+            list(APPEND _kernels ${_path})
+        endif ()
+    endforeach ()
+
+    set(_output ${CMAKE_CURRENT_BINARY_DIR}/${VAR}-kernels.c)
+    set(_depends ${OCLKIT_EMBED_SCRIPT})
+    set(_entries)
+
+    foreach (_kernel ${_kernels})
+        get_filename_component(_name ${_kernel} NAME)
+        set(_binary "")
+
+        if (_precompile)
+            set(_binary ${CMAKE_CURRENT_BINARY_DIR}/${VAR}-${_name}.bin)
+
+            add_custom_command(OUTPUT ${_binary}
+                COMMAND oclkit-compile ${_binary} ${_kernel} "${_options}"
+                DEPENDS oclkit-compile ${_kernel}
+                COMMENT "Precompiling ${_name}"
+                VERBATIM)
+
+            list(APPEND _depends ${_binary})
+        endif ()
+
+        # name|source|binary, expanded by the embed script
+        list(APPEND _entries "${_name}|${_kernel}|${_binary}")
+        list(APPEND _depends ${_kernel})
+    endforeach ()
+
+    string(REPLACE ";" "," _entries "${_entries}")
+
+    add_custom_command(OUTPUT ${_output}
+        COMMAND ${CMAKE_COMMAND} -DOUTPUT=${_output} -DENTRIES=${_entries} -P ${OCLKIT_EMBED_SCRIPT}
+        DEPENDS ${_depends}
+        COMMENT "Embedding kernels for ${VAR}"
+        VERBATIM)
+
+    set(${VAR} ${_output} PARENT_SCOPE)
+endfunction()
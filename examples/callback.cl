@@ -1,5 +1,10 @@
+#include "callback.h"
+
 __kernel void
-do_something (global Callback *cb)
+do_something (global OclRing *ring)
 {
-    print (cb, 9.876, 5, 123);
+    int idx = get_global_id (0);
+
+    if (idx % 100 == 0)
+        print (ring, 9.876, idx, 123);
 }
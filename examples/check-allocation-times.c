@@ -1,71 +1,194 @@
 #include <glib.h>
 #include <stdio.h>
 #include <ocl.h>
+#include <ocl-pool.h>
+#include <ocl-bench.h>
 
 static void
-measure_allocation (cl_context context, cl_command_queue queue, size_t size, double *time)
+measure_allocation (OclBenchSeries *series, cl_context context, cl_command_queue queue, size_t size)
 {
     cl_mem mem;
     cl_int err;
     char *data;
-    GTimer *timer;
+    double start;
 
-    timer = g_timer_new ();
     mem = clCreateBuffer (context, CL_MEM_READ_WRITE, size, NULL, &err);
     data = malloc (size);
 
-    g_timer_start (timer);
+    start = ocl_bench_time ();
     err = clEnqueueWriteBuffer (queue, mem, CL_TRUE, 0, size, data, 0, NULL, NULL);
     OCL_CHECK_ERROR (err);
-    g_timer_stop (timer);
-    *time = g_timer_elapsed (timer, NULL);
+    ocl_bench_series_add (series, ocl_bench_time () - start);
 
     free (data);
     OCL_CHECK_ERROR (clReleaseMemObject (mem));
-    g_timer_destroy (timer);
+}
+
+static void
+measure_repeated_raw (OclBenchSeries *series, unsigned num_runs, cl_context context, cl_command_queue queue, size_t size, char *data)
+{
+    cl_int err;
+
+    for (unsigned r = 0; r < num_runs; r++) {
+        cl_mem mem;
+        double start;
+
+        start = ocl_bench_time ();
+        mem = clCreateBuffer (context, CL_MEM_READ_WRITE, size, NULL, &err);
+        OCL_CHECK_ERROR (err);
+        OCL_CHECK_ERROR (clEnqueueWriteBuffer (queue, mem, CL_TRUE, 0, size, data, 0, NULL, NULL));
+        OCL_CHECK_ERROR (clReleaseMemObject (mem));
+        ocl_bench_series_add (series, ocl_bench_time () - start);
+    }
+}
+
+static void
+measure_repeated_pooled (OclBenchSeries *series, unsigned num_runs, OclBufferPool *pool, unsigned device, cl_command_queue queue, size_t size, char *data)
+{
+    cl_int err;
+
+    for (unsigned r = 0; r < num_runs; r++) {
+        cl_mem mem;
+        double start;
+
+        start = ocl_bench_time ();
+        mem = ocl_buffer_pool_acquire (pool, device, CL_MEM_READ_WRITE, size, &err);
+        OCL_CHECK_ERROR (err);
+        OCL_CHECK_ERROR (clEnqueueWriteBuffer (queue, mem, CL_TRUE, 0, size, data, 0, NULL, NULL));
+        ocl_buffer_pool_release (pool, mem);
+        ocl_bench_series_add (series, ocl_bench_time () - start);
+    }
+}
+
+static void
+run_pool_benchmark (int argc, const char **argv)
+{
+    OclPlatform *ocl;
+    OclBench *bench;
+    cl_command_queue *queues;
+    int num_devices;
+
+    ocl = ocl_new_from_args (argc, argv, 0);
+
+    if (ocl == NULL)
+        return;
+
+    num_devices = ocl_get_num_devices (ocl);
+    queues = ocl_get_cmd_queues (ocl);
+
+    bench = ocl_bench_new (ocl, "allocation-times-pool");
+    ocl_bench_set_repetitions (bench, 0, 20);
+
+    for (int i = 0; i < num_devices; i++) {
+        const OclDeviceInfo *info = ocl_get_device_info (ocl, i);
+        cl_ulong max_mem_alloc_size = info->max_mem_alloc_size;
+        OclBufferPool *pool;
+        OclBufferPoolStats stats;
+
+        /* keep at most one maximum sized buffer cached */
+        pool = ocl_buffer_pool_new (ocl, max_mem_alloc_size);
+
+        while (max_mem_alloc_size > 0) {
+            OclBenchSeries *raw;
+            OclBenchSeries *pooled;
+            char *data;
+
+            raw = ocl_bench_series_new (bench, i, "raw", "s", max_mem_alloc_size);
+            pooled = ocl_bench_series_new (bench, i, "pooled", "s", max_mem_alloc_size);
+
+            data = malloc (max_mem_alloc_size);
+            measure_repeated_raw (raw, ocl_bench_get_runs (bench), ocl_get_context (ocl), queues[i], max_mem_alloc_size, data);
+            measure_repeated_pooled (pooled, ocl_bench_get_runs (bench), pool, i, queues[i], max_mem_alloc_size, data);
+            free (data);
+
+            ocl_bench_series_finish (raw, NULL);
+            ocl_bench_series_finish (pooled, NULL);
+            max_mem_alloc_size /= 2;
+        }
+
+        ocl_buffer_pool_get_stats (pool, &stats);
+        ocl_bench_record (bench, i, "pool hits", "count", 0, stats.hits);
+        ocl_bench_record (bench, i, "pool misses", "count", 0, stats.misses);
+        ocl_bench_record (bench, i, "pool evictions", "count", 0, stats.evictions);
+        ocl_bench_record (bench, i, "pool bytes held", "bytes", 0, stats.bytes_held);
+        ocl_buffer_pool_free (pool);
+    }
+
+    ocl_bench_free (bench);
+    ocl_free (ocl);
 }
 
 int
 main (int argc, const char **argv)
 {
     OclPlatform *ocl;
+    OclBench *bench;
     cl_device_id *devices;
     int num_devices;
+    gboolean pool = FALSE;
+    GOptionContext *context;
+    GError *error = NULL;
+
+    GOptionEntry entries[] = {
+        { "pool", 0, 0, G_OPTION_ARG_NONE, &pool, "Compare pooled and raw repeated allocations", NULL },
+        { NULL }
+    };
+
+    context = g_option_context_new (NULL);
+    g_option_context_add_main_entries (context, entries, NULL);
+    g_option_context_set_ignore_unknown_options (context, TRUE);
+
+    if (!g_option_context_parse (context, &argc, (gchar ***) &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+        g_error_free (error);
+        return 1;
+    }
+
+    g_option_context_free (context);
+
+    if (pool) {
+        run_pool_benchmark (argc, argv);
+        return 0;
+    }
 
     ocl = ocl_new_from_args_bare (argc, argv);
 
+    if (ocl == NULL)
+        return 1;
+
     num_devices = ocl_get_num_devices (ocl);
     devices = ocl_get_devices (ocl);
 
+    /* the largest sizes take seconds, so no warmup and few runs */
+    bench = ocl_bench_new (ocl, "allocation-times");
+    ocl_bench_set_repetitions (bench, 0, 3);
+
     for (int i = 0; i < num_devices; i++) {
-        char name[256];
+        const OclDeviceInfo *info = ocl_get_device_info (ocl, i);
         cl_context context;
         cl_command_queue queue;
-        cl_ulong max_mem_alloc_size;
+        cl_ulong max_mem_alloc_size = info->max_mem_alloc_size;
         cl_int err;
 
-        OCL_CHECK_ERROR (clGetDeviceInfo (devices[i], CL_DEVICE_NAME, 256, name, NULL));
-        OCL_CHECK_ERROR (clGetDeviceInfo (devices[i], CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof (cl_ulong), &max_mem_alloc_size, NULL));
-
-        g_print ("%s\n", name);
-
         context = clCreateContext (NULL, 1, &devices[i], NULL, NULL, &err);
         queue = clCreateCommandQueue (context, devices[i], CL_QUEUE_PROFILING_ENABLE, &err);
 
         while (max_mem_alloc_size > 0) {
-            double time;
+            OclBenchSeries *series;
 
-            measure_allocation (context, queue, max_mem_alloc_size, &time);
-            g_print ("  %-12zu %3.5f\n", max_mem_alloc_size, time);
+            series = ocl_bench_series_new (bench, i, "allocate and write", "s", max_mem_alloc_size);
+
+            for (unsigned r = 0; r < ocl_bench_get_runs (bench); r++)
+                measure_allocation (series, context, queue, max_mem_alloc_size);
+
+            ocl_bench_series_finish (series, NULL);
             max_mem_alloc_size /= 2;
         }
 
         OCL_CHECK_ERROR (clReleaseCommandQueue (queue));
         OCL_CHECK_ERROR (clReleaseContext (context));
-
-        if (i < num_devices - 1)
-            g_print ("\n");
     }
 
+    ocl_bench_free (bench);
     ocl_free (ocl);
 }
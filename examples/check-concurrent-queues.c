@@ -1,8 +1,10 @@
 #include <stdint.h>
 #include <ocl.h>
+#include <ocl-bench.h>
 
 
 typedef struct {
+    OclBench *bench;
     cl_context context;
     cl_device_id device;
     cl_kernel kernel;
@@ -23,13 +25,18 @@ static const char* source =
 
 
 static void
-check_events (FILE *stream, int n_kernels, cl_event *events)
+check_events (App *app, FILE *stream, const char *name, int n_kernels, cl_event *events)
 {
     cl_ulong *start;
     cl_ulong *end;
     cl_ulong earliest;
+    cl_ulong latest;
+    cl_ulong busy;
+    char metric[64];
 
     earliest = UINT64_MAX;
+    latest = 0;
+    busy = 0;
     start = malloc (n_kernels * sizeof (cl_ulong));
     end  = malloc (n_kernels * sizeof (cl_ulong));
 
@@ -39,12 +46,24 @@ check_events (FILE *stream, int n_kernels, cl_event *events)
 
         if (start[i] < earliest)
             earliest = start[i];
+
+        if (end[i] > latest)
+            latest = end[i];
+
+        busy += end[i] - start[i];
     }
 
     for (int i = 0; i < n_kernels; i++) {
         fprintf (stream, " %lu %lu ", start[i] - earliest, end[i] - earliest);
     }
 
+    /* concurrency is the kernel time per time span, 1 means serialized */
+    snprintf (metric, sizeof (metric), "%s, %i kernels", name, n_kernels);
+    ocl_bench_record (app->bench, 0, metric, "s", app->work_size, (latest - earliest) / 1e9);
+    snprintf (metric, sizeof (metric), "%s concurrency, %i kernels", name, n_kernels);
+    ocl_bench_record (app->bench, 0, metric, "ratio", app->work_size,
+                      latest > earliest ? busy / ((double) (latest - earliest)) : 0.0);
+
     free (start);
     free (end);
 }
@@ -80,7 +99,7 @@ measure_in_order_queue (App *app, FILE *stream, int n_kernels)
     /* Wait for completion */
     OCL_CHECK_ERROR (clWaitForEvents (n_kernels, events));
 
-    check_events (stream, n_kernels, events);
+    check_events (app, stream, "in-order", n_kernels, events);
 
     OCL_CHECK_ERROR (clReleaseEvent (sync_event));
     OCL_CHECK_ERROR (clReleaseCommandQueue (queue));
@@ -119,7 +138,7 @@ measure_out_of_order_queue (App *app, FILE *stream, int n_kernels)
     /* Wait for completion */
     OCL_CHECK_ERROR (clWaitForEvents (n_kernels, events));
 
-    check_events (stream, n_kernels, events);
+    check_events (app, stream, "out-of-order", n_kernels, events);
 
     OCL_CHECK_ERROR (clReleaseEvent (sync_event));
     OCL_CHECK_ERROR (clReleaseCommandQueue (queue));
@@ -160,7 +179,7 @@ measure_multi_queue (App *app, FILE *stream, int n_kernels)
     /* Wait for completion */
     OCL_CHECK_ERROR (clWaitForEvents (n_kernels, events));
 
-    check_events (stream, n_kernels, events);
+    check_events (app, stream, "multi-queue", n_kernels, events);
 
     OCL_CHECK_ERROR (clReleaseEvent (sync_event));
 
@@ -259,7 +278,6 @@ main (int argc, const char **argv)
     app.n_times = 1000;
 
     clGetDeviceInfo (ocl_get_devices (ocl)[0], CL_DEVICE_NAME, 256, app.device_name, NULL);
-    printf ("# running on %s", app.device_name);
 
     sanitize (app.device_name, 256);
 
@@ -269,7 +287,9 @@ main (int argc, const char **argv)
     app.kernel = clCreateKernel (program, "compute", &errcode);
     OCL_CHECK_ERROR (errcode);
 
+    app.bench = ocl_bench_new (ocl, "concurrent-queues");
     run (&app);
+    ocl_bench_free (app.bench);
 
     OCL_CHECK_ERROR (clReleaseKernel (app.kernel));
     OCL_CHECK_ERROR (clReleaseProgram (program));
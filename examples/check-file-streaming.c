@@ -0,0 +1,214 @@
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include "ocl.h"
+#include "ocl-stream.h"
+#include "ocl-bench.h"
+
+static const char *source =
+    "__kernel void scale(global const float *input, global float *output) "
+    "{ "
+    "   int idx = get_global_id (0); "
+    "   output[idx] = 2.0f * input[idx]; "
+    "} ";
+
+static gboolean
+write_input (const gchar *filename, gsize size)
+{
+    FILE *fp;
+    gsize block = 1024 * 1024;
+    gchar *data;
+    gboolean success = TRUE;
+
+    fp = fopen (filename, "wb");
+
+    if (fp == NULL)
+        return FALSE;
+
+    data = g_malloc (block);
+
+    /* distinct values, so that misplaced chunks show up in the check */
+    for (gsize i = 0; i < block / sizeof (gfloat); i++)
+        ((gfloat *) data)[i] = (gfloat) (i % 65521);
+
+    for (gsize written = 0; written < size && success; written += block)
+        success = fwrite (data, MIN (block, size - written), 1, fp) == 1;
+
+    g_free (data);
+    fclose (fp);
+    return success;
+}
+
+/*
+ * Compares the output with twice the input, which the stream pads with zeros to
+ * whole chunks. Returns the number of wrong elements or -1 if a file could not
+ * be read.
+ */
+static gint64
+check_output (const gchar *input_filename, const gchar *output_filename)
+{
+    FILE *input;
+    FILE *output;
+    gsize block = 1024 * 1024;
+    gfloat *expected;
+    gfloat *result;
+    gint64 errors = 0;
+    gsize length;
+
+    input = fopen (input_filename, "rb");
+    output = fopen (output_filename, "rb");
+
+    if (input == NULL || output == NULL) {
+        if (input != NULL)
+            fclose (input);
+
+        if (output != NULL)
+            fclose (output);
+
+        return -1;
+    }
+
+    expected = g_malloc (block);
+    result = g_malloc (block);
+
+    while ((length = fread (result, 1, block, output)) > 0) {
+        gsize read = fread (expected, 1, length, input);
+
+        memset ((gchar *) expected + read, 0, block - read);
+
+        for (gsize i = 0; i < length / sizeof (gfloat); i++) {
+            if (result[i] != 2.0f * expected[i])
+                errors++;
+        }
+    }
+
+    g_free (result);
+    g_free (expected);
+    fclose (output);
+    fclose (input);
+    return errors;
+}
+
+int
+main (int argc, char **argv)
+{
+    OclPlatform *ocl;
+    OclStreamStats stats;
+    OclBench *bench;
+    OclBenchSeries *series[6];
+    cl_program program;
+    cl_kernel kernel;
+    cl_int errcode;
+    GOptionContext *context;
+    GError *error = NULL;
+    gchar *input = NULL;
+    gchar *output = NULL;
+    gint size = 256;
+    gint chunk = 16;
+    gboolean generated = FALSE;
+    gint64 errors;
+    size_t n_elements;
+    const cl_command_queue_properties properties[] = {
+        CL_QUEUE_PROFILING_ENABLE, CL_QUEUE_PROFILING_ENABLE, CL_QUEUE_PROFILING_ENABLE
+    };
+
+    GOptionEntry entries[] = {
+        { "input", 0, 0, G_OPTION_ARG_FILENAME, &input, "Input file (default: generate one)", "FILE" },
+        { "output", 0, 0, G_OPTION_ARG_FILENAME, &output, "Output file (default: stream-output.raw)", "FILE" },
+        { "size", 0, 0, G_OPTION_ARG_INT, &size, "Size of the generated input in MB", "N" },
+        { "chunk", 0, 0, G_OPTION_ARG_INT, &chunk, "Chunk size in MB", "N" },
+        { NULL }
+    };
+
+    context = g_option_context_new (NULL);
+    g_option_context_add_main_entries (context, entries, NULL);
+
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+        g_error_free (error);
+        return 1;
+    }
+
+    g_option_context_free (context);
+
+    if (chunk <= 0 || size <= 0) {
+        g_printerr ("Sizes must be positive\n");
+        return 1;
+    }
+
+    if (input == NULL) {
+        input = g_strdup ("stream-input.raw");
+        generated = TRUE;
+
+        if (!write_input (input, ((gsize) size) * 1024 * 1024)) {
+            g_printerr ("Could not write %s\n", input);
+            return 1;
+        }
+    }
+
+    if (output == NULL)
+        output = g_strdup ("stream-output.raw");
+
+    ocl = ocl_new_with_queue_roles (0, CL_DEVICE_TYPE_ALL, 3, properties);
+
+    if (ocl == NULL)
+        return 1;
+
+    program = ocl_create_program_from_source (ocl, source, NULL, &errcode);
+    OCL_CHECK_ERROR (errcode);
+
+    kernel = clCreateKernel (program, "scale", &errcode);
+    OCL_CHECK_ERROR (errcode);
+
+    n_elements = ((size_t) chunk) * 1024 * 1024 / sizeof (float);
+
+    /* the page cache is warm after the first run unless warmup is zero */
+    bench = ocl_bench_new (ocl, "file-streaming");
+    ocl_bench_set_repetitions (bench, 0, 1);
+
+    series[0] = ocl_bench_series_new (bench, 0, "disk read", "MB/s", n_elements * sizeof (float));
+    series[1] = ocl_bench_series_new (bench, 0, "upload", "MB/s", n_elements * sizeof (float));
+    series[2] = ocl_bench_series_new (bench, 0, "compute", "MB/s", n_elements * sizeof (float));
+    series[3] = ocl_bench_series_new (bench, 0, "download", "MB/s", n_elements * sizeof (float));
+    series[4] = ocl_bench_series_new (bench, 0, "disk write", "MB/s", n_elements * sizeof (float));
+    series[5] = ocl_bench_series_new (bench, 0, "total", "MB/s", n_elements * sizeof (float));
+
+    for (guint r = 0; r < ocl_bench_get_warmup (bench) + ocl_bench_get_runs (bench); r++) {
+        OCL_CHECK_ERROR (ocl_stream_file (ocl, 0, kernel, input, output,
+                                          n_elements * sizeof (float), n_elements * sizeof (float), 3,
+                                          1, &n_elements, NULL, &stats));
+
+        if (r < ocl_bench_get_warmup (bench))
+            continue;
+
+        ocl_bench_series_add (series[0], stats.read_bandwidth);
+        ocl_bench_series_add (series[1], stats.upload_bandwidth);
+        ocl_bench_series_add (series[2], stats.compute_bandwidth);
+        ocl_bench_series_add (series[3], stats.download_bandwidth);
+        ocl_bench_series_add (series[4], stats.write_bandwidth);
+        ocl_bench_series_add (series[5], stats.total_bandwidth);
+    }
+
+    ocl_bench_record (bench, 0, "chunks", "count", n_elements * sizeof (float), stats.num_chunks);
+
+    for (guint i = 0; i < G_N_ELEMENTS (series); i++)
+        ocl_bench_series_finish (series[i], NULL);
+
+    ocl_bench_free (bench);
+    errors = check_output (input, output);
+
+    if (errors != 0)
+        g_printerr ("%s does not hold twice %s: %" G_GINT64_FORMAT " wrong elements\n",
+                    output, input, errors);
+
+    if (generated)
+        g_unlink (input);
+
+    OCL_CHECK_ERROR (clReleaseKernel (kernel));
+    OCL_CHECK_ERROR (clReleaseProgram (program));
+    ocl_free (ocl);
+    g_free (input);
+    g_free (output);
+    return errors == 0 ? 0 : 1;
+}
@@ -1,9 +1,77 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <glib.h>
 #include "ocl.h"
+#include "ocl-client.h"
+#include "ocl-bench.h"
+
+static int
+run_daemon_benchmark (const gchar *socket_path)
+{
+    OclBench *bench;
+    OclClient *client;
+    OclClientBuffer *buffer;
+    OclClientArg arg;
+    char *source;
+    cl_int errcode;
+    cl_ulong time;
+    size_t n_elements;
+    int program;
+    double start;
+
+    if ((source = ocl_read_program ("test.cl")) == NULL)
+        return 1;
+
+    /* the platform lives in the daemon, all records are host records */
+    bench = ocl_bench_new (NULL, "infrastructure-times-daemon");
+
+    start = ocl_bench_time ();
+    client = ocl_client_new (socket_path, &errcode);
+    OCL_CHECK_ERROR (errcode);
+    ocl_bench_record (bench, OCL_BENCH_NO_DEVICE, "connect", "s", 0, ocl_bench_time () - start);
+
+    if (client == NULL) {
+        ocl_bench_free (bench);
+        free (source);
+        return 1;
+    }
+
+    start = ocl_bench_time ();
+    program = ocl_client_create_program_from_source (client, source, NULL, &errcode);
+    OCL_CHECK_ERROR (errcode);
+    ocl_bench_record (bench, OCL_BENCH_NO_DEVICE, "build program", "s", 0, ocl_bench_time () - start);
+
+    start = ocl_bench_time ();
+    n_elements = 1024 * 1024;
+    buffer = ocl_client_buffer_new (client, n_elements * sizeof (float), &errcode);
+    OCL_CHECK_ERROR (errcode);
+    ocl_bench_record (bench, OCL_BENCH_NO_DEVICE, "create buffer", "s", n_elements * sizeof (float),
+                      ocl_bench_time () - start);
+
+    arg.type = OCL_CLIENT_ARG_BUFFER;
+    arg.size = 0;
+    arg.value = NULL;
+    arg.buffer = buffer;
+    arg.offset = 0;
+    arg.flags = CL_MEM_WRITE_ONLY;
+
+    start = ocl_bench_time ();
+    OCL_CHECK_ERROR (ocl_client_run (client, 0, program, "fill_ones", 1, &n_elements, NULL, 1, &arg, &time));
+    ocl_bench_record (bench, OCL_BENCH_NO_DEVICE, "run kernel", "s", 0, ocl_bench_time () - start);
+    ocl_bench_record (bench, OCL_BENCH_NO_DEVICE, "kernel", "s", 0, time / 1e9);
+
+    start = ocl_bench_time ();
+    ocl_client_buffer_free (buffer);
+    ocl_client_free (client);
+    ocl_bench_record (bench, OCL_BENCH_NO_DEVICE, "cleanup", "s", 0, ocl_bench_time () - start);
+
+    ocl_bench_free (bench);
+    free (source);
+    return 0;
+}
 
 int
-main (void)
+main (int argc, char **argv)
 {
     OclPlatform *ocl;
     cl_mem mem;
@@ -12,38 +80,62 @@ main (void)
     cl_int errcode;
     cl_event event;
     size_t n_elements;
-    GTimer *timer;
+    OclBench *bench;
+    double start;
+    double elapsed;
     cl_command_queue *cmd_queues;
+    GOptionContext *context;
+    GError *error = NULL;
+    gchar *socket_path = NULL;
 
-    timer = g_timer_new ();
+    GOptionEntry entries[] = {
+        { "daemon", 0, 0, G_OPTION_ARG_FILENAME, &socket_path, "Run the same job through an oclkit-daemon", "SOCKET" },
+        { NULL }
+    };
+
+    context = g_option_context_new (NULL);
+    g_option_context_add_main_entries (context, entries, NULL);
+
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+        g_error_free (error);
+        return 1;
+    }
+
+    g_option_context_free (context);
+
+    if (socket_path != NULL)
+        return run_daemon_benchmark (socket_path);
+
+    start = ocl_bench_time ();
     ocl = ocl_new_with_queues (0, CL_DEVICE_TYPE_ALL, 0);
-    g_timer_stop (timer);
-    g_print ("Create context: %8.6f s\n", g_timer_elapsed (timer, NULL));
+    elapsed = ocl_bench_time () - start;
 
     if (ocl == NULL)
         return 1;
 
-    g_timer_start (timer);
+    bench = ocl_bench_new (ocl, "infrastructure-times");
+    ocl_bench_record (bench, OCL_BENCH_NO_DEVICE, "create context", "s", 0, elapsed);
+
+    start = ocl_bench_time ();
     program = ocl_create_program_from_file (ocl, "test.cl", NULL, &errcode);
     OCL_CHECK_ERROR (errcode);
-    g_timer_stop (timer);
-    g_print ("Build program : %8.6f s\n", g_timer_elapsed (timer, NULL));
+    ocl_bench_record (bench, OCL_BENCH_NO_DEVICE, "build program", "s", 0, ocl_bench_time () - start);
 
     cmd_queues = ocl_get_cmd_queues (ocl);
 
-    g_timer_start (timer);
+    start = ocl_bench_time ();
     kernel = clCreateKernel (program, "fill_ones", &errcode);
     OCL_CHECK_ERROR (errcode);
-    g_timer_stop (timer);
-    g_print ("Create kernel : %8.6f s\n", g_timer_elapsed (timer, NULL));
+    ocl_bench_record (bench, OCL_BENCH_NO_DEVICE, "create kernel", "s", 0, ocl_bench_time () - start);
 
-    g_timer_start (timer);
+    start = ocl_bench_time ();
     n_elements = 1024 * 1024;
     mem = clCreateBuffer (ocl_get_context (ocl), CL_MEM_READ_WRITE,
                           n_elements * sizeof (float),
                           NULL, &errcode);
-    g_timer_stop (timer);
-    g_print ("Create buffer : %8.6f s\n", g_timer_elapsed (timer, NULL));
+    ocl_bench_record (bench, OCL_BENCH_NO_DEVICE, "create buffer", "s", n_elements * sizeof (float),
+                      ocl_bench_time () - start);
 
     OCL_CHECK_ERROR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &mem));
     OCL_CHECK_ERROR (clEnqueueNDRangeKernel (cmd_queues[0], kernel,
@@ -52,14 +144,14 @@ main (void)
                                              
     OCL_CHECK_ERROR (clWaitForEvents (1, &event));
 
-    g_timer_start (timer);
+    start = ocl_bench_time ();
     OCL_CHECK_ERROR (clReleaseEvent (event));
     OCL_CHECK_ERROR (clReleaseMemObject (mem));
     OCL_CHECK_ERROR (clReleaseKernel (kernel));
     OCL_CHECK_ERROR (clReleaseProgram (program));
     ocl_free (ocl);
-    g_timer_stop (timer);
-    g_print ("Cleanup       : %8.6f s\n", g_timer_elapsed (timer, NULL));
+    ocl_bench_record (bench, OCL_BENCH_NO_DEVICE, "cleanup", "s", 0, ocl_bench_time () - start);
 
+    ocl_bench_free (bench);
     return 0;
 }
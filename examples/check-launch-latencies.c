@@ -1,108 +1,645 @@
+#define _XOPEN_SOURCE 700
+
 #include <glib.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 #include <ocl.h>
+#include <ocl-bench.h>
+#include <ocl-clock.h>
+#include <ocl-wait.h>
+#include <ocl-kernel.h>
+
 
+typedef struct {
+    cl_command_queue queue;
+    cl_kernel kernel;
+    pthread_barrier_t *barrier;
+    unsigned num_kernels;
+    unsigned batch_size;
+    unsigned flush_interval;
+    gboolean events;
+    OclKernel *instances;       /* per-thread kernels with arguments */
+    pthread_mutex_t *lock;      /* guards the shared kernel otherwise */
+    cl_mem buffer;
+    double cpu_time;
+    cl_int errcode;
+} Submitter;
 
 static const char* source =
     "__kernel void touch(void) "
     "{ "
     "   1 + 1; "
+    "} "
+    "__kernel void fill(global float *data, float value) "
+    "{ "
+    "   data[get_global_id (0)] = value; "
     "} ";
 
+static const unsigned BATCH_SIZES[] = { 1, 32, 1024 };
+static const unsigned FLUSH_INTERVALS[] = { 0, 1, 32 };
+static const unsigned INSTANCE_FLUSH_INTERVAL = 32;
 
-static void
-get_event_times (cl_event event, unsigned long *start_wait, unsigned long *execution)
-{
-    cl_ulong queued, start, end;
-
-    OCL_CHECK_ERROR (clGetEventProfilingInfo (event, CL_PROFILING_COMMAND_QUEUED, sizeof (cl_ulong), &queued, NULL));
-    OCL_CHECK_ERROR (clGetEventProfilingInfo (event, CL_PROFILING_COMMAND_START, sizeof (cl_ulong), &start, NULL));
-    OCL_CHECK_ERROR (clGetEventProfilingInfo (event, CL_PROFILING_COMMAND_END, sizeof (cl_ulong), &end, NULL));
+static const struct {
+    OclWaitPolicy policy;
+    const char *name;
+} WAIT_POLICIES[] = {
+    { OCL_WAIT_BLOCK, "block" },
+    { OCL_WAIT_SPIN, "spin" },
+    { OCL_WAIT_ADAPTIVE, "adaptive" },
+};
 
-    *start_wait = start - queued;
-    *execution = end - start;
-}
 
-int
-main (int argc, const char **argv)
+static void
+run_latencies (OclPlatform *ocl, cl_kernel kernel)
 {
-    OclPlatform *ocl;
-    cl_program program;
-    cl_device_id *devices;
+    OclBench *bench;
     cl_command_queue *queues;
-    cl_kernel kernel;
     cl_int errcode;
     int num_devices;
-    GTimer *timer;
-
-    ocl = ocl_new_from_args (argc, argv, CL_QUEUE_PROFILING_ENABLE);
-
-    program = ocl_create_program_from_source (ocl, source, NULL, &errcode);
-    OCL_CHECK_ERROR (errcode);
-
-    kernel = clCreateKernel (program, "touch", &errcode);
-    OCL_CHECK_ERROR (errcode);
 
     num_devices = ocl_get_num_devices (ocl);
-    devices = ocl_get_devices (ocl);
     queues = ocl_get_cmd_queues (ocl);
-    timer = g_timer_new ();
+
+    bench = ocl_bench_new (ocl, "launch-latencies");
+    ocl_bench_set_repetitions (bench, 10, 50000);
+    ocl_bench_set_outlier_threshold (bench, 10.0);
 
     for (int i = 0; i < num_devices; i++) {
-        char name[256];
+        OclBenchSeries *wait;
+        OclBenchSeries *execution;
+        OclBenchSeries *wall_clock;
+        OclBenchSeries *submit_to_start;
+        OclBenchSeries *end_to_wakeup;
+        OclClock *clock;
         cl_event event;
+        cl_ulong *times;
         size_t size = 16;
-        const int NUM_WARMUP = 10;
-        const int NUM_RUNS = 50000;
-        unsigned long total_wait = 0;
-        unsigned long total_execution = 0;
-        double wall_clock = 0.0;
+        unsigned num_warmup = ocl_bench_get_warmup (bench);
+        unsigned num_runs = ocl_bench_get_runs (bench);
 
-        for (int r = 0; r < NUM_WARMUP; r++) {
+        for (unsigned r = 0; r < num_warmup; r++) {
             OCL_CHECK_ERROR (clEnqueueNDRangeKernel (queues[i], kernel, 1, NULL, &size, NULL, 0, NULL, &event));
             OCL_CHECK_ERROR (clWaitForEvents (1, &event));
             OCL_CHECK_ERROR (clReleaseEvent (event));
         }
 
-        for (int r = 0; r < NUM_RUNS; r++) {
-            unsigned long wait;
-            unsigned long execution;
+        clock = ocl_clock_new (ocl, i, &errcode);
+        OCL_CHECK_ERROR (errcode);
+
+        /* host enqueue, host wakeup, device start and device end per run */
+        times = g_new0 (cl_ulong, 4 * num_runs);
 
-            g_timer_start (timer);
+        wait = ocl_bench_series_new (bench, i, "wait for start", "s", 0);
+        execution = ocl_bench_series_new (bench, i, "execution time", "s", 0);
+        wall_clock = ocl_bench_series_new (bench, i, "wall clock", "s", 0);
+
+        for (unsigned r = 0; r < num_runs; r++) {
+            cl_ulong *t = &times[4 * r];
+
+            t[0] = ocl_clock_host_time ();
             OCL_CHECK_ERROR (clEnqueueNDRangeKernel (queues[i], kernel, 
                                                      1, NULL, &size, NULL,
                                                      0, NULL, &event));
 
             clWaitForEvents (1, &event);
-            g_timer_stop (timer);
+            t[1] = ocl_clock_host_time ();
+            ocl_bench_series_add (wall_clock, (t[1] - t[0]) / 1e9);
 
-            wall_clock += g_timer_elapsed (timer, NULL);
-
-            get_event_times (event, &wait, &execution);
+            ocl_bench_series_add_event (wait, event, OCL_BENCH_START_DELAY);
+            ocl_bench_series_add_event (execution, event, OCL_BENCH_EXECUTION);
+            ocl_get_event_times (event, &t[2], &t[3], NULL, NULL);
             OCL_CHECK_ERROR (clReleaseEvent (event));
+        }
+
+        ocl_bench_series_finish (wait, NULL);
+        ocl_bench_series_finish (execution, NULL);
+        ocl_bench_series_finish (wall_clock, NULL);
+
+        /*
+         * With the drift known from a second calibration, host call and device
+         * execution are on one axis and the submission and wakeup gaps are
+         * measured directly instead of being guessed from the wall clock.
+         */
+        if (clock != NULL) {
+            OCL_CHECK_ERROR (ocl_clock_calibrate (clock));
+            submit_to_start = ocl_bench_series_new (bench, i, "host submit to device start", "s", 0);
+            end_to_wakeup = ocl_bench_series_new (bench, i, "device end to host wakeup", "s", 0);
+
+            for (unsigned r = 0; r < num_runs; r++) {
+                cl_ulong *t = &times[4 * r];
+
+                ocl_bench_series_add (submit_to_start, ((cl_long) (ocl_clock_to_host (clock, t[2]) - t[0])) / 1e9);
+                ocl_bench_series_add (end_to_wakeup, ((cl_long) (t[1] - ocl_clock_to_host (clock, t[3]))) / 1e9);
+            }
+
+            ocl_bench_series_finish (submit_to_start, NULL);
+            ocl_bench_series_finish (end_to_wakeup, NULL);
+            ocl_clock_free (clock);
+        }
+
+        g_free (times);
+    }
+
+    ocl_bench_free (bench);
+}
+
+static double
+thread_cpu_time (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* includes runtime threads that a blocking wait may keep busy instead */
+static double
+process_cpu_time (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Submits its share of kernels in batches that are waited for with clFinish,
+ * flushing every flush_interval kernels in between. Only the time spent in
+ * enqueueing and flushing counts as CPU time, not the wait for the batch.
+ */
+static void *
+submit (void *data)
+{
+    Submitter *submitter = data;
+    size_t size = 16;
+    double start;
+
+    submitter->cpu_time = 0.0;
+    submitter->errcode = CL_SUCCESS;
+
+    pthread_barrier_wait (submitter->barrier);
+    start = thread_cpu_time ();
+
+    for (unsigned i = 0; i < submitter->num_kernels; i++) {
+        cl_event event;
+        cl_int errcode;
+
+        errcode = clEnqueueNDRangeKernel (submitter->queue, submitter->kernel, 1, NULL, &size, NULL,
+                                          0, NULL, submitter->events ? &event : NULL);
+
+        if (errcode != CL_SUCCESS) {
+            submitter->errcode = errcode;
+            break;
+        }
+
+        if (submitter->events)
+            clReleaseEvent (event);
+
+        if (submitter->flush_interval > 0 && (i + 1) % submitter->flush_interval == 0)
+            clFlush (submitter->queue);
+
+        if ((i + 1) % submitter->batch_size == 0 || i == submitter->num_kernels - 1) {
+            submitter->cpu_time += thread_cpu_time () - start;
+            clFinish (submitter->queue);
+            start = thread_cpu_time ();
+        }
+    }
+
+    clFinish (submitter->queue);
+    return NULL;
+}
+
+static void
+measure_throughput (OclBench *bench, unsigned device, Submitter *submitters, unsigned num_threads,
+                    unsigned num_kernels, unsigned batch_size, unsigned flush_interval, gboolean events)
+{
+    OclBenchSeries *throughput;
+    OclBenchSeries *cpu_time;
+    pthread_barrier_t barrier;
+    pthread_t *threads;
+    unsigned num_warmup = ocl_bench_get_warmup (bench);
+    unsigned num_runs = ocl_bench_get_runs (bench);
+    gchar *metric;
+
+    metric = g_strdup_printf ("kernels/s batch=%u flush=%u events=%s threads=%u",
+                              batch_size, flush_interval, events ? "yes" : "no", num_threads);
+    throughput = ocl_bench_series_new (bench, device, metric, "kernels/s", 0);
+    g_free (metric);
+
+    metric = g_strdup_printf ("cpu per enqueue batch=%u flush=%u events=%s threads=%u",
+                              batch_size, flush_interval, events ? "yes" : "no", num_threads);
+    cpu_time = ocl_bench_series_new (bench, device, metric, "s", 0);
+    g_free (metric);
+
+    threads = g_new0 (pthread_t, num_threads);
+    pthread_barrier_init (&barrier, NULL, num_threads + 1);
+
+    for (unsigned t = 0; t < num_threads; t++) {
+        /* split the kernels so that every thread count submits the same total */
+        submitters[t].barrier = &barrier;
+        submitters[t].num_kernels = num_kernels / num_threads + (t < num_kernels % num_threads ? 1 : 0);
+        submitters[t].batch_size = batch_size;
+        submitters[t].flush_interval = flush_interval;
+        submitters[t].events = events;
+    }
+
+    for (unsigned r = 0; r < num_warmup + num_runs; r++) {
+        double start;
+        double wall_time;
+        double total_cpu_time = 0.0;
+
+        for (unsigned t = 0; t < num_threads; t++)
+            pthread_create (&threads[t], NULL, submit, &submitters[t]);
+
+        pthread_barrier_wait (&barrier);
+        start = ocl_bench_time ();
+
+        for (unsigned t = 0; t < num_threads; t++) {
+            pthread_join (threads[t], NULL);
+            OCL_CHECK_ERROR (submitters[t].errcode);
+            total_cpu_time += submitters[t].cpu_time;
+        }
+
+        wall_time = ocl_bench_time () - start;
+
+        if (r >= num_warmup) {
+            ocl_bench_series_add (throughput, num_kernels / wall_time);
+            ocl_bench_series_add (cpu_time, total_cpu_time / num_kernels);
+        }
+    }
+
+    pthread_barrier_destroy (&barrier);
+    g_free (threads);
+
+    ocl_bench_series_finish (throughput, NULL);
+    ocl_bench_series_finish (cpu_time, NULL);
+}
+
+/* powers of two up to and including the maximum */
+static unsigned
+next_thread_count (unsigned num_threads, unsigned max_threads)
+{
+    if (num_threads == max_threads)
+        return max_threads + 1;
+
+    return MIN (num_threads * 2, max_threads);
+}
+
+static void
+run_throughput (OclPlatform *ocl, cl_kernel kernel, unsigned max_threads, unsigned num_kernels)
+{
+    OclBench *bench;
+    cl_device_id *devices;
+    Submitter *submitters;
+    int num_devices;
+
+    num_devices = ocl_get_num_devices (ocl);
+    devices = ocl_get_devices (ocl);
+    submitters = g_new0 (Submitter, max_threads);
+
+    bench = ocl_bench_new (ocl, "launch-throughput");
+    ocl_bench_set_repetitions (bench, 1, 5);
+
+    for (int i = 0; i < num_devices; i++) {
+        /* one in-order queue per submitting thread, like independent producers */
+        for (unsigned t = 0; t < max_threads; t++) {
+            cl_int errcode;
+
+            submitters[t].kernel = kernel;
+            submitters[t].queue = clCreateCommandQueue (ocl_get_context (ocl), devices[i], 0, &errcode);
+            OCL_CHECK_ERROR (errcode);
+        }
+
+        for (unsigned num_threads = 1; num_threads <= max_threads; num_threads = next_thread_count (num_threads, max_threads)) {
+            for (guint b = 0; b < G_N_ELEMENTS (BATCH_SIZES); b++) {
+                for (guint f = 0; f < G_N_ELEMENTS (FLUSH_INTERVALS); f++) {
+                    /* finishing a batch flushes anyway */
+                    if (FLUSH_INTERVALS[f] >= BATCH_SIZES[b] && FLUSH_INTERVALS[f] > 0)
+                        continue;
+
+                    measure_throughput (bench, i, submitters, num_threads, num_kernels,
+                                        BATCH_SIZES[b], FLUSH_INTERVALS[f], FALSE);
+                    measure_throughput (bench, i, submitters, num_threads, num_kernels,
+                                        BATCH_SIZES[b], FLUSH_INTERVALS[f], TRUE);
+                }
+            }
+        }
+
+        for (unsigned t = 0; t < max_threads; t++)
+            OCL_CHECK_ERROR (clReleaseCommandQueue (submitters[t].queue));
+    }
+
+    ocl_bench_free (bench);
+    g_free (submitters);
+}
+
+/*
+ * Sets both arguments of the fill kernel and enqueues it, either on the
+ * instance of this thread or on the one shared kernel while holding the lock.
+ */
+static void *
+submit_with_args (void *data)
+{
+    Submitter *submitter = data;
+    cl_command_queue queue = submitter->queue;
+    size_t size = 16;
+
+    submitter->errcode = CL_SUCCESS;
+
+    if (submitter->instances != NULL)
+        queue = ocl_kernel_get_queue (submitter->instances, &submitter->errcode);
+
+    pthread_barrier_wait (submitter->barrier);
+
+    for (unsigned i = 0; i < submitter->num_kernels && submitter->errcode == CL_SUCCESS; i++) {
+        float value = (float) i;
+        cl_int errcode;
+
+        if (submitter->instances != NULL) {
+            errcode = ocl_kernel_set_arg (submitter->instances, 0, sizeof (cl_mem), &submitter->buffer);
+
+            if (errcode == CL_SUCCESS)
+                errcode = ocl_kernel_set_arg (submitter->instances, 1, sizeof (float), &value);
+
+            if (errcode == CL_SUCCESS)
+                errcode = ocl_kernel_enqueue (submitter->instances, 1, &size, NULL, 0, NULL, NULL);
+        }
+        else {
+            pthread_mutex_lock (submitter->lock);
+            errcode = clSetKernelArg (submitter->kernel, 0, sizeof (cl_mem), &submitter->buffer);
+
+            if (errcode == CL_SUCCESS)
+                errcode = clSetKernelArg (submitter->kernel, 1, sizeof (float), &value);
+
+            if (errcode == CL_SUCCESS)
+                errcode = clEnqueueNDRangeKernel (queue, submitter->kernel, 1, NULL, &size, NULL, 0, NULL, NULL);
+
+            pthread_mutex_unlock (submitter->lock);
+        }
+
+        if (errcode != CL_SUCCESS)
+            submitter->errcode = errcode;
+        else if ((i + 1) % INSTANCE_FLUSH_INTERVAL == 0)
+            clFlush (queue);
+    }
+
+    if (queue != NULL)
+        clFinish (queue);
+
+    return NULL;
+}
+
+static void
+measure_instances (OclBench *bench, unsigned device, Submitter *submitters, unsigned num_threads,
+                   unsigned num_kernels, gboolean per_thread)
+{
+    OclBenchSeries *throughput;
+    pthread_barrier_t barrier;
+    pthread_t *threads;
+    unsigned num_warmup = ocl_bench_get_warmup (bench);
+    unsigned num_runs = ocl_bench_get_runs (bench);
+    gchar *metric;
+
+    metric = g_strdup_printf ("kernels/s args=%s threads=%u", per_thread ? "per-thread" : "locked", num_threads);
+    throughput = ocl_bench_series_new (bench, device, metric, "kernels/s", 0);
+    g_free (metric);
+
+    threads = g_new0 (pthread_t, num_threads);
+    pthread_barrier_init (&barrier, NULL, num_threads + 1);
+
+    for (unsigned t = 0; t < num_threads; t++) {
+        submitters[t].barrier = &barrier;
+        submitters[t].num_kernels = num_kernels / num_threads + (t < num_kernels % num_threads ? 1 : 0);
+    }
+
+    for (unsigned r = 0; r < num_warmup + num_runs; r++) {
+        double start;
+        double wall_time;
+
+        for (unsigned t = 0; t < num_threads; t++)
+            pthread_create (&threads[t], NULL, submit_with_args, &submitters[t]);
+
+        pthread_barrier_wait (&barrier);
+        start = ocl_bench_time ();
+
+        for (unsigned t = 0; t < num_threads; t++) {
+            pthread_join (threads[t], NULL);
+            OCL_CHECK_ERROR (submitters[t].errcode);
+        }
+
+        wall_time = ocl_bench_time () - start;
+
+        if (r >= num_warmup)
+            ocl_bench_series_add (throughput, num_kernels / wall_time);
+    }
+
+    pthread_barrier_destroy (&barrier);
+    g_free (threads);
+    ocl_bench_series_finish (throughput, NULL);
+}
+
+/*
+ * Both variants give every thread its own queue and buffer, so they only
+ * differ in whether arguments are set on one kernel behind a lock or on a
+ * kernel instance of the thread.
+ */
+static void
+run_instances (OclPlatform *ocl, cl_program program, unsigned max_threads, unsigned num_kernels)
+{
+    OclBench *bench;
+    cl_device_id *devices;
+    Submitter *submitters;
+    pthread_mutex_t lock;
+    int num_devices;
+
+    num_devices = ocl_get_num_devices (ocl);
+    devices = ocl_get_devices (ocl);
+    submitters = g_new0 (Submitter, max_threads);
+    pthread_mutex_init (&lock, NULL);
+
+    bench = ocl_bench_new (ocl, "launch-thread-scaling");
+    ocl_bench_set_repetitions (bench, 1, 5);
+
+    for (int i = 0; i < num_devices; i++) {
+        OclKernel *instances;
+        cl_kernel kernel;
+        cl_int errcode;
+
+        kernel = clCreateKernel (program, "fill", &errcode);
+        OCL_CHECK_ERROR (errcode);
+
+        instances = ocl_kernel_new (ocl, i, program, "fill", 0, &errcode);
+        OCL_CHECK_ERROR (errcode);
+
+        for (unsigned t = 0; t < max_threads; t++) {
+            submitters[t].kernel = kernel;
+            submitters[t].lock = &lock;
+            submitters[t].queue = clCreateCommandQueue (ocl_get_context (ocl), devices[i], 0, &errcode);
+            OCL_CHECK_ERROR (errcode);
+
+            submitters[t].buffer = clCreateBuffer (ocl_get_context (ocl), CL_MEM_READ_WRITE, 16 * sizeof (float),
+                                                   NULL, &errcode);
+            OCL_CHECK_ERROR (errcode);
+        }
+
+        for (unsigned num_threads = 1; num_threads <= max_threads; num_threads = next_thread_count (num_threads, max_threads)) {
+            for (unsigned t = 0; t < max_threads; t++)
+                submitters[t].instances = NULL;
 
-            total_wait += wait;
-            total_execution += execution;
+            measure_instances (bench, i, submitters, num_threads, num_kernels, FALSE);
+
+            for (unsigned t = 0; t < max_threads; t++)
+                submitters[t].instances = instances;
+
+            measure_instances (bench, i, submitters, num_threads, num_kernels, TRUE);
+        }
+
+        for (unsigned t = 0; t < max_threads; t++) {
+            OCL_CHECK_ERROR (clReleaseMemObject (submitters[t].buffer));
+            OCL_CHECK_ERROR (clReleaseCommandQueue (submitters[t].queue));
+        }
+
+        ocl_kernel_free (instances);
+        OCL_CHECK_ERROR (clReleaseKernel (kernel));
+    }
+
+    ocl_bench_free (bench);
+    pthread_mutex_destroy (&lock);
+    g_free (submitters);
+}
+
+static void
+run_wait_policies (OclPlatform *ocl, cl_kernel kernel)
+{
+    OclBench *bench;
+    cl_command_queue *queues;
+    int num_devices;
+
+    num_devices = ocl_get_num_devices (ocl);
+    queues = ocl_get_cmd_queues (ocl);
+
+    bench = ocl_bench_new (ocl, "launch-wait-policies");
+    ocl_bench_set_repetitions (bench, 100, 10000);
+    ocl_bench_set_outlier_threshold (bench, 10.0);
+
+    for (int i = 0; i < num_devices; i++) {
+        for (guint p = 0; p < G_N_ELEMENTS (WAIT_POLICIES); p++) {
+            OclBenchSeries *wall_clock;
+            OclBenchSeries *cpu_time;
+            OclWaiter *waiter;
+            gchar *metric;
+            size_t size = 16;
+            unsigned num_warmup = ocl_bench_get_warmup (bench);
+            unsigned num_runs = ocl_bench_get_runs (bench);
+
+            metric = g_strdup_printf ("wall clock wait=%s", WAIT_POLICIES[p].name);
+            wall_clock = ocl_bench_series_new (bench, i, metric, "s", 0);
+            g_free (metric);
+
+            metric = g_strdup_printf ("cpu time wait=%s", WAIT_POLICIES[p].name);
+            cpu_time = ocl_bench_series_new (bench, i, metric, "s", 0);
+            g_free (metric);
+
+            waiter = ocl_waiter_new (WAIT_POLICIES[p].policy);
+
+            for (unsigned r = 0; r < num_warmup + num_runs; r++) {
+                cl_event event;
+                double start;
+                double start_cpu;
+
+                start_cpu = process_cpu_time ();
+                start = ocl_bench_time ();
+                OCL_CHECK_ERROR (clEnqueueNDRangeKernel (queues[i], kernel, 1, NULL, &size, NULL, 0, NULL, &event));
+                OCL_CHECK_ERROR (ocl_waiter_wait (waiter, 1, &event));
+
+                if (r >= num_warmup) {
+                    ocl_bench_series_add (wall_clock, ocl_bench_time () - start);
+                    ocl_bench_series_add (cpu_time, process_cpu_time () - start_cpu);
+                }
+
+                OCL_CHECK_ERROR (clReleaseEvent (event));
+            }
+
+            ocl_bench_series_finish (wall_clock, NULL);
+            ocl_bench_series_finish (cpu_time, NULL);
+
+            if (WAIT_POLICIES[p].policy == OCL_WAIT_ADAPTIVE)
+                ocl_bench_record (bench, i, "spin budget wait=adaptive", "s", 0,
+                                  ocl_waiter_get_spin_budget (waiter) / 1e9);
+
+            ocl_waiter_free (waiter);
         }
+    }
+
+    ocl_bench_free (bench);
+}
+
+int
+main (int argc, const char **argv)
+{
+    OclPlatform *ocl;
+    cl_program program;
+    cl_kernel kernel;
+    cl_int errcode;
+    GOptionContext *context;
+    GError *error = NULL;
+    gboolean throughput = FALSE;
+    gboolean wait_policies = FALSE;
+    gboolean instances = FALSE;
+    gint max_threads = CLAMP ((gint) sysconf (_SC_NPROCESSORS_ONLN), 1, 4);
+    gint num_kernels = 10000;
 
-        OCL_CHECK_ERROR (clGetDeviceInfo (devices[i], CL_DEVICE_NAME, 256, name, NULL));
+    GOptionEntry entries[] = {
+        { "throughput", 0, 0, G_OPTION_ARG_NONE, &throughput, "Measure sustained enqueue throughput instead", NULL },
+        { "threads", 0, 0, G_OPTION_ARG_INT, &max_threads, "Maximum number of submitting threads", "N" },
+        { "kernels", 0, 0, G_OPTION_ARG_INT, &num_kernels, "Number of kernels per throughput run", "N" },
+        { "wait", 0, 0, G_OPTION_ARG_NONE, &wait_policies, "Compare blocking, polling and adaptive waits instead", NULL },
+        { "instances", 0, 0, G_OPTION_ARG_NONE, &instances, "Scale threaded submission with per-thread kernels instead", NULL },
+        { NULL }
+    };
 
-        g_print ("%s\n"
-                 "  wait for start: %8.5f us\n"
-                 "  execution time: %8.5f us\n"
-                 "  wall clock    : %8.5f us\n",
-                 name,
-                 total_wait / ((double) NUM_RUNS) / 1000,
-                 total_execution / ((double) NUM_RUNS) / 1000,
-                 wall_clock / NUM_RUNS * 1000 * 1000);
+    context = g_option_context_new (NULL);
+    g_option_context_add_main_entries (context, entries, NULL);
+    g_option_context_set_ignore_unknown_options (context, TRUE);
 
-        if (i < num_devices - 1)
-            g_print ("\n");
+    if (!g_option_context_parse (context, &argc, (gchar ***) &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+        g_error_free (error);
+        return 1;
     }
 
-    g_timer_destroy (timer);
+    g_option_context_free (context);
+
+    if (max_threads < 1 || num_kernels < 1) {
+        g_printerr ("Thread and kernel numbers must be positive\n");
+        return 1;
+    }
+
+    ocl = ocl_new_from_args (argc, argv, CL_QUEUE_PROFILING_ENABLE);
+
+    if (ocl == NULL)
+        return 1;
+
+    program = ocl_create_program_from_source (ocl, source, NULL, &errcode);
+    OCL_CHECK_ERROR (errcode);
+
+    kernel = clCreateKernel (program, "touch", &errcode);
+    OCL_CHECK_ERROR (errcode);
+
+    if (throughput)
+        run_throughput (ocl, kernel, max_threads, num_kernels);
+    else if (wait_policies)
+        run_wait_policies (ocl, kernel);
+    else if (instances)
+        run_instances (ocl, program, max_threads, num_kernels);
+    else
+        run_latencies (ocl, kernel);
+
     clReleaseKernel (kernel);
     clReleaseProgram (program);
 
     ocl_free (ocl);
+    return 0;
 }
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <ocl.h>
+#include <ocl-bench.h>
 
 typedef struct {
     gboolean could_allocate;
@@ -19,15 +20,13 @@ measure_allocation (cl_context context, cl_command_queue queue, cl_mem_flags fla
 {
     cl_mem mem;
     cl_int err;
-    GTimer *timer;
+    double start;
 
-    timer = g_timer_new ();
     memset (result, 0, sizeof (Result));
 
-    g_timer_start (timer);
+    start = ocl_bench_time ();
     mem = clCreateBuffer (context, flags, size, NULL, &err);
-    g_timer_stop (timer);
-    result->alloc_time = g_timer_elapsed (timer, NULL);
+    result->alloc_time = ocl_bench_time () - start;
     result->could_allocate = err == CL_SUCCESS;
 
     if (result->could_allocate) {
@@ -35,57 +34,72 @@ measure_allocation (cl_context context, cl_command_queue queue, cl_mem_flags fla
 
         data = malloc (size);
 
-        g_timer_start (timer);
+        start = ocl_bench_time ();
         err = clEnqueueWriteBuffer (queue, mem, CL_TRUE, 0, size, data, 0, NULL, NULL);
-        g_timer_stop (timer);
-        result->warmup_time = g_timer_elapsed (timer, NULL);
+        result->warmup_time = ocl_bench_time () - start;
 
-        g_timer_start (timer);
+        start = ocl_bench_time ();
         err = clEnqueueWriteBuffer (queue, mem, CL_TRUE, 0, size, data, 0, NULL, NULL);
-        g_timer_stop (timer);
-        result->write_time = g_timer_elapsed (timer, NULL);
+        result->write_time = ocl_bench_time () - start;
         result->could_write = err == CL_SUCCESS;
 
-        g_timer_start (timer);
+        start = ocl_bench_time ();
         err = clEnqueueReadBuffer (queue, mem, CL_TRUE, 0, size, data, 0, NULL, NULL);
-        g_timer_stop (timer);
-        result->read_time = g_timer_elapsed (timer, NULL);
+        result->read_time = ocl_bench_time () - start;
         result->could_read = err == CL_SUCCESS;
 
         free (data);
     }
 
-    OCL_CHECK_ERROR (clReleaseMemObject (mem));
-    g_timer_destroy (timer);
+    if (result->could_allocate)
+        OCL_CHECK_ERROR (clReleaseMemObject (mem));
 }
 
 static void
-print_timing (Result *result, size_t size)
+record (OclBench *bench, unsigned device, const char *flags, const char *name, const char *unit, size_t size, double value)
 {
-    static char *bools[] = {"no", "yes"};
-
-    g_print ("    Could allocate             : %s (%3.5f s)\n"
-             "    Could write                : %s (%3.5f s, %3.2f MB/s, warm up: %3.5fs)\n"
-             "    Could read                 : %s (%3.5f s, %3.2f MB/s)\n",
-             bools[result->could_allocate], result->alloc_time,
-             bools[result->could_write], result->write_time, size / result->write_time / 1024. / 1024., result->warmup_time,
-             bools[result->could_read], result->read_time, size / result->read_time / 1024. / 1024.);
+    char metric[64];
+
+    snprintf (metric, sizeof (metric), "%s %s", flags, name);
+    ocl_bench_record (bench, device, metric, unit, size, value);
+}
+
+static void
+record_result (OclBench *bench, unsigned device, const char *flags, Result *result, size_t size)
+{
+    record (bench, device, flags, "could allocate", "bool", size, result->could_allocate);
+    record (bench, device, flags, "allocation", "s", size, result->alloc_time);
+    record (bench, device, flags, "could write", "bool", size, result->could_write);
+    record (bench, device, flags, "could read", "bool", size, result->could_read);
+
+    if (result->could_write) {
+        record (bench, device, flags, "first write", "s", size, result->warmup_time);
+        record (bench, device, flags, "write", "MB/s", size, size / result->write_time / 1024. / 1024.);
+    }
+
+    if (result->could_read)
+        record (bench, device, flags, "read", "MB/s", size, size / result->read_time / 1024. / 1024.);
 }
 
 int
 main (int argc, const char **argv)
 {
     OclPlatform *ocl;
+    OclBench *bench;
     cl_device_id *devices;
     int num_devices;
 
     ocl = ocl_new_from_args_bare (argc, argv);
 
+    if (ocl == NULL)
+        return 1;
+
+    bench = ocl_bench_new (ocl, "max-allocation");
     num_devices = ocl_get_num_devices (ocl);
     devices = ocl_get_devices (ocl);
 
     for (int i = 0; i < num_devices; i++) {
-        char name[256];
+        const OclDeviceInfo *info;
         cl_context context;
         cl_command_queue queue;
         cl_ulong global_mem_size;
@@ -93,17 +107,12 @@ main (int argc, const char **argv)
         cl_int err;
         Result result;
 
-        OCL_CHECK_ERROR (clGetDeviceInfo (devices[i], CL_DEVICE_NAME, 256, name, NULL));
-        OCL_CHECK_ERROR (clGetDeviceInfo (devices[i], CL_DEVICE_GLOBAL_MEM_SIZE, sizeof (cl_ulong), &global_mem_size, NULL));
-        OCL_CHECK_ERROR (clGetDeviceInfo (devices[i], CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof (cl_ulong), &max_mem_alloc_size, NULL));
+        info = ocl_get_device_info (ocl, i);
+        global_mem_size = info->global_mem_size;
+        max_mem_alloc_size = info->max_mem_alloc_size;
 
-        g_print ("%s\n"
-                 "  CL_DEVICE_GLOBAL_MEM_SIZE    : %-11lu B (%3.2f MB)\n"
-                 "  CL_DEVICE_MAX_MEM_ALLOC_SIZE : %-11lu B (%3.2f MB, %3.1f%%)\n",
-                 name,
-                 global_mem_size, global_mem_size / 1024. / 1024.,
-                 max_mem_alloc_size, max_mem_alloc_size / 1024. / 1024.,
-                 ((double) max_mem_alloc_size) / global_mem_size * 100);
+        ocl_bench_record (bench, i, "CL_DEVICE_GLOBAL_MEM_SIZE", "bytes", 0, global_mem_size);
+        ocl_bench_record (bench, i, "CL_DEVICE_MAX_MEM_ALLOC_SIZE", "bytes", 0, max_mem_alloc_size);
 
         context = clCreateContext (NULL, 1, &devices[i], NULL, NULL, &err);
         queue = clCreateCommandQueue (context, devices[i], CL_QUEUE_PROFILING_ENABLE, &err);
@@ -111,19 +120,15 @@ main (int argc, const char **argv)
         OCL_CHECK_ERROR (err);
 
         measure_allocation (context, queue, CL_MEM_READ_WRITE, max_mem_alloc_size, &result);
-        g_print ("  CL_MEM_READ_WRITE\n");
-        print_timing (&result, max_mem_alloc_size);
+        record_result (bench, i, "CL_MEM_READ_WRITE", &result, max_mem_alloc_size);
 
         measure_allocation (context, queue, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, max_mem_alloc_size, &result);
-        g_print ("  CL_MEM_ALLOC_HOST_PTR\n");
-        print_timing (&result, max_mem_alloc_size);
+        record_result (bench, i, "CL_MEM_ALLOC_HOST_PTR", &result, max_mem_alloc_size);
 
         OCL_CHECK_ERROR (clReleaseCommandQueue (queue));
         OCL_CHECK_ERROR (clReleaseContext (context));
-
-        if (i < num_devices - 1)
-            g_print ("\n");
     }
 
+    ocl_bench_free (bench);
     ocl_free (ocl);
 }
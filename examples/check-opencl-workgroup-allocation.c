@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <ocl.h>
+#include <ocl-tune.h>
 
 
 static const char* source =
@@ -25,6 +26,7 @@ main (int argc, const char **argv)
     size_t buffer_size;
     cl_int errcode;
     int num_devices;
+    OclTuner *tuner;
 
     ocl = ocl_new_from_args (argc, argv, CL_QUEUE_PROFILING_ENABLE);
 
@@ -48,7 +50,7 @@ main (int argc, const char **argv)
 
     for (int i = 0; i < num_devices; i++) {
         cl_kernel kernel;
-        size_t max_work_item_sizes[4];
+        const size_t *max_work_item_sizes;
         size_t size[2];
         size_t max = 4096;
 
@@ -56,8 +58,7 @@ main (int argc, const char **argv)
 
         kernel = kernels[1];
 
-        OCL_CHECK_ERROR (clGetDeviceInfo (devices[i], CL_DEVICE_MAX_WORK_ITEM_SIZES,
-                                          3 * sizeof (size_t), max_work_item_sizes, NULL));
+        max_work_item_sizes = ocl_get_device_info (ocl, i)->max_work_item_sizes;
 
         printf ("device %i -> %zu %zu %zu\n", i,
                 max_work_item_sizes[0], max_work_item_sizes[1], max_work_item_sizes[2]);
@@ -87,6 +88,26 @@ main (int argc, const char **argv)
         /*         wall_clock / NUM_RUNS * 1000 * 1000 * 1000); */
     }
 
+    /* compare with the local size the tuner picks, results persist across runs */
+    tuner = ocl_tuner_new ("workgroup-tuning.txt");
+
+    for (int i = 0; i < num_devices; i++) {
+        size_t size[2] = { 2048, 2048 };
+        size_t local[2];
+        int cached;
+
+        OCL_CHECK_ERROR (clSetKernelArg (kernels[1], 0, sizeof (cl_mem), &buffer));
+        cached = ocl_tuner_lookup (tuner, devices[i], kernels[1], 2, size, local);
+
+        if (!cached)
+            OCL_CHECK_ERROR (ocl_tuner_tune (tuner, queues[i], kernels[1], 2, size, local));
+
+        printf ("device %i tuned %zu %zu -> %zu %zu%s\n", i, size[0], size[1],
+                local[0], local[1], cached ? " (cached)" : "");
+    }
+
+    ocl_tuner_free (tuner);
+
     for (int i = 0; i < 2; i++)
         clReleaseKernel (kernels[i]);
 
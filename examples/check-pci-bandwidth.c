@@ -1,14 +1,36 @@
+#include <string.h>
 #include <glib.h>
 #include <ocl.h>
+#include <ocl-staging.h>
+#include <ocl-host.h>
+#include <ocl-bench.h>
+#include <ocl-rect.h>
 
 
 typedef struct {
+    OclPlatform *ocl;
     cl_context context;
     cl_command_queue queue;
     cl_kernel kernel;
+    OclStaging *staging;
+    OclBench *bench;
     guint num_runs;
 } App;
 
+/* both directions of one device, each with its own queue and pinned memory */
+typedef struct {
+    cl_command_queue up_queue;
+    cl_command_queue down_queue;
+    cl_mem up_buffer;
+    cl_mem down_buffer;
+    cl_mem up_pinned;
+    cl_mem down_pinned;
+    void *up_data;
+    void *down_data;
+    cl_event up_event;
+    cl_event down_event;
+} Lane;
+
 static const char* source =
     "__kernel void touch(global char *array) "
     "{ "
@@ -16,27 +38,30 @@ static const char* source =
     "} ";
 
 
+static void
+add_bandwidth (OclBenchSeries *series, size_t size, double time)
+{
+    ocl_bench_series_add (series, size / 1024. / 1024. / time);
+}
+
 void
-measure_transfer_normal (App *app, size_t size, gdouble *upload, gdouble *download)
+measure_transfer_normal (App *app, size_t size, OclBenchSeries *upload, OclBenchSeries *download)
 {
     cl_int errcode;
     cl_mem buffer;
     cl_event event;
     char *array;
-    GTimer *timer;
+    double start;
 
-    timer = g_timer_new ();
     buffer = clCreateBuffer (app->context, CL_MEM_READ_WRITE, size, NULL, &errcode);
     OCL_CHECK_ERROR (errcode);
 
     array = g_malloc0 (size);
 
     for (guint i = 0; i < app->num_runs; i++) {
-        g_timer_start (timer);
+        start = ocl_bench_time ();
         OCL_CHECK_ERROR (clEnqueueWriteBuffer (app->queue, buffer, CL_TRUE, 0, size, array, 0, NULL, NULL));
-        g_timer_stop (timer);
-
-        *upload += g_timer_elapsed (timer, NULL);
+        add_bandwidth (upload, size, ocl_bench_time () - start);
 
         /* Call a stupid kernel to avoid any optimizing assumptions of the OpenCL
          * run-time */
@@ -46,33 +71,29 @@ measure_transfer_normal (App *app, size_t size, gdouble *upload, gdouble *downlo
         OCL_CHECK_ERROR (clWaitForEvents (1, &event));
         OCL_CHECK_ERROR (clReleaseEvent (event));
 
-        g_timer_start (timer);
+        start = ocl_bench_time ();
         OCL_CHECK_ERROR (clEnqueueReadBuffer (app->queue, buffer, CL_TRUE, 0, size, array, 0, NULL, NULL));
-        g_timer_stop (timer);
-
-        *download += g_timer_elapsed (timer, NULL);
+        add_bandwidth (download, size, ocl_bench_time () - start);
     }
 
     g_free (array);
     clReleaseMemObject (buffer);
-    g_timer_destroy (timer);
 }
 
 void
-measure_transfer_pinned (App *app, size_t size, gdouble *upload, gdouble *download)
+measure_transfer_pinned (App *app, size_t size, OclBenchSeries *upload, OclBenchSeries *download)
 {
     cl_int errcode;
     cl_mem buffer;
     cl_event event;
     char *array;
-    GTimer *timer;
+    double start;
 
-    timer = g_timer_new ();
     buffer = clCreateBuffer (app->context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size, NULL, &errcode);
     OCL_CHECK_ERROR (errcode);
 
     for (guint i = 0; i < app->num_runs; i++) {
-        g_timer_start (timer);
+        start = ocl_bench_time ();
         array = clEnqueueMapBuffer (app->queue, buffer, CL_TRUE, CL_MAP_WRITE, 0, size, 0, NULL, NULL, &errcode);
         OCL_CHECK_ERROR (errcode);
 
@@ -81,9 +102,7 @@ measure_transfer_pinned (App *app, size_t size, gdouble *upload, gdouble *downlo
         OCL_CHECK_ERROR (clEnqueueUnmapMemObject (app->queue, buffer, array, 0, NULL, &event));
         OCL_CHECK_ERROR (clWaitForEvents (1, &event));
         OCL_CHECK_ERROR (clReleaseEvent (event));
-        g_timer_stop (timer);
-
-        *upload += g_timer_elapsed (timer, NULL);
+        add_bandwidth (upload, size, ocl_bench_time () - start);
 
         /* Call a stupid kernel to avoid any optimizing assumptions of the OpenCL
          * run-time */
@@ -93,7 +112,7 @@ measure_transfer_pinned (App *app, size_t size, gdouble *upload, gdouble *downlo
         OCL_CHECK_ERROR (clWaitForEvents (1, &event));
         OCL_CHECK_ERROR (clReleaseEvent (event));
 
-        g_timer_start (timer);
+        start = ocl_bench_time ();
         array = clEnqueueMapBuffer (app->queue, buffer, CL_TRUE, CL_MAP_READ, 0, size, 0, NULL, NULL, &errcode);
         OCL_CHECK_ERROR (errcode);
 
@@ -102,38 +121,529 @@ measure_transfer_pinned (App *app, size_t size, gdouble *upload, gdouble *downlo
         OCL_CHECK_ERROR (clEnqueueUnmapMemObject (app->queue, buffer, array, 0, NULL, &event));
         OCL_CHECK_ERROR (clWaitForEvents (1, &event));
         OCL_CHECK_ERROR (clReleaseEvent (event));
-        g_timer_stop (timer);
-        *download += g_timer_elapsed (timer, NULL);
+        add_bandwidth (download, size, ocl_bench_time () - start);
     }
 
     clReleaseMemObject (buffer);
-    g_timer_destroy (timer);
 }
 
+void
+measure_transfer_staged (App *app, size_t size, OclBenchSeries *upload, OclBenchSeries *download)
+{
+    cl_int errcode;
+    cl_mem buffer;
+    cl_event event;
+    char *array;
+    double start;
 
-void run (App *app)
+    buffer = clCreateBuffer (app->context, CL_MEM_READ_WRITE, size, NULL, &errcode);
+    OCL_CHECK_ERROR (errcode);
+
+    array = g_malloc0 (size);
+
+    for (guint i = 0; i < app->num_runs; i++) {
+        start = ocl_bench_time ();
+        OCL_CHECK_ERROR (ocl_staging_write (app->staging, buffer, 0, size, array, 0, NULL, &event));
+        OCL_CHECK_ERROR (clWaitForEvents (1, &event));
+        OCL_CHECK_ERROR (clReleaseEvent (event));
+        add_bandwidth (upload, size, ocl_bench_time () - start);
+
+        OCL_CHECK_ERROR (clSetKernelArg (app->kernel, 0, sizeof (cl_mem), &buffer));
+        OCL_CHECK_ERROR (clEnqueueNDRangeKernel (app->queue, app->kernel, 1, NULL, &size, NULL, 0, NULL, &event));
+        OCL_CHECK_ERROR (clWaitForEvents (1, &event));
+        OCL_CHECK_ERROR (clReleaseEvent (event));
+
+        start = ocl_bench_time ();
+        OCL_CHECK_ERROR (ocl_staging_read (app->staging, buffer, 0, size, array, 0, NULL));
+        add_bandwidth (download, size, ocl_bench_time () - start);
+    }
+
+    g_free (array);
+    clReleaseMemObject (buffer);
+}
+
+void
+measure_transfer_zero_copy (App *app, size_t size, OclBenchSeries *upload, OclBenchSeries *download)
 {
-    g_print ("# size in bytes  /  upload MB/s  / download MB/s  /  upload/pinned MB/s  /  download/pinned MB/s\n");
+    cl_int errcode;
+    cl_mem buffer;
+    cl_event event;
+    char *host;
+    char *array;
+    double start;
+
+    host = ocl_host_alloc (app->ocl, size);
+    buffer = ocl_host_wrap (app->ocl, host, size, CL_MEM_READ_WRITE, &errcode);
+    OCL_CHECK_ERROR (errcode);
 
-#define NORMALIZE(x) (size / 1024. / 1024. / ((x) / app->num_runs))
+    for (guint i = 0; i < app->num_runs; i++) {
+        start = ocl_bench_time ();
+        array = ocl_host_map (app->ocl, 0, buffer, CL_MAP_WRITE, size, &errcode);
+        OCL_CHECK_ERROR (errcode);
+        OCL_CHECK_ERROR (ocl_host_unmap (app->ocl, 0, buffer, array));
+        add_bandwidth (upload, size, ocl_bench_time () - start);
 
+        OCL_CHECK_ERROR (clSetKernelArg (app->kernel, 0, sizeof (cl_mem), &buffer));
+        OCL_CHECK_ERROR (clEnqueueNDRangeKernel (app->queue, app->kernel, 1, NULL, &size, NULL, 0, NULL, &event));
+        OCL_CHECK_ERROR (clWaitForEvents (1, &event));
+        OCL_CHECK_ERROR (clReleaseEvent (event));
+
+        start = ocl_bench_time ();
+        array = ocl_host_map (app->ocl, 0, buffer, CL_MAP_READ, size, &errcode);
+        OCL_CHECK_ERROR (errcode);
+        OCL_CHECK_ERROR (ocl_host_unmap (app->ocl, 0, buffer, array));
+        add_bandwidth (download, size, ocl_bench_time () - start);
+    }
+
+    clReleaseMemObject (buffer);
+    ocl_host_free (host);
+}
+
+
+typedef void (*MeasureFunc) (App *app, size_t size, OclBenchSeries *upload, OclBenchSeries *download);
+
+static void
+measure (App *app, MeasureFunc func, const char *name, size_t size)
+{
+    OclBenchSeries *upload;
+    OclBenchSeries *download;
+    char metric[64];
+
+    g_snprintf (metric, sizeof (metric), "upload/%s", name);
+    upload = ocl_bench_series_new (app->bench, 0, metric, "MB/s", size);
+    g_snprintf (metric, sizeof (metric), "download/%s", name);
+    download = ocl_bench_series_new (app->bench, 0, metric, "MB/s", size);
+
+    func (app, size, upload, download);
+
+    ocl_bench_series_finish (upload, NULL);
+    ocl_bench_series_finish (download, NULL);
+}
+
+void run (App *app)
+{
     for (size_t size = 256 * 1024; size < 64 * 1024 * 1024 + 1; size += 256 * 1024) {
-        gdouble upload_normal = 0.0;
-        gdouble download_normal = 0.0;
-        gdouble upload_pinned = 0.0;
-        gdouble download_pinned = 0.0;
+        measure (app, measure_transfer_normal, "normal", size);
+        measure (app, measure_transfer_pinned, "pinned", size);
+        measure (app, measure_transfer_staged, "staged", size);
+        measure (app, measure_transfer_zero_copy, "zero-copy", size);
+    }
+}
+
+
+static void
+setup_lane (OclPlatform *ocl, unsigned device, size_t size, Lane *lane)
+{
+    cl_context context = ocl_get_context (ocl);
+    cl_device_id id = ocl_get_devices (ocl)[device];
+    cl_int errcode;
+
+    lane->up_queue = clCreateCommandQueue (context, id, CL_QUEUE_PROFILING_ENABLE, &errcode);
+    OCL_CHECK_ERROR (errcode);
+    lane->down_queue = clCreateCommandQueue (context, id, CL_QUEUE_PROFILING_ENABLE, &errcode);
+    OCL_CHECK_ERROR (errcode);
+
+    lane->up_buffer = clCreateBuffer (context, CL_MEM_READ_ONLY, size, NULL, &errcode);
+    OCL_CHECK_ERROR (errcode);
+    lane->down_buffer = clCreateBuffer (context, CL_MEM_WRITE_ONLY, size, NULL, &errcode);
+    OCL_CHECK_ERROR (errcode);
+
+    /* mapped CL_MEM_ALLOC_HOST_PTR memory lets the DMA engines run at full speed */
+    lane->up_pinned = clCreateBuffer (context, CL_MEM_ALLOC_HOST_PTR, size, NULL, &errcode);
+    OCL_CHECK_ERROR (errcode);
+    lane->down_pinned = clCreateBuffer (context, CL_MEM_ALLOC_HOST_PTR, size, NULL, &errcode);
+    OCL_CHECK_ERROR (errcode);
+
+    lane->up_data = clEnqueueMapBuffer (lane->up_queue, lane->up_pinned, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE,
+                                        0, size, 0, NULL, NULL, &errcode);
+    OCL_CHECK_ERROR (errcode);
+    lane->down_data = clEnqueueMapBuffer (lane->down_queue, lane->down_pinned, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE,
+                                          0, size, 0, NULL, NULL, &errcode);
+    OCL_CHECK_ERROR (errcode);
+}
+
+static void
+teardown_lane (Lane *lane)
+{
+    OCL_CHECK_ERROR (clEnqueueUnmapMemObject (lane->up_queue, lane->up_pinned, lane->up_data, 0, NULL, NULL));
+    OCL_CHECK_ERROR (clEnqueueUnmapMemObject (lane->down_queue, lane->down_pinned, lane->down_data, 0, NULL, NULL));
+    OCL_CHECK_ERROR (clFinish (lane->up_queue));
+    OCL_CHECK_ERROR (clFinish (lane->down_queue));
+
+    OCL_CHECK_ERROR (clReleaseMemObject (lane->up_pinned));
+    OCL_CHECK_ERROR (clReleaseMemObject (lane->down_pinned));
+    OCL_CHECK_ERROR (clReleaseMemObject (lane->up_buffer));
+    OCL_CHECK_ERROR (clReleaseMemObject (lane->down_buffer));
+    OCL_CHECK_ERROR (clReleaseCommandQueue (lane->up_queue));
+    OCL_CHECK_ERROR (clReleaseCommandQueue (lane->down_queue));
+}
+
+/* starts all transfers before waiting for any and returns the wall time */
+static double
+run_transfers (Lane *lanes, guint num_lanes, size_t size, gboolean up, gboolean down)
+{
+    double start;
+
+    start = ocl_bench_time ();
+
+    for (guint i = 0; i < num_lanes; i++) {
+        if (up)
+            OCL_CHECK_ERROR (clEnqueueWriteBuffer (lanes[i].up_queue, lanes[i].up_buffer, CL_FALSE, 0, size,
+                                                   lanes[i].up_data, 0, NULL, &lanes[i].up_event));
+
+        if (down)
+            OCL_CHECK_ERROR (clEnqueueReadBuffer (lanes[i].down_queue, lanes[i].down_buffer, CL_FALSE, 0, size,
+                                                  lanes[i].down_data, 0, NULL, &lanes[i].down_event));
+    }
+
+    for (guint i = 0; i < num_lanes; i++) {
+        if (up)
+            OCL_CHECK_ERROR (clFlush (lanes[i].up_queue));
+
+        if (down)
+            OCL_CHECK_ERROR (clFlush (lanes[i].down_queue));
+    }
 
-        measure_transfer_normal (app, size, &upload_normal, &download_normal);
-        measure_transfer_pinned (app, size, &upload_pinned, &download_pinned);
+    for (guint i = 0; i < num_lanes; i++) {
+        if (up)
+            OCL_CHECK_ERROR (clWaitForEvents (1, &lanes[i].up_event));
 
-        g_print ("%zu  %.5f  %.5f  %.5f  %.5f\n", size,
-                 NORMALIZE (upload_normal), NORMALIZE (download_normal),
-                 NORMALIZE (upload_pinned), NORMALIZE (download_pinned));
+        if (down)
+            OCL_CHECK_ERROR (clWaitForEvents (1, &lanes[i].down_event));
     }
 
-#undef NORMALIZE
+    return ocl_bench_time () - start;
 }
 
+static double
+event_bandwidth (cl_event event, size_t size)
+{
+    double time;
+
+    time = ocl_bench_event_time (event, OCL_BENCH_EXECUTION);
+    OCL_CHECK_ERROR (clReleaseEvent (event));
+    return size / 1024. / 1024. / time;
+}
+
+/*
+ * Runs the transfers of all lanes at once and reports the bandwidth of each
+ * direction of each lane from its profiled duration and the aggregate over all
+ * lanes from the wall time. Returns the mean aggregate bandwidth.
+ */
+static double
+measure_concurrent (OclBench *bench, const char *prefix, Lane *lanes, guint num_lanes, guint first_device,
+                    size_t size, gboolean up, gboolean down, double *up_means, double *down_means)
+{
+    OclBenchSeries **ups;
+    OclBenchSeries **downs;
+    OclBenchSeries *aggregate;
+    OclBenchStats stats;
+    unsigned num_warmup = ocl_bench_get_warmup (bench);
+    unsigned num_runs = ocl_bench_get_runs (bench);
+    gchar *metric;
+
+    ups = g_new0 (OclBenchSeries *, num_lanes);
+    downs = g_new0 (OclBenchSeries *, num_lanes);
+
+    for (guint i = 0; i < num_lanes; i++) {
+        if (up) {
+            metric = g_strdup_printf ("%s upload", prefix);
+            ups[i] = ocl_bench_series_new (bench, first_device + i, metric, "MB/s", size);
+            g_free (metric);
+        }
+
+        if (down) {
+            metric = g_strdup_printf ("%s download", prefix);
+            downs[i] = ocl_bench_series_new (bench, first_device + i, metric, "MB/s", size);
+            g_free (metric);
+        }
+    }
+
+    metric = g_strdup_printf ("%s aggregate", prefix);
+    aggregate = ocl_bench_series_new (bench, num_lanes > 1 ? OCL_BENCH_NO_DEVICE : first_device,
+                                      metric, "MB/s", size);
+    g_free (metric);
+
+    for (unsigned r = 0; r < num_warmup + num_runs; r++) {
+        double wall_time;
+
+        wall_time = run_transfers (lanes, num_lanes, size, up, down);
+
+        for (guint i = 0; i < num_lanes; i++) {
+            double up_bandwidth = up ? event_bandwidth (lanes[i].up_event, size) : 0.0;
+            double down_bandwidth = down ? event_bandwidth (lanes[i].down_event, size) : 0.0;
+
+            if (r < num_warmup)
+                continue;
+
+            if (up)
+                ocl_bench_series_add (ups[i], up_bandwidth);
+
+            if (down)
+                ocl_bench_series_add (downs[i], down_bandwidth);
+        }
+
+        if (r >= num_warmup)
+            ocl_bench_series_add (aggregate, num_lanes * ((up ? 1 : 0) + (down ? 1 : 0)) * size / 1024. / 1024. / wall_time);
+    }
+
+    for (guint i = 0; i < num_lanes; i++) {
+        if (up) {
+            ocl_bench_series_finish (ups[i], &stats);
+
+            if (up_means != NULL)
+                up_means[i] = stats.mean;
+        }
+
+        if (down) {
+            ocl_bench_series_finish (downs[i], &stats);
+
+            if (down_means != NULL)
+                down_means[i] = stats.mean;
+        }
+    }
+
+    ocl_bench_series_finish (aggregate, &stats);
+    g_free (ups);
+    g_free (downs);
+    return stats.mean;
+}
+
+static void
+run_concurrent (OclPlatform *ocl, size_t size)
+{
+    OclBench *bench;
+    Lane *lanes;
+    double *bidirectional;
+    guint num_devices;
+
+    num_devices = ocl_get_num_devices (ocl);
+    lanes = g_new0 (Lane, num_devices);
+    bidirectional = g_new0 (double, num_devices);
+
+    bench = ocl_bench_new (ocl, "pci-bandwidth-concurrent");
+    ocl_bench_set_repetitions (bench, 1, 5);
+
+    for (guint i = 0; i < num_devices; i++)
+        setup_lane (ocl, i, size, &lanes[i]);
+
+    /* duplex efficiency of 1 means up and down do not slow each other down */
+    for (guint i = 0; i < num_devices; i++) {
+        double isolated_up;
+        double isolated_down;
+
+        measure_concurrent (bench, "isolated", &lanes[i], 1, i, size, TRUE, FALSE, &isolated_up, NULL);
+        measure_concurrent (bench, "isolated", &lanes[i], 1, i, size, FALSE, TRUE, NULL, &isolated_down);
+        bidirectional[i] = measure_concurrent (bench, "bidirectional", &lanes[i], 1, i, size, TRUE, TRUE, NULL, NULL);
+        ocl_bench_record (bench, i, "duplex efficiency", "ratio", size,
+                          bidirectional[i] / (isolated_up + isolated_down));
+    }
+
+    /* scaling of 1 means the devices do not share a bottleneck */
+    if (num_devices > 1) {
+        double all_devices;
+        double sum = 0.0;
+
+        all_devices = measure_concurrent (bench, "all devices", lanes, num_devices, 0, size, TRUE, TRUE, NULL, NULL);
+
+        for (guint i = 0; i < num_devices; i++)
+            sum += bidirectional[i];
+
+        ocl_bench_record (bench, OCL_BENCH_NO_DEVICE, "all devices scaling", "ratio", size, all_devices / sum);
+    }
+
+    for (guint i = 0; i < num_devices; i++)
+        teardown_lane (&lanes[i]);
+
+    ocl_bench_free (bench);
+    g_free (bidirectional);
+    g_free (lanes);
+}
+
+typedef struct {
+    size_t width;
+    size_t height;
+} Tile;
+
+static const Tile TILES[] = {
+    { 64, 64 }, { 256, 256 }, { 1024, 1024 }, { 4096, 64 }, { 64, 4096 }, { 1024, 16 },
+};
+
+static const size_t FRAME_SIZE = 4096;
+
+/* counts the elements of a packed tile that differ from the pattern of the frame */
+static guint
+count_tile_errors (const float *tile_data, const Tile *tile, const size_t *frame_origin)
+{
+    guint errors = 0;
+
+    for (size_t y = 0; y < tile->height; y++) {
+        for (size_t x = 0; x < tile->width; x++) {
+            size_t index = (frame_origin[1] + y) * FRAME_SIZE + frame_origin[0] + x;
+
+            if (tile_data[y * tile->width + x] != (float) index)
+                errors++;
+        }
+    }
+
+    return errors;
+}
+
+/*
+ * Checks once that the tile arrives in the device buffer with either upload and
+ * back in the frame with either download. The frame holds its own indices, so
+ * the tile is cleared before each transfer that must restore it.
+ */
+static guint
+verify_tile (cl_command_queue queue, cl_mem buffer, float *frame, float *staging, const Tile *tile,
+             const OclRectLayout *frame_layout, const OclRectLayout *tile_layout,
+             const size_t *frame_origin, const size_t *tile_origin, const size_t *region)
+{
+    size_t size = tile->width * tile->height * sizeof (float);
+    guint errors = 0;
+
+    memset (staging, 0, size);
+    OCL_CHECK_ERROR (clEnqueueWriteBuffer (queue, buffer, CL_TRUE, 0, size, staging, 0, NULL, NULL));
+    OCL_CHECK_ERROR (ocl_rect_write (queue, buffer, NULL, tile_origin, frame, frame_layout, frame_origin,
+                                     region, CL_TRUE, 0, NULL, NULL));
+    OCL_CHECK_ERROR (clEnqueueReadBuffer (queue, buffer, CL_TRUE, 0, size, staging, 0, NULL, NULL));
+    errors += count_tile_errors (staging, tile, frame_origin);
+
+    OCL_CHECK_ERROR (ocl_rect_copy (staging, tile_layout, tile_origin, frame, frame_layout, frame_origin, region));
+    errors += count_tile_errors (staging, tile, frame_origin);
+
+    for (size_t y = 0; y < tile->height; y++)
+        memset (&frame[(frame_origin[1] + y) * FRAME_SIZE + frame_origin[0]], 0, tile->width * sizeof (float));
+
+    OCL_CHECK_ERROR (ocl_rect_read (queue, buffer, NULL, tile_origin, frame, frame_layout, frame_origin,
+                                    region, CL_TRUE, 0, NULL, NULL));
+    OCL_CHECK_ERROR (ocl_rect_copy (staging, tile_layout, tile_origin, frame, frame_layout, frame_origin, region));
+    errors += count_tile_errors (staging, tile, frame_origin);
+
+    for (size_t y = 0; y < tile->height; y++)
+        memset (&frame[(frame_origin[1] + y) * FRAME_SIZE + frame_origin[0]], 0, tile->width * sizeof (float));
+
+    OCL_CHECK_ERROR (clEnqueueReadBuffer (queue, buffer, CL_TRUE, 0, size, staging, 0, NULL, NULL));
+    OCL_CHECK_ERROR (ocl_rect_copy (frame, frame_layout, frame_origin, staging, tile_layout, tile_origin, region));
+    errors += count_tile_errors (staging, tile, frame_origin);
+
+    /* the unpacked tile must be in the frame as well */
+    OCL_CHECK_ERROR (ocl_rect_copy (staging, tile_layout, tile_origin, frame, frame_layout, frame_origin, region));
+    errors += count_tile_errors (staging, tile, frame_origin);
+
+    return errors;
+}
+
+/*
+ * Moves a tile from the middle of a frame into a packed device buffer and back,
+ * once with the rect transfers and once by repacking on the host into a
+ * contiguous staging area around plain reads and writes.
+ */
+static guint
+measure_tile (OclBench *bench, cl_command_queue queue, cl_mem buffer,
+              float *frame, float *staging, const Tile *tile)
+{
+    OclRectLayout frame_layout = { sizeof (float), FRAME_SIZE, FRAME_SIZE, 0, 0 };
+    OclRectLayout tile_layout = { sizeof (float), tile->width, tile->height, 0, 0 };
+    OclBenchSeries *series[4];
+    size_t frame_origin[3] = { (FRAME_SIZE - tile->width) / 2, (FRAME_SIZE - tile->height) / 2, 0 };
+    size_t tile_origin[3] = { 0, 0, 0 };
+    size_t region[3] = { tile->width, tile->height, 1 };
+    size_t size = tile->width * tile->height * sizeof (float);
+    unsigned num_warmup = ocl_bench_get_warmup (bench);
+    unsigned num_runs = ocl_bench_get_runs (bench);
+    const char *names[] = { "rect upload", "repack upload", "rect download", "download unpack" };
+    guint errors;
+
+    errors = verify_tile (queue, buffer, frame, staging, tile, &frame_layout, &tile_layout,
+                          frame_origin, tile_origin, region);
+
+    if (errors > 0)
+        g_printerr ("Tile %zux%zu: %u wrong elements\n", tile->width, tile->height, errors);
+
+    for (guint i = 0; i < G_N_ELEMENTS (series); i++) {
+        gchar *metric;
+
+        metric = g_strdup_printf ("%s %zux%zu", names[i], tile->width, tile->height);
+        series[i] = ocl_bench_series_new (bench, 0, metric, "MB/s", size);
+        g_free (metric);
+    }
+
+    for (unsigned r = 0; r < num_warmup + num_runs; r++) {
+        double start[5];
+
+        start[0] = ocl_bench_time ();
+        OCL_CHECK_ERROR (ocl_rect_write (queue, buffer, NULL, tile_origin, frame, &frame_layout, frame_origin,
+                                         region, CL_TRUE, 0, NULL, NULL));
+
+        start[1] = ocl_bench_time ();
+        OCL_CHECK_ERROR (ocl_rect_copy (staging, &tile_layout, tile_origin, frame, &frame_layout, frame_origin, region));
+        OCL_CHECK_ERROR (clEnqueueWriteBuffer (queue, buffer, CL_TRUE, 0, size, staging, 0, NULL, NULL));
+
+        start[2] = ocl_bench_time ();
+        OCL_CHECK_ERROR (ocl_rect_read (queue, buffer, NULL, tile_origin, frame, &frame_layout, frame_origin,
+                                        region, CL_TRUE, 0, NULL, NULL));
+
+        start[3] = ocl_bench_time ();
+        OCL_CHECK_ERROR (clEnqueueReadBuffer (queue, buffer, CL_TRUE, 0, size, staging, 0, NULL, NULL));
+        OCL_CHECK_ERROR (ocl_rect_copy (frame, &frame_layout, frame_origin, staging, &tile_layout, tile_origin, region));
+        start[4] = ocl_bench_time ();
+
+        if (r < num_warmup)
+            continue;
+
+        for (guint i = 0; i < G_N_ELEMENTS (series); i++)
+            ocl_bench_series_add (series[i], size / 1024. / 1024. / (start[i + 1] - start[i]));
+    }
+
+    for (guint i = 0; i < G_N_ELEMENTS (series); i++)
+        ocl_bench_series_finish (series[i], NULL);
+
+    return errors;
+}
+
+static guint
+run_rect (OclPlatform *ocl)
+{
+    OclBench *bench;
+    cl_command_queue queue;
+    float *frame;
+    float *staging;
+    size_t max_size = 0;
+    guint errors = 0;
+
+    queue = ocl_get_cmd_queues (ocl)[0];
+    frame = g_malloc (FRAME_SIZE * FRAME_SIZE * sizeof (float));
+
+    /* indices below 2^24 are exact in floats and make misplaced elements visible */
+    for (size_t i = 0; i < FRAME_SIZE * FRAME_SIZE; i++)
+        frame[i] = (float) i;
+
+    for (guint i = 0; i < G_N_ELEMENTS (TILES); i++)
+        max_size = MAX (max_size, TILES[i].width * TILES[i].height * sizeof (float));
+
+    staging = g_malloc0 (max_size);
+
+    bench = ocl_bench_new (ocl, "pci-bandwidth-rect");
+    ocl_bench_set_repetitions (bench, 1, 10);
+
+    for (guint i = 0; i < G_N_ELEMENTS (TILES); i++) {
+        cl_mem buffer;
+        cl_int errcode;
+
+        buffer = clCreateBuffer (ocl_get_context (ocl), CL_MEM_READ_WRITE,
+                                 TILES[i].width * TILES[i].height * sizeof (float), NULL, &errcode);
+        OCL_CHECK_ERROR (errcode);
+
+        errors += measure_tile (bench, queue, buffer, frame, staging, &TILES[i]);
+        OCL_CHECK_ERROR (clReleaseMemObject (buffer));
+    }
+
+    ocl_bench_free (bench);
+    g_free (staging);
+    g_free (frame);
+    return errors;
+}
 
 int
 main (int argc, const char **argv)
@@ -141,15 +651,62 @@ main (int argc, const char **argv)
     OclPlatform *ocl;
     cl_int errcode;
     cl_program program;
-    gchar device_name[256];
     App app;
+    GOptionContext *context;
+    GError *error = NULL;
+    gboolean concurrent = FALSE;
+    gboolean rect = FALSE;
+    gint size = 64;
+
+    GOptionEntry entries[] = {
+        { "concurrent", 0, 0, G_OPTION_ARG_NONE, &concurrent, "Run both directions and all devices at once", NULL },
+        { "size", 0, 0, G_OPTION_ARG_INT, &size, "Transfer size in MB of the concurrent mode", "N" },
+        { "rect", 0, 0, G_OPTION_ARG_NONE, &rect, "Compare rect transfers of tiles against host repacking", NULL },
+        { NULL }
+    };
+
+    context = g_option_context_new (NULL);
+    g_option_context_add_main_entries (context, entries, NULL);
+    g_option_context_set_ignore_unknown_options (context, TRUE);
+
+    if (!g_option_context_parse (context, &argc, (gchar ***) &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+        g_error_free (error);
+        return 1;
+    }
+
+    g_option_context_free (context);
+
+    if (size <= 0) {
+        g_printerr ("Size must be positive\n");
+        return 1;
+    }
 
     ocl = ocl_new_from_args (argc, argv, 0);
+
+    if (ocl == NULL)
+        return 1;
+
+    if (concurrent) {
+        run_concurrent (ocl, ((size_t) size) * 1024 * 1024);
+        ocl_free (ocl);
+        return 0;
+    }
+
+    if (rect) {
+        guint errors = run_rect (ocl);
+
+        ocl_free (ocl);
+        return errors == 0 ? 0 : 1;
+    }
+
+    app.ocl = ocl;
     app.context = ocl_get_context (ocl);
     app.queue = ocl_get_cmd_queues (ocl)[0];
 
-    clGetDeviceInfo (ocl_get_devices (ocl)[0], CL_DEVICE_NAME, 256, device_name, NULL);
-    g_print ("# running on %s\n", device_name);
+    app.bench = ocl_bench_new (ocl, "pci-bandwidth");
+    ocl_bench_set_repetitions (app.bench, 0, 3);
+    ocl_bench_record (app.bench, 0, "zero-copy", "bool", 0, ocl_host_is_zero_copy (ocl, 0));
 
     program = ocl_create_program_from_source (ocl, source, NULL, &errcode);
     OCL_CHECK_ERROR (errcode);
@@ -157,10 +714,15 @@ main (int argc, const char **argv)
     app.kernel = clCreateKernel (program, "touch", &errcode);
     OCL_CHECK_ERROR (errcode);
 
-    app.num_runs = 3;
+    app.num_runs = ocl_bench_get_runs (app.bench);
+
+    app.staging = ocl_staging_new (app.context, app.queue, 4 * 1024 * 1024, 4, &errcode);
+    OCL_CHECK_ERROR (errcode);
 
     run (&app);
 
+    ocl_bench_free (app.bench);
+    ocl_staging_free (app.staging);
     clReleaseKernel (app.kernel);
     clReleaseProgram (program);
 
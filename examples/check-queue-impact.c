@@ -1,9 +1,12 @@
 #include <glib.h>
 #include <stdio.h>
 #include "ocl.h"
+#include "ocl-pipeline.h"
+#include "ocl-bench.h"
 
 typedef struct {
     OclPlatform *ocl;
+    OclBench *bench;
     cl_program program;
     cl_kernel kernel;
     cl_command_queue write_queue;
@@ -195,60 +198,111 @@ setup_three_queues (Data *data, cl_device_id device)
     data->read_queue = clCreateCommandQueue (ocl_get_context (data->ocl), device, 0, &errcode);
 }
 
+static void
+setup_role_queues (Data *data, cl_device_id device)
+{
+    cl_device_id *devices;
+    int index = 0;
+
+    devices = ocl_get_devices (data->ocl);
+
+    while (devices[index] != device)
+        index++;
+
+    /* queues belong to the platform, retain them for teardown_queues */
+    data->write_queue = ocl_get_queue (data->ocl, index, OCL_QUEUE_UPLOAD);
+    data->compute_queue = ocl_get_queue (data->ocl, index, OCL_QUEUE_COMPUTE);
+    data->read_queue = ocl_get_queue (data->ocl, index, OCL_QUEUE_DOWNLOAD);
+
+    OCL_CHECK_ERROR (clRetainCommandQueue (data->write_queue));
+    OCL_CHECK_ERROR (clRetainCommandQueue (data->compute_queue));
+    OCL_CHECK_ERROR (clRetainCommandQueue (data->read_queue));
+}
+
 static void
 run_benchmark (SetupQueueFunc setup,
-               const char *fmt,
+               const char *metric,
                Data *data,
-               cl_device_id device)
+               unsigned device)
 {
-    GTimer *timer;
-
-    setup (data, device);
-    timer = g_timer_new ();
-    execute_kernel (data, N_ITERATIONS);
-    g_timer_stop (timer);
-    g_print (fmt, g_timer_elapsed (timer, NULL));
-    g_timer_destroy (timer);
+    OclBenchSeries *series;
+    unsigned num_warmup = ocl_bench_get_warmup (data->bench);
+    unsigned num_runs = ocl_bench_get_runs (data->bench);
+
+    setup (data, ocl_get_devices (data->ocl)[device]);
+    series = ocl_bench_series_new (data->bench, device, metric, "s", data->size);
+
+    for (unsigned r = 0; r < num_warmup + num_runs; r++) {
+        double start;
+
+        start = ocl_bench_time ();
+        execute_kernel (data, N_ITERATIONS);
+
+        if (r >= num_warmup)
+            ocl_bench_series_add (series, ocl_bench_time () - start);
+    }
+
+    ocl_bench_series_finish (series, NULL);
     teardown_queues (data);
 }
 
+static int
+produce_chunk (void *data, size_t size, unsigned long index, void *user_data)
+{
+    return index < (unsigned long) N_ITERATIONS;
+}
+
+static void
+run_pipeline (Data *data, unsigned device)
+{
+    OclPipeline *pipeline;
+    OclPipelineStats stats;
+    cl_int errcode;
+
+    pipeline = ocl_pipeline_new (data->ocl, device, data->kernel,
+                                 data->size, data->size, 3,
+                                 1, &data->n_elements, NULL, &errcode);
+    OCL_CHECK_ERROR (errcode);
+
+    OCL_CHECK_ERROR (ocl_pipeline_run (pipeline, produce_chunk, NULL, NULL, &stats));
+    ocl_bench_record (data->bench, device, "pipeline, 3 sets", "s", data->size, stats.wall_time);
+    ocl_bench_record (data->bench, device, "pipeline overlap efficiency", "ratio", data->size,
+                      stats.overlap_efficiency);
+
+    ocl_pipeline_free (pipeline);
+}
+
 int
 main (void)
 {
     OclPlatform *ocl;
     Data *data;
-    cl_device_id *devices;
     int num_devices;
+    const cl_command_queue_properties properties[] = {
+        CL_QUEUE_PROFILING_ENABLE, CL_QUEUE_PROFILING_ENABLE, CL_QUEUE_PROFILING_ENABLE
+    };
 
-    ocl = ocl_new (0, CL_DEVICE_TYPE_ALL);
+    ocl = ocl_new_with_queue_roles (0, CL_DEVICE_TYPE_ALL, 3, properties);
 
     if (ocl == NULL)
         return 1;
 
     data = setup_data (ocl, 2048 * 2048);
     num_devices = ocl_get_num_devices (ocl);
-    devices = ocl_get_devices (ocl);
-
-    for (int i = 0; i < num_devices; i++) {
-        char name[256];
-
-        OCL_CHECK_ERROR (clGetDeviceInfo (devices[i], CL_DEVICE_NAME, 256, name, NULL));
 
-        printf ("%s\n", name);
+    data->bench = ocl_bench_new (ocl, "queue-impact");
+    ocl_bench_set_repetitions (data->bench, 0, 3);
 
-        run_benchmark (setup_single_blocking_queue,
-                       "  Blocking queue    : %3.5fs\n", data, devices[i]);
-        run_benchmark (setup_ooo_queue,
-                       "  Out-of-order queue: %3.5fs\n", data, devices[i]);
-        run_benchmark (setup_two_queues,
-                       "  Two queues        : %3.5fs\n", data, devices[i]);
-        run_benchmark (setup_three_queues,
-                       "  Three queues      : %3.5fs\n", data, devices[i]);
-
-        if (i < num_devices - 1)
-            g_print ("\n");
+    for (int i = 0; i < num_devices; i++) {
+        run_benchmark (setup_single_blocking_queue, "blocking queue", data, i);
+        run_benchmark (setup_ooo_queue, "out-of-order queue", data, i);
+        run_benchmark (setup_two_queues, "two queues", data, i);
+        run_benchmark (setup_three_queues, "three queues", data, i);
+        run_benchmark (setup_role_queues, "role queues", data, i);
+        run_pipeline (data, i);
     }
 
+    ocl_bench_free (data->bench);
     free_data (data);
     ocl_free (ocl);
 
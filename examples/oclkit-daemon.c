@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <signal.h>
+#include <glib.h>
+#include "ocl.h"
+#include "ocl-daemon.h"
+
+static OclDaemon *daemon_instance;
+
+static void
+on_signal (int signum)
+{
+    ocl_daemon_stop (daemon_instance);
+}
+
+int
+main (int argc, const char **argv)
+{
+    OclPlatform *ocl;
+    OclDaemonStats stats;
+    GOptionContext *context;
+    GError *error = NULL;
+    gchar *socket_path = NULL;
+    gchar *cache_path = NULL;
+    cl_int errcode;
+
+    GOptionEntry entries[] = {
+        { "socket", 0, 0, G_OPTION_ARG_FILENAME, &socket_path, "Unix socket to listen on (default: /tmp/oclkit.sock)", "PATH" },
+        { "cache", 0, 0, G_OPTION_ARG_FILENAME, &cache_path, "Program binary cache directory", "PATH" },
+        { NULL }
+    };
+
+    context = g_option_context_new (NULL);
+    g_option_context_add_main_entries (context, entries, NULL);
+    g_option_context_set_ignore_unknown_options (context, TRUE);
+
+    if (!g_option_context_parse (context, &argc, (gchar ***) &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+        g_error_free (error);
+        return 1;
+    }
+
+    g_option_context_free (context);
+
+    ocl = ocl_new_from_args (argc, argv, CL_QUEUE_PROFILING_ENABLE);
+
+    if (ocl == NULL)
+        return 1;
+
+    if (cache_path != NULL)
+        ocl_enable_program_cache (ocl, cache_path);
+
+    daemon_instance = ocl_daemon_new (ocl, socket_path != NULL ? socket_path : "/tmp/oclkit.sock", &errcode);
+    OCL_CHECK_ERROR (errcode);
+
+    if (daemon_instance == NULL)
+        return 1;
+
+    signal (SIGINT, on_signal);
+    signal (SIGTERM, on_signal);
+
+    g_print ("Serving %i device(s) on %s\n", ocl_get_num_devices (ocl),
+             socket_path != NULL ? socket_path : "/tmp/oclkit.sock");
+
+    ocl_daemon_run (daemon_instance);
+    ocl_daemon_get_stats (daemon_instance, &stats);
+
+    g_print ("%lu connections, %lu jobs, %lu programs built, %lu reused\n",
+             stats.connections, stats.jobs, stats.programs_built, stats.programs_reused);
+
+    ocl_daemon_free (daemon_instance);
+    ocl_free (ocl);
+    g_free (socket_path);
+    g_free (cache_path);
+    return 0;
+}
@@ -1,6 +1,8 @@
 #include <glib.h>
 #include <glib-object.h>
 #include <ocl.h>
+#include <ocl-link.h>
+#include <ocl-ring.h>
 
 
 typedef struct {
@@ -13,19 +15,18 @@ typedef struct {
 
 
 typedef struct {
-    cl_context context;
+    OclPlatform *ocl;
     cl_command_queue queue;
     cl_kernel kernel;
-    gboolean stop;
+    volatile gboolean stop;
     GHashTable *callbacks;
     GThread *listener;
     guint last;
 
+    GString *aux_header;
     GString *aux_source;
 
-    gsize param_size;
-    gpointer param_host_data;
-    cl_mem param_dev_data;
+    OclRing *ring;
 } App;
 
 
@@ -64,7 +65,7 @@ get_assignments (GList *args, gsize *sizes)
     for (GList *it = g_list_first (args); it != NULL; it = g_list_next (it)) {
         const gchar *type = (const gchar *) it->data;
 
-        g_string_append_printf (str, "*((global %s *) &cb->data[%zu]) = param%i;\n", type, current, i);
+        g_string_append_printf (str, "*((global %s *) &data[%zu]) = param%i;\n", type, current, i);
         current += sizes[i];
         i++;
     }
@@ -117,8 +118,11 @@ register_callback (App *app, GCallback func, const gchar *name, guint n_params,
     param_list = get_param_list (args);
     assignments = get_assignments (args, callback->type_sizes);
 
-    g_string_append_printf (app->aux_source, "void %s (global Callback *cb, %s)\n", name, param_list);
-    g_string_append_printf (app->aux_source, "{\nint idx = get_global_id (0);\nif (idx == 0) {\n%s;\ncb->flag = %i;}}", assignments, app->last);
+    g_string_append_printf (app->aux_header, "void %s (global OclRing *ring, %s);\n", name, param_list);
+    g_string_append_printf (app->aux_source, "void %s (global OclRing *ring, %s)\n", name, param_list);
+    g_string_append_printf (app->aux_source,
+                            "{\nuint index;\nglobal uchar *data = ocl_ring_reserve (ring, &index);\n"
+                            "if (data != 0) {\n%socl_ring_commit (ring, index, %i);}}\n", assignments, app->last);
 
     g_free (param_list);
     g_free (assignments);
@@ -153,18 +157,15 @@ largest_callback_param_size (App *app)
 static void
 finish_callback_registration (App *app)
 {
-    gchar *def;
-
-    def = g_strdup_printf ("typedef struct { unsigned flag; char data[%zu]; } Callback;\n", largest_callback_param_size (app));
-    g_string_prepend (app->aux_source, def);
-    g_free (def);
+    g_string_prepend (app->aux_header, ocl_ring_get_source ());
+    g_string_prepend (app->aux_source, "#include \"callback.h\"\n");
 }
 
 static void
-handle_callback (App *app, guint id, gchar *param_data)
+handle_callback (App *app, guint id, const gchar *param_data)
 {
     #define TYPE_CASE(upper, lower) case G_TYPE_##upper: \
-        g_value_set_##lower (&values[i], *((g##lower *) param_data)); break;
+        g_value_set_##lower (&values[i], *((const g##lower *) param_data)); break;
 
     Callback *callback;
     GValue *values;
@@ -197,47 +198,39 @@ handle_callback (App *app, guint id, gchar *param_data)
 }
 
 static void
-listen (App *app)
+dispatch (unsigned tag, const void *data, void *user_data)
 {
-    while (!app->stop) {
-        cl_uint *uint_buffer;
-        cl_uint callback_id;
-
-        OCL_CHECK_ERROR (clEnqueueReadBuffer (app->queue, app->param_dev_data, CL_TRUE, 0,
-                                              app->param_size, app->param_host_data,
-                                              0, NULL, NULL));
-
-        uint_buffer = (cl_uint *) app->param_host_data;
-        callback_id = uint_buffer[0];
-
-        if (callback_id != 0) {
-            handle_callback (app, callback_id, (gchar *) &uint_buffer[1]);
-
-            /* Reset flag */
-            uint_buffer[0] = 0;
-            OCL_CHECK_ERROR (clEnqueueWriteBuffer (app->queue, app->param_dev_data, CL_TRUE, 0,
-                                                   app->param_size, app->param_host_data,
-                                                   0, NULL, NULL));
-
-        }
-        g_usleep (1000);
-    }
+    handle_callback ((App *) user_data, tag, (const gchar *) data);
 }
 
+/*
+ * Work-items append their calls to a ring that stays shared with the host
+ * while the kernel runs, so the listener drains whatever arrived without any
+ * transfer and backs off on its own while nothing does.
+ */
+static void
+listen (App *app)
+{
+    while (!app->stop)
+        ocl_ring_poll (app->ring, dispatch, app);
+}
 
+/* the kernels need to be built with the options of the ring */
 static void
-start_listening (App *app)
+create_ring (App *app)
 {
     cl_int errcode;
 
-    app->param_size = largest_callback_param_size (app);
-    app->param_size += sizeof (cl_uint);
-
-    app->param_host_data = g_malloc0 (app->param_size);
-    app->param_dev_data = clCreateBuffer (app->context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
-                                          app->param_size, (gpointer) app->param_host_data, &errcode);
+    app->ring = ocl_ring_new (app->ocl, 0, largest_callback_param_size (app), 1024, &errcode);
     OCL_CHECK_ERROR (errcode);
 
+    if (app->ring == NULL)
+        g_error ("Device neither supports fine-grained SVM atomics nor is a CPU");
+}
+
+static void
+start_listening (App *app)
+{
 #if !(GLIB_CHECK_VERSION (2, 32, 0))
     app->listener = g_thread_create ((GThreadFunc) listen, app, TRUE, NULL);
 #else
@@ -248,45 +241,94 @@ start_listening (App *app)
 static void
 stop_listening (App *app)
 {
-    g_usleep (2500);
+    guint dropped;
+
     app->stop = TRUE;
     g_thread_join (app->listener);
+
+    /* calls that arrived after the last poll */
+    ocl_ring_drain (app->ring, dispatch, app);
+    dropped = ocl_ring_get_dropped (app->ring);
+
+    if (dropped > 0)
+        g_print ("%u calls dropped on a full ring\n", dropped);
+
+    ocl_ring_free (app->ring);
 }
 
+/*
+ * The generated callbacks are a module of their own that is only recompiled
+ * when the registered callbacks change, the kernel file includes the
+ * generated header.
+ */
 static cl_program
-create_callback_program_from_file (App *app, OclPlatform *ocl,
+create_callback_program_from_file (App *app, OclLinker *linker,
                                    const gchar *filename, const gchar *options,
                                    cl_int *errcode)
 {
     gchar *source;
-    gchar *full_source;
-    cl_program program;
 
     source = ocl_read_program (filename);
-    full_source = g_strdup_printf ("%s\n%s", app->aux_source->str, source);
-    program = ocl_create_program_from_source (ocl, full_source, options, errcode);
 
-    g_free (full_source);
+    if (source == NULL) {
+        *errcode = CL_INVALID_VALUE;
+        return NULL;
+    }
+
+    OCL_CHECK_ERROR (ocl_linker_add_header (linker, "callback.h", app->aux_header->str));
+    OCL_CHECK_ERROR (ocl_linker_add_module (linker, "callbacks", app->aux_source->str, options));
+    OCL_CHECK_ERROR (ocl_linker_add_module (linker, filename, source, options));
     g_free (source);
 
-    return program;
+    return ocl_linker_link (linker, NULL, errcode);
+}
+
+/*
+ * Changing the generated callbacks must recompile only them, the unchanged
+ * kernel file has to be served from its compiled object.
+ */
+static gboolean
+relink_changed_callbacks (App *app, OclLinker *linker, const gchar *options, cl_program *program)
+{
+    OclLinkerStats before;
+    OclLinkerStats after;
+    cl_int errcode;
+
+    ocl_linker_get_stats (linker, &before);
+
+    g_string_append (app->aux_source, "\n/* relinked */\n");
+    OCL_CHECK_ERROR (ocl_linker_add_module (linker, "callbacks", app->aux_source->str, options));
+
+    OCL_CHECK_ERROR (clReleaseProgram (*program));
+    *program = ocl_linker_link (linker, NULL, &errcode);
+    OCL_CHECK_ERROR (errcode);
+
+    ocl_linker_get_stats (linker, &after);
+
+    g_print ("relink: %lu modules compiled (expected 1), %lu reused (expected 1)\n",
+             after.compiles - before.compiles, after.reuses - before.reuses);
+
+    return after.compiles == before.compiles + 1 && after.reuses == before.reuses + 1;
 }
 
 int
 main (void)
 {
     OclPlatform *ocl;
+    OclLinker *linker;
     cl_int errcode;
     cl_program program;
     App app;
     cl_event event;
     size_t global_work_size = { 1000 };
+    gboolean relinked;
 
     ocl = ocl_new_with_queues (0, CL_DEVICE_TYPE_GPU, 0);
 
+    app.ocl = ocl;
     app.stop = FALSE;
+    app.aux_header = g_string_new (NULL);
     app.aux_source = g_string_new (NULL);
-    app.context = ocl_get_context (ocl);
     app.queue = ocl_get_cmd_queues (ocl)[0];
 
 #if !GLIB_CHECK_VERSION(2, 36, 0)
@@ -298,16 +340,21 @@ main (void)
 
     register_callback (&app, (GCallback) handle_print, "print", 3, G_TYPE_FLOAT, G_TYPE_INT, G_TYPE_INT);
     finish_callback_registration (&app);
+    create_ring (&app);
 
-    program = create_callback_program_from_file (&app, ocl, "callback.cl", NULL, &errcode);
+    linker = ocl_linker_new (ocl);
+    program = create_callback_program_from_file (&app, linker, "callback.cl",
+                                                 ocl_ring_get_build_options (app.ring), &errcode);
     OCL_CHECK_ERROR (errcode);
 
+    relinked = relink_changed_callbacks (&app, linker, ocl_ring_get_build_options (app.ring), &program);
+
     app.kernel = clCreateKernel (program, "do_something", &errcode);
     OCL_CHECK_ERROR (errcode);
 
     start_listening (&app);
 
-    OCL_CHECK_ERROR (clSetKernelArg (app.kernel, 0, sizeof (cl_mem), &app.param_dev_data));
+    OCL_CHECK_ERROR (ocl_ring_set_kernel_arg (app.ring, app.kernel, 0));
     OCL_CHECK_ERROR (clEnqueueNDRangeKernel (app.queue, app.kernel, 1, NULL, &global_work_size, NULL, 0, NULL, &event));
 
     clWaitForEvents (1, &event);
@@ -315,8 +362,12 @@ main (void)
 
     stop_listening (&app);
 
+    g_string_free (app.aux_header, TRUE);
     g_string_free (app.aux_source, TRUE);
     clReleaseKernel (app.kernel);
     clReleaseProgram (program);
+    ocl_linker_free (linker);
     ocl_free (ocl);
+
+    return relinked ? 0 : 1;
 }
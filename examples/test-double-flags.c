@@ -42,10 +42,7 @@ main (int argc, const char **argv)
     num_devices = ocl_get_num_devices (ocl);
 
     for (int i = 0; i < num_devices; i++) {
-        static char name[256];
-
         device = ocl_get_devices (ocl)[i];
-        OCL_CHECK_ERROR (clGetDeviceInfo (device, CL_DEVICE_NAME, 256, name, NULL));
 
         queue = clCreateCommandQueue (context, device, 0, &errcode);
         OCL_CHECK_ERROR (errcode);
@@ -65,7 +62,7 @@ main (int argc, const char **argv)
 
         printf ("%s\n"
                 "  cl_khr_fp64 = %i\n"
-                "  cl_amd_fp64 = %i\n", name, flags & (1 << 0), (flags & (1 << 1)) >> 1);
+                "  cl_amd_fp64 = %i\n", ocl_get_device_info (ocl, i)->name, flags & (1 << 0), (flags & (1 << 1)) >> 1);
 
         if (i < num_devices - 1)
             printf ("\n");
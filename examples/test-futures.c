@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <ocl.h>
+#include <ocl-bench.h>
+#include <ocl-future.h>
+
+
+static const char* source =
+    "__kernel void increment(global float *data)"
+    "{ "
+    "   int idx = get_global_id (0);"
+    "   data[idx] = data[idx] + 1.0f;"
+    "} ";
+
+static const unsigned NUM_CHAINS = 256;
+static const unsigned NUM_STEPS = 8;
+static const size_t NUM_ITEMS = 1024;
+
+/*
+ * Each chain owns a kernel and buffer and enqueues its next step from the
+ * continuation of the previous one, so the main thread only submits the
+ * first step of every chain and then waits for all of them at once.
+ */
+typedef struct {
+    OclFutures *futures;
+    cl_command_queue queue;
+    cl_kernel kernel;
+    cl_mem buffer;
+    unsigned steps;
+    cl_int status;
+} Chain;
+
+static void submit (Chain *chain);
+
+static void
+step_done (cl_int status, void *user_data)
+{
+    Chain *chain = user_data;
+
+    if (status != CL_COMPLETE) {
+        chain->status = status;
+        return;
+    }
+
+    if (++chain->steps < NUM_STEPS)
+        submit (chain);
+}
+
+static OclFuture *
+enqueue (Chain *chain)
+{
+    OclFuture *future;
+    cl_event event;
+    cl_int errcode;
+
+    errcode = clEnqueueNDRangeKernel (chain->queue, chain->kernel, 1, NULL, &NUM_ITEMS, NULL, 0, NULL, &event);
+    OCL_CHECK_ERROR (errcode);
+
+    if (errcode != CL_SUCCESS)
+        return NULL;
+
+    OCL_CHECK_ERROR (clFlush (chain->queue));
+    future = ocl_future_new (chain->futures, event, &errcode);
+    OCL_CHECK_ERROR (errcode);
+    OCL_CHECK_ERROR (clReleaseEvent (event));
+    return future;
+}
+
+static void
+submit (Chain *chain)
+{
+    OclFuture *future;
+    cl_int errcode;
+
+    future = enqueue (chain);
+
+    if (future == NULL) {
+        chain->status = CL_INVALID_OPERATION;
+        return;
+    }
+
+    ocl_future_free (ocl_future_then (future, step_done, chain, &errcode));
+    OCL_CHECK_ERROR (errcode);
+    ocl_future_free (future);
+}
+
+int
+main (int argc, const char **argv)
+{
+    OclPlatform *ocl;
+    OclFutures *futures;
+    OclFuture **first;
+    OclFuture *any;
+    OclFuture *all;
+    Chain *chains;
+    cl_program program;
+    cl_command_queue *queues;
+    cl_int errcode;
+    cl_device_type type;
+    unsigned int platform;
+    unsigned num_queues;
+    unsigned num_first = 0;
+    float *data;
+    double start;
+    double any_time;
+    double all_time;
+    double chain_time;
+    int errors = 0;
+
+    platform = 0;
+    type = CL_DEVICE_TYPE_GPU;
+
+    if (ocl_read_args (argc, argv, &platform, &type))
+        return 1;
+
+    ocl = ocl_new_with_queues (platform, type, 0);
+
+    if (ocl == NULL)
+        return 1;
+
+    program = ocl_create_program_from_source (ocl, source, NULL, &errcode);
+    OCL_CHECK_ERROR (errcode);
+
+    futures = ocl_futures_new (0, &errcode);
+    OCL_CHECK_ERROR (errcode);
+
+    queues = ocl_get_cmd_queues (ocl);
+    num_queues = (unsigned) ocl_get_num_devices (ocl);
+    chains = calloc (NUM_CHAINS, sizeof (Chain));
+    data = calloc (NUM_ITEMS, sizeof (float));
+
+    for (unsigned i = 0; i < NUM_CHAINS; i++) {
+        chains[i].futures = futures;
+        chains[i].queue = queues[i % num_queues];
+
+        chains[i].kernel = clCreateKernel (program, "increment", &errcode);
+        OCL_CHECK_ERROR (errcode);
+
+        chains[i].buffer = clCreateBuffer (ocl_get_context (ocl), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                           NUM_ITEMS * sizeof (float), data, &errcode);
+        OCL_CHECK_ERROR (errcode);
+        OCL_CHECK_ERROR (clSetKernelArg (chains[i].kernel, 0, sizeof (cl_mem), &chains[i].buffer));
+    }
+
+    start = ocl_bench_time ();
+
+    for (unsigned i = 0; i < NUM_CHAINS; i++)
+        submit (&chains[i]);
+
+    ocl_futures_wait (futures);
+    chain_time = ocl_bench_time () - start;
+
+    for (unsigned i = 0; i < NUM_CHAINS; i++) {
+        OCL_CHECK_ERROR (clEnqueueReadBuffer (chains[i].queue, chains[i].buffer, CL_TRUE,
+                                              0, NUM_ITEMS * sizeof (float), data, 0, NULL, NULL));
+
+        if (chains[i].status != CL_COMPLETE)
+            errors++;
+
+        for (size_t j = 0; j < NUM_ITEMS; j++) {
+            if (data[j] != (float) NUM_STEPS)
+                errors++;
+        }
+    }
+
+    printf ("%u chains of %u kernels on %u queues from one thread: %.3f ms\n",
+            NUM_CHAINS, NUM_STEPS, num_queues, chain_time * 1000);
+
+    /* one kernel per chain, react to the first and to the last completion */
+    first = calloc (NUM_CHAINS, sizeof (OclFuture *));
+    start = ocl_bench_time ();
+
+    for (unsigned i = 0; i < NUM_CHAINS; i++) {
+        first[num_first] = enqueue (&chains[i]);
+
+        if (first[num_first] != NULL)
+            num_first++;
+        else
+            errors++;
+    }
+
+    any = ocl_future_when_any (futures, num_first, first, &errcode);
+    OCL_CHECK_ERROR (errcode);
+    all = ocl_future_when_all (futures, num_first, first, &errcode);
+    OCL_CHECK_ERROR (errcode);
+
+    if (ocl_future_wait (any) != CL_COMPLETE)
+        errors++;
+
+    any_time = ocl_bench_time () - start;
+
+    if (ocl_future_wait (all) != CL_COMPLETE)
+        errors++;
+
+    all_time = ocl_bench_time () - start;
+    printf ("when_any after %.3f ms, when_all after %.3f ms\n", any_time * 1000, all_time * 1000);
+    printf ("%s: %i errors\n", errors == 0 ? "OK" : "FAILED", errors);
+
+    for (unsigned i = 0; i < num_first; i++)
+        ocl_future_free (first[i]);
+
+    ocl_future_free (any);
+    ocl_future_free (all);
+    ocl_futures_free (futures);
+
+    for (unsigned i = 0; i < NUM_CHAINS; i++) {
+        OCL_CHECK_ERROR (clReleaseMemObject (chains[i].buffer));
+        OCL_CHECK_ERROR (clReleaseKernel (chains[i].kernel));
+    }
+
+    free (first);
+    free (chains);
+    free (data);
+    OCL_CHECK_ERROR (clReleaseProgram (program));
+    ocl_free (ocl);
+
+    return errors == 0 ? 0 : 1;
+}
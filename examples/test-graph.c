@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <ocl.h>
+#include <ocl-graph.h>
+
+
+static const char* source =
+    "__kernel void add_one(global float *in, global float *out)"
+    "{ "
+    "   int idx = get_global_id (0);"
+    "   out[idx] = in[idx] + 1.0f;"
+    "} "
+    "__kernel void sum(global float *a, global float *b, global float *out)"
+    "{ "
+    "   int idx = get_global_id (0);"
+    "   out[idx] = a[idx] + b[idx];"
+    "} ";
+
+static const int NUM_RUNS = 100;
+
+int
+main (int argc, const char **argv)
+{
+    OclPlatform *ocl;
+    OclGraph *graph;
+    cl_program program;
+    cl_kernel add_one;
+    cl_kernel sum;
+    cl_mem buffers[5];
+    cl_command_queue queues[3];
+    cl_event event;
+    cl_int errcode;
+    float *input;
+    float *output;
+    size_t n_elements = 1024 * 1024;
+    size_t size = n_elements * sizeof (float);
+    int node;
+    unsigned num_edges;
+    int edge_errors;
+    int errors = 0;
+    unsigned int platform = 0;
+    cl_device_type type = CL_DEVICE_TYPE_GPU;
+
+    if (ocl_read_args (argc, argv, &platform, &type))
+        return 1;
+
+    ocl = ocl_new_with_queue_roles (platform, type, 3, NULL);
+
+    if (ocl == NULL)
+        return 1;
+
+    program = ocl_create_program_from_source (ocl, source, NULL, &errcode);
+    OCL_CHECK_ERROR (errcode);
+
+    add_one = clCreateKernel (program, "add_one", &errcode);
+    OCL_CHECK_ERROR (errcode);
+    sum = clCreateKernel (program, "sum", &errcode);
+    OCL_CHECK_ERROR (errcode);
+
+    input = malloc (size);
+    output = malloc (size);
+
+    for (size_t i = 0; i < n_elements; i++)
+        input[i] = (float) i;
+
+    for (int i = 0; i < 5; i++) {
+        buffers[i] = clCreateBuffer (ocl_get_context (ocl), CL_MEM_READ_WRITE, size, NULL, &errcode);
+        OCL_CHECK_ERROR (errcode);
+    }
+
+    for (int i = 0; i < 3; i++)
+        queues[i] = ocl_get_queue (ocl, 0, i);
+
+    /* A and B are uploaded, C = A + 1 and D = B + 1 are independent, E = C + D */
+    graph = ocl_graph_new (queues, 3);
+
+    ocl_graph_add_write (graph, buffers[0], 0, size, input);
+    ocl_graph_add_write (graph, buffers[1], 0, size, input);
+
+    node = ocl_graph_add_kernel (graph, add_one, 1, &n_elements, NULL, 1, &buffers[0], 1, &buffers[2]);
+    ocl_graph_set_kernel_arg (graph, node, 0, sizeof (cl_mem), &buffers[0]);
+    ocl_graph_set_kernel_arg (graph, node, 1, sizeof (cl_mem), &buffers[2]);
+
+    node = ocl_graph_add_kernel (graph, add_one, 1, &n_elements, NULL, 1, &buffers[1], 1, &buffers[3]);
+    ocl_graph_set_kernel_arg (graph, node, 0, sizeof (cl_mem), &buffers[1]);
+    ocl_graph_set_kernel_arg (graph, node, 1, sizeof (cl_mem), &buffers[3]);
+
+    node = ocl_graph_add_kernel (graph, sum, 1, &n_elements, NULL, 2, &buffers[2], 1, &buffers[4]);
+    ocl_graph_set_kernel_arg (graph, node, 0, sizeof (cl_mem), &buffers[2]);
+    ocl_graph_set_kernel_arg (graph, node, 1, sizeof (cl_mem), &buffers[3]);
+    ocl_graph_set_kernel_arg (graph, node, 2, sizeof (cl_mem), &buffers[4]);
+
+    ocl_graph_add_read (graph, buffers[4], 0, size, output);
+
+    /* a missing edge lets a kernel race its producer, a spurious one costs overlap */
+    num_edges = ocl_graph_get_num_edges (graph);
+    edge_errors = num_edges != 5;
+
+    for (int r = 0; r < NUM_RUNS; r++)
+        OCL_CHECK_ERROR (ocl_graph_submit (graph, r == NUM_RUNS - 1 ? &event : NULL));
+
+    OCL_CHECK_ERROR (clWaitForEvents (1, &event));
+    OCL_CHECK_ERROR (clReleaseEvent (event));
+
+    for (size_t i = 0; i < n_elements; i++) {
+        if (output[i] != 2.0f * i + 2.0f)
+            errors++;
+    }
+
+    printf ("%s: %u edges (expected 5), %i wrong elements\n",
+            errors + edge_errors == 0 ? "OK" : "FAILED", num_edges, errors);
+
+    ocl_graph_free (graph);
+
+    for (int i = 0; i < 5; i++)
+        OCL_CHECK_ERROR (clReleaseMemObject (buffers[i]));
+
+    free (input);
+    free (output);
+    OCL_CHECK_ERROR (clReleaseKernel (add_one));
+    OCL_CHECK_ERROR (clReleaseKernel (sum));
+    OCL_CHECK_ERROR (clReleaseProgram (program));
+    ocl_free (ocl);
+
+    return errors + edge_errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <ocl.h>
+#include <ocl-partition.h>
+
+
+static const char* source =
+    "__kernel void scale(global float *data)"
+    "{ "
+    "   int idx = get_global_id (0);"
+    "   data[idx] = data[idx] * 2.0f;"
+    "} ";
+
+static const int NUM_SUB_DEVICES = 2;
+static const int NUM_RUNS = 10;
+
+int
+main (int argc, const char **argv)
+{
+    OclPlatform *ocl;
+    OclPartition *partition;
+    cl_program program;
+    cl_kernel kernel;
+    cl_mem buffer;
+    cl_int errcode;
+    cl_device_type type;
+    unsigned int platform;
+    float *data;
+    size_t n_elements = 4 * 1024 * 1024;
+    int num_devices;
+    int errors = 0;
+
+    platform = 0;
+    type = CL_DEVICE_TYPE_CPU;
+
+    if (ocl_read_args (argc, argv, &platform, &type))
+        return 1;
+
+    /* a single CPU is split into sub devices to exercise the partitioning */
+    if (type == CL_DEVICE_TYPE_CPU)
+        ocl = ocl_new_with_sub_devices (platform, type, NUM_SUB_DEVICES, 0);
+    else
+        ocl = ocl_new_with_queues (platform, type, 0);
+
+    if (ocl == NULL)
+        return 1;
+
+    program = ocl_create_program_from_source (ocl, source, NULL, &errcode);
+    OCL_CHECK_ERROR (errcode);
+
+    kernel = clCreateKernel (program, "scale", &errcode);
+    OCL_CHECK_ERROR (errcode);
+
+    data = malloc (n_elements * sizeof (float));
+
+    for (size_t i = 0; i < n_elements; i++)
+        data[i] = 1.0f;
+
+    buffer = clCreateBuffer (ocl_get_context (ocl), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                             n_elements * sizeof (float), data, &errcode);
+    OCL_CHECK_ERROR (errcode);
+
+    partition = ocl_partition_new (ocl, kernel);
+    OCL_CHECK_ERROR (ocl_partition_set_buffer (partition, 0, buffer, sizeof (float)));
+    num_devices = ocl_get_num_devices (ocl);
+
+    for (int r = 0; r < NUM_RUNS; r++) {
+        OCL_CHECK_ERROR (ocl_partition_run (partition, 1, &n_elements, NULL));
+
+        printf ("run %2i:", r);
+
+        for (int i = 0; i < num_devices; i++) {
+            size_t items;
+            double time;
+
+            ocl_partition_get_share (partition, i, &items, &time, NULL);
+            printf ("  [%i] %8zu items in %8.5f s", i, items, time);
+        }
+
+        printf ("\n");
+    }
+
+    OCL_CHECK_ERROR (clEnqueueReadBuffer (ocl_get_cmd_queues (ocl)[0], buffer, CL_TRUE,
+                                          0, n_elements * sizeof (float), data, 0, NULL, NULL));
+
+    for (size_t i = 0; i < n_elements; i++) {
+        if (data[i] != (float) (1 << NUM_RUNS))
+            errors++;
+    }
+
+    printf ("%s: %i wrong elements\n", errors == 0 ? "OK" : "FAILED", errors);
+
+    ocl_partition_free (partition);
+    free (data);
+    OCL_CHECK_ERROR (clReleaseMemObject (buffer));
+    OCL_CHECK_ERROR (clReleaseKernel (kernel));
+    OCL_CHECK_ERROR (clReleaseProgram (program));
+    ocl_free (ocl);
+
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <ocl.h>
+#include <ocl-pipeline.h>
+
+
+static const char* source =
+    "__kernel void transform(global uint *in, global uint *out)"
+    "{ "
+    "   int idx = get_global_id (0);"
+    "   out[idx] = in[idx] * 3 + 1;"
+    "} ";
+
+typedef struct {
+    unsigned num_sets;
+    unsigned long num_chunks;
+} Config;
+
+/* chunk counts that are no multiple of the sets leave a partial rotation to drain */
+static const Config CONFIGS[] = {
+    { 3, 10 }, { 2, 7 }, { 4, 4 }, { 1, 5 }, { 3, 1 }, { 3, 0 },
+};
+
+typedef struct {
+    unsigned long num_chunks;
+    unsigned long next;
+    int errors;
+} Check;
+
+static cl_uint
+input_value (unsigned long index, size_t i)
+{
+    return (cl_uint) (index * 100003 + i);
+}
+
+static int
+produce (void *data, size_t size, unsigned long index, void *user_data)
+{
+    Check *check = user_data;
+    cl_uint *values = data;
+
+    if (index >= check->num_chunks)
+        return 0;
+
+    for (size_t i = 0; i < size / sizeof (cl_uint); i++)
+        values[i] = input_value (index, i);
+
+    return 1;
+}
+
+static void
+consume (const void *data, size_t size, unsigned long index, void *user_data)
+{
+    Check *check = user_data;
+    const cl_uint *values = data;
+
+    /* chunks must arrive once each, in order, with the output of their own input */
+    if (index != check->next)
+        check->errors++;
+
+    for (size_t i = 0; i < size / sizeof (cl_uint); i++) {
+        if (values[i] != input_value (index, i) * 3 + 1)
+            check->errors++;
+    }
+
+    check->next = index + 1;
+}
+
+int
+main (int argc, const char **argv)
+{
+    OclPlatform *ocl;
+    cl_program program;
+    cl_kernel kernel;
+    cl_int errcode;
+    size_t n_elements = 256 * 1024;
+    size_t size = n_elements * sizeof (cl_uint);
+    int errors = 0;
+    unsigned int platform = 0;
+    cl_device_type type = CL_DEVICE_TYPE_GPU;
+
+    if (ocl_read_args (argc, argv, &platform, &type))
+        return 1;
+
+    ocl = ocl_new_with_queue_roles (platform, type, 3, NULL);
+
+    if (ocl == NULL)
+        return 1;
+
+    program = ocl_create_program_from_source (ocl, source, NULL, &errcode);
+    OCL_CHECK_ERROR (errcode);
+
+    kernel = clCreateKernel (program, "transform", &errcode);
+    OCL_CHECK_ERROR (errcode);
+
+    for (size_t c = 0; c < sizeof (CONFIGS) / sizeof (Config); c++) {
+        OclPipeline *pipeline;
+        OclPipelineStats stats;
+        Check check = { CONFIGS[c].num_chunks, 0, 0 };
+
+        pipeline = ocl_pipeline_new (ocl, 0, kernel, size, size, CONFIGS[c].num_sets,
+                                     1, &n_elements, NULL, &errcode);
+        OCL_CHECK_ERROR (errcode);
+        OCL_CHECK_ERROR (ocl_pipeline_run (pipeline, produce, consume, &check, &stats));
+
+        if (check.next != check.num_chunks || stats.num_chunks != check.num_chunks)
+            check.errors++;
+
+        printf ("%u sets, %2lu chunks: %lu consumed, %i errors\n",
+                CONFIGS[c].num_sets, check.num_chunks, check.next, check.errors);
+
+        errors += check.errors;
+        ocl_pipeline_free (pipeline);
+    }
+
+    printf ("%s: %i errors\n", errors == 0 ? "OK" : "FAILED", errors);
+
+    OCL_CHECK_ERROR (clReleaseKernel (kernel));
+    OCL_CHECK_ERROR (clReleaseProgram (program));
+    ocl_free (ocl);
+
+    return errors == 0 ? 0 : 1;
+}
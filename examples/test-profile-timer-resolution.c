@@ -5,18 +5,13 @@ int
 main (int argc, const char **argv)
 {
     OclPlatform *ocl;
-    cl_device_id *devices;
 
     ocl = ocl_new_from_args (argc, argv, 0);
-    devices = ocl_get_devices (ocl);
 
     for (int i = 0; i < ocl_get_num_devices (ocl); i++) {
-        static char name[256];
-        size_t resolution;
+        const OclDeviceInfo *info = ocl_get_device_info (ocl, i);
 
-        OCL_CHECK_ERROR (clGetDeviceInfo (devices[i], CL_DEVICE_NAME, 256, name, NULL));
-        OCL_CHECK_ERROR (clGetDeviceInfo (devices[i], CL_DEVICE_PROFILING_TIMER_RESOLUTION, sizeof(size_t), &resolution, NULL));
-        printf ("%-30s: %zu ns\n", name, resolution);
+        printf ("%-30s: %zu ns\n", info->name, info->timer_resolution);
     }
 
     ocl_free (ocl);
@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <ocl.h>
+#include <ocl-rect.h>
+
+
+/*
+ * Both sides are padded rows and slices that are larger than the region, and
+ * the region sits at non-zero origins on both, so any mix-up of elements and
+ * bytes, origins or pitches moves the wrong elements.
+ */
+static const OclRectLayout host_layout = { sizeof (float), 37, 23, 42 * sizeof (float), 42 * 25 * sizeof (float) };
+static const OclRectLayout buffer_layout = { sizeof (float), 29, 19, 32 * sizeof (float), 32 * 20 * sizeof (float) };
+static const size_t HOST_SLICES = 4;
+static const size_t BUFFER_SLICES = 3;
+static const float UNTOUCHED = -1.0f;
+
+static size_t
+index_of (const OclRectLayout *layout, size_t x, size_t y, size_t z)
+{
+    return (z * layout->slice_pitch + y * layout->row_pitch) / sizeof (float) + x;
+}
+
+static int
+in_region (const size_t *origin, const size_t *region, size_t x, size_t y, size_t z)
+{
+    return x >= origin[0] && x < origin[0] + region[0] &&
+           y >= origin[1] && y < origin[1] + region[1] &&
+           z >= origin[2] && z < origin[2] + region[2];
+}
+
+/*
+ * Counts the elements of data, including padding, that differ from source
+ * inside the region and from UNTOUCHED outside of it.
+ */
+static int
+count_errors (const float *data, const OclRectLayout *layout, size_t num_slices, const size_t *origin,
+              const float *source, const OclRectLayout *source_layout, const size_t *source_origin,
+              const size_t *region)
+{
+    size_t row_length = layout->row_pitch / sizeof (float);
+    size_t num_rows = layout->slice_pitch / layout->row_pitch;
+    int errors = 0;
+
+    for (size_t z = 0; z < num_slices; z++) {
+        for (size_t y = 0; y < num_rows; y++) {
+            for (size_t x = 0; x < row_length; x++) {
+                float expected = UNTOUCHED;
+
+                if (in_region (origin, region, x, y, z))
+                    expected = source[index_of (source_layout,
+                                                source_origin[0] + x - origin[0],
+                                                source_origin[1] + y - origin[1],
+                                                source_origin[2] + z - origin[2])];
+
+                if (data[index_of (layout, x, y, z)] != expected)
+                    errors++;
+            }
+        }
+    }
+
+    return errors;
+}
+
+int
+main (int argc, const char **argv)
+{
+    OclPlatform *ocl;
+    cl_command_queue queue;
+    cl_mem buffer;
+    cl_int errcode;
+    float *host;
+    float *device;
+    float *result;
+    size_t host_size = host_layout.slice_pitch * HOST_SLICES;
+    size_t buffer_size = buffer_layout.slice_pitch * BUFFER_SLICES;
+    size_t host_origin[3] = { 5, 3, 1 };
+    size_t buffer_origin[3] = { 7, 4, 1 };
+    size_t result_origin[3] = { 2, 9, 2 };
+    size_t region[3] = { 11, 7, 2 };
+    int write_errors;
+    int read_errors;
+    int copy_errors;
+    unsigned int platform = 0;
+    cl_device_type type = CL_DEVICE_TYPE_GPU;
+
+    if (ocl_read_args (argc, argv, &platform, &type))
+        return 1;
+
+    ocl = ocl_new_with_queues (platform, type, 0);
+
+    if (ocl == NULL)
+        return 1;
+
+    queue = ocl_get_cmd_queues (ocl)[0];
+    host = malloc (host_size);
+    device = malloc (buffer_size);
+    result = malloc (host_size);
+
+    for (size_t i = 0; i < host_size / sizeof (float); i++)
+        host[i] = (float) i;
+
+    for (size_t i = 0; i < buffer_size / sizeof (float); i++)
+        device[i] = UNTOUCHED;
+
+    buffer = clCreateBuffer (ocl_get_context (ocl), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                             buffer_size, device, &errcode);
+    OCL_CHECK_ERROR (errcode);
+
+    /* the write must only touch the region of the buffer */
+    OCL_CHECK_ERROR (ocl_rect_write (queue, buffer, &buffer_layout, buffer_origin,
+                                     host, &host_layout, host_origin, region, CL_TRUE, 0, NULL, NULL));
+    OCL_CHECK_ERROR (clEnqueueReadBuffer (queue, buffer, CL_TRUE, 0, buffer_size, device, 0, NULL, NULL));
+    write_errors = count_errors (device, &buffer_layout, BUFFER_SLICES, buffer_origin,
+                                 host, &host_layout, host_origin, region);
+
+    /* reading back to another origin must return the data written */
+    for (size_t i = 0; i < host_size / sizeof (float); i++)
+        result[i] = UNTOUCHED;
+
+    OCL_CHECK_ERROR (ocl_rect_read (queue, buffer, &buffer_layout, buffer_origin,
+                                    result, &host_layout, result_origin, region, CL_TRUE, 0, NULL, NULL));
+    read_errors = count_errors (result, &host_layout, HOST_SLICES, result_origin,
+                                host, &host_layout, host_origin, region);
+
+    /* the host copy follows the same rules */
+    for (size_t i = 0; i < buffer_size / sizeof (float); i++)
+        device[i] = UNTOUCHED;
+
+    OCL_CHECK_ERROR (ocl_rect_copy (device, &buffer_layout, buffer_origin, host, &host_layout, host_origin, region));
+    copy_errors = count_errors (device, &buffer_layout, BUFFER_SLICES, buffer_origin,
+                                host, &host_layout, host_origin, region);
+
+    printf ("%s: %i wrong elements after write, %i after read, %i after copy\n",
+            write_errors + read_errors + copy_errors == 0 ? "OK" : "FAILED",
+            write_errors, read_errors, copy_errors);
+
+    OCL_CHECK_ERROR (clReleaseMemObject (buffer));
+    free (result);
+    free (device);
+    free (host);
+    ocl_free (ocl);
+
+    return write_errors + read_errors + copy_errors == 0 ? 0 : 1;
+}
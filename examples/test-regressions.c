@@ -1,5 +1,6 @@
 
 #include <stdarg.h>
+#include <stdlib.h>
 #include <glib.h>
 #include <glib/gprintf.h>
 #include "ocl.h"
@@ -34,30 +35,33 @@ static GList *
 read_kernel_names (const gchar *filename)
 {
     GList   *names = NULL;
-    FILE    *fp;
-    gchar   *line;
+    gchar   *source;
+    gchar  **lines;
     GRegex  *regex;
     GMatchInfo *match_info;
 
-    regex = g_regex_new ("__kernel void ([_A-Za-z][_A-Za-z0-9]*)", 0, 0, NULL);
-    fp = fopen (filename, "r");
+    /* the source may be embedded, so do not open the file ourselves */
+    source = ocl_read_program (filename);
 
-    if (fp == NULL) {
+    if (source == NULL) {
         g_print ("Warning: could not open `%s'\n", filename);
         return NULL;
     }
 
-    line = g_malloc0 (1024);
+    regex = g_regex_new ("__kernel void ([_A-Za-z][_A-Za-z0-9]*)", 0, 0, NULL);
+    lines = g_strsplit (source, "\n", -1);
 
-    while (fgets (line, 1024, fp) != NULL) {
-        if (g_regex_match (regex, line, 0, &match_info)) {
+    for (guint i = 0; lines[i] != NULL; i++) {
+        if (g_regex_match (regex, lines[i], 0, &match_info)) {
             gchar *kernel_name = g_match_info_fetch (match_info, 1);
             names = g_list_append (names, kernel_name);
         }
+
+        g_match_info_free (match_info);
     }
 
-    fclose (fp);
-    g_free (line);
+    g_strfreev (lines);
+    free (source);
     g_regex_unref (regex);
 
     return names;
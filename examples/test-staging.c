@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ocl.h>
+#include <ocl-staging.h>
+
+
+/*
+ * Slots are small and odd-sized, so that most transfers span the whole ring
+ * several times, chunks end in the middle of a slot and slots are reused while
+ * earlier chunks of the same and of previous transfers are still queued.
+ */
+static const size_t SLOT_SIZE = 1000;
+static const unsigned NUM_SLOTS = 3;
+static const size_t BUFFER_SIZE = 65536;
+static const unsigned char UNTOUCHED = 0xaa;
+
+typedef struct {
+    size_t offset;
+    size_t size;
+} Range;
+
+static const Range WRITES[] = {
+    { 1, 12345 }, { 7777, 3001 }, { 20011, 999 }, { 30000, 1 }, { 31313, 34223 }, { 0, 3000 },
+};
+
+static const Range READS[] = {
+    { 3, 12343 }, { 9999, 2999 }, { 30000, 1 }, { 0, 65536 }, { 40001, 1000 },
+};
+
+static int
+count_errors (const unsigned char *data, const unsigned char *expected, size_t size)
+{
+    int errors = 0;
+
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] != expected[i])
+            errors++;
+    }
+
+    return errors;
+}
+
+int
+main (int argc, const char **argv)
+{
+    OclPlatform *ocl;
+    OclStaging *staging;
+    cl_command_queue queue;
+    cl_mem buffer;
+    cl_event event;
+    cl_int errcode;
+    unsigned char *expected;
+    unsigned char *result;
+    int write_errors;
+    int read_errors = 0;
+    unsigned int platform = 0;
+    cl_device_type type = CL_DEVICE_TYPE_GPU;
+
+    if (ocl_read_args (argc, argv, &platform, &type))
+        return 1;
+
+    ocl = ocl_new_with_queues (platform, type, 0);
+
+    if (ocl == NULL)
+        return 1;
+
+    queue = ocl_get_cmd_queues (ocl)[0];
+    expected = calloc (BUFFER_SIZE, 1);
+    result = malloc (BUFFER_SIZE + 1);
+
+    buffer = clCreateBuffer (ocl_get_context (ocl), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                             BUFFER_SIZE, expected, &errcode);
+    OCL_CHECK_ERROR (errcode);
+
+    staging = ocl_staging_new (ocl_get_context (ocl), queue, SLOT_SIZE, NUM_SLOTS, &errcode);
+    OCL_CHECK_ERROR (errcode);
+
+    /* overlapping writes without waiting in between, the later one must win */
+    for (size_t i = 0; i < sizeof (WRITES) / sizeof (Range); i++) {
+        const Range *range = &WRITES[i];
+        unsigned char *data = malloc (range->size);
+
+        for (size_t j = 0; j < range->size; j++)
+            data[j] = (unsigned char) ((range->offset + j) * 7 + i * 31 + 1);
+
+        memcpy (expected + range->offset, data, range->size);
+        OCL_CHECK_ERROR (ocl_staging_write (staging, buffer, range->offset, range->size, data, 0, NULL, &event));
+
+        /* the data is staged, so the caller's copy may be reused right away */
+        memset (data, 0, range->size);
+        free (data);
+
+        OCL_CHECK_ERROR (clReleaseEvent (event));
+    }
+
+    OCL_CHECK_ERROR (ocl_staging_finish (staging));
+    OCL_CHECK_ERROR (clEnqueueReadBuffer (queue, buffer, CL_TRUE, 0, BUFFER_SIZE, result, 0, NULL, NULL));
+    write_errors = count_errors (result, expected, BUFFER_SIZE);
+
+    /* reads must fill exactly the range and nothing behind it */
+    for (size_t i = 0; i < sizeof (READS) / sizeof (Range); i++) {
+        const Range *range = &READS[i];
+
+        memset (result, UNTOUCHED, BUFFER_SIZE + 1);
+        OCL_CHECK_ERROR (ocl_staging_read (staging, buffer, range->offset, range->size, result, 0, NULL));
+        read_errors += count_errors (result, expected + range->offset, range->size);
+        read_errors += result[range->size] != UNTOUCHED;
+    }
+
+    printf ("%s: %i wrong bytes after write, %i after read\n",
+            write_errors + read_errors == 0 ? "OK" : "FAILED", write_errors, read_errors);
+
+    ocl_staging_free (staging);
+    OCL_CHECK_ERROR (clReleaseMemObject (buffer));
+    free (result);
+    free (expected);
+    ocl_free (ocl);
+
+    return write_errors + read_errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,769 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+#include "ocl-bench.h"
+#include "ocl-private.h"
+
+/*
+ * All check-* tools report through one schema so that runs can be compared
+ * across machines and revisions. A record is one metric of one device,
+ * optionally at a transfer or allocation size, summarized over all samples
+ * that survived outlier rejection. Time samples are kept in seconds with unit
+ * "s"; the text format scales them for reading, CSV and JSON never do.
+ *
+ * Outliers are samples further than threshold times the scaled median
+ * absolute deviation from the median. A threshold of zero keeps everything.
+ *
+ * The environment overrides whatever a tool configures, so that every tool
+ * can be driven by scripts without having its own argument parsing:
+ *
+ *   OCLKIT_BENCH_FORMAT        text, csv or json
+ *   OCLKIT_BENCH_OUTPUT        file name instead of stdout
+ *   OCLKIT_BENCH_WARMUP        number of warmup runs
+ *   OCLKIT_BENCH_RUNS          number of measured runs
+ *   OCLKIT_BENCH_OUTLIERS      outlier threshold
+ *
+ * The platform is only needed for the first record and for device records, so
+ * a benchmark without a platform can report host records and one that has
+ * written a record may outlive its platform to time the teardown.
+ */
+#define SCHEMA_VERSION  1
+#define MAD_SCALE       1.4826
+
+enum {
+    OVERRIDE_FORMAT     = 1 << 0,
+    OVERRIDE_WARMUP     = 1 << 1,
+    OVERRIDE_RUNS       = 1 << 2,
+    OVERRIDE_OUTLIERS   = 1 << 3,
+};
+
+struct OclBench {
+    OclPlatform         *ocl;
+    char                *name;
+    unsigned             num_warmup;
+    unsigned             num_runs;
+    double               threshold;
+    OclBenchFormat       format;
+    FILE                *fp;
+    int                  own_fp;
+    unsigned             overrides;
+    int                  started;
+    unsigned long        num_results;
+    unsigned             last_device;
+};
+
+struct OclBenchSeries {
+    OclBench            *bench;
+    unsigned             device;
+    char                *metric;
+    char                *unit;
+    cl_ulong             size;
+    double              *samples;
+    unsigned long        num_samples;
+    unsigned long        capacity;
+};
+
+static int
+read_env_unsigned (const char *name, unsigned *value)
+{
+    const char *s;
+    char *end;
+    unsigned long v;
+
+    s = getenv (name);
+
+    if (s == NULL || *s == '\0')
+        return 0;
+
+    v = strtoul (s, &end, 10);
+
+    if (*end != '\0') {
+        fprintf (stderr, "Ignoring invalid %s=%s\n", name, s);
+        return 0;
+    }
+
+    *value = (unsigned) v;
+    return 1;
+}
+
+static void
+read_environment (OclBench *bench)
+{
+    const char *s;
+
+    s = getenv ("OCLKIT_BENCH_FORMAT");
+
+    if (s != NULL && *s != '\0') {
+        bench->overrides |= OVERRIDE_FORMAT;
+
+        if (!strcmp (s, "text"))
+            bench->format = OCL_BENCH_TEXT;
+        else if (!strcmp (s, "csv"))
+            bench->format = OCL_BENCH_CSV;
+        else if (!strcmp (s, "json"))
+            bench->format = OCL_BENCH_JSON;
+        else {
+            fprintf (stderr, "Ignoring unknown OCLKIT_BENCH_FORMAT=%s\n", s);
+            bench->overrides &= ~OVERRIDE_FORMAT;
+        }
+    }
+
+    s = getenv ("OCLKIT_BENCH_OUTPUT");
+
+    if (s != NULL && *s != '\0') {
+        FILE *fp;
+
+        fp = fopen (s, "w");
+
+        if (fp != NULL) {
+            bench->fp = fp;
+            bench->own_fp = 1;
+        }
+        else {
+            fprintf (stderr, "Could not open %s, writing to stdout\n", s);
+        }
+    }
+
+    if (read_env_unsigned ("OCLKIT_BENCH_WARMUP", &bench->num_warmup))
+        bench->overrides |= OVERRIDE_WARMUP;
+
+    if (read_env_unsigned ("OCLKIT_BENCH_RUNS", &bench->num_runs) && bench->num_runs > 0)
+        bench->overrides |= OVERRIDE_RUNS;
+
+    s = getenv ("OCLKIT_BENCH_OUTLIERS");
+
+    if (s != NULL && *s != '\0') {
+        char *end;
+        double threshold;
+
+        threshold = strtod (s, &end);
+
+        if (*end == '\0' && threshold >= 0.0) {
+            bench->threshold = threshold;
+            bench->overrides |= OVERRIDE_OUTLIERS;
+        }
+        else {
+            fprintf (stderr, "Ignoring invalid OCLKIT_BENCH_OUTLIERS=%s\n", s);
+        }
+    }
+}
+
+OclBench *
+ocl_bench_new (OclPlatform *ocl, const char *name)
+{
+    OclBench *bench;
+
+    bench = calloc (1, sizeof (OclBench));
+
+    if (bench == NULL)
+        return NULL;
+
+    bench->ocl = ocl;
+    bench->name = strdup (name);
+    bench->num_warmup = 10;
+    bench->num_runs = 100;
+    bench->format = OCL_BENCH_TEXT;
+    bench->fp = stdout;
+    bench->last_device = OCL_BENCH_NO_DEVICE;
+
+    read_environment (bench);
+    return bench;
+}
+
+void
+ocl_bench_set_repetitions (OclBench *bench, unsigned num_warmup, unsigned num_runs)
+{
+    if (!(bench->overrides & OVERRIDE_WARMUP))
+        bench->num_warmup = num_warmup;
+
+    if (!(bench->overrides & OVERRIDE_RUNS) && num_runs > 0)
+        bench->num_runs = num_runs;
+}
+
+unsigned
+ocl_bench_get_warmup (OclBench *bench)
+{
+    return bench->num_warmup;
+}
+
+unsigned
+ocl_bench_get_runs (OclBench *bench)
+{
+    return bench->num_runs;
+}
+
+void
+ocl_bench_set_outlier_threshold (OclBench *bench, double threshold)
+{
+    if (!(bench->overrides & OVERRIDE_OUTLIERS) && threshold >= 0.0)
+        bench->threshold = threshold;
+}
+
+void
+ocl_bench_set_output (OclBench *bench, OclBenchFormat format, FILE *fp)
+{
+    if (!(bench->overrides & OVERRIDE_FORMAT))
+        bench->format = format;
+
+    if (fp != NULL && !bench->own_fp)
+        bench->fp = fp;
+}
+
+double
+ocl_bench_time (void)
+{
+    return ocl_time_ns () / 1e9;
+}
+
+double
+ocl_bench_event_time (cl_event event, OclBenchTimer timer)
+{
+    cl_ulong queued;
+    cl_ulong start;
+    cl_ulong end;
+
+    ocl_get_event_times (event, &start, &end, &queued, NULL);
+
+    switch (timer) {
+        case OCL_BENCH_EXECUTION:
+            return (end - start) / 1e9;
+        case OCL_BENCH_START_DELAY:
+            return (start - queued) / 1e9;
+        default:
+            return (end - queued) / 1e9;
+    }
+}
+
+static void
+write_csv_string (FILE *fp, const char *s)
+{
+    fputc ('"', fp);
+
+    for (; *s != '\0'; s++) {
+        if (*s == '"')
+            fputc ('"', fp);
+
+        fputc (*s, fp);
+    }
+
+    fputc ('"', fp);
+}
+
+static void
+write_json_string (FILE *fp, const char *s)
+{
+    fputc ('"', fp);
+
+    for (; *s != '\0'; s++) {
+        unsigned char c = (unsigned char) *s;
+
+        if (c == '"' || c == '\\')
+            fprintf (fp, "\\%c", c);
+        else if (c < 0x20)
+            fprintf (fp, "\\u%04x", c);
+        else
+            fputc (c, fp);
+    }
+
+    fputc ('"', fp);
+}
+
+static const char *
+device_name (OclBench *bench, unsigned device)
+{
+    if (device == OCL_BENCH_NO_DEVICE)
+        return "host";
+
+    return ocl_get_device_info (bench->ocl, device)->name;
+}
+
+static const char *
+device_driver (OclBench *bench, unsigned device)
+{
+    if (device == OCL_BENCH_NO_DEVICE)
+        return "";
+
+    return ocl_get_device_info (bench->ocl, device)->driver_version;
+}
+
+static void
+write_preamble (OclBench *bench)
+{
+    struct utsname uts;
+    char hostname[256];
+    char date[32];
+    char *platform_name;
+    char *platform_version;
+    time_t now;
+    struct tm tm;
+    FILE *fp = bench->fp;
+
+    if (gethostname (hostname, sizeof (hostname)) != 0)
+        strcpy (hostname, "unknown");
+
+    hostname[sizeof (hostname) - 1] = '\0';
+
+    if (uname (&uts) != 0)
+        memset (&uts, 0, sizeof (uts));
+
+    now = time (NULL);
+    gmtime_r (&now, &tm);
+    strftime (date, sizeof (date), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+    if (bench->ocl != NULL) {
+        platform_name = ocl_get_platform_info (bench->ocl, CL_PLATFORM_NAME);
+        platform_version = ocl_get_platform_info (bench->ocl, CL_PLATFORM_VERSION);
+    }
+    else {
+        platform_name = strdup ("none");
+        platform_version = strdup ("");
+    }
+
+    switch (bench->format) {
+        case OCL_BENCH_TEXT:
+            fprintf (fp, "# %s on %s (%s %s %s), %s %s, %s\n", bench->name,
+                     hostname, uts.sysname, uts.release, uts.machine,
+                     platform_name, platform_version, date);
+            break;
+
+        case OCL_BENCH_CSV:
+            fprintf (fp, "# schema=%i\n# benchmark=%s\n# host=%s\n# os=%s %s %s\n"
+                     "# platform=%s %s\n# date=%s\n",
+                     SCHEMA_VERSION, bench->name, hostname,
+                     uts.sysname, uts.release, uts.machine,
+                     platform_name, platform_version, date);
+            fprintf (fp, "benchmark,metric,unit,device,device_name,driver,size,"
+                     "n,rejected,min,mean,median,stddev,p90,p99,max\n");
+            break;
+
+        case OCL_BENCH_JSON:
+            fprintf (fp, "{\n  \"schema\": %i,\n  \"benchmark\": ", SCHEMA_VERSION);
+            write_json_string (fp, bench->name);
+            fprintf (fp, ",\n  \"host\": {\"name\": ");
+            write_json_string (fp, hostname);
+            fprintf (fp, ", \"os\": ");
+            write_json_string (fp, uts.sysname);
+            fprintf (fp, ", \"release\": ");
+            write_json_string (fp, uts.release);
+            fprintf (fp, ", \"machine\": ");
+            write_json_string (fp, uts.machine);
+            fprintf (fp, ", \"date\": ");
+            write_json_string (fp, date);
+            fprintf (fp, "},\n  \"platform\": {\"name\": ");
+            write_json_string (fp, platform_name);
+            fprintf (fp, ", \"version\": ");
+            write_json_string (fp, platform_version);
+            fprintf (fp, "},\n  \"devices\": [");
+
+            for (int i = 0; bench->ocl != NULL && i < ocl_get_num_devices (bench->ocl); i++) {
+                const OclDeviceInfo *info = ocl_get_device_info (bench->ocl, i);
+
+                fprintf (fp, "%s\n    {\"index\": %i, \"name\": ", i > 0 ? "," : "", i);
+                write_json_string (fp, info->name);
+                fprintf (fp, ", \"vendor\": ");
+                write_json_string (fp, info->vendor);
+                fprintf (fp, ", \"version\": ");
+                write_json_string (fp, info->version);
+                fprintf (fp, ", \"driver\": ");
+                write_json_string (fp, info->driver_version);
+                fprintf (fp, "}");
+            }
+
+            fprintf (fp, "\n  ],\n  \"results\": [");
+            break;
+    }
+
+    free (platform_name);
+    free (platform_version);
+    bench->started = 1;
+}
+
+static void
+write_text_record (OclBench *bench, OclBenchSeries *series, OclBenchStats *stats)
+{
+    char label[256];
+    const char *unit = series->unit;
+    double scale = 1.0;
+    FILE *fp = bench->fp;
+
+    if (series->device != bench->last_device) {
+        fprintf (fp, "%s%s\n", bench->num_results > 0 ? "\n" : "",
+                 device_name (bench, series->device));
+    }
+
+    if (series->size > 0)
+        snprintf (label, sizeof (label), "%s %llu", series->metric, (unsigned long long) series->size);
+    else
+        snprintf (label, sizeof (label), "%s", series->metric);
+
+    if (!strcmp (unit, "s")) {
+        if (stats->median < 1e-3) {
+            scale = 1e6;
+            unit = "us";
+        }
+        else if (stats->median < 1.0) {
+            scale = 1e3;
+            unit = "ms";
+        }
+    }
+
+    if (stats->num_samples + stats->num_rejected == 1) {
+        fprintf (fp, "  %-32s %12.5f %s\n", label, stats->mean * scale, unit);
+        return;
+    }
+
+    fprintf (fp, "  %-32s %12.5f %s [median=%.5f, stddev=%.5f, min=%.5f, p99=%.5f, max=%.5f, n=%lu",
+             label, stats->mean * scale, unit, stats->median * scale, stats->stddev * scale,
+             stats->min * scale, stats->p99 * scale, stats->max * scale, stats->num_samples);
+
+    if (stats->num_rejected > 0)
+        fprintf (fp, ", rejected=%lu", stats->num_rejected);
+
+    fprintf (fp, "]\n");
+}
+
+static void
+write_csv_record (OclBench *bench, OclBenchSeries *series, OclBenchStats *stats)
+{
+    FILE *fp = bench->fp;
+
+    write_csv_string (fp, bench->name);
+    fputc (',', fp);
+    write_csv_string (fp, series->metric);
+    fputc (',', fp);
+    write_csv_string (fp, series->unit);
+    fprintf (fp, ",%i,", series->device == OCL_BENCH_NO_DEVICE ? -1 : (int) series->device);
+    write_csv_string (fp, device_name (bench, series->device));
+    fputc (',', fp);
+    write_csv_string (fp, device_driver (bench, series->device));
+    fprintf (fp, ",%llu,%lu,%lu,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g\n",
+             (unsigned long long) series->size, stats->num_samples, stats->num_rejected,
+             stats->min, stats->mean, stats->median, stats->stddev,
+             stats->p90, stats->p99, stats->max);
+}
+
+static void
+write_json_record (OclBench *bench, OclBenchSeries *series, OclBenchStats *stats)
+{
+    FILE *fp = bench->fp;
+
+    fprintf (fp, "%s\n    {\"metric\": ", bench->num_results > 0 ? "," : "");
+    write_json_string (fp, series->metric);
+    fprintf (fp, ", \"unit\": ");
+    write_json_string (fp, series->unit);
+    fprintf (fp, ", \"device\": %i, \"device_name\": ",
+             series->device == OCL_BENCH_NO_DEVICE ? -1 : (int) series->device);
+    write_json_string (fp, device_name (bench, series->device));
+    fprintf (fp, ", \"driver\": ");
+    write_json_string (fp, device_driver (bench, series->device));
+    fprintf (fp, ", \"size\": %llu, \"n\": %lu, \"rejected\": %lu, "
+             "\"min\": %.9g, \"mean\": %.9g, \"median\": %.9g, \"stddev\": %.9g, "
+             "\"p90\": %.9g, \"p99\": %.9g, \"max\": %.9g}",
+             (unsigned long long) series->size, stats->num_samples, stats->num_rejected,
+             stats->min, stats->mean, stats->median, stats->stddev,
+             stats->p90, stats->p99, stats->max);
+}
+
+static void
+write_record (OclBench *bench, OclBenchSeries *series, OclBenchStats *stats)
+{
+    if (!bench->started)
+        write_preamble (bench);
+
+    switch (bench->format) {
+        case OCL_BENCH_TEXT:
+            write_text_record (bench, series, stats);
+            break;
+        case OCL_BENCH_CSV:
+            write_csv_record (bench, series, stats);
+            break;
+        case OCL_BENCH_JSON:
+            write_json_record (bench, series, stats);
+            break;
+    }
+
+    bench->last_device = series->device;
+    bench->num_results++;
+    fflush (bench->fp);
+}
+
+static int
+compare_doubles (const void *a, const void *b)
+{
+    double x = *((const double *) a);
+    double y = *((const double *) b);
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static double
+sorted_median (const double *values, unsigned long n)
+{
+    if (n == 0)
+        return 0.0;
+
+    if (n % 2)
+        return values[n / 2];
+
+    return (values[n / 2 - 1] + values[n / 2]) / 2.0;
+}
+
+static double
+sorted_percentile (const double *values, unsigned long n, double percentile)
+{
+    unsigned long rank;
+
+    if (n == 0)
+        return 0.0;
+
+    /* nearest rank */
+    rank = (unsigned long) ceil (percentile / 100.0 * n);
+    return values[rank > 0 ? rank - 1 : 0];
+}
+
+static void
+compute_stats (double *samples, unsigned long n, double threshold, OclBenchStats *stats)
+{
+    unsigned long first = 0;
+    unsigned long last = n;
+    double sum = 0.0;
+
+    memset (stats, 0, sizeof (OclBenchStats));
+
+    if (n == 0)
+        return;
+
+    qsort (samples, n, sizeof (double), compare_doubles);
+
+    if (threshold > 0.0 && n > 2) {
+        double *deviations;
+        double median;
+        double mad;
+
+        median = sorted_median (samples, n);
+        deviations = malloc (n * sizeof (double));
+
+        for (unsigned long i = 0; i < n; i++)
+            deviations[i] = fabs (samples[i] - median);
+
+        qsort (deviations, n, sizeof (double), compare_doubles);
+        mad = sorted_median (deviations, n) * MAD_SCALE;
+        free (deviations);
+
+        /* samples are sorted, so the survivors are a contiguous range */
+        if (mad > 0.0) {
+            while (first < last && median - samples[first] > threshold * mad)
+                first++;
+
+            while (last > first && samples[last - 1] - median > threshold * mad)
+                last--;
+        }
+    }
+
+    stats->num_samples = last - first;
+    stats->num_rejected = n - stats->num_samples;
+
+    samples += first;
+    n = stats->num_samples;
+
+    for (unsigned long i = 0; i < n; i++)
+        sum += samples[i];
+
+    stats->min = samples[0];
+    stats->max = samples[n - 1];
+    stats->mean = sum / n;
+    stats->median = sorted_median (samples, n);
+    stats->p90 = sorted_percentile (samples, n, 90.0);
+    stats->p99 = sorted_percentile (samples, n, 99.0);
+
+    if (n > 1) {
+        double sq_sum = 0.0;
+
+        for (unsigned long i = 0; i < n; i++)
+            sq_sum += (samples[i] - stats->mean) * (samples[i] - stats->mean);
+
+        stats->stddev = sqrt (sq_sum / (n - 1));
+    }
+}
+
+static void
+free_series (OclBenchSeries *series)
+{
+    free (series->samples);
+    free (series->metric);
+    free (series->unit);
+    free (series);
+}
+
+OclBenchSeries *
+ocl_bench_series_new (OclBench *bench, unsigned device, const char *metric, const char *unit, cl_ulong size)
+{
+    OclBenchSeries *series;
+
+    series = calloc (1, sizeof (OclBenchSeries));
+
+    if (series == NULL)
+        return NULL;
+
+    series->bench = bench;
+    series->device = device;
+    series->metric = strdup (metric);
+    series->unit = strdup (unit);
+    series->size = size;
+    return series;
+}
+
+void
+ocl_bench_series_add (OclBenchSeries *series, double value)
+{
+    if (series->num_samples == series->capacity) {
+        unsigned long capacity;
+        double *samples;
+
+        capacity = series->capacity > 0 ? series->capacity * 2 : 128;
+        samples = realloc (series->samples, capacity * sizeof (double));
+
+        if (samples == NULL)
+            return;
+
+        series->samples = samples;
+        series->capacity = capacity;
+    }
+
+    series->samples[series->num_samples++] = value;
+}
+
+void
+ocl_bench_series_add_event (OclBenchSeries *series, cl_event event, OclBenchTimer timer)
+{
+    ocl_bench_series_add (series, ocl_bench_event_time (event, timer));
+}
+
+void
+ocl_bench_series_finish (OclBenchSeries *series, OclBenchStats *stats)
+{
+    OclBenchStats result;
+
+    compute_stats (series->samples, series->num_samples, series->bench->threshold, &result);
+    write_record (series->bench, series, &result);
+
+    if (stats != NULL)
+        *stats = result;
+
+    free_series (series);
+}
+
+void
+ocl_bench_record (OclBench *bench, unsigned device, const char *metric, const char *unit, cl_ulong size, double value)
+{
+    OclBenchSeries *series;
+
+    series = ocl_bench_series_new (bench, device, metric, unit, size);
+
+    if (series == NULL)
+        return;
+
+    ocl_bench_series_add (series, value);
+    ocl_bench_series_finish (series, NULL);
+}
+
+cl_int
+ocl_bench_run (OclBench *bench,
+               unsigned device,
+               const char *metric,
+               cl_ulong size,
+               OclBenchTimer timer,
+               OclBenchFunc func,
+               void *user_data,
+               OclBenchStats *stats)
+{
+    OclBenchSeries *series;
+    cl_int errcode = CL_SUCCESS;
+
+    series = ocl_bench_series_new (bench, device, metric, "s", size);
+
+    if (series == NULL)
+        return CL_OUT_OF_HOST_MEMORY;
+
+    for (unsigned r = 0; r < bench->num_warmup + bench->num_runs; r++) {
+        cl_event event = NULL;
+        double start;
+        double elapsed;
+
+        start = ocl_bench_time ();
+        errcode = func (user_data, &event);
+
+        if (errcode == CL_SUCCESS && event != NULL)
+            errcode = clWaitForEvents (1, &event);
+
+        elapsed = ocl_bench_time () - start;
+
+        if (errcode != CL_SUCCESS) {
+            if (event != NULL)
+                clReleaseEvent (event);
+
+            break;
+        }
+
+        if (r >= bench->num_warmup) {
+            /* without an event there is nothing to profile */
+            if (timer == OCL_BENCH_WALL || event == NULL)
+                ocl_bench_series_add (series, elapsed);
+            else
+                ocl_bench_series_add_event (series, event, timer);
+        }
+
+        if (event != NULL)
+            clReleaseEvent (event);
+    }
+
+    if (errcode != CL_SUCCESS) {
+        free_series (series);
+        return errcode;
+    }
+
+    ocl_bench_series_finish (series, stats);
+    return CL_SUCCESS;
+}
+
+void
+ocl_bench_free (OclBench *bench)
+{
+    if (bench->format == OCL_BENCH_JSON) {
+        if (!bench->started)
+            write_preamble (bench);
+
+        fprintf (bench->fp, "\n  ]\n}\n");
+    }
+
+    if (bench->own_fp)
+        fclose (bench->fp);
+    else
+        fflush (bench->fp);
+
+    free (bench->name);
+    free (bench);
+}
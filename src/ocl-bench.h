@@ -0,0 +1,107 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OCL_BENCH_H
+#define OCL_BENCH_H
+
+#include "ocl.h"
+
+#define OCL_BENCH_NO_DEVICE ((unsigned) -1)
+
+typedef struct OclBench OclBench;
+typedef struct OclBenchSeries OclBenchSeries;
+
+typedef enum {
+    OCL_BENCH_TEXT = 0,
+    OCL_BENCH_CSV,
+    OCL_BENCH_JSON,
+} OclBenchFormat;
+
+typedef enum {
+    OCL_BENCH_WALL = 0,         /* host clock around the call and the wait */
+    OCL_BENCH_EXECUTION,        /* profiled start to end */
+    OCL_BENCH_START_DELAY,      /* profiled queued to start */
+    OCL_BENCH_TOTAL,            /* profiled queued to end */
+} OclBenchTimer;
+
+typedef struct {
+    unsigned long   num_samples;    /* after outlier rejection */
+    unsigned long   num_rejected;
+    double          min;
+    double          max;
+    double          mean;
+    double          median;
+    double          stddev;
+    double          p90;
+    double          p99;
+} OclBenchStats;
+
+typedef cl_int (*OclBenchFunc) (void *user_data, cl_event *event);
+
+OclBench *          ocl_bench_new       (OclPlatform        *ocl,
+                                         const char         *name);
+void                ocl_bench_free      (OclBench           *bench);
+void                ocl_bench_set_repetitions
+                                        (OclBench           *bench,
+                                         unsigned            num_warmup,
+                                         unsigned            num_runs);
+unsigned            ocl_bench_get_warmup
+                                        (OclBench           *bench);
+unsigned            ocl_bench_get_runs  (OclBench           *bench);
+void                ocl_bench_set_outlier_threshold
+                                        (OclBench           *bench,
+                                         double              threshold);
+void                ocl_bench_set_output
+                                        (OclBench           *bench,
+                                         OclBenchFormat      format,
+                                         FILE               *fp);
+OclBenchSeries *    ocl_bench_series_new
+                                        (OclBench           *bench,
+                                         unsigned            device,
+                                         const char         *metric,
+                                         const char         *unit,
+                                         cl_ulong            size);
+void                ocl_bench_series_add
+                                        (OclBenchSeries     *series,
+                                         double              value);
+void                ocl_bench_series_add_event
+                                        (OclBenchSeries     *series,
+                                         cl_event            event,
+                                         OclBenchTimer       timer);
+void                ocl_bench_series_finish
+                                        (OclBenchSeries     *series,
+                                         OclBenchStats      *stats);
+void                ocl_bench_record    (OclBench           *bench,
+                                         unsigned            device,
+                                         const char         *metric,
+                                         const char         *unit,
+                                         cl_ulong            size,
+                                         double              value);
+cl_int              ocl_bench_run       (OclBench           *bench,
+                                         unsigned            device,
+                                         const char         *metric,
+                                         cl_ulong            size,
+                                         OclBenchTimer       timer,
+                                         OclBenchFunc        func,
+                                         void               *user_data,
+                                         OclBenchStats      *stats);
+double              ocl_bench_time      (void);
+double              ocl_bench_event_time
+                                        (cl_event            event,
+                                         OclBenchTimer       timer);
+
+#endif
@@ -0,0 +1,327 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "ocl-client.h"
+#include "ocl-private.h"
+
+/*
+ * Client side of ocl-daemon. Requests are synchronous, one connection carries
+ * one request at a time. Buffers are POSIX shared memory objects that the
+ * daemon maps as well; the name is unlinked as soon as both sides have it
+ * mapped so that nothing is left behind if either side dies.
+ */
+struct OclClient {
+    int                  fd;
+    int                  num_devices;
+    unsigned             num_buffers;
+};
+
+struct OclClientBuffer {
+    OclClient           *client;
+    void                *data;
+    size_t               size;
+    cl_uint              handle;
+};
+
+static cl_int
+request (OclClient *client, OclWireType type, const void *payload, size_t size, OclWireReply *reply)
+{
+    OclWireHeader header;
+
+    if (size > OCL_WIRE_MAX_PAYLOAD)
+        return CL_INVALID_VALUE;
+
+    header.type = type;
+    header.size = size;
+
+    /* a broken connection leaves the daemon unusable for this client */
+    if (!ocl_wire_write (client->fd, &header, sizeof (OclWireHeader)) ||
+        !ocl_wire_write (client->fd, payload, size) ||
+        !ocl_wire_read (client->fd, reply, sizeof (OclWireReply)))
+        return CL_DEVICE_NOT_AVAILABLE;
+
+    return reply->status;
+}
+
+OclClient *
+ocl_client_new (const char *socket_path,
+                cl_int *errcode)
+{
+    OclClient *client;
+    OclWireReply reply;
+    struct sockaddr_un address;
+    cl_int status;
+    int fd;
+
+    assert (socket_path != NULL);
+
+    if (strlen (socket_path) >= sizeof (address.sun_path)) {
+        ocl_transfer_error (CL_INVALID_VALUE, errcode);
+        return NULL;
+    }
+
+    memset (&address, 0, sizeof (address));
+    address.sun_family = AF_UNIX;
+    strcpy (address.sun_path, socket_path);
+
+    fd = socket (AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0 || connect (fd, (struct sockaddr *) &address, sizeof (address)) < 0) {
+        if (fd >= 0)
+            close (fd);
+
+        ocl_transfer_error (CL_DEVICE_NOT_AVAILABLE, errcode);
+        return NULL;
+    }
+
+    client = calloc (1, sizeof (OclClient));
+    client->fd = fd;
+
+    status = request (client, OCL_WIRE_HELLO, NULL, 0, &reply);
+
+    if (status != CL_SUCCESS) {
+        ocl_client_free (client);
+        ocl_transfer_error (status, errcode);
+        return NULL;
+    }
+
+    client->num_devices = (int) reply.value;
+    ocl_transfer_error (CL_SUCCESS, errcode);
+    return client;
+}
+
+void
+ocl_client_free (OclClient *client)
+{
+    if (client == NULL)
+        return;
+
+    /* the daemon unmaps what is left when the connection closes */
+    close (client->fd);
+    free (client);
+}
+
+int
+ocl_client_get_num_devices (OclClient *client)
+{
+    assert (client != NULL);
+    return client->num_devices;
+}
+
+int
+ocl_client_create_program_from_source (OclClient *client,
+                                       const char *source,
+                                       const char *options,
+                                       cl_int *errcode)
+{
+    OclWireReply reply;
+    char *payload;
+    size_t source_size;
+    size_t options_size;
+    cl_int status;
+
+    assert (client != NULL);
+    assert (source != NULL);
+
+    if (options == NULL)
+        options = "";
+
+    source_size = strlen (source) + 1;
+    options_size = strlen (options) + 1;
+    payload = malloc (source_size + options_size);
+    memcpy (payload, source, source_size);
+    memcpy (payload + source_size, options, options_size);
+
+    status = request (client, OCL_WIRE_PROGRAM, payload, source_size + options_size, &reply);
+    free (payload);
+    ocl_transfer_error (status, errcode);
+
+    return status == CL_SUCCESS ? (int) reply.handle : -1;
+}
+
+OclClientBuffer *
+ocl_client_buffer_new (OclClient *client,
+                       size_t size,
+                       cl_int *errcode)
+{
+    OclClientBuffer *buffer;
+    OclWireMap map;
+    OclWireReply reply;
+    void *data;
+    cl_int status;
+    int fd;
+
+    assert (client != NULL);
+
+    if (size == 0) {
+        ocl_transfer_error (CL_INVALID_BUFFER_SIZE, errcode);
+        return NULL;
+    }
+
+    memset (&map, 0, sizeof (OclWireMap));
+    snprintf (map.name, OCL_WIRE_MAX_NAME, "/oclkit-%ld-%u", (long) getpid (), client->num_buffers++);
+    map.size = size;
+
+    fd = shm_open (map.name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+
+    if (fd < 0) {
+        ocl_transfer_error (CL_OUT_OF_HOST_MEMORY, errcode);
+        return NULL;
+    }
+
+    if (ftruncate (fd, size) < 0 ||
+        (data = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        close (fd);
+        shm_unlink (map.name);
+        ocl_transfer_error (CL_OUT_OF_HOST_MEMORY, errcode);
+        return NULL;
+    }
+
+    close (fd);
+    status = request (client, OCL_WIRE_MAP, &map, sizeof (OclWireMap), &reply);
+    shm_unlink (map.name);
+
+    if (status != CL_SUCCESS) {
+        munmap (data, size);
+        ocl_transfer_error (status, errcode);
+        return NULL;
+    }
+
+    buffer = malloc (sizeof (OclClientBuffer));
+    buffer->client = client;
+    buffer->data = data;
+    buffer->size = size;
+    buffer->handle = reply.handle;
+
+    ocl_transfer_error (CL_SUCCESS, errcode);
+    return buffer;
+}
+
+void *
+ocl_client_buffer_get_data (OclClientBuffer *buffer)
+{
+    assert (buffer != NULL);
+    return buffer->data;
+}
+
+void
+ocl_client_buffer_free (OclClientBuffer *buffer)
+{
+    OclWireReply reply;
+
+    if (buffer == NULL)
+        return;
+
+    request (buffer->client, OCL_WIRE_UNMAP, &buffer->handle, sizeof (cl_uint), &reply);
+    munmap (buffer->data, buffer->size);
+    free (buffer);
+}
+
+cl_int
+ocl_client_run (OclClient *client,
+                unsigned device,
+                int program,
+                const char *kernel,
+                cl_uint work_dim,
+                const size_t *global_work_size,
+                const size_t *local_work_size,
+                cl_uint num_args,
+                const OclClientArg *args,
+                cl_ulong *time)
+{
+    OclWireRun run;
+    OclWireReply reply;
+    OclWireArg *wire_args;
+    char *payload;
+    size_t size;
+    size_t values;
+    cl_int status;
+
+    assert (client != NULL);
+    assert (kernel != NULL);
+    assert (global_work_size != NULL);
+
+    if (program < 0 || work_dim < 1 || work_dim > 3 || strlen (kernel) >= OCL_WIRE_MAX_NAME)
+        return CL_INVALID_VALUE;
+
+    memset (&run, 0, sizeof (OclWireRun));
+    strcpy (run.kernel, kernel);
+    run.device = device;
+    run.program = (cl_uint) program;
+    run.work_dim = work_dim;
+    run.num_args = num_args;
+    run.use_local_work_size = local_work_size != NULL;
+
+    for (cl_uint i = 0; i < work_dim; i++) {
+        run.global_work_size[i] = global_work_size[i];
+        run.local_work_size[i] = local_work_size != NULL ? local_work_size[i] : 0;
+    }
+
+    size = sizeof (OclWireRun) + num_args * sizeof (OclWireArg);
+
+    for (cl_uint i = 0; i < num_args; i++) {
+        if (args[i].type == OCL_CLIENT_ARG_VALUE)
+            size += args[i].size;
+    }
+
+    payload = malloc (size);
+    wire_args = calloc (num_args + 1, sizeof (OclWireArg));
+    memcpy (payload, &run, sizeof (OclWireRun));
+    values = sizeof (OclWireRun) + num_args * sizeof (OclWireArg);
+
+    for (cl_uint i = 0; i < num_args; i++) {
+        const OclClientArg *arg = &args[i];
+
+        wire_args[i].type = arg->type;
+        wire_args[i].size = arg->size;
+        wire_args[i].flags = arg->flags;
+
+        if (arg->type == OCL_CLIENT_ARG_VALUE) {
+            memcpy (payload + values, arg->value, arg->size);
+            values += arg->size;
+        }
+        else if (arg->type == OCL_CLIENT_ARG_BUFFER) {
+            assert (arg->buffer != NULL);
+            wire_args[i].handle = arg->buffer->handle;
+            wire_args[i].offset = arg->offset;
+
+            if (arg->size == 0 && arg->offset < arg->buffer->size)
+                wire_args[i].size = arg->buffer->size - arg->offset;
+        }
+    }
+
+    memcpy (payload + sizeof (OclWireRun), wire_args, num_args * sizeof (OclWireArg));
+    status = request (client, OCL_WIRE_RUN, payload, size, &reply);
+
+    if (status == CL_SUCCESS && time != NULL)
+        *time = reply.value;
+
+    free (wire_args);
+    free (payload);
+    return status;
+}
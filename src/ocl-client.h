@@ -0,0 +1,70 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OCL_CLIENT_H
+#define OCL_CLIENT_H
+
+#include "ocl.h"
+
+typedef struct OclClient OclClient;
+typedef struct OclClientBuffer OclClientBuffer;
+
+typedef enum {
+    OCL_CLIENT_ARG_VALUE = 0,
+    OCL_CLIENT_ARG_LOCAL,
+    OCL_CLIENT_ARG_BUFFER,
+} OclClientArgType;
+
+typedef struct {
+    OclClientArgType    type;
+    size_t              size;       /* bytes of value, local memory or buffer */
+    const void         *value;
+    OclClientBuffer    *buffer;
+    size_t              offset;
+    cl_mem_flags        flags;      /* kernel access, decides up- and download */
+} OclClientArg;
+
+OclClient *         ocl_client_new      (const char         *socket_path,
+                                         cl_int             *errcode);
+void                ocl_client_free     (OclClient          *client);
+int                 ocl_client_get_num_devices
+                                        (OclClient          *client);
+int                 ocl_client_create_program_from_source
+                                        (OclClient          *client,
+                                         const char         *source,
+                                         const char         *options,
+                                         cl_int             *errcode);
+OclClientBuffer *   ocl_client_buffer_new
+                                        (OclClient          *client,
+                                         size_t              size,
+                                         cl_int             *errcode);
+void *              ocl_client_buffer_get_data
+                                        (OclClientBuffer    *buffer);
+void                ocl_client_buffer_free
+                                        (OclClientBuffer    *buffer);
+cl_int              ocl_client_run      (OclClient          *client,
+                                         unsigned            device,
+                                         int                 program,
+                                         const char         *kernel,
+                                         cl_uint             work_dim,
+                                         const size_t       *global_work_size,
+                                         const size_t       *local_work_size,
+                                         cl_uint             num_args,
+                                         const OclClientArg *args,
+                                         cl_ulong           *time);
+
+#endif
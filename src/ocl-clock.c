@@ -0,0 +1,322 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "ocl-clock.h"
+#include "ocl-private.h"
+
+/*
+ * Device profiling timestamps have an arbitrary epoch and run at a slightly
+ * different rate than the host clock. A calibration point pairs a device time
+ * with the CLOCK_MONOTONIC time (ocl_clock_host_time) at which it was taken.
+ * With OpenCL 2.1, clGetDeviceAndHostTimer returns a device timestamp between
+ * two host clock reads. Otherwise a marker is enqueued on an idle profiling
+ * queue between two host clock reads and its CL_PROFILING_COMMAND_QUEUED time,
+ * which the runtime takes during the enqueue, is used.
+ *
+ * Of NUM_SAMPLES tries per calibration the one with the tightest bracket is
+ * kept as a point, with the middle of the bracket as host time. A line fitted
+ * through all points maps device to host time; with a single point only the
+ * offset is known. Calibrating again after a while measures the drift. Times
+ * are kept relative to the first point so that doubles keep ns precision.
+ */
+#define NUM_SAMPLES     16
+#define MAX_POINTS      32
+#define MIN_SPAN        10000
+
+typedef struct {
+    double               device;
+    double               host;
+} Point;
+
+struct OclClock {
+    OclPlatform         *ocl;
+    cl_device_id         device;
+    cl_command_queue     queue;
+    OclClockMethod       method;
+    cl_ulong             ref_device;
+    cl_ulong             ref_host;
+    Point                points[MAX_POINTS];
+    unsigned             num_points;
+    unsigned             total_points;
+    double               intercept;
+    double               slope;
+    double               uncertainty;
+    pthread_mutex_t      lock;
+};
+
+static int
+has_host_timer (const OclDeviceInfo *info)
+{
+#ifdef CL_VERSION_2_1
+    return ocl_device_version_at_least (info, 2, 1);
+#else
+    return 0;
+#endif
+}
+
+static cl_int
+sample_host_timer (OclClock *clock, cl_ulong *device_time, cl_ulong *before, cl_ulong *after)
+{
+#ifdef CL_VERSION_2_1
+    cl_ulong host_time;
+    cl_int errcode;
+
+    *before = ocl_time_ns ();
+    errcode = clGetDeviceAndHostTimer (clock->device, device_time, &host_time);
+    *after = ocl_time_ns ();
+    return errcode;
+#else
+    return CL_INVALID_OPERATION;
+#endif
+}
+
+static cl_int
+sample_marker (OclClock *clock, cl_ulong *device_time, cl_ulong *before, cl_ulong *after)
+{
+    cl_event event;
+    cl_int errcode;
+
+    *before = ocl_time_ns ();
+    errcode = clEnqueueMarkerWithWaitList (clock->queue, 0, NULL, &event);
+    *after = ocl_time_ns ();
+
+    if (errcode != CL_SUCCESS)
+        return errcode;
+
+    errcode = clWaitForEvents (1, &event);
+
+    if (errcode == CL_SUCCESS)
+        errcode = clGetEventProfilingInfo (event, CL_PROFILING_COMMAND_QUEUED,
+                                           sizeof (cl_ulong), device_time, NULL);
+
+    clReleaseEvent (event);
+    return errcode;
+}
+
+static void
+fit (OclClock *clock)
+{
+    double mean_device = 0.0;
+    double mean_host = 0.0;
+    double covariance = 0.0;
+    double variance = 0.0;
+    double span;
+
+    for (unsigned i = 0; i < clock->num_points; i++) {
+        mean_device += clock->points[i].device;
+        mean_host += clock->points[i].host;
+    }
+
+    mean_device /= clock->num_points;
+    mean_host /= clock->num_points;
+
+    for (unsigned i = 0; i < clock->num_points; i++) {
+        double dx = clock->points[i].device - mean_device;
+
+        covariance += dx * (clock->points[i].host - mean_host);
+        variance += dx * dx;
+    }
+
+    /*
+     * Points closer in time than MIN_SPAN brackets would turn the bracketing
+     * error into a rate error larger than any real drift.
+     */
+    span = clock->points[clock->num_points - 1].device - clock->points[0].device;
+    clock->slope = span > MIN_SPAN * 2.0 * clock->uncertainty && variance > 0.0 ? covariance / variance : 1.0;
+    clock->intercept = mean_host - clock->slope * mean_device;
+}
+
+static cl_int
+calibrate (OclClock *clock)
+{
+    cl_ulong best_device = 0;
+    cl_ulong best_before = 0;
+    cl_ulong best_width = 0;
+    Point point;
+
+    for (unsigned i = 0; i < NUM_SAMPLES; i++) {
+        cl_ulong device_time;
+        cl_ulong before;
+        cl_ulong after;
+        cl_int errcode;
+
+        if (clock->method == OCL_CLOCK_HOST_TIMER)
+            errcode = sample_host_timer (clock, &device_time, &before, &after);
+        else
+            errcode = sample_marker (clock, &device_time, &before, &after);
+
+        if (errcode != CL_SUCCESS)
+            return errcode;
+
+        if (i == 0 || after - before < best_width) {
+            best_device = device_time;
+            best_before = before;
+            best_width = after - before;
+        }
+    }
+
+    if (clock->total_points == 0) {
+        clock->ref_device = best_device;
+        clock->ref_host = best_before + best_width / 2;
+    }
+
+    point.device = (double) (cl_long) (best_device - clock->ref_device);
+    point.host = (double) (cl_long) (best_before - clock->ref_host) + best_width / 2.0;
+
+    if (clock->num_points == MAX_POINTS) {
+        memmove (clock->points, clock->points + 1, (MAX_POINTS - 1) * sizeof (Point));
+        clock->num_points--;
+    }
+
+    clock->points[clock->num_points++] = point;
+    clock->total_points++;
+
+    if (clock->total_points == 1 || best_width / 2.0 < clock->uncertainty)
+        clock->uncertainty = best_width / 2.0;
+
+    fit (clock);
+    return CL_SUCCESS;
+}
+
+OclClock *
+ocl_clock_new (OclPlatform *ocl, unsigned device, cl_int *errcode)
+{
+    OclClock *clock;
+    cl_int errcode_ret = CL_SUCCESS;
+
+    clock = calloc (1, sizeof (OclClock));
+
+    if (clock == NULL) {
+        ocl_transfer_error (CL_OUT_OF_HOST_MEMORY, errcode);
+        return NULL;
+    }
+
+    clock->ocl = ocl;
+    clock->device = ocl_get_devices (ocl)[device];
+    clock->slope = 1.0;
+    pthread_mutex_init (&clock->lock, NULL);
+
+    /* the host timer may still be unsupported, fall back to markers then */
+    if (has_host_timer (ocl_get_device_info (ocl, device))) {
+        clock->method = OCL_CLOCK_HOST_TIMER;
+
+        if (calibrate (clock) == CL_SUCCESS)
+            goto ocl_clock_new_done;
+    }
+
+    clock->method = OCL_CLOCK_MARKER;
+    clock->queue = clCreateCommandQueue (ocl_get_context (ocl), clock->device,
+                                         CL_QUEUE_PROFILING_ENABLE, &errcode_ret);
+
+    if (errcode_ret == CL_SUCCESS)
+        errcode_ret = calibrate (clock);
+
+    if (errcode_ret != CL_SUCCESS) {
+        ocl_transfer_error (errcode_ret, errcode);
+        ocl_clock_free (clock);
+        return NULL;
+    }
+
+ocl_clock_new_done:
+    ocl_transfer_error (CL_SUCCESS, errcode);
+    return clock;
+}
+
+void
+ocl_clock_free (OclClock *clock)
+{
+    if (clock->queue != NULL)
+        clReleaseCommandQueue (clock->queue);
+
+    pthread_mutex_destroy (&clock->lock);
+    free (clock);
+}
+
+cl_int
+ocl_clock_calibrate (OclClock *clock)
+{
+    cl_int errcode;
+
+    pthread_mutex_lock (&clock->lock);
+    errcode = calibrate (clock);
+    pthread_mutex_unlock (&clock->lock);
+    return errcode;
+}
+
+void
+ocl_clock_get_info (OclClock *clock, OclClockInfo *info)
+{
+    const Point *last;
+
+    pthread_mutex_lock (&clock->lock);
+    last = &clock->points[clock->num_points - 1];
+    info->method = clock->method;
+    info->num_points = clock->total_points;
+    info->offset = (double) (cl_long) (clock->ref_host - clock->ref_device) + last->host - last->device;
+    info->drift = (1.0 / clock->slope - 1.0) * 1e6;
+    info->uncertainty = clock->uncertainty;
+    pthread_mutex_unlock (&clock->lock);
+}
+
+cl_ulong
+ocl_clock_host_time (void)
+{
+    return ocl_time_ns ();
+}
+
+cl_ulong
+ocl_clock_to_host (OclClock *clock, cl_ulong device_time)
+{
+    double delta;
+    cl_ulong host_time;
+
+    pthread_mutex_lock (&clock->lock);
+    delta = (double) (cl_long) (device_time - clock->ref_device);
+    host_time = clock->ref_host + (cl_ulong) (cl_long) llround (clock->intercept + clock->slope * delta);
+    pthread_mutex_unlock (&clock->lock);
+    return host_time;
+}
+
+void
+ocl_clock_get_event_times (OclClock *clock,
+                           cl_event event,
+                           cl_ulong *start,
+                           cl_ulong *end,
+                           cl_ulong *queued,
+                           cl_ulong *submitted)
+{
+    ocl_get_event_times (event, start, end, queued, submitted);
+
+    if (start != NULL)
+        *start = ocl_clock_to_host (clock, *start);
+
+    if (end != NULL)
+        *end = ocl_clock_to_host (clock, *end);
+
+    if (queued != NULL)
+        *queued = ocl_clock_to_host (clock, *queued);
+
+    if (submitted != NULL)
+        *submitted = ocl_clock_to_host (clock, *submitted);
+}
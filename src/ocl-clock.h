@@ -0,0 +1,56 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OCL_CLOCK_H
+#define OCL_CLOCK_H
+
+#include "ocl.h"
+
+typedef struct OclClock OclClock;
+
+typedef enum {
+    OCL_CLOCK_HOST_TIMER = 0,       /* clGetDeviceAndHostTimer */
+    OCL_CLOCK_MARKER,               /* queued time of profiled markers */
+} OclClockMethod;
+
+typedef struct {
+    OclClockMethod  method;
+    unsigned        num_points;
+    double          offset;         /* host minus device ns at the last point */
+    double          drift;          /* ppm the device clock runs fast */
+    double          uncertainty;    /* ns, half of the best bracketing interval */
+} OclClockInfo;
+
+OclClock *          ocl_clock_new       (OclPlatform        *ocl,
+                                         unsigned            device,
+                                         cl_int             *errcode);
+void                ocl_clock_free      (OclClock           *clock);
+cl_int              ocl_clock_calibrate (OclClock           *clock);
+void                ocl_clock_get_info  (OclClock           *clock,
+                                         OclClockInfo       *info);
+cl_ulong            ocl_clock_host_time (void);
+cl_ulong            ocl_clock_to_host   (OclClock           *clock,
+                                         cl_ulong            device_time);
+void                ocl_clock_get_event_times
+                                        (OclClock           *clock,
+                                         cl_event            event,
+                                         cl_ulong           *start,
+                                         cl_ulong           *end,
+                                         cl_ulong           *queued,
+                                         cl_ulong           *submitted);
+
+#endif
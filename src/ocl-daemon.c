@@ -0,0 +1,708 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "ocl-daemon.h"
+#include "ocl-pool.h"
+#include "ocl-private.h"
+
+/*
+ * The daemon owns an OclPlatform and serves all clients from a single thread
+ * that polls the listening socket and the client connections. Programs are
+ * built once and shared by all clients, keyed by source and build options.
+ * Kernels are created on first use and kept with their program. Since clients
+ * share them, a job must set every argument, and buffer arguments are cleared
+ * once the job is done, so no job sees another client's buffers. Device
+ * buffers come from a buffer pool and are filled from, and read back into,
+ * shared memory regions that clients map with OCL_WIRE_MAP.
+ */
+#define MAX_CACHED_BYTES    (256 * 1024 * 1024)
+#define POLL_TIMEOUT_MS     250
+#define TRIM_IDLE_TIME      10.0
+
+typedef struct {
+    char                *name;
+    cl_kernel            kernel;
+    cl_uint              num_args;
+} Kernel;
+
+typedef struct {
+    cl_ulong             key;
+    char                *source;
+    char                *options;
+    cl_program           program;
+    Kernel              *kernels;
+    unsigned             num_kernels;
+} Program;
+
+typedef struct {
+    void                *data;
+    size_t               size;
+} Region;
+
+typedef struct {
+    int                  fd;
+    Region              *regions;
+    unsigned             num_regions;
+} Client;
+
+struct OclDaemon {
+    OclPlatform         *ocl;
+    OclBufferPool       *pool;
+    char                *socket_path;
+    int                  fd;
+    int                  stop;
+
+    Program             *programs;
+    unsigned             num_programs;
+    Client              *clients;
+    unsigned             num_clients;
+
+    OclDaemonStats       stats;
+};
+
+static cl_int
+get_program (OclDaemon *daemon, const char *payload, size_t size, cl_uint *handle)
+{
+    const char *source = payload;
+    const char *options;
+    size_t source_length;
+    cl_ulong key;
+    cl_program program;
+    cl_int errcode;
+    Program *entry;
+
+    /* the payload is terminated by the reader, options may be missing */
+    source_length = strlen (source);
+    options = source_length < size ? source + source_length + 1 : "";
+
+    if (*options == '\0')
+        options = NULL;
+
+    key = ocl_hash_string (ocl_hash_string (OCL_HASH_SEED, source), options);
+
+    /* the hash only narrows the search, a collision must not run another program */
+    for (unsigned i = 0; i < daemon->num_programs; i++) {
+        Program *candidate = &daemon->programs[i];
+
+        if (candidate->key == key && !strcmp (candidate->source, source) &&
+            !strcmp (candidate->options, options != NULL ? options : "")) {
+            daemon->stats.programs_reused++;
+            *handle = i;
+            return CL_SUCCESS;
+        }
+    }
+
+    program = ocl_create_program_from_source (daemon->ocl, source, options, &errcode);
+
+    if (program == NULL)
+        return errcode;
+
+    daemon->programs = realloc (daemon->programs, (daemon->num_programs + 1) * sizeof (Program));
+    entry = &daemon->programs[daemon->num_programs];
+    entry->key = key;
+    entry->source = strdup (source);
+    entry->options = strdup (options != NULL ? options : "");
+    entry->program = program;
+    entry->kernels = NULL;
+    entry->num_kernels = 0;
+
+    daemon->stats.programs_built++;
+    *handle = daemon->num_programs++;
+    return CL_SUCCESS;
+}
+
+static Kernel *
+get_kernel (Program *program, const char *name, cl_int *errcode)
+{
+    cl_kernel kernel;
+    cl_uint num_args;
+    Kernel *entry;
+
+    for (unsigned i = 0; i < program->num_kernels; i++) {
+        if (!strcmp (program->kernels[i].name, name))
+            return &program->kernels[i];
+    }
+
+    kernel = clCreateKernel (program->program, name, errcode);
+
+    if (kernel == NULL)
+        return NULL;
+
+    *errcode = clGetKernelInfo (kernel, CL_KERNEL_NUM_ARGS, sizeof (cl_uint), &num_args, NULL);
+
+    if (*errcode != CL_SUCCESS) {
+        OCL_CHECK_ERROR (clReleaseKernel (kernel));
+        return NULL;
+    }
+
+    program->kernels = realloc (program->kernels, (program->num_kernels + 1) * sizeof (Kernel));
+    entry = &program->kernels[program->num_kernels++];
+    entry->name = strdup (name);
+    entry->kernel = kernel;
+    entry->num_args = num_args;
+    return entry;
+}
+
+static cl_int
+map_region (Client *client, const char *payload, size_t size, cl_uint *handle)
+{
+    OclWireMap request;
+    struct stat st;
+    void *data;
+    int fd;
+    unsigned slot;
+
+    if (size != sizeof (OclWireMap))
+        return CL_INVALID_VALUE;
+
+    memcpy (&request, payload, sizeof (OclWireMap));
+    request.name[OCL_WIRE_MAX_NAME - 1] = '\0';
+
+    fd = shm_open (request.name, O_RDWR, 0);
+
+    if (fd < 0)
+        return CL_INVALID_HOST_PTR;
+
+    /* mapping beyond the end of the object would SIGBUS on access */
+    if (fstat (fd, &st) < 0 || request.size == 0 || (cl_ulong) st.st_size < request.size) {
+        close (fd);
+        return CL_INVALID_BUFFER_SIZE;
+    }
+
+    data = mmap (NULL, request.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close (fd);
+
+    if (data == MAP_FAILED)
+        return CL_OUT_OF_HOST_MEMORY;
+
+    for (slot = 0; slot < client->num_regions; slot++) {
+        if (client->regions[slot].data == NULL)
+            break;
+    }
+
+    if (slot == client->num_regions) {
+        client->regions = realloc (client->regions, (client->num_regions + 1) * sizeof (Region));
+        client->num_regions++;
+    }
+
+    client->regions[slot].data = data;
+    client->regions[slot].size = request.size;
+    *handle = slot;
+    return CL_SUCCESS;
+}
+
+static cl_int
+unmap_region (Client *client, const char *payload, size_t size)
+{
+    cl_uint handle;
+    Region *region;
+
+    if (size != sizeof (cl_uint))
+        return CL_INVALID_VALUE;
+
+    memcpy (&handle, payload, sizeof (cl_uint));
+
+    if (handle >= client->num_regions || client->regions[handle].data == NULL)
+        return CL_INVALID_MEM_OBJECT;
+
+    region = &client->regions[handle];
+    munmap (region->data, region->size);
+    region->data = NULL;
+    region->size = 0;
+    return CL_SUCCESS;
+}
+
+static char *
+get_region (Client *client, const OclWireArg *arg)
+{
+    Region *region;
+
+    if (arg->handle >= client->num_regions)
+        return NULL;
+
+    region = &client->regions[arg->handle];
+
+    if (region->data == NULL || arg->size == 0 ||
+        arg->offset > region->size || arg->size > region->size - arg->offset)
+        return NULL;
+
+    return ((char *) region->data) + arg->offset;
+}
+
+static cl_int
+run_job (OclDaemon *daemon, Client *client, const char *payload, size_t size, cl_ulong *time)
+{
+    OclWireRun run;
+    OclWireArg *args;
+    cl_mem *mems;
+    cl_command_queue queue;
+    Kernel *entry;
+    cl_kernel kernel;
+    cl_event event = NULL;
+    size_t global_work_size[3];
+    size_t local_work_size[3];
+    size_t values;
+    cl_ulong start;
+    cl_int errcode = CL_SUCCESS;
+
+    if (size < sizeof (OclWireRun))
+        return CL_INVALID_VALUE;
+
+    memcpy (&run, payload, sizeof (OclWireRun));
+    run.kernel[OCL_WIRE_MAX_NAME - 1] = '\0';
+
+    if (run.device >= (cl_uint) ocl_get_num_devices (daemon->ocl))
+        return CL_INVALID_DEVICE;
+
+    if (run.program >= daemon->num_programs)
+        return CL_INVALID_PROGRAM;
+
+    if (run.work_dim < 1 || run.work_dim > 3)
+        return CL_INVALID_WORK_DIMENSION;
+
+    if (run.num_args > (size - sizeof (OclWireRun)) / sizeof (OclWireArg))
+        return CL_INVALID_VALUE;
+
+    entry = get_kernel (&daemon->programs[run.program], run.kernel, &errcode);
+
+    if (entry == NULL)
+        return errcode;
+
+    /* leftover arguments of an earlier job must never be launched with */
+    if (run.num_args != entry->num_args)
+        return CL_INVALID_KERNEL_ARGS;
+
+    kernel = entry->kernel;
+
+    queue = ocl_get_queue (daemon->ocl, run.device, OCL_QUEUE_COMPUTE);
+
+    if (queue == NULL)
+        queue = ocl_get_cmd_queues (daemon->ocl)[run.device];
+
+    for (cl_uint i = 0; i < run.work_dim; i++) {
+        global_work_size[i] = run.global_work_size[i];
+        local_work_size[i] = run.local_work_size[i];
+    }
+
+    args = malloc (run.num_args * sizeof (OclWireArg) + 1);
+    mems = calloc (run.num_args + 1, sizeof (cl_mem));
+    memcpy (args, payload + sizeof (OclWireRun), run.num_args * sizeof (OclWireArg));
+    values = sizeof (OclWireRun) + run.num_args * sizeof (OclWireArg);
+    start = ocl_time_ns ();
+
+    for (cl_uint i = 0; i < run.num_args && errcode == CL_SUCCESS; i++) {
+        const OclWireArg *arg = &args[i];
+        char *data;
+
+        switch (arg->type) {
+            case OCL_WIRE_ARG_VALUE:
+                if (arg->size > size - values) {
+                    errcode = CL_INVALID_ARG_SIZE;
+                    break;
+                }
+
+                errcode = clSetKernelArg (kernel, i, arg->size, payload + values);
+                values += arg->size;
+                break;
+
+            case OCL_WIRE_ARG_LOCAL:
+                errcode = clSetKernelArg (kernel, i, arg->size, NULL);
+                break;
+
+            case OCL_WIRE_ARG_BUFFER:
+                data = get_region (client, arg);
+
+                if (data == NULL) {
+                    errcode = CL_INVALID_MEM_OBJECT;
+                    break;
+                }
+
+                mems[i] = ocl_buffer_pool_acquire (daemon->pool, run.device,
+                                                   arg->flags & (CL_MEM_READ_WRITE | CL_MEM_READ_ONLY | CL_MEM_WRITE_ONLY),
+                                                   arg->size, &errcode);
+
+                if (mems[i] == NULL)
+                    break;
+
+                if (!(arg->flags & CL_MEM_WRITE_ONLY))
+                    errcode = clEnqueueWriteBuffer (queue, mems[i], CL_FALSE, 0, arg->size, data, 0, NULL, NULL);
+
+                if (errcode == CL_SUCCESS)
+                    errcode = clSetKernelArg (kernel, i, sizeof (cl_mem), &mems[i]);
+
+                break;
+
+            default:
+                errcode = CL_INVALID_VALUE;
+        }
+    }
+
+    if (errcode != CL_SUCCESS)
+        goto run_job_cleanup;
+
+    errcode = clEnqueueNDRangeKernel (queue, kernel, run.work_dim, NULL, global_work_size,
+                                      run.use_local_work_size ? local_work_size : NULL,
+                                      0, NULL, &event);
+
+    if (errcode != CL_SUCCESS)
+        goto run_job_cleanup;
+
+    for (cl_uint i = 0; i < run.num_args && errcode == CL_SUCCESS; i++) {
+        if (mems[i] != NULL && !(args[i].flags & CL_MEM_READ_ONLY))
+            errcode = clEnqueueReadBuffer (queue, mems[i], CL_FALSE, 0, args[i].size,
+                                           get_region (client, &args[i]), 0, NULL, NULL);
+    }
+
+    OCL_CHECK_ERROR (clFinish (queue));
+
+    /* report kernel time if the queue profiles, otherwise the job time */
+    if (errcode == CL_SUCCESS) {
+        cl_ulong begin, end;
+
+        if (clGetEventProfilingInfo (event, CL_PROFILING_COMMAND_START, sizeof (cl_ulong), &begin, NULL) == CL_SUCCESS &&
+            clGetEventProfilingInfo (event, CL_PROFILING_COMMAND_END, sizeof (cl_ulong), &end, NULL) == CL_SUCCESS)
+            *time = end - begin;
+        else
+            *time = ocl_time_ns () - start;
+    }
+
+    daemon->stats.jobs++;
+
+run_job_cleanup:
+    if (event != NULL)
+        OCL_CHECK_ERROR (clReleaseEvent (event));
+
+    /* failed uploads may still be queued and read from the region */
+    if (errcode != CL_SUCCESS)
+        OCL_CHECK_ERROR (clFinish (queue));
+
+    for (cl_uint i = 0; i < run.num_args; i++) {
+        if (mems[i] != NULL) {
+            OCL_CHECK_ERROR (clSetKernelArg (kernel, i, sizeof (cl_mem), NULL));
+            ocl_buffer_pool_release (daemon->pool, mems[i]);
+        }
+    }
+
+    free (mems);
+    free (args);
+    return errcode;
+}
+
+static int
+handle_request (OclDaemon *daemon, Client *client)
+{
+    OclWireHeader header;
+    OclWireReply reply;
+    char *payload;
+
+    if (!ocl_wire_read (client->fd, &header, sizeof (OclWireHeader)))
+        return 0;
+
+    if (header.size > OCL_WIRE_MAX_PAYLOAD)
+        return 0;
+
+    payload = malloc (header.size + 1);
+
+    if (!ocl_wire_read (client->fd, payload, header.size)) {
+        free (payload);
+        return 0;
+    }
+
+    payload[header.size] = '\0';
+    memset (&reply, 0, sizeof (OclWireReply));
+
+    switch (header.type) {
+        case OCL_WIRE_HELLO:
+            reply.status = CL_SUCCESS;
+            reply.value = ocl_get_num_devices (daemon->ocl);
+            break;
+
+        case OCL_WIRE_PROGRAM:
+            reply.status = get_program (daemon, payload, header.size, &reply.handle);
+            break;
+
+        case OCL_WIRE_MAP:
+            reply.status = map_region (client, payload, header.size, &reply.handle);
+            break;
+
+        case OCL_WIRE_UNMAP:
+            reply.status = unmap_region (client, payload, header.size);
+            break;
+
+        case OCL_WIRE_RUN:
+            reply.status = run_job (daemon, client, payload, header.size, &reply.value);
+            break;
+
+        default:
+            reply.status = CL_INVALID_OPERATION;
+    }
+
+    free (payload);
+    return ocl_wire_write (client->fd, &reply, sizeof (OclWireReply));
+}
+
+static void
+accept_client (OclDaemon *daemon)
+{
+    Client *client;
+    int fd;
+
+    fd = accept (daemon->fd, NULL, NULL);
+
+    if (fd < 0)
+        return;
+
+    daemon->clients = realloc (daemon->clients, (daemon->num_clients + 1) * sizeof (Client));
+    client = &daemon->clients[daemon->num_clients++];
+    client->fd = fd;
+    client->regions = NULL;
+    client->num_regions = 0;
+    daemon->stats.connections++;
+}
+
+static void
+close_client (Client *client)
+{
+    for (unsigned i = 0; i < client->num_regions; i++) {
+        if (client->regions[i].data != NULL)
+            munmap (client->regions[i].data, client->regions[i].size);
+    }
+
+    free (client->regions);
+    close (client->fd);
+}
+
+static void
+remove_client (OclDaemon *daemon, unsigned index)
+{
+    close_client (&daemon->clients[index]);
+    daemon->clients[index] = daemon->clients[--daemon->num_clients];
+}
+
+/*
+ * Only a socket that no daemon listens on anymore is removed, anything else at
+ * the path is left alone and fails the start.
+ */
+static int
+remove_stale_socket (const struct sockaddr_un *address)
+{
+    struct stat st;
+    int fd;
+    int live;
+
+    if (lstat (address->sun_path, &st) < 0)
+        return errno == ENOENT;
+
+    if (!S_ISSOCK (st.st_mode)) {
+        fprintf (stderr, "%s exists and is not a socket\n", address->sun_path);
+        return 0;
+    }
+
+    if ((fd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return 0;
+
+    live = connect (fd, (const struct sockaddr *) address, sizeof (struct sockaddr_un)) == 0 || errno != ECONNREFUSED;
+    close (fd);
+
+    if (live) {
+        fprintf (stderr, "%s is in use by a running daemon\n", address->sun_path);
+        return 0;
+    }
+
+    return unlink (address->sun_path) == 0;
+}
+
+OclDaemon *
+ocl_daemon_new (OclPlatform *ocl,
+                const char *socket_path,
+                cl_int *errcode)
+{
+    OclDaemon *daemon;
+    struct sockaddr_un address;
+    mode_t mask;
+    int fd;
+    int bound;
+
+    assert (ocl != NULL);
+    assert (socket_path != NULL);
+
+    if (strlen (socket_path) >= sizeof (address.sun_path)) {
+        ocl_transfer_error (CL_INVALID_VALUE, errcode);
+        return NULL;
+    }
+
+    memset (&address, 0, sizeof (address));
+    address.sun_family = AF_UNIX;
+    strcpy (address.sun_path, socket_path);
+
+    fd = socket (AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0) {
+        ocl_transfer_error (CL_OUT_OF_RESOURCES, errcode);
+        return NULL;
+    }
+
+    /* a stale socket of a previous daemon would make bind fail */
+    if (!remove_stale_socket (&address)) {
+        close (fd);
+        ocl_transfer_error (CL_INVALID_VALUE, errcode);
+        return NULL;
+    }
+
+    /*
+     * Jobs run with our privileges, so only the owner may connect. The socket
+     * is created without group and other permissions rather than restricted
+     * after bind, which would leave a window for other users to connect.
+     */
+    mask = umask (S_IRWXG | S_IRWXO);
+    bound = bind (fd, (struct sockaddr *) &address, sizeof (address)) == 0;
+    umask (mask);
+
+    if (!bound || chmod (socket_path, S_IRUSR | S_IWUSR) < 0 || listen (fd, 16) < 0) {
+        fprintf (stderr, "Could not listen on %s: %s\n", socket_path, strerror (errno));
+
+        if (bound)
+            unlink (socket_path);
+
+        close (fd);
+        ocl_transfer_error (CL_OUT_OF_RESOURCES, errcode);
+        return NULL;
+    }
+
+    daemon = calloc (1, sizeof (OclDaemon));
+    daemon->ocl = ocl;
+    daemon->pool = ocl_buffer_pool_new (ocl, MAX_CACHED_BYTES);
+    daemon->socket_path = strdup (socket_path);
+    daemon->fd = fd;
+
+    ocl_transfer_error (CL_SUCCESS, errcode);
+    return daemon;
+}
+
+int
+ocl_daemon_run (OclDaemon *daemon)
+{
+    assert (daemon != NULL);
+
+    while (!__atomic_load_n (&daemon->stop, __ATOMIC_SEQ_CST)) {
+        struct pollfd *fds;
+        unsigned num_fds;
+        int ready;
+
+        num_fds = daemon->num_clients + 1;
+        fds = malloc (num_fds * sizeof (struct pollfd));
+        fds[0].fd = daemon->fd;
+        fds[0].events = POLLIN;
+
+        for (unsigned i = 0; i < daemon->num_clients; i++) {
+            fds[i + 1].fd = daemon->clients[i].fd;
+            fds[i + 1].events = POLLIN;
+        }
+
+        ready = poll (fds, num_fds, POLL_TIMEOUT_MS);
+
+        if (ready < 0) {
+            free (fds);
+
+            if (errno == EINTR)
+                continue;
+
+            return 0;
+        }
+
+        if (ready == 0)
+            ocl_buffer_pool_trim (daemon->pool, TRIM_IDLE_TIME);
+
+        /* walk backwards, removal moves the last client into the hole */
+        for (unsigned i = num_fds - 1; i > 0; i--) {
+            if (fds[i].revents != 0 && !handle_request (daemon, &daemon->clients[i - 1]))
+                remove_client (daemon, i - 1);
+        }
+
+        if (fds[0].revents & POLLIN)
+            accept_client (daemon);
+
+        free (fds);
+    }
+
+    return 1;
+}
+
+void
+ocl_daemon_stop (OclDaemon *daemon)
+{
+    assert (daemon != NULL);
+
+    /* may be called from a signal handler */
+    __atomic_store_n (&daemon->stop, 1, __ATOMIC_SEQ_CST);
+}
+
+void
+ocl_daemon_get_stats (OclDaemon *daemon,
+                      OclDaemonStats *stats)
+{
+    assert (daemon != NULL);
+    assert (stats != NULL);
+
+    *stats = daemon->stats;
+}
+
+void
+ocl_daemon_free (OclDaemon *daemon)
+{
+    if (daemon == NULL)
+        return;
+
+    for (unsigned i = 0; i < daemon->num_clients; i++)
+        close_client (&daemon->clients[i]);
+
+    for (unsigned i = 0; i < daemon->num_programs; i++) {
+        Program *program = &daemon->programs[i];
+
+        for (unsigned j = 0; j < program->num_kernels; j++) {
+            OCL_CHECK_ERROR (clReleaseKernel (program->kernels[j].kernel));
+            free (program->kernels[j].name);
+        }
+
+        free (program->kernels);
+        free (program->source);
+        free (program->options);
+        OCL_CHECK_ERROR (clReleaseProgram (program->program));
+    }
+
+    ocl_buffer_pool_free (daemon->pool);
+    close (daemon->fd);
+    unlink (daemon->socket_path);
+    free (daemon->socket_path);
+    free (daemon->programs);
+    free (daemon->clients);
+    free (daemon);
+}
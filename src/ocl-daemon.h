@@ -0,0 +1,42 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OCL_DAEMON_H
+#define OCL_DAEMON_H
+
+#include "ocl.h"
+
+typedef struct OclDaemon OclDaemon;
+
+typedef struct {
+    unsigned long   connections;
+    unsigned long   jobs;
+    unsigned long   programs_built;
+    unsigned long   programs_reused;
+} OclDaemonStats;
+
+OclDaemon *         ocl_daemon_new      (OclPlatform        *ocl,
+                                         const char         *socket_path,
+                                         cl_int             *errcode);
+int                 ocl_daemon_run      (OclDaemon          *daemon);
+void                ocl_daemon_stop     (OclDaemon          *daemon);
+void                ocl_daemon_get_stats
+                                        (OclDaemon          *daemon,
+                                         OclDaemonStats     *stats);
+void                ocl_daemon_free     (OclDaemon          *daemon);
+
+#endif
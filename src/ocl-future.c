@@ -0,0 +1,544 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include "ocl-future.h"
+#include "ocl-private.h"
+
+/*
+ * A future completes when its event does (clSetEventCallback), after its
+ * continuation ran (then) or once all or any of the futures it depends on
+ * completed. Event callbacks only queue the future, completion and the
+ * continuations run on the worker threads of OclFutures so that the runtime
+ * thread is never held up by user code. One lock guards all futures of a
+ * pool; it is released while a continuation runs.
+ *
+ * A future is referenced by its creator, by each future it depends on until
+ * that one completes and by the ready queue or a pending event callback. A
+ * continuation that creates new futures does so before its own future
+ * completes, which keeps ocl_futures_wait waiting across chains.
+ */
+#define DEFAULT_THREADS     2
+
+typedef enum {
+    FUTURE_EVENT,
+    FUTURE_THEN,
+    FUTURE_ALL,
+    FUTURE_ANY,
+} FutureKind;
+
+struct OclFuture {
+    OclFutures          *futures;
+    FutureKind           kind;
+    cl_event             event;
+    OclFutureFunc        func;
+    void                *user_data;
+    unsigned             pending;
+    int                  done;
+    cl_int               status;
+    unsigned             refs;
+    OclFuture          **dependents;
+    unsigned             num_dependents;
+    unsigned             max_dependents;
+    OclFuture           *next;
+};
+
+struct OclFutures {
+    pthread_t           *threads;
+    unsigned             num_threads;
+    pthread_mutex_t      lock;
+    pthread_cond_t       ready;
+    pthread_cond_t       completed;
+    OclFuture           *head;
+    OclFuture           *tail;
+    unsigned long        outstanding;
+    int                  stop;
+};
+
+static OclFuture *
+create_future (OclFutures *futures,
+               FutureKind kind)
+{
+    OclFuture *future;
+
+    future = calloc (1, sizeof (OclFuture));
+
+    if (future == NULL)
+        return NULL;
+
+    future->futures = futures;
+    future->kind = kind;
+    future->status = CL_COMPLETE;
+    future->refs = 1;
+
+    pthread_mutex_lock (&futures->lock);
+    futures->outstanding++;
+    pthread_mutex_unlock (&futures->lock);
+
+    return future;
+}
+
+static void
+destroy_future (OclFuture *future)
+{
+    if (future->event != NULL)
+        OCL_CHECK_ERROR (clReleaseEvent (future->event));
+
+    free (future->dependents);
+    free (future);
+}
+
+/* all of the following expect the lock to be held */
+
+static void
+unref_future (OclFuture *future)
+{
+    if (--future->refs == 0)
+        destroy_future (future);
+}
+
+static void
+push_ready (OclFuture *future)
+{
+    OclFutures *futures = future->futures;
+
+    future->next = NULL;
+
+    if (futures->tail != NULL)
+        futures->tail->next = future;
+    else
+        futures->head = future;
+
+    futures->tail = future;
+    pthread_cond_signal (&futures->ready);
+}
+
+static void complete_future (OclFuture *future);
+
+static void
+arrive (OclFuture *dependent,
+        cl_int status)
+{
+    switch (dependent->kind) {
+        case FUTURE_THEN:
+            dependent->status = status;
+            dependent->refs++;
+            push_ready (dependent);
+            break;
+
+        case FUTURE_ALL:
+            if (status != CL_COMPLETE && dependent->status == CL_COMPLETE)
+                dependent->status = status;
+
+            if (--dependent->pending == 0)
+                complete_future (dependent);
+            break;
+
+        case FUTURE_ANY:
+            if (dependent->pending > 0) {
+                dependent->pending = 0;
+                dependent->status = status;
+                complete_future (dependent);
+            }
+            break;
+
+        default:
+            assert (0);
+    }
+}
+
+static void
+complete_future (OclFuture *future)
+{
+    OclFutures *futures = future->futures;
+
+    future->done = 1;
+    futures->outstanding--;
+
+    for (unsigned i = 0; i < future->num_dependents; i++) {
+        arrive (future->dependents[i], future->status);
+        unref_future (future->dependents[i]);
+    }
+
+    free (future->dependents);
+    future->dependents = NULL;
+    future->num_dependents = 0;
+    pthread_cond_broadcast (&futures->completed);
+}
+
+static cl_int
+depend (OclFuture *future,
+        OclFuture *dependent)
+{
+    if (future->done) {
+        arrive (dependent, future->status);
+        return CL_SUCCESS;
+    }
+
+    if (future->num_dependents == future->max_dependents) {
+        unsigned max = future->max_dependents > 0 ? 2 * future->max_dependents : 4;
+        OclFuture **dependents;
+
+        dependents = realloc (future->dependents, max * sizeof (OclFuture *));
+
+        if (dependents == NULL)
+            return CL_OUT_OF_HOST_MEMORY;
+
+        future->dependents = dependents;
+        future->max_dependents = max;
+    }
+
+    future->dependents[future->num_dependents++] = dependent;
+    dependent->refs++;
+    return CL_SUCCESS;
+}
+
+static void *
+run_worker (void *data)
+{
+    OclFutures *futures = data;
+
+    pthread_mutex_lock (&futures->lock);
+
+    for (;;) {
+        OclFuture *future;
+
+        while (futures->head == NULL && !futures->stop)
+            pthread_cond_wait (&futures->ready, &futures->lock);
+
+        if (futures->head == NULL)
+            break;
+
+        future = futures->head;
+        futures->head = future->next;
+
+        if (futures->head == NULL)
+            futures->tail = NULL;
+
+        if (future->kind == FUTURE_THEN) {
+            pthread_mutex_unlock (&futures->lock);
+            future->func (future->status, future->user_data);
+            pthread_mutex_lock (&futures->lock);
+        }
+
+        complete_future (future);
+        unref_future (future);
+    }
+
+    pthread_mutex_unlock (&futures->lock);
+    return NULL;
+}
+
+static void CL_CALLBACK
+event_completed (cl_event event, cl_int status, void *user_data)
+{
+    OclFuture *future = user_data;
+
+    pthread_mutex_lock (&future->futures->lock);
+    future->status = status < 0 ? status : CL_COMPLETE;
+    push_ready (future);
+    pthread_mutex_unlock (&future->futures->lock);
+}
+
+static void
+stop_workers (OclFutures *futures,
+              unsigned num_threads)
+{
+    pthread_mutex_lock (&futures->lock);
+    futures->stop = 1;
+    pthread_cond_broadcast (&futures->ready);
+    pthread_mutex_unlock (&futures->lock);
+
+    for (unsigned i = 0; i < num_threads; i++)
+        pthread_join (futures->threads[i], NULL);
+}
+
+OclFutures *
+ocl_futures_new (unsigned num_threads,
+                 cl_int *errcode)
+{
+    OclFutures *futures;
+
+    if (num_threads == 0)
+        num_threads = DEFAULT_THREADS;
+
+    futures = calloc (1, sizeof (OclFutures));
+
+    if (futures == NULL) {
+        ocl_transfer_error (CL_OUT_OF_HOST_MEMORY, errcode);
+        return NULL;
+    }
+
+    futures->threads = calloc (num_threads, sizeof (pthread_t));
+
+    if (futures->threads == NULL) {
+        free (futures);
+        ocl_transfer_error (CL_OUT_OF_HOST_MEMORY, errcode);
+        return NULL;
+    }
+
+    pthread_mutex_init (&futures->lock, NULL);
+    pthread_cond_init (&futures->ready, NULL);
+    pthread_cond_init (&futures->completed, NULL);
+
+    for (unsigned i = 0; i < num_threads; i++) {
+        if (pthread_create (&futures->threads[i], NULL, run_worker, futures) != 0) {
+            stop_workers (futures, i);
+            ocl_futures_free (futures);
+            ocl_transfer_error (CL_OUT_OF_RESOURCES, errcode);
+            return NULL;
+        }
+
+        futures->num_threads++;
+    }
+
+    ocl_transfer_error (CL_SUCCESS, errcode);
+    return futures;
+}
+
+void
+ocl_futures_wait (OclFutures *futures)
+{
+    assert (futures != NULL);
+
+    pthread_mutex_lock (&futures->lock);
+
+    while (futures->outstanding > 0)
+        pthread_cond_wait (&futures->completed, &futures->lock);
+
+    pthread_mutex_unlock (&futures->lock);
+}
+
+void
+ocl_futures_free (OclFutures *futures)
+{
+    if (futures == NULL)
+        return;
+
+    if (!futures->stop) {
+        ocl_futures_wait (futures);
+        stop_workers (futures, futures->num_threads);
+    }
+
+    pthread_cond_destroy (&futures->completed);
+    pthread_cond_destroy (&futures->ready);
+    pthread_mutex_destroy (&futures->lock);
+    free (futures->threads);
+    free (futures);
+}
+
+OclFuture *
+ocl_future_new (OclFutures *futures,
+                cl_event event,
+                cl_int *errcode)
+{
+    OclFuture *future;
+    cl_int error;
+
+    assert (futures != NULL);
+    assert (event != NULL);
+
+    future = create_future (futures, FUTURE_EVENT);
+
+    if (future == NULL) {
+        ocl_transfer_error (CL_OUT_OF_HOST_MEMORY, errcode);
+        return NULL;
+    }
+
+    /* one reference for the caller, one for the callback */
+    future->event = event;
+    future->refs = 2;
+    OCL_CHECK_ERROR (clRetainEvent (event));
+
+    error = clSetEventCallback (event, CL_COMPLETE, event_completed, future);
+
+    if (error != CL_SUCCESS) {
+        pthread_mutex_lock (&futures->lock);
+        futures->outstanding--;
+        pthread_mutex_unlock (&futures->lock);
+        destroy_future (future);
+        ocl_transfer_error (error, errcode);
+        return NULL;
+    }
+
+    ocl_transfer_error (CL_SUCCESS, errcode);
+    return future;
+}
+
+OclFuture *
+ocl_future_then (OclFuture *future,
+                 OclFutureFunc func,
+                 void *user_data,
+                 cl_int *errcode)
+{
+    OclFutures *futures;
+    OclFuture *dependent;
+    cl_int error;
+
+    assert (future != NULL);
+    assert (func != NULL);
+
+    futures = future->futures;
+    dependent = create_future (futures, FUTURE_THEN);
+
+    if (dependent == NULL) {
+        ocl_transfer_error (CL_OUT_OF_HOST_MEMORY, errcode);
+        return NULL;
+    }
+
+    dependent->func = func;
+    dependent->user_data = user_data;
+
+    pthread_mutex_lock (&futures->lock);
+    error = depend (future, dependent);
+
+    if (error != CL_SUCCESS) {
+        futures->outstanding--;
+        unref_future (dependent);
+        dependent = NULL;
+    }
+
+    pthread_mutex_unlock (&futures->lock);
+    ocl_transfer_error (error, errcode);
+    return dependent;
+}
+
+static OclFuture *
+combine (OclFutures *futures,
+         FutureKind kind,
+         unsigned num_futures,
+         OclFuture **list,
+         cl_int *errcode)
+{
+    OclFuture *dependent;
+    unsigned registered = 0;
+    cl_int error = CL_SUCCESS;
+
+    assert (futures != NULL);
+    assert (num_futures == 0 || list != NULL);
+
+    dependent = create_future (futures, kind);
+
+    if (dependent == NULL) {
+        ocl_transfer_error (CL_OUT_OF_HOST_MEMORY, errcode);
+        return NULL;
+    }
+
+    /*
+     * The extra pending count keeps the combination from completing while
+     * the list is still being walked.
+     */
+    dependent->pending = kind == FUTURE_ALL ? num_futures + 1 : 1;
+
+    pthread_mutex_lock (&futures->lock);
+
+    for (; registered < num_futures; registered++) {
+        error = depend (list[registered], dependent);
+
+        if (error != CL_SUCCESS)
+            break;
+    }
+
+    if (kind == FUTURE_ALL) {
+        dependent->pending -= num_futures - registered + 1;
+
+        if (dependent->pending == 0)
+            complete_future (dependent);
+    }
+    else if (registered == 0 && dependent->pending > 0) {
+        dependent->pending = 0;
+        complete_future (dependent);
+    }
+
+    pthread_mutex_unlock (&futures->lock);
+
+    if (error != CL_SUCCESS) {
+        /* earlier futures still hold references and complete it later */
+        ocl_future_free (dependent);
+        ocl_transfer_error (error, errcode);
+        return NULL;
+    }
+
+    ocl_transfer_error (CL_SUCCESS, errcode);
+    return dependent;
+}
+
+OclFuture *
+ocl_future_when_all (OclFutures *futures,
+                     unsigned num_futures,
+                     OclFuture **list,
+                     cl_int *errcode)
+{
+    return combine (futures, FUTURE_ALL, num_futures, list, errcode);
+}
+
+OclFuture *
+ocl_future_when_any (OclFutures *futures,
+                     unsigned num_futures,
+                     OclFuture **list,
+                     cl_int *errcode)
+{
+    return combine (futures, FUTURE_ANY, num_futures, list, errcode);
+}
+
+int
+ocl_future_is_done (OclFuture *future)
+{
+    int done;
+
+    assert (future != NULL);
+
+    pthread_mutex_lock (&future->futures->lock);
+    done = future->done;
+    pthread_mutex_unlock (&future->futures->lock);
+    return done;
+}
+
+cl_int
+ocl_future_wait (OclFuture *future)
+{
+    OclFutures *futures;
+    cl_int status;
+
+    assert (future != NULL);
+
+    futures = future->futures;
+    pthread_mutex_lock (&futures->lock);
+
+    while (!future->done)
+        pthread_cond_wait (&futures->completed, &futures->lock);
+
+    status = future->status;
+    pthread_mutex_unlock (&futures->lock);
+    return status;
+}
+
+void
+ocl_future_free (OclFuture *future)
+{
+    OclFutures *futures;
+
+    if (future == NULL)
+        return;
+
+    futures = future->futures;
+    pthread_mutex_lock (&futures->lock);
+    unref_future (future);
+    pthread_mutex_unlock (&futures->lock);
+}
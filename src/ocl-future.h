@@ -0,0 +1,53 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OCL_FUTURE_H
+#define OCL_FUTURE_H
+
+#include "ocl.h"
+
+typedef struct OclFutures OclFutures;
+typedef struct OclFuture OclFuture;
+
+/* status is CL_COMPLETE or the negative error the command ended with */
+typedef void (*OclFutureFunc)           (cl_int              status,
+                                         void               *user_data);
+
+OclFutures *        ocl_futures_new     (unsigned            num_threads,
+                                         cl_int             *errcode);
+void                ocl_futures_wait    (OclFutures         *futures);
+void                ocl_futures_free    (OclFutures         *futures);
+OclFuture *         ocl_future_new      (OclFutures         *futures,
+                                         cl_event            event,
+                                         cl_int             *errcode);
+OclFuture *         ocl_future_then     (OclFuture          *future,
+                                         OclFutureFunc       func,
+                                         void               *user_data,
+                                         cl_int             *errcode);
+OclFuture *         ocl_future_when_all (OclFutures         *futures,
+                                         unsigned            num_futures,
+                                         OclFuture         **list,
+                                         cl_int             *errcode);
+OclFuture *         ocl_future_when_any (OclFutures         *futures,
+                                         unsigned            num_futures,
+                                         OclFuture         **list,
+                                         cl_int             *errcode);
+int                 ocl_future_is_done  (OclFuture          *future);
+cl_int              ocl_future_wait     (OclFuture          *future);
+void                ocl_future_free     (OclFuture          *future);
+
+#endif
@@ -0,0 +1,576 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "ocl-graph.h"
+
+/*
+ * Nodes are added in program order and declare the buffers they read and
+ * write. Two nodes conflict if one writes a buffer the other reads or writes.
+ * On the first submission every node gets an edge to each earlier conflicting
+ * node that is not already implied by another edge, and a queue: it stays on
+ * the queue of a dependency that was last on its queue, otherwise it goes to
+ * the next queue. Later submissions only enqueue with the stored wait lists.
+ *
+ * Consecutive submissions may overlap. A node additionally waits for the
+ * conflicting nodes of the previous submission unless one of its
+ * dependencies already does.
+ */
+typedef enum {
+    NODE_KERNEL,
+    NODE_WRITE,
+    NODE_READ,
+    NODE_COPY,
+} NodeType;
+
+typedef struct {
+    cl_uint              index;
+    size_t               size;
+    void                *value;
+} Arg;
+
+typedef struct {
+    NodeType             type;
+
+    cl_kernel            kernel;
+    cl_uint              work_dim;
+    size_t               global_work_size[3];
+    size_t               local_work_size[3];
+    int                  use_local_work_size;
+    Arg                 *args;
+    unsigned             num_args;
+
+    cl_mem               src;
+    cl_mem               dst;
+    size_t               src_offset;
+    size_t               dst_offset;
+    size_t               size;
+    void                *host;
+
+    cl_mem              *reads;
+    unsigned             num_reads;
+    cl_mem              *writes;
+    unsigned             num_writes;
+
+    unsigned            *deps;
+    unsigned             num_deps;
+    unsigned            *cross;
+    unsigned             num_cross;
+    unsigned             queue;
+    int                  is_sink;
+} Node;
+
+struct OclGraph {
+    cl_command_queue    *queues;
+    unsigned             num_queues;
+    Node                *nodes;
+    unsigned             num_nodes;
+    unsigned             max_nodes;
+    unsigned             num_edges;
+    int                  dirty;
+    unsigned             num_events;
+    cl_event            *events;
+    cl_event            *previous;
+};
+
+static int
+contains (const cl_mem *mems, unsigned num, cl_mem mem)
+{
+    for (unsigned i = 0; i < num; i++) {
+        if (mems[i] == mem)
+            return 1;
+    }
+
+    return 0;
+}
+
+static int
+conflict (const Node *a, const Node *b)
+{
+    for (unsigned i = 0; i < a->num_writes; i++) {
+        if (contains (b->reads, b->num_reads, a->writes[i]) ||
+            contains (b->writes, b->num_writes, a->writes[i]))
+            return 1;
+    }
+
+    for (unsigned i = 0; i < a->num_reads; i++) {
+        if (contains (b->writes, b->num_writes, a->reads[i]))
+            return 1;
+    }
+
+    return 0;
+}
+
+static cl_mem *
+copy_mems (const cl_mem *mems, unsigned num)
+{
+    cl_mem *copy;
+
+    if (num == 0)
+        return NULL;
+
+    copy = malloc (num * sizeof (cl_mem));
+    memcpy (copy, mems, num * sizeof (cl_mem));
+    return copy;
+}
+
+static void
+release_events (cl_event *events, unsigned num)
+{
+    for (unsigned i = 0; i < num; i++) {
+        if (events[i] != NULL) {
+            OCL_CHECK_ERROR (clReleaseEvent (events[i]));
+            events[i] = NULL;
+        }
+    }
+}
+
+static void
+finish_previous (OclGraph *graph)
+{
+    if (graph->previous == NULL)
+        return;
+
+    for (unsigned i = 0; i < graph->num_events; i++) {
+        if (graph->previous[i] != NULL)
+            clWaitForEvents (1, &graph->previous[i]);
+    }
+
+    release_events (graph->previous, graph->num_events);
+}
+
+static Node *
+append_node (OclGraph *graph,
+             NodeType type,
+             unsigned num_reads,
+             const cl_mem *reads,
+             unsigned num_writes,
+             const cl_mem *writes)
+{
+    Node *node;
+
+    if (graph->num_nodes == graph->max_nodes) {
+        graph->max_nodes = graph->max_nodes == 0 ? 16 : graph->max_nodes * 2;
+        graph->nodes = realloc (graph->nodes, graph->max_nodes * sizeof (Node));
+    }
+
+    node = &graph->nodes[graph->num_nodes++];
+    memset (node, 0, sizeof (Node));
+    node->type = type;
+    node->reads = copy_mems (reads, num_reads);
+    node->num_reads = num_reads;
+    node->writes = copy_mems (writes, num_writes);
+    node->num_writes = num_writes;
+    graph->dirty = 1;
+    return node;
+}
+
+static void
+analyze (OclGraph *graph)
+{
+    unsigned n = graph->num_nodes;
+    char *reach;
+    char *waits;
+    unsigned *tails;
+    unsigned next_queue = 0;
+
+    /*
+     * reach[j * n + i] is set if node j (transitively) depends on node i
+     * within one submission, waits[j * n + i] if it (transitively) waits for
+     * node i of the previous submission.
+     */
+    reach = calloc ((size_t) n * n, 1);
+    waits = calloc ((size_t) n * n, 1);
+    tails = malloc (graph->num_queues * sizeof (unsigned));
+    graph->num_edges = 0;
+
+    for (unsigned q = 0; q < graph->num_queues; q++)
+        tails[q] = n;
+
+    for (unsigned j = 0; j < n; j++) {
+        Node *node = &graph->nodes[j];
+
+        free (node->deps);
+        free (node->cross);
+        node->deps = malloc ((j + 1) * sizeof (unsigned));
+        node->cross = malloc (n * sizeof (unsigned));
+        node->num_deps = 0;
+        node->num_cross = 0;
+        node->is_sink = 1;
+        node->queue = n;
+
+        /* later dependencies first, so that implied edges are seen as covered */
+        for (unsigned i = j; i-- > 0;) {
+            if (reach[j * n + i] || !conflict (node, &graph->nodes[i]))
+                continue;
+
+            node->deps[node->num_deps++] = i;
+            graph->nodes[i].is_sink = 0;
+            reach[j * n + i] = 1;
+
+            for (unsigned k = 0; k < i; k++)
+                reach[j * n + k] |= reach[i * n + k];
+
+            for (unsigned k = 0; k < n; k++)
+                waits[j * n + k] |= waits[i * n + k];
+
+            if (node->queue == n && tails[graph->nodes[i].queue] == i)
+                node->queue = graph->nodes[i].queue;
+        }
+
+        for (unsigned i = 0; i < n; i++) {
+            if (!waits[j * n + i] && conflict (node, &graph->nodes[i])) {
+                node->cross[node->num_cross++] = i;
+                waits[j * n + i] = 1;
+            }
+        }
+
+        if (node->queue == n) {
+            node->queue = next_queue;
+            next_queue = (next_queue + 1) % graph->num_queues;
+        }
+
+        tails[node->queue] = j;
+        graph->num_edges += node->num_deps;
+    }
+
+    free (graph->events);
+    free (graph->previous);
+    graph->events = calloc (n, sizeof (cl_event));
+    graph->previous = calloc (n, sizeof (cl_event));
+    graph->num_events = n;
+    graph->dirty = 0;
+
+    free (tails);
+    free (waits);
+    free (reach);
+}
+
+static void
+update (OclGraph *graph)
+{
+    if (graph->dirty) {
+        /* the previous submission was analyzed with a different node set */
+        finish_previous (graph);
+        analyze (graph);
+    }
+}
+
+static cl_int
+enqueue_node (OclGraph *graph,
+              Node *node,
+              cl_uint num_wait,
+              const cl_event *wait_list,
+              cl_event *event)
+{
+    cl_command_queue queue = graph->queues[node->queue];
+    const cl_event *wait = num_wait > 0 ? wait_list : NULL;
+
+    switch (node->type) {
+        case NODE_KERNEL:
+            for (unsigned i = 0; i < node->num_args; i++) {
+                cl_int errcode = clSetKernelArg (node->kernel, node->args[i].index,
+                                                 node->args[i].size, node->args[i].value);
+
+                if (errcode != CL_SUCCESS)
+                    return errcode;
+            }
+
+            return clEnqueueNDRangeKernel (queue, node->kernel, node->work_dim, NULL,
+                                           node->global_work_size,
+                                           node->use_local_work_size ? node->local_work_size : NULL,
+                                           num_wait, wait, event);
+        case NODE_WRITE:
+            return clEnqueueWriteBuffer (queue, node->dst, CL_FALSE, node->dst_offset, node->size,
+                                         node->host, num_wait, wait, event);
+        case NODE_READ:
+            return clEnqueueReadBuffer (queue, node->src, CL_FALSE, node->src_offset, node->size,
+                                        node->host, num_wait, wait, event);
+        case NODE_COPY:
+            return clEnqueueCopyBuffer (queue, node->src, node->dst, node->src_offset, node->dst_offset,
+                                        node->size, num_wait, wait, event);
+    }
+
+    return CL_INVALID_VALUE;
+}
+
+OclGraph *
+ocl_graph_new (cl_command_queue *queues,
+               unsigned num_queues)
+{
+    OclGraph *graph;
+
+    if (queues == NULL || num_queues == 0)
+        return NULL;
+
+    graph = calloc (1, sizeof (OclGraph));
+    graph->queues = malloc (num_queues * sizeof (cl_command_queue));
+    graph->num_queues = num_queues;
+
+    for (unsigned i = 0; i < num_queues; i++) {
+        graph->queues[i] = queues[i];
+        OCL_CHECK_ERROR (clRetainCommandQueue (queues[i]));
+    }
+
+    return graph;
+}
+
+int
+ocl_graph_add_kernel (OclGraph *graph,
+                      cl_kernel kernel,
+                      cl_uint work_dim,
+                      const size_t *global_work_size,
+                      const size_t *local_work_size,
+                      unsigned num_reads,
+                      const cl_mem *reads,
+                      unsigned num_writes,
+                      const cl_mem *writes)
+{
+    Node *node;
+
+    assert (graph != NULL);
+
+    if (work_dim == 0 || work_dim > 3 || global_work_size == NULL)
+        return -1;
+
+    node = append_node (graph, NODE_KERNEL, num_reads, reads, num_writes, writes);
+    node->kernel = kernel;
+    node->work_dim = work_dim;
+    node->use_local_work_size = local_work_size != NULL;
+
+    for (cl_uint i = 0; i < work_dim; i++) {
+        node->global_work_size[i] = global_work_size[i];
+        node->local_work_size[i] = local_work_size != NULL ? local_work_size[i] : 0;
+    }
+
+    OCL_CHECK_ERROR (clRetainKernel (kernel));
+    return graph->num_nodes - 1;
+}
+
+int
+ocl_graph_add_write (OclGraph *graph,
+                     cl_mem buffer,
+                     size_t offset,
+                     size_t size,
+                     const void *data)
+{
+    Node *node;
+
+    assert (graph != NULL);
+
+    node = append_node (graph, NODE_WRITE, 0, NULL, 1, &buffer);
+    node->dst = buffer;
+    node->dst_offset = offset;
+    node->size = size;
+    node->host = (void *) data;
+    return graph->num_nodes - 1;
+}
+
+int
+ocl_graph_add_read (OclGraph *graph,
+                    cl_mem buffer,
+                    size_t offset,
+                    size_t size,
+                    void *data)
+{
+    Node *node;
+
+    assert (graph != NULL);
+
+    node = append_node (graph, NODE_READ, 1, &buffer, 0, NULL);
+    node->src = buffer;
+    node->src_offset = offset;
+    node->size = size;
+    node->host = data;
+    return graph->num_nodes - 1;
+}
+
+int
+ocl_graph_add_copy (OclGraph *graph,
+                    cl_mem src,
+                    cl_mem dst,
+                    size_t src_offset,
+                    size_t dst_offset,
+                    size_t size)
+{
+    Node *node;
+
+    assert (graph != NULL);
+
+    node = append_node (graph, NODE_COPY, 1, &src, 1, &dst);
+    node->src = src;
+    node->dst = dst;
+    node->src_offset = src_offset;
+    node->dst_offset = dst_offset;
+    node->size = size;
+    return graph->num_nodes - 1;
+}
+
+cl_int
+ocl_graph_set_kernel_arg (OclGraph *graph,
+                          int node_index,
+                          cl_uint arg_index,
+                          size_t arg_size,
+                          const void *arg_value)
+{
+    Node *node;
+    Arg *arg = NULL;
+
+    assert (graph != NULL);
+
+    if (node_index < 0 || (unsigned) node_index >= graph->num_nodes)
+        return CL_INVALID_VALUE;
+
+    node = &graph->nodes[node_index];
+
+    if (node->type != NODE_KERNEL)
+        return CL_INVALID_KERNEL;
+
+    for (unsigned i = 0; i < node->num_args; i++) {
+        if (node->args[i].index == arg_index)
+            arg = &node->args[i];
+    }
+
+    if (arg == NULL) {
+        node->args = realloc (node->args, (node->num_args + 1) * sizeof (Arg));
+        arg = &node->args[node->num_args++];
+        arg->index = arg_index;
+        arg->value = NULL;
+    }
+
+    /* a NULL value reserves local memory of arg_size bytes */
+    free (arg->value);
+    arg->size = arg_size;
+    arg->value = NULL;
+
+    if (arg_value != NULL) {
+        arg->value = malloc (arg_size);
+        memcpy (arg->value, arg_value, arg_size);
+    }
+
+    return CL_SUCCESS;
+}
+
+unsigned
+ocl_graph_get_num_edges (OclGraph *graph)
+{
+    assert (graph != NULL);
+
+    update (graph);
+    return graph->num_edges;
+}
+
+cl_int
+ocl_graph_submit (OclGraph *graph,
+                  cl_event *event)
+{
+    cl_event *wait_list;
+    cl_int errcode = CL_SUCCESS;
+    unsigned num_sinks = 0;
+    unsigned submitted = 0;
+
+    assert (graph != NULL);
+
+    update (graph);
+
+    wait_list = malloc ((graph->num_nodes * 2 + 1) * sizeof (cl_event));
+
+    for (unsigned j = 0; j < graph->num_nodes && errcode == CL_SUCCESS; j++) {
+        Node *node = &graph->nodes[j];
+        cl_uint num_wait = 0;
+
+        for (unsigned i = 0; i < node->num_deps; i++)
+            wait_list[num_wait++] = graph->events[node->deps[i]];
+
+        for (unsigned i = 0; i < node->num_cross; i++) {
+            if (graph->previous[node->cross[i]] != NULL)
+                wait_list[num_wait++] = graph->previous[node->cross[i]];
+        }
+
+        errcode = enqueue_node (graph, node, num_wait, wait_list, &graph->events[j]);
+
+        if (errcode == CL_SUCCESS)
+            submitted++;
+        else
+            graph->events[j] = NULL;
+    }
+
+    for (unsigned q = 0; q < graph->num_queues; q++)
+        OCL_CHECK_ERROR (clFlush (graph->queues[q]));
+
+    if (errcode != CL_SUCCESS) {
+        if (submitted > 0)
+            clWaitForEvents (submitted, graph->events);
+        release_events (graph->events, graph->num_nodes);
+        free (wait_list);
+        return errcode;
+    }
+
+    if (event != NULL) {
+        for (unsigned j = 0; j < graph->num_nodes; j++) {
+            if (graph->nodes[j].is_sink)
+                wait_list[num_sinks++] = graph->events[j];
+        }
+
+        errcode = clEnqueueMarkerWithWaitList (graph->queues[0], num_sinks, num_sinks > 0 ? wait_list : NULL, event);
+        OCL_CHECK_ERROR (clFlush (graph->queues[0]));
+    }
+
+    /* keep this submission's events so that the next one can wait on them */
+    release_events (graph->previous, graph->num_nodes);
+    memcpy (graph->previous, graph->events, graph->num_nodes * sizeof (cl_event));
+    memset (graph->events, 0, graph->num_nodes * sizeof (cl_event));
+
+    free (wait_list);
+    return errcode;
+}
+
+void
+ocl_graph_free (OclGraph *graph)
+{
+    if (graph == NULL)
+        return;
+
+    finish_previous (graph);
+
+    for (unsigned i = 0; i < graph->num_nodes; i++) {
+        Node *node = &graph->nodes[i];
+
+        if (node->type == NODE_KERNEL)
+            OCL_CHECK_ERROR (clReleaseKernel (node->kernel));
+
+        for (unsigned j = 0; j < node->num_args; j++)
+            free (node->args[j].value);
+
+        free (node->args);
+        free (node->reads);
+        free (node->writes);
+        free (node->deps);
+        free (node->cross);
+    }
+
+    for (unsigned q = 0; q < graph->num_queues; q++)
+        OCL_CHECK_ERROR (clReleaseCommandQueue (graph->queues[q]));
+
+    free (graph->events);
+    free (graph->previous);
+    free (graph->nodes);
+    free (graph->queues);
+    free (graph);
+}
@@ -0,0 +1,65 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OCL_GRAPH_H
+#define OCL_GRAPH_H
+
+#include "ocl.h"
+
+typedef struct OclGraph OclGraph;
+
+OclGraph *          ocl_graph_new       (cl_command_queue   *queues,
+                                         unsigned            num_queues);
+int                 ocl_graph_add_kernel
+                                        (OclGraph           *graph,
+                                         cl_kernel           kernel,
+                                         cl_uint             work_dim,
+                                         const size_t       *global_work_size,
+                                         const size_t       *local_work_size,
+                                         unsigned            num_reads,
+                                         const cl_mem       *reads,
+                                         unsigned            num_writes,
+                                         const cl_mem       *writes);
+int                 ocl_graph_add_write (OclGraph           *graph,
+                                         cl_mem              buffer,
+                                         size_t              offset,
+                                         size_t              size,
+                                         const void         *data);
+int                 ocl_graph_add_read  (OclGraph           *graph,
+                                         cl_mem              buffer,
+                                         size_t              offset,
+                                         size_t              size,
+                                         void               *data);
+int                 ocl_graph_add_copy  (OclGraph           *graph,
+                                         cl_mem              src,
+                                         cl_mem              dst,
+                                         size_t              src_offset,
+                                         size_t              dst_offset,
+                                         size_t              size);
+cl_int              ocl_graph_set_kernel_arg
+                                        (OclGraph           *graph,
+                                         int                 node,
+                                         cl_uint             arg_index,
+                                         size_t              arg_size,
+                                         const void         *arg_value);
+unsigned            ocl_graph_get_num_edges
+                                        (OclGraph           *graph);
+cl_int              ocl_graph_submit    (OclGraph           *graph,
+                                         cl_event           *event);
+void                ocl_graph_free      (OclGraph           *graph);
+
+#endif
@@ -0,0 +1,170 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include "ocl-host.h"
+#include "ocl-private.h"
+
+/*
+ * Runtimes only skip the copy for CL_MEM_USE_HOST_PTR buffers if the host
+ * pointer meets CL_DEVICE_MEM_BASE_ADDR_ALIGN and, on some of them, spans
+ * whole cache lines. Allocations are therefore aligned to a page or the
+ * strictest device alignment, whichever is larger, and padded to a full
+ * page. Mapping such a buffer on a device that shares host memory returns
+ * the wrapped pointer. Write-only maps are turned into invalidating maps on
+ * OpenCL 1.2 devices so that discrete devices skip the copy-in as well.
+ */
+
+static size_t
+get_alignment (OclPlatform *ocl)
+{
+    size_t alignment;
+
+    alignment = (size_t) sysconf (_SC_PAGESIZE);
+
+    for (int i = 0; i < ocl_get_num_devices (ocl); i++) {
+        size_t device_alignment = ocl_get_device_info (ocl, i)->mem_base_addr_align;
+
+        if (device_alignment > alignment)
+            alignment = device_alignment;
+    }
+
+    return alignment;
+}
+
+void *
+ocl_host_alloc (OclPlatform *ocl,
+                size_t size)
+{
+    size_t alignment;
+    void *ptr;
+
+    assert (ocl != NULL);
+
+    alignment = get_alignment (ocl);
+    size = ((size + alignment - 1) / alignment) * alignment;
+
+    if (size == 0 || posix_memalign (&ptr, alignment, size) != 0)
+        return NULL;
+
+    return ptr;
+}
+
+void
+ocl_host_free (void *ptr)
+{
+    free (ptr);
+}
+
+cl_mem
+ocl_host_wrap (OclPlatform *ocl,
+               void *ptr,
+               size_t size,
+               cl_mem_flags flags,
+               cl_int *errcode)
+{
+    assert (ocl != NULL);
+    assert (ptr != NULL);
+
+    flags &= ~(CL_MEM_ALLOC_HOST_PTR | CL_MEM_COPY_HOST_PTR);
+    return clCreateBuffer (ocl_get_context (ocl), flags | CL_MEM_USE_HOST_PTR, size, ptr, errcode);
+}
+
+int
+ocl_host_is_zero_copy (OclPlatform *ocl,
+                       unsigned device)
+{
+    const OclDeviceInfo *info;
+
+    assert (ocl != NULL);
+
+    if (device >= (unsigned) ocl_get_num_devices (ocl))
+        return 0;
+
+    info = ocl_get_device_info (ocl, device);
+    return (info->type & CL_DEVICE_TYPE_CPU) || (info->features & OCL_DEVICE_HOST_UNIFIED_MEMORY);
+}
+
+/* platforms created without queues have none to map on */
+static cl_int
+get_queue (OclPlatform *ocl, unsigned device, cl_command_queue *queue)
+{
+    cl_command_queue *queues;
+
+    if (device >= (unsigned) ocl_get_num_devices (ocl))
+        return CL_INVALID_DEVICE;
+
+    if ((queues = ocl_get_cmd_queues (ocl)) == NULL)
+        return CL_INVALID_COMMAND_QUEUE;
+
+    *queue = queues[device];
+    return CL_SUCCESS;
+}
+
+void *
+ocl_host_map (OclPlatform *ocl,
+              unsigned device,
+              cl_mem mem,
+              cl_map_flags flags,
+              size_t size,
+              cl_int *errcode)
+{
+    cl_command_queue queue;
+    cl_int error;
+
+    assert (ocl != NULL);
+
+    if ((error = get_queue (ocl, device, &queue)) != CL_SUCCESS) {
+        ocl_transfer_error (error, errcode);
+        return NULL;
+    }
+
+    /* invalidating maps exist since 1.2 */
+    if (flags == CL_MAP_WRITE && ocl_device_version_at_least (ocl_get_device_info (ocl, device), 1, 2))
+        flags = CL_MAP_WRITE_INVALIDATE_REGION;
+
+    return clEnqueueMapBuffer (queue, mem, CL_TRUE, flags, 0, size, 0, NULL, NULL, errcode);
+}
+
+cl_int
+ocl_host_unmap (OclPlatform *ocl,
+                unsigned device,
+                cl_mem mem,
+                void *ptr)
+{
+    cl_command_queue queue;
+    cl_event event;
+    cl_int errcode;
+
+    assert (ocl != NULL);
+
+    if ((errcode = get_queue (ocl, device, &queue)) != CL_SUCCESS)
+        return errcode;
+
+    errcode = clEnqueueUnmapMemObject (queue, mem, ptr, 0, NULL, &event);
+
+    if (errcode != CL_SUCCESS)
+        return errcode;
+
+    errcode = clWaitForEvents (1, &event);
+    OCL_CHECK_ERROR (clReleaseEvent (event));
+    return errcode;
+}
@@ -0,0 +1,45 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OCL_HOST_H
+#define OCL_HOST_H
+
+#include "ocl.h"
+
+void *              ocl_host_alloc      (OclPlatform        *ocl,
+                                         size_t              size);
+void                ocl_host_free       (void               *ptr);
+cl_mem              ocl_host_wrap       (OclPlatform        *ocl,
+                                         void               *ptr,
+                                         size_t              size,
+                                         cl_mem_flags        flags,
+                                         cl_int             *errcode);
+int                 ocl_host_is_zero_copy
+                                        (OclPlatform        *ocl,
+                                         unsigned            device);
+void *              ocl_host_map        (OclPlatform        *ocl,
+                                         unsigned            device,
+                                         cl_mem              mem,
+                                         cl_map_flags        flags,
+                                         size_t              size,
+                                         cl_int             *errcode);
+cl_int              ocl_host_unmap      (OclPlatform        *ocl,
+                                         unsigned            device,
+                                         cl_mem              mem,
+                                         void               *ptr);
+
+#endif
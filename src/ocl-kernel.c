@@ -0,0 +1,313 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include "ocl-kernel.h"
+#include "ocl-private.h"
+
+/*
+ * clSetKernelArg changes the kernel object itself, so a kernel may only be
+ * used by one thread between setting its arguments and enqueueing it. Rather
+ * than serializing submission, every thread gets its own instance, that is a
+ * kernel and an in-order queue on the device, the first time it asks for one.
+ * Instances are cloned with clCloneKernel on OpenCL 2.1 from a template that
+ * never gets arguments, or created from the program again otherwise, so new
+ * ones start without arguments. A thread-specific key finds the instance of
+ * the calling thread without locking; when a thread exits its instance is put
+ * on a free list for the next thread. OpenCL cannot unset arguments, so such
+ * a reused instance keeps those of the previous thread and callers set all of
+ * them before enqueueing. Instances are only released with the handle.
+ */
+
+typedef struct Instance Instance;
+
+struct Instance {
+    OclKernel           *owner;
+    cl_kernel            kernel;
+    cl_command_queue     queue;
+    Instance            *next;
+    Instance            *next_free;
+};
+
+struct OclKernel {
+    OclPlatform         *ocl;
+    cl_device_id         device;
+    cl_program           program;
+    char                *name;
+    cl_command_queue_properties properties;
+    cl_kernel            template;
+    int                  can_clone;
+    pthread_key_t        key;
+    pthread_mutex_t      lock;
+    Instance            *instances;
+    Instance            *free_instances;
+};
+
+static int
+has_clone (const OclDeviceInfo *info)
+{
+#ifdef CL_VERSION_2_1
+    return ocl_device_version_at_least (info, 2, 1);
+#else
+    return 0;
+#endif
+}
+
+static void
+release_instance (void *data)
+{
+    Instance *instance = data;
+    OclKernel *kernel = instance->owner;
+
+    pthread_mutex_lock (&kernel->lock);
+    instance->next_free = kernel->free_instances;
+    kernel->free_instances = instance;
+    pthread_mutex_unlock (&kernel->lock);
+}
+
+static Instance *
+create_instance (OclKernel *kernel,
+                 cl_int *errcode)
+{
+    Instance *instance;
+    cl_int error;
+
+    instance = calloc (1, sizeof (Instance));
+
+    if (instance == NULL) {
+        ocl_transfer_error (CL_OUT_OF_HOST_MEMORY, errcode);
+        return NULL;
+    }
+
+#ifdef CL_VERSION_2_1
+    if (kernel->can_clone)
+        instance->kernel = clCloneKernel (kernel->template, &error);
+    else
+#endif
+        instance->kernel = clCreateKernel (kernel->program, kernel->name, &error);
+
+    if (error == CL_SUCCESS)
+        instance->queue = clCreateCommandQueue (ocl_get_context (kernel->ocl), kernel->device,
+                                                kernel->properties, &error);
+
+    if (error != CL_SUCCESS) {
+        if (instance->kernel != NULL)
+            OCL_CHECK_ERROR (clReleaseKernel (instance->kernel));
+
+        free (instance);
+        ocl_transfer_error (error, errcode);
+        return NULL;
+    }
+
+    instance->owner = kernel;
+    ocl_transfer_error (CL_SUCCESS, errcode);
+    return instance;
+}
+
+static Instance *
+get_instance (OclKernel *kernel,
+              cl_int *errcode)
+{
+    Instance *instance;
+
+    assert (kernel != NULL);
+
+    instance = pthread_getspecific (kernel->key);
+
+    if (instance != NULL) {
+        ocl_transfer_error (CL_SUCCESS, errcode);
+        return instance;
+    }
+
+    pthread_mutex_lock (&kernel->lock);
+    instance = kernel->free_instances;
+
+    if (instance != NULL)
+        kernel->free_instances = instance->next_free;
+
+    pthread_mutex_unlock (&kernel->lock);
+
+    if (instance == NULL) {
+        instance = create_instance (kernel, errcode);
+
+        if (instance == NULL)
+            return NULL;
+
+        pthread_mutex_lock (&kernel->lock);
+        instance->next = kernel->instances;
+        kernel->instances = instance;
+        pthread_mutex_unlock (&kernel->lock);
+    }
+
+    pthread_setspecific (kernel->key, instance);
+    ocl_transfer_error (CL_SUCCESS, errcode);
+    return instance;
+}
+
+OclKernel *
+ocl_kernel_new (OclPlatform *ocl,
+                unsigned device,
+                cl_program program,
+                const char *name,
+                cl_command_queue_properties queue_properties,
+                cl_int *errcode)
+{
+    OclKernel *kernel;
+    const OclDeviceInfo *info;
+    cl_int error;
+
+    assert (ocl != NULL);
+    assert (name != NULL);
+
+    if (device >= (unsigned) ocl_get_num_devices (ocl)) {
+        ocl_transfer_error (CL_INVALID_DEVICE, errcode);
+        return NULL;
+    }
+
+    if (program == NULL) {
+        ocl_transfer_error (CL_INVALID_VALUE, errcode);
+        return NULL;
+    }
+
+    info = ocl_get_device_info (ocl, device);
+
+    kernel = calloc (1, sizeof (OclKernel));
+
+    if (kernel == NULL) {
+        ocl_transfer_error (CL_OUT_OF_HOST_MEMORY, errcode);
+        return NULL;
+    }
+
+    if (pthread_key_create (&kernel->key, release_instance) != 0) {
+        free (kernel);
+        ocl_transfer_error (CL_OUT_OF_RESOURCES, errcode);
+        return NULL;
+    }
+
+    kernel->ocl = ocl;
+    kernel->device = ocl_get_devices (ocl)[device];
+    kernel->program = program;
+    kernel->name = strdup (name);
+    kernel->properties = queue_properties;
+    kernel->can_clone = has_clone (info);
+    pthread_mutex_init (&kernel->lock, NULL);
+    OCL_CHECK_ERROR (clRetainProgram (program));
+
+    /* also checks that the kernel exists before any thread asks for it */
+    kernel->template = clCreateKernel (program, name, &error);
+
+    if (error != CL_SUCCESS) {
+        ocl_kernel_free (kernel);
+        ocl_transfer_error (error, errcode);
+        return NULL;
+    }
+
+    ocl_transfer_error (CL_SUCCESS, errcode);
+    return kernel;
+}
+
+void
+ocl_kernel_free (OclKernel *kernel)
+{
+    Instance *instance;
+
+    if (kernel == NULL)
+        return;
+
+    pthread_key_delete (kernel->key);
+    instance = kernel->instances;
+
+    while (instance != NULL) {
+        Instance *next = instance->next;
+
+        OCL_CHECK_ERROR (clReleaseCommandQueue (instance->queue));
+        OCL_CHECK_ERROR (clReleaseKernel (instance->kernel));
+        free (instance);
+        instance = next;
+    }
+
+    if (kernel->template != NULL)
+        OCL_CHECK_ERROR (clReleaseKernel (kernel->template));
+
+    OCL_CHECK_ERROR (clReleaseProgram (kernel->program));
+    pthread_mutex_destroy (&kernel->lock);
+    free (kernel->name);
+    free (kernel);
+}
+
+cl_kernel
+ocl_kernel_get (OclKernel *kernel,
+                cl_int *errcode)
+{
+    Instance *instance;
+
+    instance = get_instance (kernel, errcode);
+    return instance != NULL ? instance->kernel : NULL;
+}
+
+cl_command_queue
+ocl_kernel_get_queue (OclKernel *kernel,
+                      cl_int *errcode)
+{
+    Instance *instance;
+
+    instance = get_instance (kernel, errcode);
+    return instance != NULL ? instance->queue : NULL;
+}
+
+cl_int
+ocl_kernel_set_arg (OclKernel *kernel,
+                    cl_uint index,
+                    size_t size,
+                    const void *value)
+{
+    Instance *instance;
+    cl_int errcode;
+
+    instance = get_instance (kernel, &errcode);
+
+    if (instance == NULL)
+        return errcode;
+
+    return clSetKernelArg (instance->kernel, index, size, value);
+}
+
+cl_int
+ocl_kernel_enqueue (OclKernel *kernel,
+                    cl_uint work_dim,
+                    const size_t *global_work_size,
+                    const size_t *local_work_size,
+                    cl_uint num_events,
+                    const cl_event *wait_list,
+                    cl_event *event)
+{
+    Instance *instance;
+    cl_int errcode;
+
+    instance = get_instance (kernel, &errcode);
+
+    if (instance == NULL)
+        return errcode;
+
+    return clEnqueueNDRangeKernel (instance->queue, instance->kernel, work_dim, NULL,
+                                   global_work_size, local_work_size, num_events, wait_list, event);
+}
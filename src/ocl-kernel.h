@@ -0,0 +1,50 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OCL_KERNEL_H
+#define OCL_KERNEL_H
+
+#include "ocl.h"
+
+typedef struct OclKernel OclKernel;
+
+OclKernel *         ocl_kernel_new      (OclPlatform        *ocl,
+                                         unsigned            device,
+                                         cl_program          program,
+                                         const char         *name,
+                                         cl_command_queue_properties
+                                                             queue_properties,
+                                         cl_int             *errcode);
+void                ocl_kernel_free     (OclKernel          *kernel);
+cl_kernel           ocl_kernel_get      (OclKernel          *kernel,
+                                         cl_int             *errcode);
+cl_command_queue    ocl_kernel_get_queue
+                                        (OclKernel          *kernel,
+                                         cl_int             *errcode);
+cl_int              ocl_kernel_set_arg  (OclKernel          *kernel,
+                                         cl_uint             index,
+                                         size_t              size,
+                                         const void         *value);
+cl_int              ocl_kernel_enqueue  (OclKernel          *kernel,
+                                         cl_uint             work_dim,
+                                         const size_t       *global_work_size,
+                                         const size_t       *local_work_size,
+                                         cl_uint             num_events,
+                                         const cl_event     *wait_list,
+                                         cl_event           *event);
+
+#endif
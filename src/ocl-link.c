@@ -0,0 +1,368 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "ocl-link.h"
+#include "ocl-private.h"
+
+/*
+ * Modules are compiled with clCompileProgram into objects that are kept by a
+ * hash of their source, their compile options and all headers, so a link
+ * only recompiles modules whose inputs changed since any earlier link.
+ * Headers are not parsed, changing one recompiles every module. Objects that
+ * were not part of the last MAX_IDLE_LINKS links are released.
+ */
+#define MAX_IDLE_LINKS  16
+
+typedef struct {
+    char                *name;
+    cl_program           program;
+    cl_ulong             hash;
+} Header;
+
+typedef struct {
+    char                *name;
+    char                *source;
+    char                *options;
+} Module;
+
+typedef struct {
+    cl_ulong             key;
+    cl_program           object;
+    unsigned long        last_used;
+} Object;
+
+struct OclLinker {
+    OclPlatform         *ocl;
+    Header              *headers;
+    unsigned             num_headers;
+    Module              *modules;
+    unsigned             num_modules;
+    Object              *objects;
+    unsigned             num_objects;
+    unsigned long        generation;
+    OclLinkerStats       stats;
+};
+
+static void
+print_build_logs (OclLinker *linker, cl_program program, const char *what)
+{
+    cl_device_id *devices;
+
+    devices = ocl_get_devices (linker->ocl);
+    fprintf (stderr, "\n** Error %s.\n", what);
+
+    for (int i = 0; i < ocl_get_num_devices (linker->ocl); i++) {
+        size_t size = 0;
+        char *log;
+
+        if (clGetProgramBuildInfo (program, devices[i], CL_PROGRAM_BUILD_LOG, 0, NULL, &size) != CL_SUCCESS)
+            continue;
+
+        log = malloc (size + 1);
+        log[0] = '\0';
+
+        if (clGetProgramBuildInfo (program, devices[i], CL_PROGRAM_BUILD_LOG, size, log, NULL) == CL_SUCCESS)
+            log[size] = '\0';
+
+        fprintf (stderr, "Build log of device %i:\n%s\n", i, log);
+        free (log);
+    }
+}
+
+static Object *
+compile_module (OclLinker *linker, Module *module, cl_ulong key, cl_int *errcode)
+{
+    const char **include_names;
+    cl_program *headers;
+    cl_program program;
+    cl_ulong start;
+    Object *object;
+
+    program = clCreateProgramWithSource (ocl_get_context (linker->ocl), 1,
+                                         (const char **) &module->source, NULL, errcode);
+
+    if (*errcode != CL_SUCCESS)
+        return NULL;
+
+    include_names = malloc ((linker->num_headers + 1) * sizeof (char *));
+    headers = malloc ((linker->num_headers + 1) * sizeof (cl_program));
+
+    for (unsigned i = 0; i < linker->num_headers; i++) {
+        include_names[i] = linker->headers[i].name;
+        headers[i] = linker->headers[i].program;
+    }
+
+    start = ocl_time_ns ();
+    *errcode = clCompileProgram (program, ocl_get_num_devices (linker->ocl), ocl_get_devices (linker->ocl),
+                                 module->options, linker->num_headers,
+                                 linker->num_headers > 0 ? headers : NULL,
+                                 linker->num_headers > 0 ? include_names : NULL,
+                                 NULL, NULL);
+    linker->stats.compile_time += (ocl_time_ns () - start) / 1e9;
+
+    free (include_names);
+    free (headers);
+
+    if (*errcode != CL_SUCCESS) {
+        print_build_logs (linker, program, "compiling module");
+        OCL_CHECK_ERROR (clReleaseProgram (program));
+        return NULL;
+    }
+
+    linker->objects = realloc (linker->objects, (linker->num_objects + 1) * sizeof (Object));
+    object = &linker->objects[linker->num_objects++];
+    object->key = key;
+    object->object = program;
+    linker->stats.compiles++;
+    return object;
+}
+
+static void
+release_idle_objects (OclLinker *linker)
+{
+    unsigned i = 0;
+
+    while (i < linker->num_objects) {
+        Object *object = &linker->objects[i];
+
+        if (object->last_used + MAX_IDLE_LINKS < linker->generation) {
+            OCL_CHECK_ERROR (clReleaseProgram (object->object));
+            *object = linker->objects[--linker->num_objects];
+        }
+        else
+            i++;
+    }
+}
+
+static Module *
+find_module (OclLinker *linker, const char *name)
+{
+    for (unsigned i = 0; i < linker->num_modules; i++) {
+        if (!strcmp (linker->modules[i].name, name))
+            return &linker->modules[i];
+    }
+
+    return NULL;
+}
+
+OclLinker *
+ocl_linker_new (OclPlatform *ocl)
+{
+    OclLinker *linker;
+
+    assert (ocl != NULL);
+
+    linker = calloc (1, sizeof (OclLinker));
+    linker->ocl = ocl;
+    return linker;
+}
+
+cl_int
+ocl_linker_add_header (OclLinker *linker,
+                       const char *include_name,
+                       const char *source)
+{
+    cl_program program;
+    Header *header = NULL;
+    cl_int errcode;
+
+    assert (linker != NULL);
+    assert (include_name != NULL);
+    assert (source != NULL);
+
+    program = clCreateProgramWithSource (ocl_get_context (linker->ocl), 1, &source, NULL, &errcode);
+
+    if (errcode != CL_SUCCESS)
+        return errcode;
+
+    for (unsigned i = 0; i < linker->num_headers; i++) {
+        if (!strcmp (linker->headers[i].name, include_name)) {
+            header = &linker->headers[i];
+            OCL_CHECK_ERROR (clReleaseProgram (header->program));
+            break;
+        }
+    }
+
+    if (header == NULL) {
+        linker->headers = realloc (linker->headers, (linker->num_headers + 1) * sizeof (Header));
+        header = &linker->headers[linker->num_headers++];
+        header->name = strdup (include_name);
+    }
+
+    header->program = program;
+    header->hash = ocl_hash_string (ocl_hash_string (OCL_HASH_SEED, include_name), source);
+    return CL_SUCCESS;
+}
+
+cl_int
+ocl_linker_add_module (OclLinker *linker,
+                       const char *name,
+                       const char *source,
+                       const char *options)
+{
+    Module *module;
+
+    assert (linker != NULL);
+    assert (name != NULL);
+    assert (source != NULL);
+
+    module = find_module (linker, name);
+
+    if (module == NULL) {
+        linker->modules = realloc (linker->modules, (linker->num_modules + 1) * sizeof (Module));
+        module = &linker->modules[linker->num_modules++];
+        module->name = strdup (name);
+    }
+    else {
+        free (module->source);
+        free (module->options);
+    }
+
+    module->source = strdup (source);
+    module->options = options != NULL ? strdup (options) : NULL;
+    return CL_SUCCESS;
+}
+
+void
+ocl_linker_remove_module (OclLinker *linker,
+                          const char *name)
+{
+    Module *module;
+
+    assert (linker != NULL);
+
+    if ((module = find_module (linker, name)) == NULL)
+        return;
+
+    free (module->name);
+    free (module->source);
+    free (module->options);
+    *module = linker->modules[--linker->num_modules];
+}
+
+cl_program
+ocl_linker_link (OclLinker *linker,
+                 const char *options,
+                 cl_int *errcode)
+{
+    cl_program *objects;
+    cl_program program = NULL;
+    cl_ulong headers_hash = OCL_HASH_SEED;
+    cl_ulong start;
+    cl_int tmp_err = CL_SUCCESS;
+
+    assert (linker != NULL);
+
+    if (linker->num_modules == 0) {
+        ocl_transfer_error (CL_INVALID_VALUE, errcode);
+        return NULL;
+    }
+
+    linker->generation++;
+    objects = malloc (linker->num_modules * sizeof (cl_program));
+
+    for (unsigned i = 0; i < linker->num_headers; i++)
+        headers_hash = ocl_hash_bytes (headers_hash, &linker->headers[i].hash, sizeof (cl_ulong));
+
+    for (unsigned i = 0; i < linker->num_modules && tmp_err == CL_SUCCESS; i++) {
+        Module *module = &linker->modules[i];
+        Object *object = NULL;
+        cl_ulong key;
+
+        key = ocl_hash_string (ocl_hash_string (headers_hash, module->source), module->options);
+
+        for (unsigned j = 0; j < linker->num_objects; j++) {
+            if (linker->objects[j].key == key) {
+                object = &linker->objects[j];
+                linker->stats.reuses++;
+                break;
+            }
+        }
+
+        if (object == NULL)
+            object = compile_module (linker, module, key, &tmp_err);
+
+        if (object != NULL) {
+            object->last_used = linker->generation;
+            objects[i] = object->object;
+        }
+    }
+
+    if (tmp_err != CL_SUCCESS)
+        goto ocl_linker_link_cleanup;
+
+    start = ocl_time_ns ();
+    program = clLinkProgram (ocl_get_context (linker->ocl),
+                             ocl_get_num_devices (linker->ocl), ocl_get_devices (linker->ocl),
+                             options, linker->num_modules, objects, NULL, NULL, &tmp_err);
+    linker->stats.link_time += (ocl_time_ns () - start) / 1e9;
+    linker->stats.links++;
+
+    if (tmp_err != CL_SUCCESS && program != NULL) {
+        print_build_logs (linker, program, "linking program");
+        OCL_CHECK_ERROR (clReleaseProgram (program));
+        program = NULL;
+    }
+
+ocl_linker_link_cleanup:
+    release_idle_objects (linker);
+    free (objects);
+    ocl_transfer_error (tmp_err, errcode);
+    return program;
+}
+
+void
+ocl_linker_get_stats (OclLinker *linker,
+                      OclLinkerStats *stats)
+{
+    assert (linker != NULL);
+    assert (stats != NULL);
+
+    *stats = linker->stats;
+}
+
+void
+ocl_linker_free (OclLinker *linker)
+{
+    if (linker == NULL)
+        return;
+
+    for (unsigned i = 0; i < linker->num_objects; i++)
+        OCL_CHECK_ERROR (clReleaseProgram (linker->objects[i].object));
+
+    for (unsigned i = 0; i < linker->num_headers; i++) {
+        OCL_CHECK_ERROR (clReleaseProgram (linker->headers[i].program));
+        free (linker->headers[i].name);
+    }
+
+    for (unsigned i = 0; i < linker->num_modules; i++) {
+        free (linker->modules[i].name);
+        free (linker->modules[i].source);
+        free (linker->modules[i].options);
+    }
+
+    free (linker->objects);
+    free (linker->headers);
+    free (linker->modules);
+    free (linker);
+}
@@ -0,0 +1,54 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OCL_LINK_H
+#define OCL_LINK_H
+
+#include "ocl.h"
+
+typedef struct OclLinker OclLinker;
+
+typedef struct {
+    unsigned long   compiles;
+    unsigned long   reuses;         /* modules served from compiled objects */
+    unsigned long   links;
+    double          compile_time;   /* seconds */
+    double          link_time;
+} OclLinkerStats;
+
+OclLinker *         ocl_linker_new      (OclPlatform        *ocl);
+cl_int              ocl_linker_add_header
+                                        (OclLinker          *linker,
+                                         const char         *include_name,
+                                         const char         *source);
+cl_int              ocl_linker_add_module
+                                        (OclLinker          *linker,
+                                         const char         *name,
+                                         const char         *source,
+                                         const char         *options);
+void                ocl_linker_remove_module
+                                        (OclLinker          *linker,
+                                         const char         *name);
+cl_program          ocl_linker_link     (OclLinker          *linker,
+                                         const char         *options,
+                                         cl_int             *errcode);
+void                ocl_linker_get_stats
+                                        (OclLinker          *linker,
+                                         OclLinkerStats     *stats);
+void                ocl_linker_free     (OclLinker          *linker);
+
+#endif
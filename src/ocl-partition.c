@@ -0,0 +1,410 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include "ocl-partition.h"
+#include "ocl-private.h"
+
+/*
+ * The NDRange is split along its last dimension, i.e. elements for 1D and
+ * rows for 2D ranges. Each device receives a contiguous share proportional to
+ * its throughput, and every partitioned buffer is replaced by a sub-buffer
+ * covering exactly that share, so kernels index from zero as usual. A
+ * completion callback per share records when it finished; if it cannot be
+ * registered, the share is timed by the end of the wait for all devices.
+ */
+#define MAX_BUFFERS         16
+#define SMOOTHING           0.5
+#define FAST_SMOOTHING      0.9
+#define MISPREDICTION       0.2
+
+typedef struct {
+    cl_uint              arg_index;
+    cl_mem               buffer;
+    size_t               bytes_per_item;
+} Buffer;
+
+typedef struct {
+    OclPartition        *partition;
+    cl_command_queue     queue;
+    double               throughput;
+    size_t               offset;
+    size_t               items;
+    double               time;
+    int                  pending;
+    cl_ulong             completed;
+} Share;
+
+struct OclPartition {
+    pthread_mutex_t      lock;
+    pthread_cond_t       cond;
+    cl_kernel            kernel;
+    unsigned             num_devices;
+    size_t               base_align;
+    Share               *shares;
+    Buffer               buffers[MAX_BUFFERS];
+    unsigned             num_buffers;
+};
+
+static size_t
+gcd (size_t a, size_t b)
+{
+    while (b != 0) {
+        size_t t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+static size_t
+lcm (size_t a, size_t b)
+{
+    return a / gcd (a, b) * b;
+}
+
+static void CL_CALLBACK
+record_completion (cl_event event, cl_int status, void *user_data)
+{
+    Share *share = user_data;
+    cl_ulong now = ocl_time_ns ();
+
+    pthread_mutex_lock (&share->partition->lock);
+    share->completed = now;
+    share->pending = 0;
+    pthread_cond_broadcast (&share->partition->cond);
+    pthread_mutex_unlock (&share->partition->lock);
+}
+
+static size_t
+get_granularity (OclPartition *partition, size_t local_size)
+{
+    size_t granularity = local_size > 0 ? local_size : 1;
+
+    /* every share except the last one must start at an aligned sub-buffer origin */
+    for (unsigned i = 0; i < partition->num_buffers; i++) {
+        size_t bytes = partition->buffers[i].bytes_per_item;
+
+        granularity = lcm (granularity, partition->base_align / gcd (partition->base_align, bytes));
+    }
+
+    return granularity;
+}
+
+static void
+distribute (OclPartition *partition, size_t total, size_t granularity)
+{
+    double sum = 0.0;
+    size_t assigned = 0;
+    size_t offset = 0;
+    unsigned fastest = 0;
+    unsigned last = 0;
+
+    for (unsigned i = 0; i < partition->num_devices; i++) {
+        sum += partition->shares[i].throughput;
+
+        if (partition->shares[i].throughput > partition->shares[fastest].throughput)
+            fastest = i;
+    }
+
+    for (unsigned i = 0; i < partition->num_devices; i++) {
+        Share *share = &partition->shares[i];
+        size_t units;
+
+        units = (size_t) (total * share->throughput / sum) / granularity;
+        share->items = units * granularity;
+        assigned += share->items;
+    }
+
+    /* whole granules left over by rounding go to the fastest device */
+    partition->shares[fastest].items += (total - assigned) / granularity * granularity;
+    assigned += (total - assigned) / granularity * granularity;
+
+    for (unsigned i = 0; i < partition->num_devices; i++) {
+        if (partition->shares[i].items > 0)
+            last = i;
+    }
+
+    /* the unaligned tail can only go to the last share */
+    if (partition->shares[last].items == 0)
+        last = fastest;
+
+    partition->shares[last].items += total - assigned;
+
+    for (unsigned i = 0; i < partition->num_devices; i++) {
+        partition->shares[i].offset = offset;
+        offset += partition->shares[i].items;
+    }
+}
+
+OclPartition *
+ocl_partition_new (OclPlatform *ocl,
+                   cl_kernel kernel)
+{
+    OclPartition *partition;
+    cl_command_queue *queues;
+
+    assert (ocl != NULL);
+
+    queues = ocl_get_cmd_queues (ocl);
+
+    if (queues == NULL)
+        return NULL;
+
+    partition = calloc (1, sizeof (OclPartition));
+    pthread_mutex_init (&partition->lock, NULL);
+    pthread_cond_init (&partition->cond, NULL);
+    partition->kernel = kernel;
+    partition->num_devices = ocl_get_num_devices (ocl);
+    partition->shares = calloc (partition->num_devices, sizeof (Share));
+    partition->base_align = 1;
+
+    OCL_CHECK_ERROR (clRetainKernel (kernel));
+
+    for (unsigned i = 0; i < partition->num_devices; i++) {
+        const OclDeviceInfo *info = ocl_get_device_info (ocl, i);
+        cl_uint frequency = info->max_clock_frequency;
+
+        partition->base_align = lcm (partition->base_align, info->mem_base_addr_align > 0 ? info->mem_base_addr_align : 1);
+
+        /* until the first run, guess from the raw compute capacity */
+        partition->shares[i].partition = partition;
+        partition->shares[i].queue = queues[i];
+        partition->shares[i].throughput = (double) info->compute_units * (frequency > 0 ? frequency : 1);
+        OCL_CHECK_ERROR (clRetainCommandQueue (queues[i]));
+    }
+
+    return partition;
+}
+
+cl_int
+ocl_partition_set_buffer (OclPartition *partition,
+                          cl_uint arg_index,
+                          cl_mem buffer,
+                          size_t bytes_per_item)
+{
+    Buffer *slot = NULL;
+
+    assert (partition != NULL);
+
+    if (bytes_per_item == 0)
+        return CL_INVALID_VALUE;
+
+    for (unsigned i = 0; i < partition->num_buffers; i++) {
+        if (partition->buffers[i].arg_index == arg_index)
+            slot = &partition->buffers[i];
+    }
+
+    if (slot == NULL) {
+        if (partition->num_buffers == MAX_BUFFERS)
+            return CL_OUT_OF_RESOURCES;
+
+        slot = &partition->buffers[partition->num_buffers++];
+    }
+
+    slot->arg_index = arg_index;
+    slot->buffer = buffer;
+    slot->bytes_per_item = bytes_per_item;
+    return CL_SUCCESS;
+}
+
+void
+ocl_partition_set_throughput (OclPartition *partition,
+                              unsigned device,
+                              double items_per_second)
+{
+    assert (partition != NULL);
+
+    if (device < partition->num_devices && items_per_second > 0.0)
+        partition->shares[device].throughput = items_per_second;
+}
+
+cl_int
+ocl_partition_run (OclPartition *partition,
+                   cl_uint work_dim,
+                   const size_t *global_work_size,
+                   const size_t *local_work_size)
+{
+    cl_event *events;
+    cl_mem *sub_buffers;
+    cl_uint split;
+    cl_ulong start;
+    cl_ulong end;
+    cl_int errcode = CL_SUCCESS;
+    unsigned num_events = 0;
+    unsigned num_sub_buffers = 0;
+
+    assert (partition != NULL);
+
+    if (work_dim < 1 || work_dim > 2 || global_work_size == NULL)
+        return CL_INVALID_VALUE;
+
+    split = work_dim - 1;
+    distribute (partition, global_work_size[split],
+                get_granularity (partition, local_work_size != NULL ? local_work_size[split] : 0));
+
+    events = calloc (partition->num_devices, sizeof (cl_event));
+    sub_buffers = calloc (partition->num_devices * partition->num_buffers, sizeof (cl_mem));
+    start = ocl_time_ns ();
+
+    for (unsigned i = 0; i < partition->num_devices && errcode == CL_SUCCESS; i++) {
+        Share *share = &partition->shares[i];
+        size_t global[2];
+
+        share->completed = 0;
+        share->pending = 0;
+
+        if (share->items == 0)
+            continue;
+
+        for (unsigned j = 0; j < partition->num_buffers; j++) {
+            Buffer *buffer = &partition->buffers[j];
+            cl_buffer_region region;
+
+            region.origin = share->offset * buffer->bytes_per_item;
+            region.size = share->items * buffer->bytes_per_item;
+
+            sub_buffers[num_sub_buffers] = clCreateSubBuffer (buffer->buffer, 0, CL_BUFFER_CREATE_TYPE_REGION,
+                                                              &region, &errcode);
+
+            if (errcode != CL_SUCCESS)
+                break;
+
+            OCL_CHECK_ERROR (clSetKernelArg (partition->kernel, buffer->arg_index, sizeof (cl_mem),
+                                             &sub_buffers[num_sub_buffers]));
+            num_sub_buffers++;
+        }
+
+        if (errcode != CL_SUCCESS)
+            break;
+
+        memcpy (global, global_work_size, work_dim * sizeof (size_t));
+        global[split] = share->items;
+
+        errcode = clEnqueueNDRangeKernel (share->queue, partition->kernel, work_dim, NULL,
+                                          global, local_work_size, 0, NULL, &events[num_events]);
+
+        if (errcode != CL_SUCCESS)
+            break;
+
+        /* set before registering, the callback may run right away */
+        share->pending = 1;
+
+        if (clSetEventCallback (events[num_events], CL_COMPLETE, record_completion, share) != CL_SUCCESS)
+            share->pending = 0;
+
+        OCL_CHECK_ERROR (clFlush (share->queue));
+        num_events++;
+    }
+
+    if (num_events > 0) {
+        cl_int tmp_err = clWaitForEvents (num_events, events);
+
+        if (errcode == CL_SUCCESS)
+            errcode = tmp_err;
+    }
+
+    end = ocl_time_ns ();
+
+    /* callbacks may still be in flight right after the wait returned */
+    pthread_mutex_lock (&partition->lock);
+
+    for (unsigned i = 0; i < partition->num_devices; i++) {
+        while (partition->shares[i].pending)
+            pthread_cond_wait (&partition->cond, &partition->lock);
+    }
+
+    pthread_mutex_unlock (&partition->lock);
+
+    for (unsigned i = 0; i < num_events; i++)
+        OCL_CHECK_ERROR (clReleaseEvent (events[i]));
+
+    for (unsigned i = 0; i < num_sub_buffers; i++)
+        OCL_CHECK_ERROR (clReleaseMemObject (sub_buffers[i]));
+
+    free (events);
+    free (sub_buffers);
+
+    if (errcode != CL_SUCCESS)
+        return errcode;
+
+    for (unsigned i = 0; i < partition->num_devices; i++) {
+        Share *share = &partition->shares[i];
+        double predicted;
+        double measured;
+        double alpha;
+
+        if (share->items == 0) {
+            share->time = 0.0;
+            continue;
+        }
+
+        share->time = ((share->completed != 0 ? share->completed : end) - start) / 1e9;
+
+        if (share->time <= 0.0)
+            continue;
+
+        /* adapt quickly when a device was much slower or faster than predicted */
+        predicted = share->items / share->throughput;
+        measured = share->items / share->time;
+        alpha = share->time > predicted * (1.0 + MISPREDICTION) ||
+                share->time < predicted * (1.0 - MISPREDICTION) ? FAST_SMOOTHING : SMOOTHING;
+        share->throughput = alpha * measured + (1.0 - alpha) * share->throughput;
+    }
+
+    return CL_SUCCESS;
+}
+
+void
+ocl_partition_get_share (OclPartition *partition,
+                         unsigned device,
+                         size_t *items,
+                         double *time,
+                         double *items_per_second)
+{
+    assert (partition != NULL);
+    assert (device < partition->num_devices);
+
+    if (items != NULL)
+        *items = partition->shares[device].items;
+
+    if (time != NULL)
+        *time = partition->shares[device].time;
+
+    if (items_per_second != NULL)
+        *items_per_second = partition->shares[device].throughput;
+}
+
+void
+ocl_partition_free (OclPartition *partition)
+{
+    if (partition == NULL)
+        return;
+
+    for (unsigned i = 0; i < partition->num_devices; i++)
+        OCL_CHECK_ERROR (clReleaseCommandQueue (partition->shares[i].queue));
+
+    OCL_CHECK_ERROR (clReleaseKernel (partition->kernel));
+    pthread_cond_destroy (&partition->cond);
+    pthread_mutex_destroy (&partition->lock);
+    free (partition->shares);
+    free (partition);
+}
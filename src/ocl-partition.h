@@ -0,0 +1,48 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OCL_PARTITION_H
+#define OCL_PARTITION_H
+
+#include "ocl.h"
+
+typedef struct OclPartition OclPartition;
+
+OclPartition *      ocl_partition_new   (OclPlatform        *ocl,
+                                         cl_kernel           kernel);
+cl_int              ocl_partition_set_buffer
+                                        (OclPartition       *partition,
+                                         cl_uint             arg_index,
+                                         cl_mem              buffer,
+                                         size_t              bytes_per_item);
+void                ocl_partition_set_throughput
+                                        (OclPartition       *partition,
+                                         unsigned            device,
+                                         double              items_per_second);
+cl_int              ocl_partition_run   (OclPartition       *partition,
+                                         cl_uint             work_dim,
+                                         const size_t       *global_work_size,
+                                         const size_t       *local_work_size);
+void                ocl_partition_get_share
+                                        (OclPartition       *partition,
+                                         unsigned            device,
+                                         size_t             *items,
+                                         double             *time,
+                                         double             *items_per_second);
+void                ocl_partition_free  (OclPartition       *partition);
+
+#endif
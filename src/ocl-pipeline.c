@@ -0,0 +1,298 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "ocl-pipeline.h"
+#include "ocl-private.h"
+
+/*
+ * Chunks rotate over num_sets buffer sets. Chunk i is uploaded on the upload
+ * queue, processed on the compute queue and downloaded on the download queue,
+ * chained by events. A set is only reused after the download of its previous
+ * chunk finished, so with three sets upload, compute and download of
+ * consecutive chunks overlap. The kernel receives the input buffer as
+ * argument 0 and the output buffer as argument 1.
+ */
+typedef struct {
+    cl_mem               input;
+    cl_mem               output;
+    cl_mem               pinned_input;
+    cl_mem               pinned_output;
+    void                *host_input;
+    void                *host_output;
+    cl_event             events[3];
+    unsigned long        index;
+    int                  busy;
+} Set;
+
+struct OclPipeline {
+    cl_kernel            kernel;
+    cl_command_queue     queues[3];
+    size_t               input_size;
+    size_t               output_size;
+    cl_uint              work_dim;
+    size_t               global_work_size[3];
+    size_t               local_work_size[3];
+    int                  use_local_work_size;
+    int                  profiling;
+    unsigned             num_sets;
+    Set                 *sets;
+};
+
+static cl_mem
+create_pinned (cl_context context, cl_command_queue queue, size_t size, void **host, cl_int *errcode)
+{
+    cl_mem mem;
+
+    mem = clCreateBuffer (context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size, NULL, errcode);
+
+    if (*errcode != CL_SUCCESS)
+        return NULL;
+
+    *host = clEnqueueMapBuffer (queue, mem, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size, 0, NULL, NULL, errcode);
+    return mem;
+}
+
+static cl_int
+retire_set (OclPipeline *pipeline,
+            Set *set,
+            OclPipelineConsumer consumer,
+            void *user_data,
+            double *stage_times)
+{
+    cl_int errcode;
+
+    errcode = ocl_retire_stage_events (set->events, 3, pipeline->profiling, stage_times);
+
+    if (errcode == CL_SUCCESS && consumer != NULL)
+        consumer (set->host_output, pipeline->output_size, set->index, user_data);
+
+    set->busy = 0;
+    return errcode;
+}
+
+OclPipeline *
+ocl_pipeline_new (OclPlatform *ocl,
+                  unsigned device,
+                  cl_kernel kernel,
+                  size_t input_size,
+                  size_t output_size,
+                  unsigned num_sets,
+                  cl_uint work_dim,
+                  const size_t *global_work_size,
+                  const size_t *local_work_size,
+                  cl_int *errcode)
+{
+    OclPipeline *pipeline;
+    cl_context context;
+    cl_int tmp_err = CL_SUCCESS;
+
+    assert (ocl != NULL);
+
+    if (num_sets == 0 || work_dim == 0 || work_dim > 3 || global_work_size == NULL ||
+        ocl_get_queue (ocl, device, OCL_QUEUE_COMPUTE) == NULL) {
+        if (errcode != NULL)
+            *errcode = CL_INVALID_VALUE;
+
+        return NULL;
+    }
+
+    context = ocl_get_context (ocl);
+    pipeline = calloc (1, sizeof (OclPipeline));
+    pipeline->kernel = kernel;
+    pipeline->input_size = input_size;
+    pipeline->output_size = output_size;
+    pipeline->work_dim = work_dim;
+    pipeline->use_local_work_size = local_work_size != NULL;
+    pipeline->num_sets = num_sets;
+    pipeline->sets = calloc (num_sets, sizeof (Set));
+    pipeline->queues[0] = ocl_get_queue (ocl, device, OCL_QUEUE_UPLOAD);
+    pipeline->queues[1] = ocl_get_queue (ocl, device, OCL_QUEUE_COMPUTE);
+    pipeline->queues[2] = ocl_get_queue (ocl, device, OCL_QUEUE_DOWNLOAD);
+    pipeline->profiling = 1;
+
+    OCL_CHECK_ERROR (clRetainKernel (kernel));
+
+    for (int i = 0; i < 3; i++) {
+        OCL_CHECK_ERROR (clRetainCommandQueue (pipeline->queues[i]));
+        pipeline->profiling = pipeline->profiling && ocl_queue_has_profiling (pipeline->queues[i]);
+    }
+
+    for (cl_uint i = 0; i < work_dim; i++) {
+        pipeline->global_work_size[i] = global_work_size[i];
+        pipeline->local_work_size[i] = local_work_size != NULL ? local_work_size[i] : 0;
+    }
+
+    for (unsigned i = 0; i < num_sets && tmp_err == CL_SUCCESS; i++) {
+        Set *set = &pipeline->sets[i];
+
+        set->input = clCreateBuffer (context, CL_MEM_READ_ONLY, input_size, NULL, &tmp_err);
+
+        if (tmp_err == CL_SUCCESS)
+            set->output = clCreateBuffer (context, CL_MEM_WRITE_ONLY, output_size, NULL, &tmp_err);
+
+        if (tmp_err == CL_SUCCESS)
+            set->pinned_input = create_pinned (context, pipeline->queues[0], input_size, &set->host_input, &tmp_err);
+
+        if (tmp_err == CL_SUCCESS)
+            set->pinned_output = create_pinned (context, pipeline->queues[2], output_size, &set->host_output, &tmp_err);
+    }
+
+    if (errcode != NULL)
+        *errcode = tmp_err;
+
+    if (tmp_err != CL_SUCCESS) {
+        ocl_pipeline_free (pipeline);
+        return NULL;
+    }
+
+    return pipeline;
+}
+
+cl_int
+ocl_pipeline_run (OclPipeline *pipeline,
+                  OclPipelineProducer producer,
+                  OclPipelineConsumer consumer,
+                  void *user_data,
+                  OclPipelineStats *stats)
+{
+    double stage_times[3] = { 0.0, 0.0, 0.0 };
+    unsigned long index;
+    cl_ulong start;
+    cl_int errcode = CL_SUCCESS;
+
+    assert (pipeline != NULL);
+    assert (producer != NULL);
+
+    start = ocl_time_ns ();
+
+    for (index = 0; ; index++) {
+        Set *set = &pipeline->sets[index % pipeline->num_sets];
+        const size_t *local = pipeline->use_local_work_size ? pipeline->local_work_size : NULL;
+
+        if (set->busy && (errcode = retire_set (pipeline, set, consumer, user_data, stage_times)) != CL_SUCCESS)
+            break;
+
+        if (!producer (set->host_input, pipeline->input_size, index, user_data))
+            break;
+
+        errcode = clEnqueueWriteBuffer (pipeline->queues[0], set->input, CL_FALSE,
+                                        0, pipeline->input_size, set->host_input,
+                                        0, NULL, &set->events[0]);
+
+        if (errcode != CL_SUCCESS)
+            break;
+
+        OCL_CHECK_ERROR (clSetKernelArg (pipeline->kernel, 0, sizeof (cl_mem), &set->input));
+        OCL_CHECK_ERROR (clSetKernelArg (pipeline->kernel, 1, sizeof (cl_mem), &set->output));
+
+        errcode = clEnqueueNDRangeKernel (pipeline->queues[1], pipeline->kernel,
+                                          pipeline->work_dim, NULL, pipeline->global_work_size, local,
+                                          1, &set->events[0], &set->events[1]);
+
+        if (errcode != CL_SUCCESS) {
+            clWaitForEvents (1, &set->events[0]);
+            OCL_CHECK_ERROR (clReleaseEvent (set->events[0]));
+            break;
+        }
+
+        errcode = clEnqueueReadBuffer (pipeline->queues[2], set->output, CL_FALSE,
+                                       0, pipeline->output_size, set->host_output,
+                                       1, &set->events[1], &set->events[2]);
+
+        if (errcode != CL_SUCCESS) {
+            clWaitForEvents (2, set->events);
+            OCL_CHECK_ERROR (clReleaseEvent (set->events[0]));
+            OCL_CHECK_ERROR (clReleaseEvent (set->events[1]));
+            break;
+        }
+
+        for (int i = 0; i < 3; i++)
+            OCL_CHECK_ERROR (clFlush (pipeline->queues[i]));
+
+        set->index = index;
+        set->busy = 1;
+    }
+
+    /* drain the remaining sets in submission order */
+    for (unsigned i = 0; i < pipeline->num_sets; i++) {
+        Set *set = &pipeline->sets[(index + i) % pipeline->num_sets];
+
+        if (set->busy) {
+            cl_int tmp_err = retire_set (pipeline, set, consumer, user_data, stage_times);
+
+            if (errcode == CL_SUCCESS)
+                errcode = tmp_err;
+        }
+    }
+
+    if (stats != NULL) {
+        double slowest = 0.0;
+
+        stats->num_chunks = index;
+        stats->wall_time = (ocl_time_ns () - start) / 1e9;
+        stats->upload_time = stage_times[0];
+        stats->compute_time = stage_times[1];
+        stats->download_time = stage_times[2];
+
+        for (int i = 0; i < 3; i++)
+            slowest = stage_times[i] > slowest ? stage_times[i] : slowest;
+
+        stats->overlap_efficiency = stats->wall_time > 0.0 ? slowest / stats->wall_time : 0.0;
+    }
+
+    return errcode;
+}
+
+void
+ocl_pipeline_free (OclPipeline *pipeline)
+{
+    if (pipeline == NULL)
+        return;
+
+    for (unsigned i = 0; i < pipeline->num_sets; i++) {
+        Set *set = &pipeline->sets[i];
+
+        if (set->host_input != NULL)
+            OCL_CHECK_ERROR (clEnqueueUnmapMemObject (pipeline->queues[0], set->pinned_input, set->host_input, 0, NULL, NULL));
+
+        if (set->host_output != NULL)
+            OCL_CHECK_ERROR (clEnqueueUnmapMemObject (pipeline->queues[2], set->pinned_output, set->host_output, 0, NULL, NULL));
+    }
+
+    for (int i = 0; i < 3; i++)
+        OCL_CHECK_ERROR (clFinish (pipeline->queues[i]));
+
+    for (unsigned i = 0; i < pipeline->num_sets; i++) {
+        cl_mem mems[4] = { pipeline->sets[i].input, pipeline->sets[i].output,
+                           pipeline->sets[i].pinned_input, pipeline->sets[i].pinned_output };
+
+        for (int j = 0; j < 4; j++) {
+            if (mems[j] != NULL)
+                OCL_CHECK_ERROR (clReleaseMemObject (mems[j]));
+        }
+    }
+
+    for (int i = 0; i < 3; i++)
+        OCL_CHECK_ERROR (clReleaseCommandQueue (pipeline->queues[i]));
+
+    OCL_CHECK_ERROR (clReleaseKernel (pipeline->kernel));
+    free (pipeline->sets);
+    free (pipeline);
+}
@@ -0,0 +1,61 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OCL_PIPELINE_H
+#define OCL_PIPELINE_H
+
+#include "ocl.h"
+
+typedef struct OclPipeline OclPipeline;
+
+/* Fill data with chunk index and return 0 once the stream has ended */
+typedef int  (*OclPipelineProducer)     (void               *data,
+                                         size_t              size,
+                                         unsigned long       index,
+                                         void               *user_data);
+typedef void (*OclPipelineConsumer)     (const void         *data,
+                                         size_t              size,
+                                         unsigned long       index,
+                                         void               *user_data);
+
+typedef struct {
+    unsigned long   num_chunks;
+    double          wall_time;
+    double          upload_time;        /* device times, need profiling */
+    double          compute_time;
+    double          download_time;
+    double          overlap_efficiency; /* slowest stage / wall time */
+} OclPipelineStats;
+
+OclPipeline *       ocl_pipeline_new    (OclPlatform        *ocl,
+                                         unsigned            device,
+                                         cl_kernel           kernel,
+                                         size_t              input_size,
+                                         size_t              output_size,
+                                         unsigned            num_sets,
+                                         cl_uint             work_dim,
+                                         const size_t       *global_work_size,
+                                         const size_t       *local_work_size,
+                                         cl_int             *errcode);
+cl_int              ocl_pipeline_run    (OclPipeline        *pipeline,
+                                         OclPipelineProducer producer,
+                                         OclPipelineConsumer consumer,
+                                         void               *user_data,
+                                         OclPipelineStats   *stats);
+void                ocl_pipeline_free   (OclPipeline        *pipeline);
+
+#endif
@@ -0,0 +1,381 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include "ocl-pool.h"
+#include "ocl-private.h"
+
+#define NUM_DEFAULT_CLASSES     40
+#define MIN_DEFAULT_CLASS_SIZE  256
+
+typedef struct Entry Entry;
+
+struct Entry {
+    cl_mem               mem;
+    size_t               size;
+    cl_mem_flags         flags;
+    unsigned             device;
+    unsigned             class;
+    cl_ulong             last_used;
+    Entry               *next;
+};
+
+struct OclBufferPool {
+    cl_context           context;
+    unsigned             num_devices;
+    size_t               max_cached_bytes;
+
+    size_t              *classes;
+    unsigned             num_classes;
+
+    /* cached[device][class] lists buffers ready for reuse */
+    Entry             ***cached;
+    size_t              *held;
+    cl_ulong            *max_alloc;
+    Entry               *in_use;
+
+    OclBufferPoolStats   stats;
+    pthread_mutex_t      lock;
+};
+
+static void
+release_entry (OclBufferPool *pool, Entry *entry)
+{
+    OCL_CHECK_ERROR (clReleaseMemObject (entry->mem));
+    free (entry);
+}
+
+static void
+release_cached (OclBufferPool *pool, cl_ulong max_idle_ns)
+{
+    cl_ulong now = ocl_time_ns ();
+
+    for (unsigned d = 0; d < pool->num_devices; d++) {
+        for (unsigned c = 0; c < pool->num_classes; c++) {
+            Entry **link = &pool->cached[d][c];
+
+            while (*link != NULL) {
+                Entry *entry = *link;
+
+                if (now - entry->last_used >= max_idle_ns) {
+                    *link = entry->next;
+                    pool->held[d] -= entry->size;
+                    pool->stats.bytes_held -= entry->size;
+                    release_entry (pool, entry);
+                }
+                else
+                    link = &entry->next;
+            }
+        }
+    }
+}
+
+static int
+allocate_classes (OclBufferPool *pool, const size_t *sizes, unsigned num_sizes)
+{
+    for (unsigned i = 1; i < num_sizes; i++) {
+        if (sizes[i] <= sizes[i - 1])
+            return -1;
+    }
+
+    free (pool->classes);
+    pool->classes = malloc (num_sizes * sizeof (size_t));
+    memcpy (pool->classes, sizes, num_sizes * sizeof (size_t));
+    pool->num_classes = num_sizes;
+
+    for (unsigned d = 0; d < pool->num_devices; d++) {
+        free (pool->cached[d]);
+        pool->cached[d] = calloc (num_sizes, sizeof (Entry *));
+    }
+
+    return 0;
+}
+
+static unsigned
+find_class (OclBufferPool *pool, size_t size)
+{
+    unsigned low = 0;
+    unsigned high = pool->num_classes;
+
+    /* first class that is large enough, num_classes if there is none */
+    while (low < high) {
+        unsigned mid = low + (high - low) / 2;
+
+        if (pool->classes[mid] < size)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+static void
+evict_oldest (OclBufferPool *pool, unsigned device)
+{
+    Entry **oldest = NULL;
+    Entry *entry;
+
+    for (unsigned c = 0; c < pool->num_classes; c++) {
+        for (Entry **link = &pool->cached[device][c]; *link != NULL; link = &(*link)->next) {
+            if (oldest == NULL || (*link)->last_used < (*oldest)->last_used)
+                oldest = link;
+        }
+    }
+
+    if (oldest == NULL)
+        return;
+
+    entry = *oldest;
+    *oldest = entry->next;
+    pool->held[device] -= entry->size;
+    pool->stats.bytes_held -= entry->size;
+    pool->stats.evictions++;
+    release_entry (pool, entry);
+}
+
+OclBufferPool *
+ocl_buffer_pool_new (OclPlatform *ocl,
+                     size_t max_cached_bytes)
+{
+    OclBufferPool *pool;
+    size_t sizes[NUM_DEFAULT_CLASSES];
+
+    assert (ocl != NULL);
+
+    pool = calloc (1, sizeof (OclBufferPool));
+    pool->context = ocl_get_context (ocl);
+    pool->num_devices = ocl_get_num_devices (ocl);
+    pool->max_cached_bytes = max_cached_bytes;
+    pool->cached = calloc (pool->num_devices, sizeof (Entry **));
+    pool->held = calloc (pool->num_devices, sizeof (size_t));
+    pool->max_alloc = calloc (pool->num_devices, sizeof (cl_ulong));
+    pthread_mutex_init (&pool->lock, NULL);
+
+    for (unsigned d = 0; d < pool->num_devices; d++)
+        pool->max_alloc[d] = ocl_get_device_info (ocl, d)->max_mem_alloc_size;
+
+    for (unsigned i = 0; i < NUM_DEFAULT_CLASSES; i++)
+        sizes[i] = ((size_t) MIN_DEFAULT_CLASS_SIZE) << i;
+
+    allocate_classes (pool, sizes, NUM_DEFAULT_CLASSES);
+    return pool;
+}
+
+int
+ocl_buffer_pool_set_size_classes (OclBufferPool *pool,
+                                  const size_t *sizes,
+                                  unsigned num_sizes)
+{
+    int result;
+
+    assert (pool != NULL);
+
+    if (sizes == NULL || num_sizes == 0)
+        return -1;
+
+    pthread_mutex_lock (&pool->lock);
+    release_cached (pool, 0);
+    result = allocate_classes (pool, sizes, num_sizes);
+
+    /* buffers in use keep their old class and are not cached again */
+    for (Entry *entry = pool->in_use; entry != NULL; entry = entry->next)
+        entry->class = pool->num_classes;
+
+    pthread_mutex_unlock (&pool->lock);
+    return result;
+}
+
+cl_mem
+ocl_buffer_pool_acquire (OclBufferPool *pool,
+                         unsigned device,
+                         cl_mem_flags flags,
+                         size_t size,
+                         cl_int *errcode)
+{
+    Entry *entry = NULL;
+    unsigned class;
+    cl_int tmp_err;
+
+    assert (pool != NULL);
+
+    if (device >= pool->num_devices || size == 0 ||
+        (flags & (CL_MEM_USE_HOST_PTR | CL_MEM_COPY_HOST_PTR))) {
+        if (errcode != NULL)
+            *errcode = CL_INVALID_VALUE;
+
+        return NULL;
+    }
+
+    pthread_mutex_lock (&pool->lock);
+    class = find_class (pool, size);
+
+    /* rounding up must not exceed what the device can allocate at all */
+    if (class < pool->num_classes && pool->classes[class] > pool->max_alloc[device])
+        class = pool->num_classes;
+
+    if (class < pool->num_classes) {
+        for (Entry **link = &pool->cached[device][class]; *link != NULL; link = &(*link)->next) {
+            if ((*link)->flags == flags) {
+                entry = *link;
+                *link = entry->next;
+                pool->held[device] -= entry->size;
+                pool->stats.bytes_held -= entry->size;
+                break;
+            }
+        }
+    }
+
+    if (entry != NULL) {
+        pool->stats.hits++;
+        pool->stats.bytes_in_use += entry->size;
+        entry->next = pool->in_use;
+        pool->in_use = entry;
+        pthread_mutex_unlock (&pool->lock);
+
+        if (errcode != NULL)
+            *errcode = CL_SUCCESS;
+
+        return entry->mem;
+    }
+
+    pool->stats.misses++;
+    pthread_mutex_unlock (&pool->lock);
+
+    entry = malloc (sizeof (Entry));
+    entry->size = class < pool->num_classes ? pool->classes[class] : size;
+    entry->flags = flags;
+    entry->device = device;
+    entry->class = class;
+    entry->mem = clCreateBuffer (pool->context, flags, entry->size, NULL, &tmp_err);
+
+    if (errcode != NULL)
+        *errcode = tmp_err;
+
+    if (tmp_err != CL_SUCCESS) {
+        free (entry);
+        return NULL;
+    }
+
+    pthread_mutex_lock (&pool->lock);
+    pool->stats.bytes_in_use += entry->size;
+    entry->next = pool->in_use;
+    pool->in_use = entry;
+    pthread_mutex_unlock (&pool->lock);
+
+    return entry->mem;
+}
+
+void
+ocl_buffer_pool_release (OclBufferPool *pool,
+                         cl_mem mem)
+{
+    Entry *entry = NULL;
+
+    assert (pool != NULL);
+
+    if (mem == NULL)
+        return;
+
+    pthread_mutex_lock (&pool->lock);
+
+    for (Entry **link = &pool->in_use; *link != NULL; link = &(*link)->next) {
+        if ((*link)->mem == mem) {
+            entry = *link;
+            *link = entry->next;
+            break;
+        }
+    }
+
+    if (entry == NULL) {
+        pthread_mutex_unlock (&pool->lock);
+        fprintf (stderr, "buffer %p was not acquired from this pool\n", (void *) mem);
+        return;
+    }
+
+    pool->stats.bytes_in_use -= entry->size;
+
+    if (entry->class >= pool->num_classes || entry->size > pool->max_cached_bytes) {
+        release_entry (pool, entry);
+        pthread_mutex_unlock (&pool->lock);
+        return;
+    }
+
+    entry->last_used = ocl_time_ns ();
+    entry->next = pool->cached[entry->device][entry->class];
+    pool->cached[entry->device][entry->class] = entry;
+    pool->held[entry->device] += entry->size;
+    pool->stats.bytes_held += entry->size;
+
+    while (pool->held[entry->device] > pool->max_cached_bytes)
+        evict_oldest (pool, entry->device);
+
+    pthread_mutex_unlock (&pool->lock);
+}
+
+void
+ocl_buffer_pool_trim (OclBufferPool *pool,
+                      double max_idle_time)
+{
+    assert (pool != NULL);
+
+    pthread_mutex_lock (&pool->lock);
+    release_cached (pool, max_idle_time > 0.0 ? (cl_ulong) (max_idle_time * 1e9) : 0);
+    pthread_mutex_unlock (&pool->lock);
+}
+
+void
+ocl_buffer_pool_get_stats (OclBufferPool *pool,
+                           OclBufferPoolStats *stats)
+{
+    assert (pool != NULL);
+
+    pthread_mutex_lock (&pool->lock);
+    *stats = pool->stats;
+    pthread_mutex_unlock (&pool->lock);
+}
+
+void
+ocl_buffer_pool_free (OclBufferPool *pool)
+{
+    if (pool == NULL)
+        return;
+
+    release_cached (pool, 0);
+
+    while (pool->in_use != NULL) {
+        Entry *entry = pool->in_use;
+
+        pool->in_use = entry->next;
+        release_entry (pool, entry);
+    }
+
+    for (unsigned d = 0; d < pool->num_devices; d++)
+        free (pool->cached[d]);
+
+    pthread_mutex_destroy (&pool->lock);
+    free (pool->cached);
+    free (pool->held);
+    free (pool->max_alloc);
+    free (pool->classes);
+    free (pool);
+}
@@ -0,0 +1,57 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OCL_POOL_H
+#define OCL_POOL_H
+
+#include "ocl.h"
+
+typedef struct OclBufferPool OclBufferPool;
+
+typedef struct {
+    unsigned long   hits;
+    unsigned long   misses;
+    unsigned long   evictions;
+    size_t          bytes_held;     /* cached and ready for reuse */
+    size_t          bytes_in_use;   /* handed out and not yet released */
+} OclBufferPoolStats;
+
+OclBufferPool *     ocl_buffer_pool_new (OclPlatform        *ocl,
+                                         size_t              max_cached_bytes);
+int                 ocl_buffer_pool_set_size_classes
+                                        (OclBufferPool      *pool,
+                                         const size_t       *sizes,
+                                         unsigned            num_sizes);
+cl_mem              ocl_buffer_pool_acquire
+                                        (OclBufferPool      *pool,
+                                         unsigned            device,
+                                         cl_mem_flags        flags,
+                                         size_t              size,
+                                         cl_int             *errcode);
+void                ocl_buffer_pool_release
+                                        (OclBufferPool      *pool,
+                                         cl_mem              mem);
+void                ocl_buffer_pool_trim
+                                        (OclBufferPool      *pool,
+                                         double              max_idle_time);
+void                ocl_buffer_pool_get_stats
+                                        (OclBufferPool      *pool,
+                                         OclBufferPoolStats *stats);
+void                ocl_buffer_pool_free
+                                        (OclBufferPool      *pool);
+
+#endif
@@ -0,0 +1,115 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OCL_PRIVATE_H
+#define OCL_PRIVATE_H
+
+#include "ocl.h"
+
+#define OCL_HASH_SEED   0xcbf29ce484222325ULL
+
+cl_ulong            ocl_time_ns         (void);
+void                ocl_transfer_error  (cl_int              src,
+                                         cl_int             *dst);
+int                 ocl_queue_has_profiling
+                                        (cl_command_queue    queue);
+cl_int              ocl_retire_stage_events
+                                        (cl_event           *events,
+                                         unsigned            num_stages,
+                                         int                 profiling,
+                                         double             *stage_times);
+int                 ocl_device_version_at_least
+                                        (const OclDeviceInfo
+                                                            *info,
+                                         int                 major,
+                                         int                 minor);
+cl_ulong            ocl_hash_bytes      (cl_ulong            hash,
+                                         const void         *data,
+                                         size_t              size);
+cl_ulong            ocl_hash_string     (cl_ulong            hash,
+                                         const char         *str);
+cl_int              ocl_write_program_binaries
+                                        (OclPlatform        *ocl,
+                                         const char         *source,
+                                         const char         *options,
+                                         FILE               *fp);
+
+/*
+ * Wire format between ocl-daemon and ocl-client. Both ends run on the same
+ * host, so fields are sent in native byte order. Every request is a header
+ * followed by size bytes of payload and answered with one OclWireReply.
+ */
+#define OCL_WIRE_MAX_PAYLOAD    (16 * 1024 * 1024)
+#define OCL_WIRE_MAX_NAME       128
+
+typedef enum {
+    OCL_WIRE_HELLO = 1,
+    OCL_WIRE_PROGRAM,       /* source '\0' options '\0' */
+    OCL_WIRE_MAP,           /* OclWireMap */
+    OCL_WIRE_UNMAP,         /* cl_uint handle */
+    OCL_WIRE_RUN,           /* OclWireRun, num_args OclWireArg, values */
+} OclWireType;
+
+typedef enum {
+    OCL_WIRE_ARG_VALUE = 0,
+    OCL_WIRE_ARG_LOCAL,
+    OCL_WIRE_ARG_BUFFER,
+} OclWireArgType;
+
+typedef struct {
+    cl_uint         type;
+    cl_uint         size;
+} OclWireHeader;
+
+typedef struct {
+    cl_int          status;
+    cl_uint         handle;
+    cl_ulong        value;
+} OclWireReply;
+
+typedef struct {
+    char            name[OCL_WIRE_MAX_NAME];
+    cl_ulong        size;
+} OclWireMap;
+
+typedef struct {
+    char            kernel[OCL_WIRE_MAX_NAME];
+    cl_uint         device;
+    cl_uint         program;
+    cl_uint         work_dim;
+    cl_uint         num_args;
+    cl_ulong        global_work_size[3];
+    cl_ulong        local_work_size[3];
+    cl_uint         use_local_work_size;
+} OclWireRun;
+
+typedef struct {
+    cl_uint         type;
+    cl_uint         handle;
+    cl_ulong        offset;
+    cl_ulong        size;
+    cl_mem_flags    flags;
+} OclWireArg;
+
+int                 ocl_wire_read       (int                 fd,
+                                         void               *data,
+                                         size_t              size);
+int                 ocl_wire_write      (int                 fd,
+                                         const void         *data,
+                                         size_t              size);
+
+#endif
@@ -0,0 +1,196 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "ocl-rect.h"
+
+/*
+ * Origins and regions are given in elements, rows and slices; unused
+ * dimensions are 0 in origins and 1 in regions. A NULL layout describes memory
+ * holding exactly the region, so a tile is moved between a larger frame and a
+ * tightly packed buffer by passing only the frame layout. ocl_rect_copy does
+ * the same on the host, e.g. to repack a tile before a contiguous transfer.
+ */
+
+typedef struct {
+    size_t           origin[3];     /* bytes, rows, slices */
+    size_t           row_pitch;
+    size_t           slice_pitch;
+} Pitches;
+
+static cl_int
+resolve (const OclRectLayout *layout, const size_t *origin, const size_t *region,
+         size_t element_size, Pitches *pitches)
+{
+    size_t width;
+    size_t height;
+
+    width = layout != NULL ? layout->width : region[0];
+    height = layout != NULL ? layout->height : region[1];
+
+    if (region[0] == 0 || region[1] == 0 || region[2] == 0)
+        return CL_INVALID_VALUE;
+
+    if (origin[0] + region[0] > width || (height > 0 && origin[1] + region[1] > height))
+        return CL_INVALID_VALUE;
+
+    pitches->row_pitch = layout != NULL && layout->row_pitch > 0 ? layout->row_pitch : width * element_size;
+    pitches->slice_pitch = layout != NULL && layout->slice_pitch > 0 ? layout->slice_pitch : pitches->row_pitch * height;
+
+    if (pitches->row_pitch < width * element_size ||
+        (region[2] > 1 && pitches->slice_pitch < pitches->row_pitch * region[1]))
+        return CL_INVALID_VALUE;
+
+    pitches->origin[0] = origin[0] * element_size;
+    pitches->origin[1] = origin[1];
+    pitches->origin[2] = origin[2];
+    return CL_SUCCESS;
+}
+
+static cl_int
+resolve_both (const OclRectLayout *a_layout, const size_t *a_origin,
+              const OclRectLayout *b_layout, const size_t *b_origin,
+              const size_t *region, Pitches *a, Pitches *b, size_t *bytes)
+{
+    size_t element_size;
+    cl_int errcode;
+
+    if (a_layout == NULL && b_layout == NULL)
+        return CL_INVALID_VALUE;
+
+    element_size = a_layout != NULL ? a_layout->element_size : b_layout->element_size;
+
+    if (element_size == 0 || (a_layout != NULL && b_layout != NULL && a_layout->element_size != b_layout->element_size))
+        return CL_INVALID_VALUE;
+
+    if ((errcode = resolve (a_layout, a_origin, region, element_size, a)) != CL_SUCCESS)
+        return errcode;
+
+    if ((errcode = resolve (b_layout, b_origin, region, element_size, b)) != CL_SUCCESS)
+        return errcode;
+
+    bytes[0] = region[0] * element_size;
+    bytes[1] = region[1];
+    bytes[2] = region[2];
+    return CL_SUCCESS;
+}
+
+cl_int
+ocl_rect_write (cl_command_queue queue,
+                cl_mem buffer,
+                const OclRectLayout *buffer_layout,
+                const size_t *buffer_origin,
+                const void *host,
+                const OclRectLayout *host_layout,
+                const size_t *host_origin,
+                const size_t *region,
+                cl_bool blocking,
+                cl_uint num_events,
+                const cl_event *wait_list,
+                cl_event *event)
+{
+    Pitches device_pitches;
+    Pitches host_pitches;
+    size_t bytes[3];
+    cl_int errcode;
+
+    errcode = resolve_both (buffer_layout, buffer_origin, host_layout, host_origin, region,
+                            &device_pitches, &host_pitches, bytes);
+
+    if (errcode != CL_SUCCESS)
+        return errcode;
+
+    return clEnqueueWriteBufferRect (queue, buffer, blocking,
+                                     device_pitches.origin, host_pitches.origin, bytes,
+                                     device_pitches.row_pitch, device_pitches.slice_pitch,
+                                     host_pitches.row_pitch, host_pitches.slice_pitch,
+                                     host, num_events, wait_list, event);
+}
+
+cl_int
+ocl_rect_read (cl_command_queue queue,
+               cl_mem buffer,
+               const OclRectLayout *buffer_layout,
+               const size_t *buffer_origin,
+               void *host,
+               const OclRectLayout *host_layout,
+               const size_t *host_origin,
+               const size_t *region,
+               cl_bool blocking,
+               cl_uint num_events,
+               const cl_event *wait_list,
+               cl_event *event)
+{
+    Pitches device_pitches;
+    Pitches host_pitches;
+    size_t bytes[3];
+    cl_int errcode;
+
+    errcode = resolve_both (buffer_layout, buffer_origin, host_layout, host_origin, region,
+                            &device_pitches, &host_pitches, bytes);
+
+    if (errcode != CL_SUCCESS)
+        return errcode;
+
+    return clEnqueueReadBufferRect (queue, buffer, blocking,
+                                    device_pitches.origin, host_pitches.origin, bytes,
+                                    device_pitches.row_pitch, device_pitches.slice_pitch,
+                                    host_pitches.row_pitch, host_pitches.slice_pitch,
+                                    host, num_events, wait_list, event);
+}
+
+cl_int
+ocl_rect_copy (void *dst,
+               const OclRectLayout *dst_layout,
+               const size_t *dst_origin,
+               const void *src,
+               const OclRectLayout *src_layout,
+               const size_t *src_origin,
+               const size_t *region)
+{
+    Pitches dst_pitches;
+    Pitches src_pitches;
+    size_t bytes[3];
+    cl_int errcode;
+
+    errcode = resolve_both (dst_layout, dst_origin, src_layout, src_origin, region,
+                            &dst_pitches, &src_pitches, bytes);
+
+    if (errcode != CL_SUCCESS)
+        return errcode;
+
+    for (size_t z = 0; z < bytes[2]; z++) {
+        char *d;
+        const char *s;
+
+        d = (char *) dst + (dst_pitches.origin[2] + z) * dst_pitches.slice_pitch +
+            dst_pitches.origin[1] * dst_pitches.row_pitch + dst_pitches.origin[0];
+        s = (const char *) src + (src_pitches.origin[2] + z) * src_pitches.slice_pitch +
+            src_pitches.origin[1] * src_pitches.row_pitch + src_pitches.origin[0];
+
+        /* whole slices are one block if neither side has padding */
+        if (dst_pitches.row_pitch == bytes[0] && src_pitches.row_pitch == bytes[0]) {
+            memcpy (d, s, bytes[0] * bytes[1]);
+            continue;
+        }
+
+        for (size_t y = 0; y < bytes[1]; y++)
+            memcpy (d + y * dst_pitches.row_pitch, s + y * src_pitches.row_pitch, bytes[0]);
+    }
+
+    return CL_SUCCESS;
+}
@@ -0,0 +1,69 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OCL_RECT_H
+#define OCL_RECT_H
+
+#include "ocl.h"
+
+typedef struct {
+    size_t          element_size;   /* bytes per element */
+    size_t          width;          /* elements per row */
+    size_t          height;         /* rows per slice */
+    size_t          row_pitch;      /* bytes, 0 for width * element_size */
+    size_t          slice_pitch;    /* bytes, 0 for row_pitch * height */
+} OclRectLayout;
+
+cl_int              ocl_rect_write      (cl_command_queue    queue,
+                                         cl_mem              buffer,
+                                         const OclRectLayout
+                                                            *buffer_layout,
+                                         const size_t       *buffer_origin,
+                                         const void         *host,
+                                         const OclRectLayout
+                                                            *host_layout,
+                                         const size_t       *host_origin,
+                                         const size_t       *region,
+                                         cl_bool             blocking,
+                                         cl_uint             num_events,
+                                         const cl_event     *wait_list,
+                                         cl_event           *event);
+cl_int              ocl_rect_read       (cl_command_queue    queue,
+                                         cl_mem              buffer,
+                                         const OclRectLayout
+                                                            *buffer_layout,
+                                         const size_t       *buffer_origin,
+                                         void               *host,
+                                         const OclRectLayout
+                                                            *host_layout,
+                                         const size_t       *host_origin,
+                                         const size_t       *region,
+                                         cl_bool             blocking,
+                                         cl_uint             num_events,
+                                         const cl_event     *wait_list,
+                                         cl_event           *event);
+cl_int              ocl_rect_copy       (void               *dst,
+                                         const OclRectLayout
+                                                            *dst_layout,
+                                         const size_t       *dst_origin,
+                                         const void         *src,
+                                         const OclRectLayout
+                                                            *src_layout,
+                                         const size_t       *src_origin,
+                                         const size_t       *region);
+
+#endif
@@ -0,0 +1,386 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sched.h>
+#include <time.h>
+#include "ocl-ring.h"
+#include "ocl-host.h"
+#include "ocl-private.h"
+
+/*
+ * A ring of fixed size slots in memory that the host and the device see at
+ * the same time: fine-grained SVM with atomics if the device has it, a mapped
+ * CL_MEM_ALLOC_HOST_PTR buffer on CPU devices otherwise.
+ * Work-items reserve a slot by advancing head with a compare-and-swap as long
+ * as it stays less than capacity ahead of tail, and count a drop instead of
+ * waiting when the ring is full. They fill the payload and publish the slot
+ * by writing its index plus one into the first word after a fence. The host
+ * consumes slots in order while that word matches and only then moves tail,
+ * so a slot is never handed out again before it was read. The layout of
+ * Header and Slot must match the OpenCL C declarations in RING_SOURCE.
+ *
+ * Only OpenCL C 2.0 atomics with memory_scope_all_svm_devices order the
+ * device writes for the host, so with SVM the kernels must be compiled with
+ * -cl-std=CL2.0 (ocl_ring_get_build_options). OpenCL 1.x leaves the contents
+ * of a buffer undefined while it is mapped and kernels write to it, so the
+ * fallback is limited to CPU devices, where the mapping is the buffer itself
+ * and the device atomics and fences are those of the host.
+ */
+#define HEADER_SIZE     64
+#define SLOT_ALIGN      16
+#define SPIN_ROUNDS     16
+#define MAX_SLEEP_US    1000
+
+typedef struct {
+    cl_uint              head;
+    cl_uint              tail;
+    cl_uint              dropped;
+    cl_uint              mask;
+    cl_uint              stride;
+} Header;
+
+struct OclRing {
+    OclPlatform         *ocl;
+    unsigned             device;
+    cl_mem               buffer;
+    void                *memory;
+    size_t               size;
+    volatile Header     *header;
+    volatile char       *slots;
+    cl_uint              tail;
+    unsigned             idle;
+};
+
+static const char *RING_SOURCE =
+    "#ifndef OCL_RING_CL\n"
+    "#define OCL_RING_CL\n"
+    "#if defined(__OPENCL_C_VERSION__) && __OPENCL_C_VERSION__ >= 200\n"
+    "#define OCL_RING_ATOMICS\n"
+    "#endif\n"
+    "\n"
+    "typedef struct {\n"
+    "#ifdef OCL_RING_ATOMICS\n"
+    "    atomic_uint head;\n"
+    "    atomic_uint tail;\n"
+    "    atomic_uint dropped;\n"
+    "#else\n"
+    "    volatile uint head;\n"
+    "    volatile uint tail;\n"
+    "    volatile uint dropped;\n"
+    "#endif\n"
+    "    uint mask;\n"
+    "    uint stride;\n"
+    "    uint padding[11];\n"
+    "} OclRing;\n"
+    "\n"
+    "#ifdef OCL_RING_ATOMICS\n"
+    "static inline global uchar *\n"
+    "ocl_ring_reserve (global OclRing *ring, uint *index)\n"
+    "{\n"
+    "    uint head = atomic_load_explicit (&ring->head, memory_order_relaxed, memory_scope_all_svm_devices);\n"
+    "\n"
+    "    for (;;) {\n"
+    "        uint tail = atomic_load_explicit (&ring->tail, memory_order_acquire, memory_scope_all_svm_devices);\n"
+    "\n"
+    "        if (head - tail > ring->mask) {\n"
+    "            atomic_fetch_add_explicit (&ring->dropped, 1, memory_order_relaxed, memory_scope_all_svm_devices);\n"
+    "            return 0;\n"
+    "        }\n"
+    "\n"
+    "        if (atomic_compare_exchange_strong_explicit (&ring->head, &head, head + 1,\n"
+    "                                                     memory_order_relaxed, memory_order_relaxed,\n"
+    "                                                     memory_scope_all_svm_devices))\n"
+    "            break;\n"
+    "    }\n"
+    "\n"
+    "    *index = head;\n"
+    "    return ((global uchar *) (ring + 1)) + (head & ring->mask) * ring->stride + 2 * sizeof (uint);\n"
+    "}\n"
+    "\n"
+    "static inline void\n"
+    "ocl_ring_commit (global OclRing *ring, uint index, uint tag)\n"
+    "{\n"
+    "    global uint *slot = (global uint *) (((global uchar *) (ring + 1)) + (index & ring->mask) * ring->stride);\n"
+    "\n"
+    "    slot[1] = tag;\n"
+    "    atomic_store_explicit ((global atomic_uint *) slot, index + 1,\n"
+    "                           memory_order_release, memory_scope_all_svm_devices);\n"
+    "}\n"
+    "#else\n"
+    "static inline global uchar *\n"
+    "ocl_ring_reserve (global OclRing *ring, uint *index)\n"
+    "{\n"
+    "    uint head = ring->head;\n"
+    "\n"
+    "    for (;;) {\n"
+    "        uint seen;\n"
+    "\n"
+    "        if (head - ring->tail > ring->mask) {\n"
+    "            atomic_inc (&ring->dropped);\n"
+    "            return 0;\n"
+    "        }\n"
+    "\n"
+    "        seen = atomic_cmpxchg (&ring->head, head, head + 1);\n"
+    "\n"
+    "        if (seen == head)\n"
+    "            break;\n"
+    "\n"
+    "        head = seen;\n"
+    "    }\n"
+    "\n"
+    "    *index = head;\n"
+    "    return ((global uchar *) (ring + 1)) + (head & ring->mask) * ring->stride + 2 * sizeof (uint);\n"
+    "}\n"
+    "\n"
+    "static inline void\n"
+    "ocl_ring_commit (global OclRing *ring, uint index, uint tag)\n"
+    "{\n"
+    "    global uint *slot = (global uint *) (((global uchar *) (ring + 1)) + (index & ring->mask) * ring->stride);\n"
+    "\n"
+    "    slot[1] = tag;\n"
+    "    mem_fence (CLK_GLOBAL_MEM_FENCE);\n"
+    "    atomic_xchg (slot, index + 1);\n"
+    "}\n"
+    "#endif\n"
+    "#endif\n";
+
+static int
+has_svm_atomics (const OclDeviceInfo *info)
+{
+    return (info->features & OCL_DEVICE_SVM_FINE_GRAIN) && (info->features & OCL_DEVICE_SVM_ATOMICS);
+}
+
+OclRing *
+ocl_ring_new (OclPlatform *ocl,
+              unsigned device,
+              size_t record_size,
+              size_t capacity,
+              cl_int *errcode)
+{
+    OclRing *ring;
+    const OclDeviceInfo *info;
+    size_t stride;
+    size_t slots;
+    cl_int error = CL_SUCCESS;
+
+    assert (ocl != NULL);
+
+    if (device >= (unsigned) ocl_get_num_devices (ocl)) {
+        ocl_transfer_error (CL_INVALID_DEVICE, errcode);
+        return NULL;
+    }
+
+    if (capacity == 0 || capacity > (1 << 30)) {
+        ocl_transfer_error (CL_INVALID_VALUE, errcode);
+        return NULL;
+    }
+
+    info = ocl_get_device_info (ocl, device);
+
+    if (!has_svm_atomics (info) && !(info->type & CL_DEVICE_TYPE_CPU)) {
+        ocl_transfer_error (CL_INVALID_DEVICE, errcode);
+        return NULL;
+    }
+
+    /* power of two capacity so that indices can wrap around freely */
+    for (slots = 1; slots < capacity; slots <<= 1)
+        ;
+
+    stride = (2 * sizeof (cl_uint) + record_size + SLOT_ALIGN - 1) / SLOT_ALIGN * SLOT_ALIGN;
+
+    ring = malloc (sizeof (OclRing));
+
+    if (ring == NULL) {
+        ocl_transfer_error (CL_OUT_OF_HOST_MEMORY, errcode);
+        return NULL;
+    }
+
+    ring->ocl = ocl;
+    ring->device = device;
+    ring->buffer = NULL;
+    ring->memory = NULL;
+    ring->size = HEADER_SIZE + slots * stride;
+    ring->tail = 0;
+    ring->idle = 0;
+
+    if (has_svm_atomics (info)) {
+        ring->memory = clSVMAlloc (ocl_get_context (ocl),
+                                   CL_MEM_READ_WRITE | CL_MEM_SVM_FINE_GRAIN_BUFFER | CL_MEM_SVM_ATOMICS,
+                                   ring->size, 0);
+
+        if (ring->memory == NULL)
+            error = CL_MEM_OBJECT_ALLOCATION_FAILURE;
+    }
+    else {
+        ring->buffer = clCreateBuffer (ocl_get_context (ocl), CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                                       ring->size, NULL, &error);
+
+        if (error == CL_SUCCESS)
+            ring->memory = ocl_host_map (ocl, device, ring->buffer, CL_MAP_READ | CL_MAP_WRITE, ring->size, &error);
+    }
+
+    if (error != CL_SUCCESS) {
+        ocl_transfer_error (error, errcode);
+        ocl_ring_free (ring);
+        return NULL;
+    }
+
+    memset (ring->memory, 0, ring->size);
+    ring->header = (volatile Header *) ring->memory;
+    ring->slots = ((volatile char *) ring->memory) + HEADER_SIZE;
+    ring->header->mask = (cl_uint) (slots - 1);
+    ring->header->stride = (cl_uint) stride;
+    __sync_synchronize ();
+
+    ocl_transfer_error (CL_SUCCESS, errcode);
+    return ring;
+}
+
+void
+ocl_ring_free (OclRing *ring)
+{
+    if (ring == NULL)
+        return;
+
+    if (ring->buffer != NULL) {
+        if (ring->memory != NULL)
+            OCL_CHECK_ERROR (ocl_host_unmap (ring->ocl, ring->device, ring->buffer, ring->memory));
+
+        OCL_CHECK_ERROR (clReleaseMemObject (ring->buffer));
+    }
+    else if (ring->memory != NULL) {
+        clSVMFree (ocl_get_context (ring->ocl), ring->memory);
+    }
+
+    free (ring);
+}
+
+const char *
+ocl_ring_get_source (void)
+{
+    return RING_SOURCE;
+}
+
+const char *
+ocl_ring_get_build_options (OclRing *ring)
+{
+    assert (ring != NULL);
+    return ring->buffer == NULL ? "-cl-std=CL2.0" : NULL;
+}
+
+cl_int
+ocl_ring_set_kernel_arg (OclRing *ring,
+                         cl_kernel kernel,
+                         cl_uint index)
+{
+    assert (ring != NULL);
+
+    if (ring->buffer != NULL)
+        return clSetKernelArg (kernel, index, sizeof (cl_mem), &ring->buffer);
+
+    return clSetKernelArgSVMPointer (kernel, index, ring->memory);
+}
+
+size_t
+ocl_ring_drain (OclRing *ring,
+                OclRingFunc func,
+                void *user_data)
+{
+    size_t num_records = 0;
+    cl_uint mask;
+    cl_uint stride;
+
+    assert (ring != NULL);
+    assert (func != NULL);
+
+    mask = ring->header->mask;
+    stride = ring->header->stride;
+
+    for (;;) {
+        volatile cl_uint *slot;
+
+        slot = (volatile cl_uint *) (ring->slots + (ring->tail & mask) * stride);
+
+        if (slot[0] != ring->tail + 1)
+            break;
+
+        /* do not read the payload before the index that published it */
+        __sync_synchronize ();
+        func (slot[1], (const void *) (slot + 2), user_data);
+        ring->tail++;
+        num_records++;
+
+        /* hand back half a ring at a time while producers keep up */
+        if ((num_records & (mask >> 1)) == 0) {
+            __sync_synchronize ();
+            ring->header->tail = ring->tail;
+        }
+    }
+
+    if (num_records > 0) {
+        __sync_synchronize ();
+        ring->header->tail = ring->tail;
+    }
+
+    return num_records;
+}
+
+size_t
+ocl_ring_poll (OclRing *ring,
+               OclRingFunc func,
+               void *user_data)
+{
+    struct timespec delay;
+    size_t num_records;
+    unsigned shift;
+
+    num_records = ocl_ring_drain (ring, func, user_data);
+
+    if (num_records > 0) {
+        ring->idle = 0;
+        return num_records;
+    }
+
+    /* yield a few times before sleeping exponentially longer */
+    if (ring->idle < SPIN_ROUNDS) {
+        ring->idle++;
+        sched_yield ();
+        return 0;
+    }
+
+    shift = ring->idle - SPIN_ROUNDS;
+
+    if ((1u << shift) < MAX_SLEEP_US)
+        ring->idle++;
+
+    delay.tv_sec = 0;
+    delay.tv_nsec = ((1u << shift) < MAX_SLEEP_US ? (1u << shift) : MAX_SLEEP_US) * 1000;
+    nanosleep (&delay, NULL);
+    return 0;
+}
+
+unsigned
+ocl_ring_get_dropped (OclRing *ring)
+{
+    assert (ring != NULL);
+    return ring->header->dropped;
+}
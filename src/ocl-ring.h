@@ -0,0 +1,49 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OCL_RING_H
+#define OCL_RING_H
+
+#include "ocl.h"
+
+typedef struct OclRing OclRing;
+
+typedef void (*OclRingFunc) (unsigned tag, const void *data, void *user_data);
+
+OclRing *           ocl_ring_new        (OclPlatform        *ocl,
+                                         unsigned            device,
+                                         size_t              record_size,
+                                         size_t              capacity,
+                                         cl_int             *errcode);
+void                ocl_ring_free       (OclRing            *ring);
+const char *        ocl_ring_get_source (void);
+const char *        ocl_ring_get_build_options
+                                        (OclRing            *ring);
+cl_int              ocl_ring_set_kernel_arg
+                                        (OclRing            *ring,
+                                         cl_kernel           kernel,
+                                         cl_uint             index);
+size_t              ocl_ring_drain      (OclRing            *ring,
+                                         OclRingFunc         func,
+                                         void               *user_data);
+size_t              ocl_ring_poll       (OclRing            *ring,
+                                         OclRingFunc         func,
+                                         void               *user_data);
+unsigned            ocl_ring_get_dropped
+                                        (OclRing            *ring);
+
+#endif
@@ -0,0 +1,296 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "ocl-staging.h"
+
+/*
+ * Each slot is a CL_MEM_ALLOC_HOST_PTR buffer that stays mapped for the
+ * lifetime of the manager. Transfers are enqueued from the mapped, and
+ * therefore pinned, host pointer so that the runtime can DMA directly without
+ * an intermediate copy. A slot is reused once its transfer event completed.
+ */
+typedef struct {
+    cl_mem               mem;
+    void                *host;
+    cl_event             event;
+} Slot;
+
+struct OclStaging {
+    cl_command_queue     queue;
+    size_t               slot_size;
+    unsigned             num_slots;
+    unsigned             next;
+    Slot                *slots;
+};
+
+static cl_int
+wait_for_slot (Slot *slot)
+{
+    cl_int errcode = CL_SUCCESS;
+
+    if (slot->event != NULL) {
+        errcode = clWaitForEvents (1, &slot->event);
+        OCL_CHECK_ERROR (clReleaseEvent (slot->event));
+        slot->event = NULL;
+    }
+
+    return errcode;
+}
+
+static Slot *
+acquire_slot (OclStaging *staging, cl_int *errcode)
+{
+    Slot *slot;
+
+    /* slots are used round-robin, so the next one is always the oldest */
+    slot = &staging->slots[staging->next];
+    staging->next = (staging->next + 1) % staging->num_slots;
+    *errcode = wait_for_slot (slot);
+    return slot;
+}
+
+OclStaging *
+ocl_staging_new (cl_context context,
+                 cl_command_queue queue,
+                 size_t slot_size,
+                 unsigned num_slots,
+                 cl_int *errcode)
+{
+    OclStaging *staging;
+    cl_int tmp_err = CL_SUCCESS;
+
+    if (slot_size == 0 || num_slots == 0) {
+        if (errcode != NULL)
+            *errcode = CL_INVALID_VALUE;
+
+        return NULL;
+    }
+
+    staging = calloc (1, sizeof (OclStaging));
+    staging->queue = queue;
+    staging->slot_size = slot_size;
+    staging->num_slots = num_slots;
+    staging->slots = calloc (num_slots, sizeof (Slot));
+
+    OCL_CHECK_ERROR (clRetainCommandQueue (queue));
+
+    for (unsigned i = 0; i < num_slots; i++) {
+        Slot *slot = &staging->slots[i];
+
+        slot->mem = clCreateBuffer (context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                                    slot_size, NULL, &tmp_err);
+
+        if (tmp_err != CL_SUCCESS)
+            break;
+
+        slot->host = clEnqueueMapBuffer (queue, slot->mem, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE,
+                                         0, slot_size, 0, NULL, NULL, &tmp_err);
+
+        if (tmp_err != CL_SUCCESS)
+            break;
+    }
+
+    if (errcode != NULL)
+        *errcode = tmp_err;
+
+    if (tmp_err != CL_SUCCESS) {
+        ocl_staging_free (staging);
+        return NULL;
+    }
+
+    return staging;
+}
+
+cl_int
+ocl_staging_write (OclStaging *staging,
+                   cl_mem buffer,
+                   size_t offset,
+                   size_t size,
+                   const void *data,
+                   cl_uint num_events_in_wait_list,
+                   const cl_event *event_wait_list,
+                   cl_event *event)
+{
+    const char *src = data;
+    cl_event *chunk_events;
+    cl_uint num_chunks;
+    cl_uint num_stored = 0;
+    cl_int errcode = CL_SUCCESS;
+
+    assert (staging != NULL);
+
+    num_chunks = (size + staging->slot_size - 1) / staging->slot_size;
+    chunk_events = calloc (num_chunks > 0 ? num_chunks : 1, sizeof (cl_event));
+
+    for (cl_uint i = 0; i < num_chunks; i++) {
+        size_t chunk_offset = i * staging->slot_size;
+        size_t chunk_size = size - chunk_offset < staging->slot_size ? size - chunk_offset : staging->slot_size;
+        Slot *slot;
+
+        slot = acquire_slot (staging, &errcode);
+
+        if (errcode != CL_SUCCESS)
+            break;
+
+        memcpy (slot->host, src + chunk_offset, chunk_size);
+
+        errcode = clEnqueueWriteBuffer (staging->queue, buffer, CL_FALSE,
+                                        offset + chunk_offset, chunk_size, slot->host,
+                                        num_events_in_wait_list, event_wait_list, &slot->event);
+
+        if (errcode != CL_SUCCESS) {
+            slot->event = NULL;
+            break;
+        }
+
+        /* the slot releases its event when it is reused by a later chunk */
+        OCL_CHECK_ERROR (clRetainEvent (slot->event));
+        chunk_events[i] = slot->event;
+        num_stored++;
+    }
+
+    if (errcode == CL_SUCCESS && event != NULL) {
+        if (num_chunks == 1) {
+            OCL_CHECK_ERROR (clRetainEvent (chunk_events[0]));
+            *event = chunk_events[0];
+        }
+        else
+            errcode = clEnqueueMarkerWithWaitList (staging->queue, num_chunks, num_chunks > 0 ? chunk_events : NULL, event);
+    }
+
+    for (cl_uint i = 0; i < num_stored; i++)
+        OCL_CHECK_ERROR (clReleaseEvent (chunk_events[i]));
+
+    free (chunk_events);
+    return errcode;
+}
+
+cl_int
+ocl_staging_read (OclStaging *staging,
+                  cl_mem buffer,
+                  size_t offset,
+                  size_t size,
+                  void *data,
+                  cl_uint num_events_in_wait_list,
+                  const cl_event *event_wait_list)
+{
+    char *dst = data;
+    size_t *chunk_offsets;
+    cl_uint num_chunks;
+    cl_uint issued = 0;
+    cl_int errcode;
+
+    assert (staging != NULL);
+
+    errcode = ocl_staging_finish (staging);
+
+    if (errcode != CL_SUCCESS)
+        return errcode;
+
+    num_chunks = (size + staging->slot_size - 1) / staging->slot_size;
+    chunk_offsets = calloc (staging->num_slots, sizeof (size_t));
+
+    /*
+     * Keep all slots busy: while the oldest chunk is copied out on the host,
+     * the following chunks are still in flight.
+     */
+    for (cl_uint i = 0; i < num_chunks + staging->num_slots; i++) {
+        Slot *slot = &staging->slots[staging->next];
+        size_t *slot_offset = &chunk_offsets[staging->next];
+
+        if (slot->event != NULL) {
+            size_t chunk_size = size - *slot_offset < staging->slot_size ? size - *slot_offset : staging->slot_size;
+
+            errcode = wait_for_slot (slot);
+
+            if (errcode != CL_SUCCESS)
+                break;
+
+            memcpy (dst + *slot_offset, slot->host, chunk_size);
+        }
+
+        if (issued < num_chunks) {
+            size_t chunk_offset = issued * staging->slot_size;
+            size_t chunk_size = size - chunk_offset < staging->slot_size ? size - chunk_offset : staging->slot_size;
+
+            errcode = clEnqueueReadBuffer (staging->queue, buffer, CL_FALSE,
+                                           offset + chunk_offset, chunk_size, slot->host,
+                                           num_events_in_wait_list, event_wait_list, &slot->event);
+
+            if (errcode != CL_SUCCESS) {
+                slot->event = NULL;
+                break;
+            }
+
+            *slot_offset = chunk_offset;
+            issued++;
+        }
+
+        staging->next = (staging->next + 1) % staging->num_slots;
+    }
+
+    free (chunk_offsets);
+
+    if (errcode != CL_SUCCESS)
+        ocl_staging_finish (staging);
+
+    return errcode;
+}
+
+cl_int
+ocl_staging_finish (OclStaging *staging)
+{
+    cl_int errcode = CL_SUCCESS;
+
+    assert (staging != NULL);
+
+    for (unsigned i = 0; i < staging->num_slots; i++) {
+        cl_int tmp_err = wait_for_slot (&staging->slots[i]);
+
+        if (tmp_err != CL_SUCCESS)
+            errcode = tmp_err;
+    }
+
+    return errcode;
+}
+
+void
+ocl_staging_free (OclStaging *staging)
+{
+    if (staging == NULL)
+        return;
+
+    ocl_staging_finish (staging);
+
+    for (unsigned i = 0; i < staging->num_slots; i++) {
+        Slot *slot = &staging->slots[i];
+
+        if (slot->host != NULL)
+            OCL_CHECK_ERROR (clEnqueueUnmapMemObject (staging->queue, slot->mem, slot->host, 0, NULL, NULL));
+
+        if (slot->mem != NULL)
+            OCL_CHECK_ERROR (clReleaseMemObject (slot->mem));
+    }
+
+    OCL_CHECK_ERROR (clFinish (staging->queue));
+    OCL_CHECK_ERROR (clReleaseCommandQueue (staging->queue));
+    free (staging->slots);
+    free (staging);
+}
@@ -0,0 +1,48 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OCL_STAGING_H
+#define OCL_STAGING_H
+
+#include "ocl.h"
+
+typedef struct OclStaging OclStaging;
+
+OclStaging *        ocl_staging_new     (cl_context          context,
+                                         cl_command_queue    queue,
+                                         size_t              slot_size,
+                                         unsigned            num_slots,
+                                         cl_int             *errcode);
+cl_int              ocl_staging_write   (OclStaging         *staging,
+                                         cl_mem              buffer,
+                                         size_t              offset,
+                                         size_t              size,
+                                         const void         *data,
+                                         cl_uint             num_events_in_wait_list,
+                                         const cl_event     *event_wait_list,
+                                         cl_event           *event);
+cl_int              ocl_staging_read    (OclStaging         *staging,
+                                         cl_mem              buffer,
+                                         size_t              offset,
+                                         size_t              size,
+                                         void               *data,
+                                         cl_uint             num_events_in_wait_list,
+                                         const cl_event     *event_wait_list);
+cl_int              ocl_staging_finish  (OclStaging         *staging);
+void                ocl_staging_free    (OclStaging         *staging);
+
+#endif
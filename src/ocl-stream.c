@@ -0,0 +1,361 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ocl-stream.h"
+#include "ocl-private.h"
+
+/*
+ * The input file is mapped read-only and every chunk is uploaded straight
+ * from the mapping, the output file is mapped shared and every result is
+ * downloaded straight into it, so no bounce copy is involved. Like
+ * OclPipeline, chunks rotate over num_sets device buffer sets on the upload,
+ * compute and download queues of the device and the kernel receives input
+ * and output as arguments 0 and 1.
+ *
+ * Before uploading a chunk its pages are touched on the host, which is the
+ * disk read stage, and the chunk num_sets ahead is announced with
+ * POSIX_MADV_WILLNEED so that it is read while the device is busy. Retired
+ * input chunks are released with POSIX_MADV_DONTNEED to keep the footprint
+ * bounded. A short last chunk is padded with zeros.
+ */
+typedef struct {
+    cl_mem               input;
+    cl_mem               output;
+    cl_event             events[3];
+    unsigned long        index;
+    int                  busy;
+} Set;
+
+typedef struct {
+    cl_command_queue     queues[3];
+    int                  profiling;
+    unsigned char       *input;
+    size_t               input_size;
+    size_t               input_chunk_size;
+    size_t               page_size;
+    double               stage_times[3];
+} Stream;
+
+static void
+advise (Stream *stream, size_t offset, size_t size, int advice)
+{
+    size_t start;
+    size_t end;
+
+    if (offset >= stream->input_size)
+        return;
+
+    if (size > stream->input_size - offset)
+        size = stream->input_size - offset;
+
+    /* only whole pages, neighbouring chunks may still be in flight */
+    start = (offset + stream->page_size - 1) / stream->page_size * stream->page_size;
+    end = (offset + size) / stream->page_size * stream->page_size;
+
+    if (offset + size == stream->input_size)
+        end = offset + size;
+
+    if (start < end)
+        posix_madvise (stream->input + start, end - start, advice);
+}
+
+static cl_int
+retire_set (Stream *stream, Set *set)
+{
+    cl_int errcode;
+
+    /* without an output file there is no download event */
+    errcode = ocl_retire_stage_events (set->events, 3, stream->profiling, stream->stage_times);
+    advise (stream, set->index * stream->input_chunk_size, stream->input_chunk_size, POSIX_MADV_DONTNEED);
+    set->busy = 0;
+    return errcode;
+}
+
+static double
+touch_pages (Stream *stream, size_t offset, size_t size)
+{
+    volatile unsigned char sum = 0;
+    cl_ulong start;
+
+    start = ocl_time_ns ();
+
+    for (size_t i = 0; i < size; i += stream->page_size)
+        sum += stream->input[offset + i];
+
+    return (ocl_time_ns () - start) / 1e9;
+}
+
+static void *
+map_output (const char *filename, size_t size, int *fd)
+{
+    void *data;
+
+    *fd = open (filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (*fd < 0) {
+        fprintf (stderr, "Could not open %s: %s\n", filename, strerror (errno));
+        return NULL;
+    }
+
+    if (ftruncate (*fd, size) < 0 ||
+        (data = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0)) == MAP_FAILED) {
+        fprintf (stderr, "Could not map %s: %s\n", filename, strerror (errno));
+        close (*fd);
+        return NULL;
+    }
+
+    return data;
+}
+
+static double
+bandwidth (size_t bytes, double time)
+{
+    return time > 0.0 ? bytes / 1024. / 1024. / time : 0.0;
+}
+
+cl_int
+ocl_stream_file (OclPlatform *ocl,
+                 unsigned device,
+                 cl_kernel kernel,
+                 const char *input_filename,
+                 const char *output_filename,
+                 size_t input_chunk_size,
+                 size_t output_chunk_size,
+                 unsigned num_sets,
+                 cl_uint work_dim,
+                 const size_t *global_work_size,
+                 const size_t *local_work_size,
+                 OclStreamStats *stats)
+{
+    Stream stream;
+    Set *sets = NULL;
+    struct stat st;
+    unsigned char *output = NULL;
+    unsigned char *tail = NULL;
+    size_t output_size = 0;
+    unsigned long num_chunks;
+    unsigned long index = 0;
+    double read_time = 0.0;
+    double write_time = 0.0;
+    cl_context context;
+    cl_ulong start;
+    cl_int errcode = CL_SUCCESS;
+    int input_fd;
+    int output_fd = -1;
+
+    assert (ocl != NULL);
+    assert (input_filename != NULL);
+
+    if (num_sets == 0 || input_chunk_size == 0 || output_chunk_size == 0 ||
+        work_dim == 0 || work_dim > 3 || global_work_size == NULL ||
+        ocl_get_queue (ocl, device, OCL_QUEUE_COMPUTE) == NULL)
+        return CL_INVALID_VALUE;
+
+    memset (&stream, 0, sizeof (Stream));
+    stream.queues[0] = ocl_get_queue (ocl, device, OCL_QUEUE_UPLOAD);
+    stream.queues[1] = ocl_get_queue (ocl, device, OCL_QUEUE_COMPUTE);
+    stream.queues[2] = ocl_get_queue (ocl, device, OCL_QUEUE_DOWNLOAD);
+    stream.profiling = 1;
+    stream.input_chunk_size = input_chunk_size;
+    stream.page_size = (size_t) sysconf (_SC_PAGESIZE);
+
+    for (int i = 0; i < 3; i++)
+        stream.profiling = stream.profiling && ocl_queue_has_profiling (stream.queues[i]);
+
+    input_fd = open (input_filename, O_RDONLY);
+
+    if (input_fd < 0 || fstat (input_fd, &st) < 0 || st.st_size == 0) {
+        fprintf (stderr, "Could not open %s: %s\n", input_filename, strerror (errno));
+
+        if (input_fd >= 0)
+            close (input_fd);
+
+        return CL_INVALID_VALUE;
+    }
+
+    stream.input_size = st.st_size;
+    stream.input = mmap (NULL, stream.input_size, PROT_READ, MAP_PRIVATE, input_fd, 0);
+    close (input_fd);
+
+    if (stream.input == MAP_FAILED) {
+        fprintf (stderr, "Could not map %s: %s\n", input_filename, strerror (errno));
+        return CL_OUT_OF_HOST_MEMORY;
+    }
+
+    posix_madvise (stream.input, stream.input_size, POSIX_MADV_SEQUENTIAL);
+    num_chunks = (stream.input_size + input_chunk_size - 1) / input_chunk_size;
+
+    if (output_filename != NULL) {
+        output_size = num_chunks * output_chunk_size;
+        output = map_output (output_filename, output_size, &output_fd);
+
+        if (output == NULL) {
+            errcode = CL_OUT_OF_HOST_MEMORY;
+            goto ocl_stream_file_cleanup;
+        }
+    }
+
+    context = ocl_get_context (ocl);
+    sets = calloc (num_sets, sizeof (Set));
+
+    for (unsigned i = 0; i < num_sets && errcode == CL_SUCCESS; i++) {
+        sets[i].input = clCreateBuffer (context, CL_MEM_READ_ONLY, input_chunk_size, NULL, &errcode);
+
+        if (errcode == CL_SUCCESS)
+            sets[i].output = clCreateBuffer (context, CL_MEM_WRITE_ONLY, output_chunk_size, NULL, &errcode);
+    }
+
+    if (errcode != CL_SUCCESS)
+        goto ocl_stream_file_cleanup;
+
+    advise (&stream, 0, num_sets * input_chunk_size, POSIX_MADV_WILLNEED);
+    start = ocl_time_ns ();
+
+    for (index = 0; index < num_chunks; index++) {
+        Set *set = &sets[index % num_sets];
+        const size_t *local = local_work_size;
+        size_t offset = index * input_chunk_size;
+        size_t size = input_chunk_size;
+        const void *data = stream.input + offset;
+
+        if (set->busy && (errcode = retire_set (&stream, set)) != CL_SUCCESS)
+            break;
+
+        advise (&stream, offset + num_sets * input_chunk_size, input_chunk_size, POSIX_MADV_WILLNEED);
+
+        if (size > stream.input_size - offset)
+            size = stream.input_size - offset;
+
+        read_time += touch_pages (&stream, offset, size);
+
+        if (size < input_chunk_size) {
+            tail = calloc (1, input_chunk_size);
+            memcpy (tail, data, size);
+            data = tail;
+        }
+
+        errcode = clEnqueueWriteBuffer (stream.queues[0], set->input, CL_FALSE,
+                                        0, input_chunk_size, data, 0, NULL, &set->events[0]);
+
+        if (errcode != CL_SUCCESS)
+            break;
+
+        OCL_CHECK_ERROR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &set->input));
+        OCL_CHECK_ERROR (clSetKernelArg (kernel, 1, sizeof (cl_mem), &set->output));
+
+        errcode = clEnqueueNDRangeKernel (stream.queues[1], kernel, work_dim, NULL, global_work_size, local,
+                                          1, &set->events[0], &set->events[1]);
+
+        if (errcode != CL_SUCCESS) {
+            clWaitForEvents (1, &set->events[0]);
+            OCL_CHECK_ERROR (clReleaseEvent (set->events[0]));
+            set->events[0] = NULL;
+            break;
+        }
+
+        if (output != NULL) {
+            errcode = clEnqueueReadBuffer (stream.queues[2], set->output, CL_FALSE,
+                                           0, output_chunk_size, output + index * output_chunk_size,
+                                           1, &set->events[1], &set->events[2]);
+
+            if (errcode != CL_SUCCESS) {
+                clWaitForEvents (2, set->events);
+                OCL_CHECK_ERROR (clReleaseEvent (set->events[0]));
+                OCL_CHECK_ERROR (clReleaseEvent (set->events[1]));
+                set->events[0] = set->events[1] = NULL;
+                break;
+            }
+        }
+
+        for (int i = 0; i < 3; i++)
+            OCL_CHECK_ERROR (clFlush (stream.queues[i]));
+
+        set->index = index;
+        set->busy = 1;
+    }
+
+    /* drain the remaining sets in submission order */
+    for (unsigned i = 0; i < num_sets; i++) {
+        Set *set = &sets[(index + i) % num_sets];
+
+        if (set->busy) {
+            cl_int tmp_err = retire_set (&stream, set);
+
+            if (errcode == CL_SUCCESS)
+                errcode = tmp_err;
+        }
+    }
+
+    if (output != NULL) {
+        cl_ulong write_start = ocl_time_ns ();
+
+        msync (output, output_size, MS_SYNC);
+        write_time = (ocl_time_ns () - write_start) / 1e9;
+    }
+
+    if (stats != NULL) {
+        size_t bytes_written = output != NULL ? index * output_chunk_size : 0;
+
+        stats->num_chunks = index;
+        stats->bytes_read = index < num_chunks ? index * input_chunk_size : stream.input_size;
+        stats->bytes_written = bytes_written;
+        stats->wall_time = (ocl_time_ns () - start) / 1e9;
+        stats->read_time = read_time;
+        stats->upload_time = stream.stage_times[0];
+        stats->compute_time = stream.stage_times[1];
+        stats->download_time = stream.stage_times[2];
+        stats->write_time = write_time;
+        stats->read_bandwidth = bandwidth (stats->bytes_read, read_time);
+        stats->upload_bandwidth = bandwidth (index * input_chunk_size, stats->upload_time);
+        stats->compute_bandwidth = bandwidth (index * input_chunk_size, stats->compute_time);
+        stats->download_bandwidth = bandwidth (bytes_written, stats->download_time);
+        stats->write_bandwidth = bandwidth (bytes_written, write_time);
+        stats->total_bandwidth = bandwidth (stats->bytes_read, stats->wall_time);
+    }
+
+ocl_stream_file_cleanup:
+    if (sets != NULL) {
+        for (unsigned i = 0; i < num_sets; i++) {
+            if (sets[i].input != NULL)
+                OCL_CHECK_ERROR (clReleaseMemObject (sets[i].input));
+
+            if (sets[i].output != NULL)
+                OCL_CHECK_ERROR (clReleaseMemObject (sets[i].output));
+        }
+    }
+
+    if (output != NULL) {
+        munmap (output, output_size);
+        close (output_fd);
+    }
+
+    munmap (stream.input, stream.input_size);
+    free (sets);
+    free (tail);
+    return errcode;
+}
@@ -0,0 +1,54 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OCL_STREAM_H
+#define OCL_STREAM_H
+
+#include "ocl.h"
+
+typedef struct {
+    unsigned long   num_chunks;
+    size_t          bytes_read;
+    size_t          bytes_written;
+    double          wall_time;
+    double          read_time;          /* host page-in of the input */
+    double          upload_time;        /* device times, need profiling */
+    double          compute_time;
+    double          download_time;
+    double          write_time;         /* final write-back of the output */
+    double          read_bandwidth;     /* MB/s of each stage */
+    double          upload_bandwidth;
+    double          compute_bandwidth;
+    double          download_bandwidth;
+    double          write_bandwidth;
+    double          total_bandwidth;    /* input MB per wall clock second */
+} OclStreamStats;
+
+cl_int              ocl_stream_file     (OclPlatform        *ocl,
+                                         unsigned            device,
+                                         cl_kernel           kernel,
+                                         const char         *input_filename,
+                                         const char         *output_filename,
+                                         size_t              input_chunk_size,
+                                         size_t              output_chunk_size,
+                                         unsigned            num_sets,
+                                         cl_uint             work_dim,
+                                         const size_t       *global_work_size,
+                                         const size_t       *local_work_size,
+                                         OclStreamStats     *stats);
+
+#endif
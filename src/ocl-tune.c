@@ -0,0 +1,489 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "ocl-tune.h"
+#include "ocl-private.h"
+
+/*
+ * Tuned local work sizes are keyed by a hash of the program source (or the
+ * device binary for programs without source), the kernel name and the device
+ * and driver identity, plus the work dimensions and global work size. They are
+ * kept in a text file with one entry per line:
+ *
+ *   <key> <work_dim> <global x y z> <local x y z> <time in ns>
+ *
+ * A local size of zero in all dimensions means that the runtime choice was
+ * fastest. Since every candidate is launched, tuning must only be used with
+ * kernels that can be run repeatedly.
+ */
+#define NUM_WARMUP  1
+#define NUM_RUNS    3
+#define MAX_MEMOS   64
+
+typedef struct {
+    cl_ulong             key;
+    cl_uint              work_dim;
+    size_t               global[3];
+    size_t               local[3];
+    cl_ulong             time;
+} Entry;
+
+/*
+ * Remembers the key of a kernel and device to avoid rehashing per launch. The
+ * kernel is retained while it is remembered so that its address cannot be
+ * reused by another kernel with a different key. Only the last MAX_MEMOS
+ * kernels are remembered, the oldest one is released to make room.
+ */
+typedef struct {
+    cl_kernel            kernel;
+    cl_device_id         device;
+    cl_ulong             key;
+} Memo;
+
+struct OclTuner {
+    char                *filename;
+    Entry               *entries;
+    unsigned             num_entries;
+    Memo                 memos[MAX_MEMOS];
+    unsigned             num_memos;
+    unsigned             next_memo;
+    pthread_mutex_t      lock;
+};
+
+static cl_ulong
+hash_info (cl_ulong hash, cl_device_id device, cl_device_info param)
+{
+    size_t size;
+    char *value;
+
+    if (clGetDeviceInfo (device, param, 0, NULL, &size) != CL_SUCCESS)
+        return hash;
+
+    value = malloc (size);
+
+    if (clGetDeviceInfo (device, param, size, value, NULL) == CL_SUCCESS)
+        hash = ocl_hash_bytes (hash, value, size);
+
+    free (value);
+    return hash;
+}
+
+static cl_ulong
+hash_program (cl_ulong hash, cl_program program, cl_device_id device)
+{
+    size_t size;
+    char *source;
+    cl_uint num_devices;
+    cl_device_id *devices;
+    size_t *sizes;
+    unsigned char **binaries;
+
+    OCL_CHECK_ERROR (clGetProgramInfo (program, CL_PROGRAM_SOURCE, 0, NULL, &size));
+
+    if (size > 1) {
+        source = malloc (size);
+        OCL_CHECK_ERROR (clGetProgramInfo (program, CL_PROGRAM_SOURCE, size, source, NULL));
+        hash = ocl_hash_bytes (hash, source, size);
+        free (source);
+        return hash;
+    }
+
+    /* programs created from binaries, e.g. by the program cache, have no source */
+    OCL_CHECK_ERROR (clGetProgramInfo (program, CL_PROGRAM_NUM_DEVICES, sizeof (cl_uint), &num_devices, NULL));
+    devices = malloc (num_devices * sizeof (cl_device_id));
+    sizes = malloc (num_devices * sizeof (size_t));
+    binaries = calloc (num_devices, sizeof (unsigned char *));
+    OCL_CHECK_ERROR (clGetProgramInfo (program, CL_PROGRAM_DEVICES, num_devices * sizeof (cl_device_id), devices, NULL));
+    OCL_CHECK_ERROR (clGetProgramInfo (program, CL_PROGRAM_BINARY_SIZES, num_devices * sizeof (size_t), sizes, NULL));
+
+    for (cl_uint i = 0; i < num_devices; i++) {
+        if (devices[i] == device)
+            binaries[i] = malloc (sizes[i]);
+    }
+
+    OCL_CHECK_ERROR (clGetProgramInfo (program, CL_PROGRAM_BINARIES, num_devices * sizeof (unsigned char *), binaries, NULL));
+
+    for (cl_uint i = 0; i < num_devices; i++) {
+        if (binaries[i] != NULL)
+            hash = ocl_hash_bytes (hash, binaries[i], sizes[i]);
+
+        free (binaries[i]);
+    }
+
+    free (binaries);
+    free (sizes);
+    free (devices);
+    return hash;
+}
+
+static cl_ulong
+get_key (OclTuner *tuner, cl_device_id device, cl_kernel kernel)
+{
+    cl_program program;
+    char name[256];
+    Memo *memo;
+    cl_ulong key = OCL_HASH_SEED;
+
+    for (unsigned i = 0; i < tuner->num_memos; i++) {
+        if (tuner->memos[i].kernel == kernel && tuner->memos[i].device == device)
+            return tuner->memos[i].key;
+    }
+
+    OCL_CHECK_ERROR (clGetKernelInfo (kernel, CL_KERNEL_PROGRAM, sizeof (cl_program), &program, NULL));
+    OCL_CHECK_ERROR (clGetKernelInfo (kernel, CL_KERNEL_FUNCTION_NAME, sizeof (name), name, NULL));
+
+    key = hash_program (key, program, device);
+    key = ocl_hash_string (key, name);
+    key = hash_info (key, device, CL_DEVICE_NAME);
+    key = hash_info (key, device, CL_DRIVER_VERSION);
+
+    memo = &tuner->memos[tuner->next_memo];
+
+    if (tuner->num_memos == MAX_MEMOS) {
+        OCL_CHECK_ERROR (clReleaseKernel (memo->kernel));
+    }
+    else
+        tuner->num_memos++;
+
+    OCL_CHECK_ERROR (clRetainKernel (kernel));
+    memo->kernel = kernel;
+    memo->device = device;
+    memo->key = key;
+    tuner->next_memo = (tuner->next_memo + 1) % MAX_MEMOS;
+
+    return key;
+}
+
+static Entry *
+find_entry (OclTuner *tuner, cl_ulong key, cl_uint work_dim, const size_t *global_work_size)
+{
+    for (unsigned i = 0; i < tuner->num_entries; i++) {
+        Entry *entry = &tuner->entries[i];
+        int match = entry->key == key && entry->work_dim == work_dim;
+
+        for (cl_uint d = 0; match && d < work_dim; d++)
+            match = entry->global[d] == global_work_size[d];
+
+        if (match)
+            return entry;
+    }
+
+    return NULL;
+}
+
+static void
+load_entries (OclTuner *tuner)
+{
+    FILE *fp;
+    Entry entry;
+    unsigned long long key, time;
+    size_t *g = entry.global;
+    size_t *l = entry.local;
+
+    if ((fp = fopen (tuner->filename, "r")) == NULL)
+        return;
+
+    while (fscanf (fp, "%llx %u %zu %zu %zu %zu %zu %zu %llu",
+                   &key, &entry.work_dim, &g[0], &g[1], &g[2], &l[0], &l[1], &l[2], &time) == 9) {
+        if (entry.work_dim < 1 || entry.work_dim > 3)
+            continue;
+
+        entry.key = key;
+        entry.time = time;
+        tuner->entries = realloc (tuner->entries, (tuner->num_entries + 1) * sizeof (Entry));
+        tuner->entries[tuner->num_entries++] = entry;
+    }
+
+    fclose (fp);
+}
+
+static void
+save_entries (OclTuner *tuner)
+{
+    FILE *fp;
+    char *tmp_filename;
+    int fd;
+
+    tmp_filename = malloc (strlen (tuner->filename) + 8);
+    sprintf (tmp_filename, "%s.XXXXXX", tuner->filename);
+
+    /* replace atomically so that concurrent readers never see partial files */
+    if ((fd = mkstemp (tmp_filename)) < 0 || (fp = fdopen (fd, "w")) == NULL) {
+        if (fd >= 0) {
+            close (fd);
+            unlink (tmp_filename);
+        }
+
+        free (tmp_filename);
+        return;
+    }
+
+    for (unsigned i = 0; i < tuner->num_entries; i++) {
+        Entry *e = &tuner->entries[i];
+
+        fprintf (fp, "%016llx %u %zu %zu %zu %zu %zu %zu %llu\n",
+                 (unsigned long long) e->key, e->work_dim,
+                 e->global[0], e->global[1], e->global[2],
+                 e->local[0], e->local[1], e->local[2],
+                 (unsigned long long) e->time);
+    }
+
+    if (fclose (fp) != 0 || rename (tmp_filename, tuner->filename) != 0)
+        unlink (tmp_filename);
+
+    free (tmp_filename);
+}
+
+static cl_int
+measure (cl_command_queue queue,
+         cl_kernel kernel,
+         cl_uint work_dim,
+         const size_t *global_work_size,
+         const size_t *local_work_size,
+         int profiling,
+         cl_ulong *time)
+{
+    *time = 0;
+
+    for (int r = 0; r < NUM_WARMUP + NUM_RUNS; r++) {
+        cl_event event;
+        cl_ulong start, end;
+        cl_int errcode;
+
+        start = ocl_time_ns ();
+        errcode = clEnqueueNDRangeKernel (queue, kernel, work_dim, NULL, global_work_size, local_work_size,
+                                          0, NULL, &event);
+
+        if (errcode != CL_SUCCESS)
+            return errcode;
+
+        errcode = clWaitForEvents (1, &event);
+        end = ocl_time_ns ();
+
+        if (errcode == CL_SUCCESS && profiling)
+            ocl_get_event_times (event, &start, &end, NULL, NULL);
+
+        OCL_CHECK_ERROR (clReleaseEvent (event));
+
+        if (errcode != CL_SUCCESS)
+            return errcode;
+
+        /* the fastest run is the least disturbed one */
+        if (r >= NUM_WARMUP && (*time == 0 || end - start < *time))
+            *time = end - start;
+    }
+
+    return CL_SUCCESS;
+}
+
+static unsigned
+get_candidates (size_t max_size, size_t max_item, size_t global, size_t multiple, size_t *candidates)
+{
+    unsigned num = 0;
+
+    /* powers of two and multiples of the preferred size that divide the range */
+    for (size_t size = 1; size <= max_size && size <= max_item && size <= global; size++) {
+        int power = (size & (size - 1)) == 0;
+
+        if ((power || (multiple > 1 && size % multiple == 0)) && global % size == 0)
+            candidates[num++] = size;
+
+        if (num == 64)
+            break;
+    }
+
+    return num;
+}
+
+OclTuner *
+ocl_tuner_new (const char *filename)
+{
+    OclTuner *tuner;
+
+    tuner = calloc (1, sizeof (OclTuner));
+    pthread_mutex_init (&tuner->lock, NULL);
+
+    if (filename != NULL) {
+        tuner->filename = strdup (filename);
+        load_entries (tuner);
+    }
+
+    return tuner;
+}
+
+int
+ocl_tuner_lookup (OclTuner *tuner,
+                  cl_device_id device,
+                  cl_kernel kernel,
+                  cl_uint work_dim,
+                  const size_t *global_work_size,
+                  size_t *local_work_size)
+{
+    Entry *entry;
+
+    assert (tuner != NULL);
+
+    if (work_dim < 1 || work_dim > 3)
+        return 0;
+
+    pthread_mutex_lock (&tuner->lock);
+    entry = find_entry (tuner, get_key (tuner, device, kernel), work_dim, global_work_size);
+
+    if (entry != NULL)
+        memcpy (local_work_size, entry->local, work_dim * sizeof (size_t));
+
+    pthread_mutex_unlock (&tuner->lock);
+    return entry != NULL;
+}
+
+cl_int
+ocl_tuner_tune (OclTuner *tuner,
+                cl_command_queue queue,
+                cl_kernel kernel,
+                cl_uint work_dim,
+                const size_t *global_work_size,
+                size_t *local_work_size)
+{
+    cl_device_id device;
+    cl_command_queue_properties properties;
+    size_t kernel_wg_size;
+    size_t multiple;
+    size_t max_item_sizes[3];
+    size_t candidates[2][64];
+    unsigned num_candidates[2] = { 1, 1 };
+    size_t best[3] = { 0, 0, 0 };
+    cl_ulong best_time;
+    cl_int errcode;
+    Entry *entry;
+
+    assert (tuner != NULL);
+
+    if (work_dim < 1 || work_dim > 2 || global_work_size == NULL)
+        return CL_INVALID_VALUE;
+
+    OCL_CHECK_ERROR (clGetCommandQueueInfo (queue, CL_QUEUE_DEVICE, sizeof (cl_device_id), &device, NULL));
+    OCL_CHECK_ERROR (clGetCommandQueueInfo (queue, CL_QUEUE_PROPERTIES, sizeof (properties), &properties, NULL));
+    OCL_CHECK_ERROR (clGetKernelWorkGroupInfo (kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof (size_t), &kernel_wg_size, NULL));
+    OCL_CHECK_ERROR (clGetKernelWorkGroupInfo (kernel, device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof (size_t), &multiple, NULL));
+    OCL_CHECK_ERROR (clGetDeviceInfo (device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof (max_item_sizes), max_item_sizes, NULL));
+
+    /* the runtime's own choice is the baseline to beat */
+    errcode = measure (queue, kernel, work_dim, global_work_size, NULL,
+                       properties & CL_QUEUE_PROFILING_ENABLE, &best_time);
+
+    if (errcode != CL_SUCCESS)
+        return errcode;
+
+    candidates[1][0] = 1;
+
+    for (cl_uint d = 0; d < work_dim; d++)
+        num_candidates[d] = get_candidates (kernel_wg_size, max_item_sizes[d], global_work_size[d], multiple, candidates[d]);
+
+    for (unsigned i = 0; i < num_candidates[0]; i++) {
+        for (unsigned j = 0; j < num_candidates[1]; j++) {
+            size_t local[2] = { candidates[0][i], candidates[1][j] };
+            cl_ulong time;
+
+            if (local[0] * local[1] > kernel_wg_size)
+                continue;
+
+            /* some sizes are still rejected, e.g. for lack of local memory */
+            if (measure (queue, kernel, work_dim, global_work_size, local,
+                         properties & CL_QUEUE_PROFILING_ENABLE, &time) != CL_SUCCESS)
+                continue;
+
+            if (time < best_time) {
+                best_time = time;
+                best[0] = local[0];
+                best[1] = work_dim > 1 ? local[1] : 0;
+            }
+        }
+    }
+
+    memcpy (local_work_size, best, work_dim * sizeof (size_t));
+
+    pthread_mutex_lock (&tuner->lock);
+    entry = find_entry (tuner, get_key (tuner, device, kernel), work_dim, global_work_size);
+
+    if (entry == NULL) {
+        tuner->entries = realloc (tuner->entries, (tuner->num_entries + 1) * sizeof (Entry));
+        entry = &tuner->entries[tuner->num_entries++];
+        memset (entry, 0, sizeof (Entry));
+        entry->key = get_key (tuner, device, kernel);
+        entry->work_dim = work_dim;
+        memcpy (entry->global, global_work_size, work_dim * sizeof (size_t));
+    }
+
+    memcpy (entry->local, best, sizeof (best));
+    entry->time = best_time;
+
+    if (tuner->filename != NULL)
+        save_entries (tuner);
+
+    pthread_mutex_unlock (&tuner->lock);
+    return CL_SUCCESS;
+}
+
+cl_int
+ocl_tuner_enqueue (OclTuner *tuner,
+                   cl_command_queue queue,
+                   cl_kernel kernel,
+                   cl_uint work_dim,
+                   const size_t *global_work_size,
+                   cl_uint num_events_in_wait_list,
+                   const cl_event *event_wait_list,
+                   cl_event *event)
+{
+    cl_device_id device;
+    size_t local[3] = { 0, 0, 0 };
+
+    OCL_CHECK_ERROR (clGetCommandQueueInfo (queue, CL_QUEUE_DEVICE, sizeof (cl_device_id), &device, NULL));
+
+    if (!ocl_tuner_lookup (tuner, device, kernel, work_dim, global_work_size, local) && work_dim <= 2) {
+        cl_int errcode = ocl_tuner_tune (tuner, queue, kernel, work_dim, global_work_size, local);
+
+        if (errcode != CL_SUCCESS)
+            return errcode;
+    }
+
+    return clEnqueueNDRangeKernel (queue, kernel, work_dim, NULL, global_work_size,
+                                   local[0] == 0 ? NULL : local,
+                                   num_events_in_wait_list, event_wait_list, event);
+}
+
+void
+ocl_tuner_free (OclTuner *tuner)
+{
+    if (tuner == NULL)
+        return;
+
+    for (unsigned i = 0; i < tuner->num_memos; i++)
+        OCL_CHECK_ERROR (clReleaseKernel (tuner->memos[i].kernel));
+
+    pthread_mutex_destroy (&tuner->lock);
+    free (tuner->entries);
+    free (tuner->filename);
+    free (tuner);
+}
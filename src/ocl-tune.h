@@ -0,0 +1,48 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OCL_TUNE_H
+#define OCL_TUNE_H
+
+#include "ocl.h"
+
+typedef struct OclTuner OclTuner;
+
+OclTuner *          ocl_tuner_new       (const char         *filename);
+int                 ocl_tuner_lookup    (OclTuner           *tuner,
+                                         cl_device_id        device,
+                                         cl_kernel           kernel,
+                                         cl_uint             work_dim,
+                                         const size_t       *global_work_size,
+                                         size_t             *local_work_size);
+cl_int              ocl_tuner_tune      (OclTuner           *tuner,
+                                         cl_command_queue    queue,
+                                         cl_kernel           kernel,
+                                         cl_uint             work_dim,
+                                         const size_t       *global_work_size,
+                                         size_t             *local_work_size);
+cl_int              ocl_tuner_enqueue   (OclTuner           *tuner,
+                                         cl_command_queue    queue,
+                                         cl_kernel           kernel,
+                                         cl_uint             work_dim,
+                                         const size_t       *global_work_size,
+                                         cl_uint             num_events_in_wait_list,
+                                         const cl_event     *event_wait_list,
+                                         cl_event           *event);
+void                ocl_tuner_free      (OclTuner           *tuner);
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include "ocl-wait.h"
+#include "ocl-clock.h"
+
+/*
+ * clWaitForEvents usually sleeps on a condition or in the driver, and the
+ * wakeup alone can take longer than a short kernel. Polling the execution
+ * status reacts within a few hundred ns but keeps a core busy for as long as
+ * the command runs. The adaptive policy polls for a budget and blocks once it
+ * ran out. The budget is SPIN_FACTOR times a moving average of how long
+ * recent waits took, capped at MAX_SPIN_NS; once waits are longer than that
+ * on average, blocking is cheaper and only MIN_SPIN_NS are spent to notice
+ * when commands get short again. Polling needs the commands to be submitted,
+ * so the queues of all events are flushed first, as clWaitForEvents does.
+ *
+ * A waiter keeps no lock, each thread should use its own.
+ */
+#define MAX_SPIN_NS     200000
+#define MIN_SPIN_NS     20000
+#define SPIN_FACTOR     2
+#define AVERAGE_WEIGHT  8
+
+struct OclWaiter {
+    OclWaitPolicy        policy;
+    double               average;
+};
+
+OclWaiter *
+ocl_waiter_new (OclWaitPolicy policy)
+{
+    OclWaiter *waiter;
+
+    waiter = malloc (sizeof (OclWaiter));
+
+    if (waiter == NULL)
+        return NULL;
+
+    waiter->policy = policy;
+    waiter->average = MAX_SPIN_NS / SPIN_FACTOR;
+    return waiter;
+}
+
+void
+ocl_waiter_free (OclWaiter *waiter)
+{
+    free (waiter);
+}
+
+static cl_int
+flush_queues (cl_uint num_events,
+              const cl_event *events)
+{
+    cl_command_queue last = NULL;
+
+    for (cl_uint i = 0; i < num_events; i++) {
+        cl_command_queue queue;
+        cl_int errcode;
+
+        errcode = clGetEventInfo (events[i], CL_EVENT_COMMAND_QUEUE, sizeof (cl_command_queue), &queue, NULL);
+
+        if (errcode != CL_SUCCESS)
+            return errcode;
+
+        /* user events have no queue */
+        if (queue != NULL && queue != last) {
+            errcode = clFlush (queue);
+
+            if (errcode != CL_SUCCESS)
+                return errcode;
+
+            last = queue;
+        }
+    }
+
+    return CL_SUCCESS;
+}
+
+/* Returns 1 if all events completed, 0 if some are pending, an error otherwise */
+static cl_int
+poll_events (cl_uint num_events,
+             const cl_event *events,
+             cl_uint *first_pending)
+{
+    for (cl_uint i = *first_pending; i < num_events; i++) {
+        cl_int status;
+        cl_int errcode;
+
+        errcode = clGetEventInfo (events[i], CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof (cl_int), &status, NULL);
+
+        if (errcode != CL_SUCCESS)
+            return errcode;
+
+        if (status < 0)
+            return CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST;
+
+        if (status != CL_COMPLETE) {
+            *first_pending = i;
+            return 0;
+        }
+    }
+
+    *first_pending = num_events;
+    return 1;
+}
+
+cl_ulong
+ocl_waiter_get_spin_budget (OclWaiter *waiter)
+{
+    double budget;
+
+    assert (waiter != NULL);
+
+    switch (waiter->policy) {
+        case OCL_WAIT_BLOCK:
+            return 0;
+        case OCL_WAIT_SPIN:
+            return CL_ULONG_MAX;
+        default:
+            break;
+    }
+
+    budget = SPIN_FACTOR * waiter->average;
+    return budget > MAX_SPIN_NS ? MIN_SPIN_NS : (cl_ulong) budget;
+}
+
+cl_int
+ocl_waiter_wait (OclWaiter *waiter,
+                 cl_uint num_events,
+                 const cl_event *events)
+{
+    cl_ulong start;
+    cl_ulong budget;
+    cl_uint first_pending = 0;
+    cl_int result;
+
+    assert (waiter != NULL);
+
+    if (num_events == 0 || events == NULL)
+        return CL_INVALID_VALUE;
+
+    if (waiter->policy == OCL_WAIT_BLOCK)
+        return clWaitForEvents (num_events, events);
+
+    result = flush_queues (num_events, events);
+
+    if (result != CL_SUCCESS)
+        return result;
+
+    start = ocl_clock_host_time ();
+    budget = ocl_waiter_get_spin_budget (waiter);
+
+    /* events complete in order in most cases, so resume where the last poll stopped */
+    while ((result = poll_events (num_events, events, &first_pending)) == 0) {
+        if (ocl_clock_host_time () - start >= budget)
+            break;
+    }
+
+    if (result < 0)
+        return result;
+
+    if (result == 0) {
+        result = clWaitForEvents (num_events - first_pending, events + first_pending);
+
+        if (result != CL_SUCCESS)
+            return result;
+    }
+
+    if (waiter->policy == OCL_WAIT_ADAPTIVE)
+        waiter->average += ((double) (ocl_clock_host_time () - start) - waiter->average) / AVERAGE_WEIGHT;
+
+    return CL_SUCCESS;
+}
@@ -0,0 +1,39 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OCL_WAIT_H
+#define OCL_WAIT_H
+
+#include "ocl.h"
+
+typedef struct OclWaiter OclWaiter;
+
+typedef enum {
+    OCL_WAIT_BLOCK = 0,             /* clWaitForEvents */
+    OCL_WAIT_SPIN,                  /* poll the execution status */
+    OCL_WAIT_ADAPTIVE,              /* poll for a learned budget, then block */
+} OclWaitPolicy;
+
+OclWaiter *         ocl_waiter_new      (OclWaitPolicy       policy);
+void                ocl_waiter_free     (OclWaiter          *waiter);
+cl_int              ocl_waiter_wait     (OclWaiter          *waiter,
+                                         cl_uint             num_events,
+                                         const cl_event     *events);
+cl_ulong            ocl_waiter_get_spin_budget
+                                        (OclWaiter          *waiter);
+
+#endif
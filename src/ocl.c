@@ -15,22 +15,69 @@
  *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _XOPEN_SOURCE 700
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include "ocl.h"
+#include "ocl-private.h"
 
 struct OclPlatform {
     cl_platform_id       platform;
     cl_context           context;
     cl_uint              num_devices;
     cl_device_id        *devices;
+    OclDeviceInfo       *device_infos;
     cl_command_queue    *cmd_queues;
+    cl_command_queue    *queues;
+    unsigned             num_queues;
     int                  own_queues;
+    int                  own_sub_devices;
+
+    char                *cache_path;
+    OclProgramCacheStats cache_stats;
+    pthread_mutex_t      lock;
+};
+
+struct OclBuild {
+    OclPlatform         *ocl;
+    char                *source;
+    char                *options;
+    pthread_t            thread;
+    int                  thread_started;
+    pthread_mutex_t      lock;
+    pthread_cond_t       cond;
+    int                  done;
+    cl_program           program;
+    cl_int               errcode;
+    char               **logs;
 };
 
+/* On-disk layout of a cached program binary, followed by binary_size bytes */
+typedef struct {
+    char                 magic[8];
+    cl_ulong             key;
+    cl_ulong             check;
+    cl_ulong             build_time;
+    cl_ulong             binary_size;
+} CacheHeader;
+
+static const char cache_magic[8] = { 'O', 'C', 'L', 'K', 'B', 'I', 'N', '1' };
+
+/* Registered by code generated with oclkit_add_kernels, see cmake/ */
+static const OclEmbeddedProgram **embedded_programs;
+static unsigned num_embedded_programs;
+static pthread_mutex_t embedded_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static const char* opencl_error_msgs[] = {
     "CL_SUCCESS",
     "CL_DEVICE_NOT_FOUND",
@@ -98,21 +145,62 @@ ocl_strerr (int error)
     return opencl_error_msgs[index];
 }
 
-static void
-transfer_error (cl_int src, cl_int *dst)
+void
+ocl_transfer_error (cl_int src,
+                    cl_int *dst)
 {
     if (dst != NULL)
         *dst = src;
 }
 
+static const OclEmbeddedProgram *
+find_embedded_program (const char *filename)
+{
+    const OclEmbeddedProgram *result = NULL;
+    const char *basename;
+
+    basename = strrchr (filename, '/');
+    basename = basename != NULL ? basename + 1 : filename;
+
+    pthread_mutex_lock (&embedded_lock);
+
+    for (unsigned i = 0; i < num_embedded_programs && result == NULL; i++) {
+        for (const OclEmbeddedProgram *p = embedded_programs[i]; p->name != NULL; p++) {
+            if (!strcmp (p->name, basename)) {
+                result = p;
+                break;
+            }
+        }
+    }
+
+    pthread_mutex_unlock (&embedded_lock);
+    return result;
+}
+
+void
+ocl_register_embedded_programs (const OclEmbeddedProgram *programs)
+{
+    assert (programs != NULL);
+
+    pthread_mutex_lock (&embedded_lock);
+    embedded_programs = realloc (embedded_programs, (num_embedded_programs + 1) * sizeof (OclEmbeddedProgram *));
+    embedded_programs[num_embedded_programs++] = programs;
+    pthread_mutex_unlock (&embedded_lock);
+}
+
 char *
 ocl_read_program (const char *filename)
 {
+    const OclEmbeddedProgram *embedded;
     FILE *fp;
     char *buffer;
     size_t length;
     size_t buffer_length;
 
+    /* embedded sources win, they cannot be missing or out of date */
+    if ((embedded = find_embedded_program (filename)) != NULL)
+        return strdup (embedded->source);
+
     if ((fp = fopen(filename, "r")) == NULL)
         return NULL;
 
@@ -139,6 +227,112 @@ ocl_read_program (const char *filename)
     return buffer;
 }
 
+static int
+has_extension (const char *extensions, const char *name)
+{
+    size_t length = strlen (name);
+    const char *p = extensions;
+
+    while ((p = strstr (p, name)) != NULL) {
+        if ((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0'))
+            return 1;
+
+        p += length;
+    }
+
+    return 0;
+}
+
+static void
+query_device_info (cl_device_id device, OclDeviceInfo *info)
+{
+    char *extensions;
+    const char *minor;
+    size_t size;
+    size_t *item_sizes;
+    cl_uint align;
+    cl_bool unified = CL_FALSE;
+    cl_device_fp_config fp64 = 0;
+
+    memset (info, 0, sizeof (OclDeviceInfo));
+
+    OCL_CHECK_ERROR (clGetDeviceInfo (device, CL_DEVICE_NAME, sizeof (info->name), info->name, NULL));
+    OCL_CHECK_ERROR (clGetDeviceInfo (device, CL_DEVICE_VENDOR, sizeof (info->vendor), info->vendor, NULL));
+    OCL_CHECK_ERROR (clGetDeviceInfo (device, CL_DEVICE_VERSION, sizeof (info->version), info->version, NULL));
+    OCL_CHECK_ERROR (clGetDeviceInfo (device, CL_DRIVER_VERSION, sizeof (info->driver_version), info->driver_version, NULL));
+    OCL_CHECK_ERROR (clGetDeviceInfo (device, CL_DEVICE_TYPE, sizeof (cl_device_type), &info->type, NULL));
+    OCL_CHECK_ERROR (clGetDeviceInfo (device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof (cl_uint), &info->compute_units, NULL));
+    OCL_CHECK_ERROR (clGetDeviceInfo (device, CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof (cl_uint), &info->max_clock_frequency, NULL));
+    OCL_CHECK_ERROR (clGetDeviceInfo (device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof (cl_ulong), &info->global_mem_size, NULL));
+    OCL_CHECK_ERROR (clGetDeviceInfo (device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof (cl_ulong), &info->max_mem_alloc_size, NULL));
+    OCL_CHECK_ERROR (clGetDeviceInfo (device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof (cl_ulong), &info->local_mem_size, NULL));
+    OCL_CHECK_ERROR (clGetDeviceInfo (device, CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE, sizeof (cl_ulong), &info->max_constant_buffer_size, NULL));
+    OCL_CHECK_ERROR (clGetDeviceInfo (device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof (size_t), &info->max_work_group_size, NULL));
+    OCL_CHECK_ERROR (clGetDeviceInfo (device, CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS, sizeof (cl_uint), &info->max_work_item_dimensions, NULL));
+
+    item_sizes = malloc (info->max_work_item_dimensions * sizeof (size_t));
+    OCL_CHECK_ERROR (clGetDeviceInfo (device, CL_DEVICE_MAX_WORK_ITEM_SIZES, info->max_work_item_dimensions * sizeof (size_t), item_sizes, NULL));
+
+    for (cl_uint i = 0; i < info->max_work_item_dimensions && i < 3; i++)
+        info->max_work_item_sizes[i] = item_sizes[i];
+
+    free (item_sizes);
+
+    OCL_CHECK_ERROR (clGetDeviceInfo (device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof (cl_uint), &align, NULL));
+    OCL_CHECK_ERROR (clGetDeviceInfo (device, CL_DEVICE_PROFILING_TIMER_RESOLUTION, sizeof (size_t), &info->timer_resolution, NULL));
+
+    /* reported in bits */
+    info->mem_base_addr_align = align / 8;
+
+    if (clGetDeviceInfo (device, CL_DEVICE_DOUBLE_FP_CONFIG, sizeof (fp64), &fp64, NULL) == CL_SUCCESS && fp64 != 0)
+        info->features |= OCL_DEVICE_FP64;
+
+    if (clGetDeviceInfo (device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof (cl_bool), &unified, NULL) == CL_SUCCESS && unified)
+        info->features |= OCL_DEVICE_HOST_UNIFIED_MEMORY;
+
+    OCL_CHECK_ERROR (clGetDeviceInfo (device, CL_DEVICE_EXTENSIONS, 0, NULL, &size));
+    extensions = malloc (size);
+    OCL_CHECK_ERROR (clGetDeviceInfo (device, CL_DEVICE_EXTENSIONS, size, extensions, NULL));
+
+    if (has_extension (extensions, "cl_khr_fp64") || has_extension (extensions, "cl_amd_fp64"))
+        info->features |= OCL_DEVICE_FP64;
+
+    if (has_extension (extensions, "cl_khr_fp16"))
+        info->features |= OCL_DEVICE_FP16;
+
+    free (extensions);
+
+    /* "OpenCL <major>.<minor> ...", SVM needs at least 2.0 */
+    info->version_major = atoi (info->version + 7);
+    minor = strchr (info->version + 7, '.');
+    info->version_minor = minor != NULL ? atoi (minor + 1) : 0;
+
+    if (info->version_major >= 2) {
+        cl_device_svm_capabilities svm = 0;
+
+        if (clGetDeviceInfo (device, CL_DEVICE_SVM_CAPABILITIES, sizeof (svm), &svm, NULL) == CL_SUCCESS) {
+            if (svm & CL_DEVICE_SVM_COARSE_GRAIN_BUFFER)
+                info->features |= OCL_DEVICE_SVM;
+
+            if (svm & CL_DEVICE_SVM_FINE_GRAIN_BUFFER)
+                info->features |= OCL_DEVICE_SVM_FINE_GRAIN;
+
+            if (svm & CL_DEVICE_SVM_ATOMICS)
+                info->features |= OCL_DEVICE_SVM_ATOMICS;
+        }
+    }
+}
+
+static void
+query_device_infos (OclPlatform *ocl)
+{
+    free (ocl->device_infos);
+    ocl->device_infos = malloc (ocl->num_devices * sizeof (OclDeviceInfo));
+
+    for (cl_uint i = 0; i < ocl->num_devices; i++)
+        query_device_info (ocl->devices[i], &ocl->device_infos[i]);
+}
+
 static OclPlatform *
 create_platform_and_devices (unsigned platform, cl_device_type type)
 {
@@ -146,7 +340,8 @@ create_platform_and_devices (unsigned platform, cl_device_type type)
     cl_uint num_platforms;
     cl_platform_id *platforms;
 
-    ocl = malloc (sizeof(OclPlatform));
+    ocl = calloc (1, sizeof(OclPlatform));
+    pthread_mutex_init (&ocl->lock, NULL);
 
     OCL_CHECK_ERROR (clGetPlatformIDs (0, NULL, &num_platforms));
     platforms = malloc (sizeof (cl_platform_id) * num_platforms);
@@ -163,11 +358,13 @@ create_platform_and_devices (unsigned platform, cl_device_type type)
 
     ocl->devices = malloc (ocl->num_devices * sizeof(cl_device_id));
     OCL_CHECK_ERROR (clGetDeviceIDs (ocl->platform, type, ocl->num_devices, ocl->devices, NULL));
+    query_device_infos (ocl);
 
     free (platforms);
     return ocl;
 
 ocl_new_cleanup:
+    pthread_mutex_destroy (&ocl->lock);
     free (ocl);
     free (platforms);
     return NULL;
@@ -197,24 +394,131 @@ ocl_new_with_queues (unsigned platform,
                      cl_device_type type,
                      cl_command_queue_properties queue_properties)
 {
-    OclPlatform *ocl;
+    return ocl_new_with_queue_roles (platform, type, 1, &queue_properties);
+}
+
+static unsigned
+role_to_index (unsigned role, unsigned num_queues)
+{
+    if (role < num_queues)
+        return role;
+
+    /* with two queues, transfers in both directions share the first one */
+    if (num_queues == 2 && role == OCL_QUEUE_DOWNLOAD)
+        return OCL_QUEUE_UPLOAD;
+
+    return role % num_queues;
+}
+
+static void
+create_queues (OclPlatform *ocl,
+               unsigned num_queues,
+               const cl_command_queue_properties *queue_properties)
+{
     cl_int errcode;
 
+    ocl->own_queues = 1;
+    ocl->num_queues = num_queues;
+    ocl->queues = malloc (ocl->num_devices * num_queues * sizeof(cl_command_queue));
+    ocl->cmd_queues = malloc (ocl->num_devices * sizeof(cl_command_queue));
+
+    for (cl_uint i = 0; i < ocl->num_devices; i++) {
+        for (unsigned j = 0; j < num_queues; j++) {
+            cl_command_queue_properties properties = queue_properties != NULL ? queue_properties[j] : 0;
+
+            ocl->queues[i * num_queues + j] = clCreateCommandQueue (ocl->context, ocl->devices[i],
+                                                                    properties, &errcode);
+            OCL_CHECK_ERROR (errcode);
+        }
+
+        ocl->cmd_queues[i] = ocl->queues[i * num_queues + role_to_index (OCL_QUEUE_COMPUTE, num_queues)];
+    }
+}
+
+OclPlatform *
+ocl_new_with_queue_roles (unsigned platform,
+                          cl_device_type type,
+                          unsigned num_queues,
+                          const cl_command_queue_properties *queue_properties)
+{
+    OclPlatform *ocl;
+
+    if (num_queues == 0)
+        return NULL;
+
     ocl = ocl_new (platform, type);
 
     if (ocl == NULL)
         return NULL;
 
-    ocl->own_queues = 1;
-    ocl->cmd_queues = malloc (ocl->num_devices * sizeof(cl_command_queue));
+    create_queues (ocl, num_queues, queue_properties);
+    return ocl;
+}
 
-    for (cl_uint i = 0; i < ocl->num_devices; i++) {
-        ocl->cmd_queues[i] = clCreateCommandQueue (ocl->context, ocl->devices[i],
-                                                   queue_properties, &errcode);
+OclPlatform *
+ocl_new_with_sub_devices (unsigned platform,
+                          cl_device_type type,
+                          unsigned num_sub_devices,
+                          cl_command_queue_properties queue_properties)
+{
+    OclPlatform *ocl;
+    cl_device_partition_property *properties;
+    cl_device_id *sub_devices;
+    cl_uint compute_units;
+    cl_uint max_sub_devices;
+    cl_int errcode;
+
+    ocl = create_platform_and_devices (platform, type);
+
+    if (ocl == NULL)
+        return NULL;
+
+    if (ocl->num_devices == 0)
+        goto ocl_new_with_sub_devices_cleanup;
+
+    OCL_CHECK_ERROR (clGetDeviceInfo (ocl->devices[0], CL_DEVICE_MAX_COMPUTE_UNITS, sizeof (cl_uint), &compute_units, NULL));
+    OCL_CHECK_ERROR (clGetDeviceInfo (ocl->devices[0], CL_DEVICE_PARTITION_MAX_SUB_DEVICES, sizeof (cl_uint), &max_sub_devices, NULL));
+
+    if (num_sub_devices < 2 || num_sub_devices > max_sub_devices || num_sub_devices > compute_units) {
+        fprintf (stderr, "cannot partition device into %u sub devices\n", num_sub_devices);
+        goto ocl_new_with_sub_devices_cleanup;
+    }
+
+    /* split the compute units of the first device as evenly as possible */
+    properties = malloc ((num_sub_devices + 3) * sizeof (cl_device_partition_property));
+    properties[0] = CL_DEVICE_PARTITION_BY_COUNTS;
+
+    for (unsigned i = 0; i < num_sub_devices; i++)
+        properties[i + 1] = compute_units / num_sub_devices + (i < compute_units % num_sub_devices ? 1 : 0);
+
+    properties[num_sub_devices + 1] = CL_DEVICE_PARTITION_BY_COUNTS_LIST_END;
+    properties[num_sub_devices + 2] = 0;
+
+    sub_devices = malloc (num_sub_devices * sizeof (cl_device_id));
+    errcode = clCreateSubDevices (ocl->devices[0], properties, num_sub_devices, sub_devices, NULL);
+    free (properties);
+
+    if (errcode != CL_SUCCESS) {
         OCL_CHECK_ERROR (errcode);
+        free (sub_devices);
+        goto ocl_new_with_sub_devices_cleanup;
     }
 
+    free (ocl->devices);
+    ocl->devices = sub_devices;
+    ocl->num_devices = num_sub_devices;
+    ocl->own_sub_devices = 1;
+    query_device_infos (ocl);
+
+    ocl->context = clCreateContext (NULL, ocl->num_devices, ocl->devices, NULL, NULL, &errcode);
+    OCL_CHECK_ERROR (errcode);
+
+    create_queues (ocl, 1, &queue_properties);
     return ocl;
+
+ocl_new_with_sub_devices_cleanup:
+    ocl_free (ocl);
+    return NULL;
 }
 
 OclPlatform *
@@ -310,15 +614,24 @@ ocl_free (OclPlatform *ocl)
         return;
 
     if (ocl->own_queues) {
-        for (cl_uint i = 0; i < ocl->num_devices; i++)
-            OCL_CHECK_ERROR (clReleaseCommandQueue (ocl->cmd_queues[i]));
+        for (cl_uint i = 0; i < ocl->num_devices * ocl->num_queues; i++)
+            OCL_CHECK_ERROR (clReleaseCommandQueue (ocl->queues[i]));
 
+        free (ocl->queues);
         free (ocl->cmd_queues);
     }
 
     if (ocl->context != NULL)
         OCL_CHECK_ERROR (clReleaseContext (ocl->context));
 
+    if (ocl->own_sub_devices) {
+        for (cl_uint i = 0; i < ocl->num_devices; i++)
+            OCL_CHECK_ERROR (clReleaseDevice (ocl->devices[i]));
+    }
+
+    pthread_mutex_destroy (&ocl->lock);
+    free (ocl->cache_path);
+    free (ocl->device_infos);
     free (ocl->devices);
     free (ocl);
 }
@@ -336,6 +649,642 @@ ocl_get_platform_info (OclPlatform *ocl,
     return result;
 }
 
+cl_ulong
+ocl_time_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ((cl_ulong) ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+int
+ocl_queue_has_profiling (cl_command_queue queue)
+{
+    cl_command_queue_properties properties = 0;
+
+    OCL_CHECK_ERROR (clGetCommandQueueInfo (queue, CL_QUEUE_PROPERTIES, sizeof (properties), &properties, NULL));
+    return (properties & CL_QUEUE_PROFILING_ENABLE) != 0;
+}
+
+/*
+ * Waits for the last stage of a chunk that was enqueued, trailing stages may
+ * be NULL, adds the profiled duration of each stage and releases the events.
+ */
+cl_int
+ocl_retire_stage_events (cl_event *events,
+                         unsigned num_stages,
+                         int profiling,
+                         double *stage_times)
+{
+    cl_int errcode;
+    unsigned last = num_stages - 1;
+
+    while (last > 0 && events[last] == NULL)
+        last--;
+
+    errcode = clWaitForEvents (1, &events[last]);
+
+    for (unsigned i = 0; i <= last; i++) {
+        if (profiling && errcode == CL_SUCCESS) {
+            cl_ulong start, end;
+
+            ocl_get_event_times (events[i], &start, &end, NULL, NULL);
+            stage_times[i] += (end - start) / 1e9;
+        }
+
+        OCL_CHECK_ERROR (clReleaseEvent (events[i]));
+        events[i] = NULL;
+    }
+
+    return errcode;
+}
+
+int
+ocl_device_version_at_least (const OclDeviceInfo *info,
+                             int major,
+                             int minor)
+{
+    return info->version_major > major || (info->version_major == major && info->version_minor >= minor);
+}
+
+cl_ulong
+ocl_hash_bytes (cl_ulong hash, const void *data, size_t size)
+{
+    const unsigned char *p = data;
+
+    /* 64-bit FNV-1a */
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+cl_ulong
+ocl_hash_string (cl_ulong hash, const char *str)
+{
+    /* include the terminator so that "ab" + "c" differs from "a" + "bc" */
+    return str == NULL ? ocl_hash_bytes (hash, "", 1) : ocl_hash_bytes (hash, str, strlen (str) + 1);
+}
+
+int
+ocl_wire_read (int fd, void *data, size_t size)
+{
+    char *p = data;
+
+    while (size > 0) {
+        ssize_t n = read (fd, p, size);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0)
+            return 0;
+
+        p += n;
+        size -= n;
+    }
+
+    return 1;
+}
+
+int
+ocl_wire_write (int fd, const void *data, size_t size)
+{
+    const char *p = data;
+
+    while (size > 0) {
+        /* MSG_NOSIGNAL, a vanished peer must not kill the process */
+        ssize_t n = send (fd, p, size, MSG_NOSIGNAL);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0)
+            return 0;
+
+        p += n;
+        size -= n;
+    }
+
+    return 1;
+}
+
+static char *
+get_device_string (cl_device_id device, cl_device_info param)
+{
+    size_t size;
+    char *result;
+
+    if (clGetDeviceInfo (device, param, 0, NULL, &size) != CL_SUCCESS)
+        return NULL;
+
+    result = malloc (size);
+
+    if (clGetDeviceInfo (device, param, size, result, NULL) != CL_SUCCESS) {
+        free (result);
+        return NULL;
+    }
+
+    return result;
+}
+
+/*
+ * Hashes everything that determines the binary of a device: the source, the
+ * build options, the platform version and the device and driver identity. The
+ * key names the cache file, the check hash guards against collisions.
+ */
+static void
+compute_cache_key (OclPlatform *ocl,
+                   cl_device_id device,
+                   const char *source,
+                   const char *options,
+                   cl_ulong *key,
+                   cl_ulong *check)
+{
+    const cl_device_info params[] = { CL_DEVICE_NAME, CL_DEVICE_VENDOR, CL_DEVICE_VERSION, CL_DRIVER_VERSION };
+    char *platform_version;
+    cl_ulong seeds[2] = { OCL_HASH_SEED, 0x84222325cbf29ce4ULL };
+    cl_ulong *results[2] = { key, check };
+
+    platform_version = ocl_get_platform_info (ocl, CL_PLATFORM_VERSION);
+
+    for (int i = 0; i < 2; i++) {
+        cl_ulong hash = seeds[i];
+
+        hash = ocl_hash_string (hash, source);
+        hash = ocl_hash_string (hash, options);
+        hash = ocl_hash_string (hash, platform_version);
+
+        for (size_t j = 0; j < sizeof (params) / sizeof (params[0]); j++) {
+            char *value = get_device_string (device, params[j]);
+            hash = ocl_hash_string (hash, value);
+            free (value);
+        }
+
+        *results[i] = hash;
+    }
+
+    free (platform_version);
+}
+
+static char *
+get_cache_filename (OclPlatform *ocl, cl_ulong key)
+{
+    char *filename;
+    size_t size;
+
+    size = strlen (ocl->cache_path) + 32;
+    filename = malloc (size);
+    snprintf (filename, size, "%s/%016llx.bin", ocl->cache_path, (unsigned long long) key);
+    return filename;
+}
+
+static unsigned char *
+read_cached_binary (OclPlatform *ocl,
+                    cl_ulong key,
+                    cl_ulong check,
+                    size_t *size,
+                    cl_ulong *build_time)
+{
+    FILE *fp;
+    char *filename;
+    CacheHeader header;
+    unsigned char *binary = NULL;
+
+    filename = get_cache_filename (ocl, key);
+    fp = fopen (filename, "rb");
+    free (filename);
+
+    if (fp == NULL)
+        return NULL;
+
+    if (fread (&header, sizeof (header), 1, fp) != 1 ||
+        memcmp (header.magic, cache_magic, sizeof (cache_magic)) ||
+        header.key != key || header.check != check || header.binary_size == 0)
+        goto read_cached_binary_cleanup;
+
+    binary = malloc (header.binary_size);
+
+    if (binary == NULL)
+        goto read_cached_binary_cleanup;
+
+    /* a truncated file is a stale entry, the next build replaces it */
+    if (fread (binary, 1, header.binary_size, fp) != header.binary_size) {
+        free (binary);
+        binary = NULL;
+        goto read_cached_binary_cleanup;
+    }
+
+    *size = header.binary_size;
+    *build_time = header.build_time;
+
+read_cached_binary_cleanup:
+    fclose (fp);
+    return binary;
+}
+
+static void
+write_cached_binary (OclPlatform *ocl,
+                     cl_ulong key,
+                     cl_ulong check,
+                     const unsigned char *binary,
+                     size_t size,
+                     cl_ulong build_time)
+{
+    FILE *fp;
+    char *filename;
+    char *tmp_filename;
+    CacheHeader header;
+    int fd;
+
+    filename = get_cache_filename (ocl, key);
+    tmp_filename = malloc (strlen (filename) + 8);
+    sprintf (tmp_filename, "%s.XXXXXX", filename);
+
+    /*
+     * Write to a unique temporary file and rename it in place, so that
+     * concurrent readers see either the old or the complete new entry.
+     */
+    if ((fd = mkstemp (tmp_filename)) < 0)
+        goto write_cached_binary_cleanup;
+
+    if ((fp = fdopen (fd, "wb")) == NULL) {
+        close (fd);
+        unlink (tmp_filename);
+        goto write_cached_binary_cleanup;
+    }
+
+    memcpy (header.magic, cache_magic, sizeof (cache_magic));
+    header.key = key;
+    header.check = check;
+    header.build_time = build_time;
+    header.binary_size = size;
+
+    if (fwrite (&header, sizeof (header), 1, fp) != 1 ||
+        fwrite (binary, 1, size, fp) != size) {
+        fclose (fp);
+        unlink (tmp_filename);
+        goto write_cached_binary_cleanup;
+    }
+
+    if (fclose (fp) != 0 || rename (tmp_filename, filename) != 0)
+        unlink (tmp_filename);
+
+write_cached_binary_cleanup:
+    free (tmp_filename);
+    free (filename);
+}
+
+/*
+ * Precompiled binaries are embedded as a sequence of cache entries, so they
+ * are only used if key and check match, i.e. the platform, device and driver
+ * at runtime are the ones they were built for.
+ */
+static unsigned char *
+read_embedded_binary (cl_ulong key,
+                      cl_ulong check,
+                      size_t *size,
+                      cl_ulong *build_time)
+{
+    unsigned char *binary = NULL;
+
+    pthread_mutex_lock (&embedded_lock);
+
+    for (unsigned i = 0; i < num_embedded_programs && binary == NULL; i++) {
+        for (const OclEmbeddedProgram *p = embedded_programs[i]; p->name != NULL && binary == NULL; p++) {
+            size_t offset = 0;
+
+            while (p->binaries != NULL && p->binaries_size - offset >= sizeof (CacheHeader)) {
+                CacheHeader header;
+
+                memcpy (&header, p->binaries + offset, sizeof (CacheHeader));
+                offset += sizeof (CacheHeader);
+
+                if (memcmp (header.magic, cache_magic, sizeof (cache_magic)) ||
+                    header.binary_size > p->binaries_size - offset)
+                    break;
+
+                if (header.key == key && header.check == check && header.binary_size > 0) {
+                    binary = malloc (header.binary_size);
+                    memcpy (binary, p->binaries + offset, header.binary_size);
+                    *size = header.binary_size;
+                    *build_time = header.build_time;
+                    break;
+                }
+
+                offset += header.binary_size;
+            }
+        }
+    }
+
+    pthread_mutex_unlock (&embedded_lock);
+    return binary;
+}
+
+static int
+have_embedded_binaries (void)
+{
+    int result = 0;
+
+    pthread_mutex_lock (&embedded_lock);
+
+    for (unsigned i = 0; i < num_embedded_programs && !result; i++) {
+        for (const OclEmbeddedProgram *p = embedded_programs[i]; p->name != NULL; p++)
+            result = result || p->binaries_size > 0;
+    }
+
+    pthread_mutex_unlock (&embedded_lock);
+    return result;
+}
+
+static cl_program
+load_program_from_cache (OclPlatform *ocl,
+                         const char *options,
+                         cl_ulong *keys,
+                         cl_ulong *checks)
+{
+    unsigned char **binaries;
+    size_t *sizes;
+    cl_int *status;
+    cl_program program = NULL;
+    cl_ulong saved = 0;
+    cl_ulong start;
+    cl_uint loaded = 0;
+    cl_int errcode;
+
+    start = ocl_time_ns ();
+    binaries = calloc (ocl->num_devices, sizeof (unsigned char *));
+    sizes = calloc (ocl->num_devices, sizeof (size_t));
+    status = calloc (ocl->num_devices, sizeof (cl_int));
+
+    for (cl_uint i = 0; i < ocl->num_devices; i++) {
+        cl_ulong build_time;
+
+        binaries[i] = read_embedded_binary (keys[i], checks[i], &sizes[i], &build_time);
+
+        if (binaries[i] == NULL && ocl->cache_path != NULL)
+            binaries[i] = read_cached_binary (ocl, keys[i], checks[i], &sizes[i], &build_time);
+
+        if (binaries[i] == NULL)
+            goto load_program_from_cache_cleanup;
+
+        saved += build_time;
+        loaded++;
+    }
+
+    program = clCreateProgramWithBinary (ocl->context, ocl->num_devices, ocl->devices,
+                                         sizes, (const unsigned char **) binaries, status, &errcode);
+
+    if (errcode != CL_SUCCESS) {
+        program = NULL;
+        goto load_program_from_cache_cleanup;
+    }
+
+    if (clBuildProgram (program, ocl->num_devices, ocl->devices, options, NULL, NULL) != CL_SUCCESS) {
+        OCL_CHECK_ERROR (clReleaseProgram (program));
+        program = NULL;
+    }
+
+load_program_from_cache_cleanup:
+    /* like misses, hits are only counted for an actual cache directory */
+    if (program != NULL && ocl->cache_path != NULL) {
+        cl_ulong elapsed = ocl_time_ns () - start;
+
+        pthread_mutex_lock (&ocl->lock);
+        ocl->cache_stats.hits++;
+        ocl->cache_stats.saved_time += saved > elapsed ? (saved - elapsed) / 1e9 : 0.0;
+        pthread_mutex_unlock (&ocl->lock);
+    }
+
+    for (cl_uint i = 0; i < loaded; i++)
+        free (binaries[i]);
+
+    free (binaries);
+    free (sizes);
+    free (status);
+    return program;
+}
+
+static void
+store_program_in_cache (OclPlatform *ocl,
+                        cl_program program,
+                        cl_ulong *keys,
+                        cl_ulong *checks,
+                        cl_ulong build_time)
+{
+    size_t *sizes;
+    unsigned char **binaries;
+
+    sizes = calloc (ocl->num_devices, sizeof (size_t));
+    binaries = calloc (ocl->num_devices, sizeof (unsigned char *));
+
+    /* the program was built for exactly ocl->devices in that order */
+    if (clGetProgramInfo (program, CL_PROGRAM_BINARY_SIZES, ocl->num_devices * sizeof (size_t), sizes, NULL) != CL_SUCCESS)
+        goto store_program_in_cache_cleanup;
+
+    for (cl_uint i = 0; i < ocl->num_devices; i++)
+        binaries[i] = sizes[i] > 0 ? malloc (sizes[i]) : NULL;
+
+    if (clGetProgramInfo (program, CL_PROGRAM_BINARIES, ocl->num_devices * sizeof (unsigned char *), binaries, NULL) != CL_SUCCESS)
+        goto store_program_in_cache_cleanup;
+
+    /* one build covered all devices, attribute an equal share to each entry */
+    for (cl_uint i = 0; i < ocl->num_devices; i++) {
+        if (binaries[i] != NULL)
+            write_cached_binary (ocl, keys[i], checks[i], binaries[i], sizes[i],
+                                 build_time / ocl->num_devices);
+    }
+
+store_program_in_cache_cleanup:
+    for (cl_uint i = 0; i < ocl->num_devices; i++)
+        free (binaries[i]);
+
+    free (binaries);
+    free (sizes);
+}
+
+/*
+ * Builds source for all devices and writes one cache entry per device to fp,
+ * this is what oclkit-compile embeds next to the source.
+ */
+cl_int
+ocl_write_program_binaries (OclPlatform *ocl,
+                            const char *source,
+                            const char *options,
+                            FILE *fp)
+{
+    cl_program program;
+    size_t *sizes;
+    unsigned char **binaries;
+    cl_ulong start;
+    cl_ulong build_time;
+    cl_int errcode;
+
+    program = clCreateProgramWithSource (ocl->context, 1, (const char **) &source, NULL, &errcode);
+
+    if (errcode != CL_SUCCESS)
+        return errcode;
+
+    sizes = calloc (ocl->num_devices, sizeof (size_t));
+    binaries = calloc (ocl->num_devices, sizeof (unsigned char *));
+    start = ocl_time_ns ();
+    errcode = clBuildProgram (program, ocl->num_devices, ocl->devices, options, NULL, NULL);
+    build_time = ocl_time_ns () - start;
+
+    if (errcode != CL_SUCCESS)
+        goto ocl_write_program_binaries_cleanup;
+
+    errcode = clGetProgramInfo (program, CL_PROGRAM_BINARY_SIZES, ocl->num_devices * sizeof (size_t), sizes, NULL);
+
+    if (errcode != CL_SUCCESS)
+        goto ocl_write_program_binaries_cleanup;
+
+    for (cl_uint i = 0; i < ocl->num_devices; i++)
+        binaries[i] = sizes[i] > 0 ? malloc (sizes[i]) : NULL;
+
+    errcode = clGetProgramInfo (program, CL_PROGRAM_BINARIES, ocl->num_devices * sizeof (unsigned char *), binaries, NULL);
+
+    for (cl_uint i = 0; i < ocl->num_devices && errcode == CL_SUCCESS; i++) {
+        CacheHeader header;
+
+        if (binaries[i] == NULL)
+            continue;
+
+        memcpy (header.magic, cache_magic, sizeof (cache_magic));
+        compute_cache_key (ocl, ocl->devices[i], source, options, &header.key, &header.check);
+        header.build_time = build_time / ocl->num_devices;
+        header.binary_size = sizes[i];
+
+        if (fwrite (&header, sizeof (header), 1, fp) != 1 ||
+            fwrite (binaries[i], 1, sizes[i], fp) != sizes[i])
+            errcode = CL_OUT_OF_HOST_MEMORY;
+    }
+
+ocl_write_program_binaries_cleanup:
+    for (cl_uint i = 0; i < ocl->num_devices; i++)
+        free (binaries[i]);
+
+    free (binaries);
+    free (sizes);
+    OCL_CHECK_ERROR (clReleaseProgram (program));
+    return errcode;
+}
+
+int
+ocl_enable_program_cache (OclPlatform *ocl,
+                          const char *path)
+{
+    assert (ocl != NULL);
+
+    if (path == NULL)
+        return -1;
+
+    if (mkdir (path, 0755) != 0 && errno != EEXIST) {
+        fprintf (stderr, "could not create program cache `%s': %s\n", path, strerror (errno));
+        return -1;
+    }
+
+    free (ocl->cache_path);
+    ocl->cache_path = strdup (path);
+    return 0;
+}
+
+void
+ocl_get_program_cache_stats (OclPlatform *ocl,
+                             OclProgramCacheStats *stats)
+{
+    assert (ocl != NULL);
+    pthread_mutex_lock (&ocl->lock);
+    *stats = ocl->cache_stats;
+    pthread_mutex_unlock (&ocl->lock);
+}
+
+/*
+ * Creates and builds the program for all devices. On a build failure the
+ * program is still returned, so that callers can fetch the build logs.
+ */
+static cl_program
+build_program (OclPlatform *ocl,
+               const char *source,
+               const char *options,
+               cl_int *errcode)
+{
+    cl_program program;
+    cl_ulong *keys = NULL;
+    cl_ulong *checks = NULL;
+    cl_ulong start;
+
+    if (ocl->cache_path != NULL || have_embedded_binaries ()) {
+        keys = malloc (ocl->num_devices * sizeof (cl_ulong));
+        checks = malloc (ocl->num_devices * sizeof (cl_ulong));
+
+        for (cl_uint i = 0; i < ocl->num_devices; i++)
+            compute_cache_key (ocl, ocl->devices[i], source, options, &keys[i], &checks[i]);
+
+        program = load_program_from_cache (ocl, options, keys, checks);
+
+        if (program != NULL) {
+            *errcode = CL_SUCCESS;
+            goto build_program_cleanup;
+        }
+
+        /* embedded binaries alone are no cache that could have hit */
+        if (ocl->cache_path != NULL) {
+            pthread_mutex_lock (&ocl->lock);
+            ocl->cache_stats.misses++;
+            pthread_mutex_unlock (&ocl->lock);
+        }
+    }
+
+    program = clCreateProgramWithSource (ocl->context, 1, (const char **) &source, NULL, errcode);
+
+    if (*errcode != CL_SUCCESS) {
+        program = NULL;
+        goto build_program_cleanup;
+    }
+
+    start = ocl_time_ns ();
+    *errcode = clBuildProgram (program, ocl->num_devices, ocl->devices, options, NULL, NULL);
+
+    if (*errcode == CL_SUCCESS && ocl->cache_path != NULL) {
+        cl_ulong build_time = ocl_time_ns () - start;
+
+        pthread_mutex_lock (&ocl->lock);
+        ocl->cache_stats.build_time += build_time / 1e9;
+        pthread_mutex_unlock (&ocl->lock);
+
+        store_program_in_cache (ocl, program, keys, checks, build_time);
+    }
+
+build_program_cleanup:
+    free (keys);
+    free (checks);
+    return program;
+}
+
+static char *
+get_build_log (cl_program program,
+               cl_device_id device)
+{
+    size_t log_size;
+    char *log;
+
+    if (clGetProgramBuildInfo (program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size) != CL_SUCCESS)
+        return NULL;
+
+    log = malloc (log_size * sizeof(char));
+
+    if (clGetProgramBuildInfo (program, device, CL_PROGRAM_BUILD_LOG, log_size, log, NULL) != CL_SUCCESS) {
+        free (log);
+        return NULL;
+    }
+
+    return log;
+}
+
 cl_program
 ocl_create_program_from_source (OclPlatform *ocl,
                                 const char *source,
@@ -345,35 +1294,158 @@ ocl_create_program_from_source (OclPlatform *ocl,
     cl_int tmp_err;
     cl_program program;
 
-    program = clCreateProgramWithSource (ocl->context, 1, (const char **) &source, NULL, &tmp_err);
+    program = build_program (ocl, source, options, &tmp_err);
+    ocl_transfer_error (tmp_err, errcode);
 
-    if (tmp_err != CL_SUCCESS) {
-        transfer_error (tmp_err, errcode);
+    if (tmp_err != CL_SUCCESS && program != NULL) {
+        fprintf (stderr, "\n** Error building program.\n");
+
+        for (cl_uint i = 0; i < ocl->num_devices; i++) {
+            char *log = get_build_log (program, ocl->devices[i]);
+
+            fprintf (stderr, "Build log of device %u:\n%s\n", i, log != NULL ? log : "");
+            free (log);
+        }
+
+        OCL_CHECK_ERROR (clReleaseProgram (program));
         return NULL;
     }
 
-    tmp_err = clBuildProgram (program, ocl->num_devices, ocl->devices, options, NULL, NULL);
+    return program;
+}
 
-    if (tmp_err != CL_SUCCESS) {
-        size_t log_size;
-        char* log;
+static void *
+build_worker (void *data)
+{
+    OclBuild *build = data;
+    OclPlatform *ocl = build->ocl;
+    cl_program program;
+    cl_int errcode;
 
-        transfer_error (tmp_err, errcode);
+    program = build_program (ocl, build->source, build->options, &errcode);
 
-        OCL_CHECK_ERROR (clGetProgramBuildInfo (program, ocl->devices[0], CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size));
-        log = malloc (log_size * sizeof(char));
+    if (program != NULL) {
+        for (cl_uint i = 0; i < ocl->num_devices; i++)
+            build->logs[i] = get_build_log (program, ocl->devices[i]);
 
-        OCL_CHECK_ERROR (clGetProgramBuildInfo (program, ocl->devices[0], CL_PROGRAM_BUILD_LOG, log_size, log, NULL));
-        fprintf (stderr, "\n** Error building program. Build log:\n%s\n", log);
-        free (log);
+        if (errcode != CL_SUCCESS) {
+            OCL_CHECK_ERROR (clReleaseProgram (program));
+            program = NULL;
+        }
+    }
+
+    pthread_mutex_lock (&build->lock);
+    build->program = program;
+    build->errcode = errcode;
+    build->done = 1;
+    pthread_cond_broadcast (&build->cond);
+    pthread_mutex_unlock (&build->lock);
+
+    return NULL;
+}
+
+OclBuild *
+ocl_create_program_from_source_async (OclPlatform *ocl,
+                                      const char *source,
+                                      const char *options,
+                                      cl_int *errcode)
+{
+    OclBuild *build;
+
+    build = calloc (1, sizeof (OclBuild));
+
+    if (build == NULL) {
+        ocl_transfer_error (CL_OUT_OF_HOST_MEMORY, errcode);
         return NULL;
     }
 
-    *errcode = CL_SUCCESS;
+    build->ocl = ocl;
+    build->source = strdup (source);
+    build->options = options != NULL ? strdup (options) : NULL;
+    build->logs = calloc (ocl->num_devices, sizeof (char *));
+    pthread_mutex_init (&build->lock, NULL);
+    pthread_cond_init (&build->cond, NULL);
+
+    if (pthread_create (&build->thread, NULL, build_worker, build) != 0) {
+        build->thread_started = 0;
+        ocl_build_free (build);
+        ocl_transfer_error (CL_OUT_OF_RESOURCES, errcode);
+        return NULL;
+    }
+
+    build->thread_started = 1;
+    ocl_transfer_error (CL_SUCCESS, errcode);
+    return build;
+}
+
+int
+ocl_build_is_done (OclBuild *build)
+{
+    int done;
+
+    assert (build != NULL);
+    pthread_mutex_lock (&build->lock);
+    done = build->done;
+    pthread_mutex_unlock (&build->lock);
+    return done;
+}
+
+cl_program
+ocl_build_wait (OclBuild *build,
+                cl_int *errcode)
+{
+    cl_program program;
+
+    assert (build != NULL);
+    pthread_mutex_lock (&build->lock);
+
+    while (!build->done)
+        pthread_cond_wait (&build->cond, &build->lock);
+
+    /* ownership of the program passes to the caller */
+    program = build->program;
+    build->program = NULL;
+    ocl_transfer_error (build->errcode, errcode);
+    pthread_mutex_unlock (&build->lock);
 
     return program;
 }
 
+const char *
+ocl_build_get_log (OclBuild *build,
+                   unsigned device)
+{
+    assert (build != NULL);
+
+    if (!ocl_build_is_done (build) || device >= build->ocl->num_devices)
+        return NULL;
+
+    return build->logs[device];
+}
+
+void
+ocl_build_free (OclBuild *build)
+{
+    if (build == NULL)
+        return;
+
+    if (build->thread_started)
+        pthread_join (build->thread, NULL);
+
+    if (build->program != NULL)
+        OCL_CHECK_ERROR (clReleaseProgram (build->program));
+
+    for (cl_uint i = 0; i < build->ocl->num_devices; i++)
+        free (build->logs[i]);
+
+    pthread_cond_destroy (&build->cond);
+    pthread_mutex_destroy (&build->lock);
+    free (build->logs);
+    free (build->source);
+    free (build->options);
+    free (build);
+}
+
 cl_program
 ocl_create_program_from_file (OclPlatform *ocl,
                               const char *filename,
@@ -414,6 +1486,15 @@ ocl_get_devices (OclPlatform *ocl)
     return ocl->devices;
 }
 
+const OclDeviceInfo *
+ocl_get_device_info (OclPlatform *ocl,
+                     unsigned device)
+{
+    assert (ocl != NULL);
+    assert (device < ocl->num_devices);
+    return &ocl->device_infos[device];
+}
+
 cl_command_queue *
 ocl_get_cmd_queues (OclPlatform *ocl)
 {
@@ -421,6 +1502,26 @@ ocl_get_cmd_queues (OclPlatform *ocl)
     return ocl->cmd_queues;
 }
 
+unsigned
+ocl_get_num_queues (OclPlatform *ocl)
+{
+    assert (ocl != NULL);
+    return ocl->num_queues;
+}
+
+cl_command_queue
+ocl_get_queue (OclPlatform *ocl,
+               unsigned device,
+               unsigned role)
+{
+    assert (ocl != NULL);
+
+    if (!ocl->own_queues || device >= ocl->num_devices)
+        return NULL;
+
+    return ocl->queues[device * ocl->num_queues + role_to_index (role, ocl->num_queues)];
+}
+
 void
 ocl_get_event_times (cl_event event,
                      cl_ulong *start,
@@ -22,6 +22,58 @@
 #include <stdio.h>
 
 typedef struct OclPlatform OclPlatform;
+typedef struct OclBuild OclBuild;
+
+typedef enum {
+    OCL_QUEUE_UPLOAD = 0,
+    OCL_QUEUE_COMPUTE,
+    OCL_QUEUE_DOWNLOAD,
+} OclQueueRole;
+
+typedef enum {
+    OCL_DEVICE_FP64                 = 1 << 0,
+    OCL_DEVICE_FP16                 = 1 << 1,
+    OCL_DEVICE_SVM                  = 1 << 2,
+    OCL_DEVICE_SVM_FINE_GRAIN       = 1 << 3,
+    OCL_DEVICE_SVM_ATOMICS          = 1 << 4,
+    OCL_DEVICE_HOST_UNIFIED_MEMORY  = 1 << 5,
+} OclDeviceFeature;
+
+typedef struct {
+    char            name[256];
+    char            vendor[256];
+    char            version[256];
+    char            driver_version[256];
+    int             version_major;
+    int             version_minor;
+    cl_device_type  type;
+    cl_uint         compute_units;
+    cl_uint         max_clock_frequency;
+    cl_ulong        global_mem_size;
+    cl_ulong        max_mem_alloc_size;
+    cl_ulong        local_mem_size;
+    cl_ulong        max_constant_buffer_size;
+    size_t          max_work_group_size;
+    cl_uint         max_work_item_dimensions;
+    size_t          max_work_item_sizes[3];
+    cl_uint         mem_base_addr_align;    /* in bytes */
+    size_t          timer_resolution;       /* in ns */
+    unsigned        features;               /* OclDeviceFeature flags */
+} OclDeviceInfo;
+
+typedef struct {
+    unsigned long   hits;
+    unsigned long   misses;
+    double          build_time;     /* seconds spent building on misses */
+    double          saved_time;     /* seconds saved by loading binaries */
+} OclProgramCacheStats;
+
+typedef struct {
+    const char             *name;           /* file name of the source */
+    const char             *source;
+    const unsigned char    *binaries;       /* program cache entries or NULL */
+    size_t                  binaries_size;
+} OclEmbeddedProgram;
 
 #define OCL_CHECK_ERROR(error) { \
     if ((error) != CL_SUCCESS) fprintf (stderr, "OpenCL error <%s:%i>: %s\n", __FILE__, __LINE__, ocl_strerr((error))); }
@@ -36,6 +88,18 @@ OclPlatform *       ocl_new_with_queues (unsigned            platform,
                                          cl_device_type      type,
                                          cl_command_queue_properties
                                                              queue_properties);
+OclPlatform *       ocl_new_with_queue_roles
+                                        (unsigned            platform,
+                                         cl_device_type      type,
+                                         unsigned            num_queues,
+                                         const cl_command_queue_properties
+                                                            *queue_properties);
+OclPlatform *       ocl_new_with_sub_devices
+                                        (unsigned            platform,
+                                         cl_device_type      type,
+                                         unsigned            num_sub_devices,
+                                         cl_command_queue_properties
+                                                             queue_properties);
 OclPlatform *       ocl_new_from_args   (int                 argc,
                                          const char **       argv,
                                          cl_command_queue_properties
@@ -59,11 +123,39 @@ cl_program          ocl_create_program_from_source
                                          const char         *source,
                                          const char         *options,
                                          cl_int             *errcode);
+OclBuild *          ocl_create_program_from_source_async
+                                        (OclPlatform        *ocl,
+                                         const char         *source,
+                                         const char         *options,
+                                         cl_int             *errcode);
+int                 ocl_build_is_done   (OclBuild           *build);
+cl_program          ocl_build_wait      (OclBuild           *build,
+                                         cl_int             *errcode);
+const char *        ocl_build_get_log   (OclBuild           *build,
+                                         unsigned            device);
+void                ocl_build_free      (OclBuild           *build);
+int                 ocl_enable_program_cache
+                                        (OclPlatform        *ocl,
+                                         const char         *path);
+void                ocl_get_program_cache_stats
+                                        (OclPlatform        *ocl,
+                                         OclProgramCacheStats
+                                                            *stats);
 int                 ocl_get_num_devices (OclPlatform        *ocl);
 cl_device_id *      ocl_get_devices     (OclPlatform        *ocl);
+const OclDeviceInfo *
+                    ocl_get_device_info (OclPlatform        *ocl,
+                                         unsigned            device);
 cl_command_queue *  ocl_get_cmd_queues  (OclPlatform        *ocl);
+unsigned            ocl_get_num_queues  (OclPlatform        *ocl);
+cl_command_queue    ocl_get_queue       (OclPlatform        *ocl,
+                                         unsigned            device,
+                                         unsigned            role);
 const char*         ocl_strerr          (int                 error);
 char*               ocl_read_program    (const char         *filename);
+void                ocl_register_embedded_programs
+                                        (const OclEmbeddedProgram
+                                                            *programs);
 void                ocl_get_event_times (cl_event            event,
                                          cl_ulong           *start,
                                          cl_ulong           *end,
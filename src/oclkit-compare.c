@@ -0,0 +1,702 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+/*
+ * Compares CSV output of the oclkit-bench harness against a baseline store and
+ * exits with 1 if a metric got significantly worse. The store is a directory
+ * with one file per benchmark and device, <store>/<benchmark>/<device>-<index>.csv
+ * in the harness schema, written with --save. Results are matched by benchmark,
+ * device name and index, metric, unit and size but not by driver, so that a
+ * driver upgrade can be checked against the results of the old one while two
+ * identical devices of one node keep separate baselines.
+ *
+ * A result is a regression if its mean is worse than the baseline by more than
+ * the relative threshold and, if both sides have more than one sample, a
+ * one-sided Welch t-test rejects equal means at the given significance level.
+ * Times ("s") are worse when higher, bandwidths ("MB/s"), ratios and flags
+ * when lower; other units are only reported.
+ *
+ * Nothing here needs OpenCL, so baselines recorded with a CPU runtime can be
+ * checked on any machine.
+ */
+#define SCHEMA_VERSION  1
+
+typedef struct {
+    char                *benchmark;
+    char                *metric;
+    char                *unit;
+    char                *device_name;
+    char                *driver;
+    int                  device;
+    unsigned long long   size;
+    unsigned long        n;
+    unsigned long        rejected;
+    double               min;
+    double               mean;
+    double               median;
+    double               stddev;
+    double               p90;
+    double               p99;
+    double               max;
+} Row;
+
+typedef struct {
+    Row                 *rows;
+    unsigned             num_rows;
+    unsigned             capacity;
+} Rows;
+
+enum {
+    COL_BENCHMARK = 0,
+    COL_METRIC,
+    COL_UNIT,
+    COL_DEVICE,
+    COL_DEVICE_NAME,
+    COL_DRIVER,
+    COL_SIZE,
+    COL_N,
+    COL_REJECTED,
+    COL_MIN,
+    COL_MEAN,
+    COL_MEDIAN,
+    COL_STDDEV,
+    COL_P90,
+    COL_P99,
+    COL_MAX,
+    NUM_COLUMNS,
+};
+
+static const char *column_names[NUM_COLUMNS] = {
+    "benchmark", "metric", "unit", "device", "device_name", "driver", "size",
+    "n", "rejected", "min", "mean", "median", "stddev", "p90", "p99", "max",
+};
+
+/* splits a line in place, quoted fields may contain commas and "" */
+static unsigned
+split_csv_line (char *line, char **fields, unsigned max_fields)
+{
+    unsigned num_fields = 0;
+    char *src = line;
+
+    while (num_fields < max_fields) {
+        char *dst = src;
+
+        fields[num_fields++] = dst;
+
+        if (*src == '"') {
+            src++;
+
+            while (*src != '\0') {
+                if (*src == '"' && src[1] == '"') {
+                    *dst++ = '"';
+                    src += 2;
+                }
+                else if (*src == '"') {
+                    src++;
+                    break;
+                }
+                else {
+                    *dst++ = *src++;
+                }
+            }
+        }
+
+        while (*src != '\0' && *src != ',' && *src != '\n' && *src != '\r')
+            *dst++ = *src++;
+
+        if (*src != ',') {
+            *dst = '\0';
+            break;
+        }
+
+        src++;
+        *dst = '\0';
+    }
+
+    return num_fields;
+}
+
+static void
+append_row (Rows *rows, Row *row)
+{
+    if (rows->num_rows == rows->capacity) {
+        rows->capacity = rows->capacity > 0 ? rows->capacity * 2 : 64;
+        rows->rows = realloc (rows->rows, rows->capacity * sizeof (Row));
+    }
+
+    rows->rows[rows->num_rows++] = *row;
+}
+
+static const char *
+field (char **fields, unsigned num_fields, const int *columns, int column)
+{
+    if (columns[column] < 0 || (unsigned) columns[column] >= num_fields)
+        return "";
+
+    return fields[columns[column]];
+}
+
+static int
+read_csv (FILE *fp, const char *filename, Rows *rows)
+{
+    char *line = NULL;
+    size_t length = 0;
+    int columns[NUM_COLUMNS];
+    int have_header = 0;
+    unsigned line_number = 0;
+
+    while (getline (&line, &length, fp) != -1) {
+        char *fields[64];
+        unsigned num_fields;
+        Row row;
+
+        line_number++;
+
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r' || line[0] == '\0')
+            continue;
+
+        num_fields = split_csv_line (line, fields, 64);
+
+        if (!have_header) {
+            for (int c = 0; c < NUM_COLUMNS; c++) {
+                columns[c] = -1;
+
+                for (unsigned i = 0; i < num_fields; i++) {
+                    if (!strcmp (fields[i], column_names[c]))
+                        columns[c] = i;
+                }
+            }
+
+            if (columns[COL_BENCHMARK] < 0 || columns[COL_METRIC] < 0 || columns[COL_UNIT] < 0 ||
+                columns[COL_DEVICE_NAME] < 0 || columns[COL_N] < 0 || columns[COL_MEAN] < 0) {
+                fprintf (stderr, "%s:%u: not oclkit-bench CSV output\n", filename, line_number);
+                free (line);
+                return -1;
+            }
+
+            have_header = 1;
+            continue;
+        }
+
+#define FIELD(column) field (fields, num_fields, columns, column)
+        /* concatenated outputs repeat the header */
+        if (!strcmp (FIELD (COL_BENCHMARK), column_names[COL_BENCHMARK]))
+            continue;
+
+        row.benchmark = strdup (FIELD (COL_BENCHMARK));
+        row.metric = strdup (FIELD (COL_METRIC));
+        row.unit = strdup (FIELD (COL_UNIT));
+        row.device_name = strdup (FIELD (COL_DEVICE_NAME));
+        row.driver = strdup (FIELD (COL_DRIVER));
+        row.device = atoi (FIELD (COL_DEVICE));
+        row.size = strtoull (FIELD (COL_SIZE), NULL, 10);
+        row.n = strtoul (FIELD (COL_N), NULL, 10);
+        row.rejected = strtoul (FIELD (COL_REJECTED), NULL, 10);
+        row.min = atof (FIELD (COL_MIN));
+        row.mean = atof (FIELD (COL_MEAN));
+        row.median = atof (FIELD (COL_MEDIAN));
+        row.stddev = atof (FIELD (COL_STDDEV));
+        row.p90 = atof (FIELD (COL_P90));
+        row.p99 = atof (FIELD (COL_P99));
+        row.max = atof (FIELD (COL_MAX));
+#undef FIELD
+
+        append_row (rows, &row);
+    }
+
+    free (line);
+    return 0;
+}
+
+static int
+read_csv_file (const char *filename, Rows *rows)
+{
+    FILE *fp;
+    int result;
+
+    if (!strcmp (filename, "-"))
+        return read_csv (stdin, "<stdin>", rows);
+
+    if ((fp = fopen (filename, "r")) == NULL) {
+        fprintf (stderr, "Could not read `%s': %s\n", filename, strerror (errno));
+        return -1;
+    }
+
+    result = read_csv (fp, filename, rows);
+    fclose (fp);
+    return result;
+}
+
+static int
+has_suffix (const char *s, const char *suffix)
+{
+    size_t length = strlen (s);
+    size_t suffix_length = strlen (suffix);
+
+    return length >= suffix_length && !strcmp (s + length - suffix_length, suffix);
+}
+
+static int
+read_store (const char *store, Rows *rows)
+{
+    DIR *dir;
+    struct dirent *entry;
+
+    if ((dir = opendir (store)) == NULL) {
+        fprintf (stderr, "Could not open baseline store `%s': %s\n", store, strerror (errno));
+        return -1;
+    }
+
+    /* only <store>/<benchmark>/<device>-<index>.csv, anything else is left alone */
+    while ((entry = readdir (dir)) != NULL) {
+        char path[4096];
+        DIR *subdir;
+        struct dirent *subentry;
+
+        if (entry->d_name[0] == '.')
+            continue;
+
+        snprintf (path, sizeof (path), "%s/%s", store, entry->d_name);
+
+        if ((subdir = opendir (path)) == NULL)
+            continue;
+
+        while ((subentry = readdir (subdir)) != NULL) {
+            char filename[4096 + 256];
+
+            if (subentry->d_name[0] == '.' || !has_suffix (subentry->d_name, ".csv"))
+                continue;
+
+            snprintf (filename, sizeof (filename), "%s/%s", path, subentry->d_name);
+
+            if (read_csv_file (filename, rows) != 0)
+                fprintf (stderr, "Ignoring `%s'\n", filename);
+        }
+
+        closedir (subdir);
+    }
+
+    closedir (dir);
+    return 0;
+}
+
+static void
+free_rows (Rows *rows)
+{
+    for (unsigned i = 0; i < rows->num_rows; i++) {
+        free (rows->rows[i].benchmark);
+        free (rows->rows[i].metric);
+        free (rows->rows[i].unit);
+        free (rows->rows[i].device_name);
+        free (rows->rows[i].driver);
+    }
+
+    free (rows->rows);
+}
+
+static void
+slugify (const char *s, char *slug, size_t size)
+{
+    size_t length = 0;
+
+    for (; *s != '\0' && length < size - 1; s++) {
+        if (isalnum ((unsigned char) *s))
+            slug[length++] = tolower ((unsigned char) *s);
+        else if (length > 0 && slug[length - 1] != '-')
+            slug[length++] = '-';
+    }
+
+    while (length > 0 && slug[length - 1] == '-')
+        length--;
+
+    slug[length] = '\0';
+}
+
+static void
+write_csv_string (FILE *fp, const char *s)
+{
+    fputc ('"', fp);
+
+    for (; *s != '\0'; s++) {
+        if (*s == '"')
+            fputc ('"', fp);
+
+        fputc (*s, fp);
+    }
+
+    fputc ('"', fp);
+}
+
+static int
+same_group (const Row *a, const Row *b)
+{
+    return !strcmp (a->benchmark, b->benchmark) &&
+           !strcmp (a->device_name, b->device_name) &&
+           a->device == b->device;
+}
+
+static int
+save_store (const char *store, Rows *rows)
+{
+    int *saved;
+
+    if (mkdir (store, 0755) != 0 && errno != EEXIST) {
+        fprintf (stderr, "Could not create `%s': %s\n", store, strerror (errno));
+        return -1;
+    }
+
+    saved = calloc (rows->num_rows, sizeof (int));
+
+    for (unsigned i = 0; i < rows->num_rows; i++) {
+        const Row *first = &rows->rows[i];
+        char benchmark[256];
+        char device[256];
+        char path[4096];
+        FILE *fp;
+
+        if (saved[i])
+            continue;
+
+        slugify (first->benchmark, benchmark, sizeof (benchmark));
+        slugify (first->device_name, device, sizeof (device));
+        snprintf (path, sizeof (path), "%s/%s", store, benchmark);
+
+        if (mkdir (path, 0755) != 0 && errno != EEXIST) {
+            fprintf (stderr, "Could not create `%s': %s\n", path, strerror (errno));
+            free (saved);
+            return -1;
+        }
+
+        snprintf (path, sizeof (path), "%s/%s/%s-%i.csv", store, benchmark, device, first->device);
+
+        if ((fp = fopen (path, "w")) == NULL) {
+            fprintf (stderr, "Could not write `%s': %s\n", path, strerror (errno));
+            free (saved);
+            return -1;
+        }
+
+        fprintf (fp, "# schema=%i\n# benchmark=%s\n# device=%s\n# driver=%s\n",
+                 SCHEMA_VERSION, first->benchmark, first->device_name, first->driver);
+
+        for (int c = 0; c < NUM_COLUMNS; c++)
+            fprintf (fp, "%s%s", c > 0 ? "," : "", column_names[c]);
+
+        fprintf (fp, "\n");
+
+        for (unsigned j = i; j < rows->num_rows; j++) {
+            const Row *row = &rows->rows[j];
+
+            if (saved[j] || !same_group (first, row))
+                continue;
+
+            write_csv_string (fp, row->benchmark);
+            fputc (',', fp);
+            write_csv_string (fp, row->metric);
+            fputc (',', fp);
+            write_csv_string (fp, row->unit);
+            fprintf (fp, ",%i,", row->device);
+            write_csv_string (fp, row->device_name);
+            fputc (',', fp);
+            write_csv_string (fp, row->driver);
+            fprintf (fp, ",%llu,%lu,%lu,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g\n",
+                     row->size, row->n, row->rejected, row->min, row->mean, row->median,
+                     row->stddev, row->p90, row->p99, row->max);
+            saved[j] = 1;
+        }
+
+        fclose (fp);
+        printf ("Saved %s\n", path);
+    }
+
+    free (saved);
+    return 0;
+}
+
+static const Row *
+find_baseline (Rows *baselines, const Row *row)
+{
+    for (unsigned i = 0; i < baselines->num_rows; i++) {
+        const Row *base = &baselines->rows[i];
+
+        if (base->size == row->size &&
+            !strcmp (base->benchmark, row->benchmark) &&
+            base->device == row->device &&
+            !strcmp (base->device_name, row->device_name) &&
+            !strcmp (base->metric, row->metric) &&
+            !strcmp (base->unit, row->unit))
+            return base;
+    }
+
+    return NULL;
+}
+
+/* 1 if higher values are better, -1 if lower ones are, 0 if neither */
+static int
+direction (const char *unit)
+{
+    if (!strcmp (unit, "s"))
+        return -1;
+
+    if (has_suffix (unit, "/s") || !strcmp (unit, "bool") || !strcmp (unit, "ratio"))
+        return 1;
+
+    return 0;
+}
+
+/* continued fraction of the regularized incomplete beta function */
+static double
+beta_fraction (double a, double b, double x)
+{
+    const double tiny = 1e-300;
+    double c = 1.0;
+    double d;
+    double h;
+
+    d = 1.0 - (a + b) * x / (a + 1.0);
+    d = fabs (d) < tiny ? 1.0 / tiny : 1.0 / d;
+    h = d;
+
+    for (int m = 1; m <= 200; m++) {
+        double aa;
+        double delta;
+
+        aa = m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m));
+        d = 1.0 + aa * d;
+        d = fabs (d) < tiny ? 1.0 / tiny : 1.0 / d;
+        c = 1.0 + aa / c;
+        c = fabs (c) < tiny ? tiny : c;
+        h *= d * c;
+
+        aa = -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1));
+        d = 1.0 + aa * d;
+        d = fabs (d) < tiny ? 1.0 / tiny : 1.0 / d;
+        c = 1.0 + aa / c;
+        c = fabs (c) < tiny ? tiny : c;
+        delta = d * c;
+        h *= delta;
+
+        if (fabs (delta - 1.0) < 1e-12)
+            break;
+    }
+
+    return h;
+}
+
+static double
+incomplete_beta (double a, double b, double x)
+{
+    double front;
+
+    if (x <= 0.0)
+        return 0.0;
+
+    if (x >= 1.0)
+        return 1.0;
+
+    front = exp (lgamma (a + b) - lgamma (a) - lgamma (b) + a * log (x) + b * log (1.0 - x));
+
+    if (x < (a + 1.0) / (a + b + 2.0))
+        return front * beta_fraction (a, b, x) / a;
+
+    return 1.0 - front * beta_fraction (b, a, 1.0 - x) / b;
+}
+
+/* one-sided p-value of Welch's t-test that the means differ in this direction */
+static double
+welch_p_value (const Row *base, const Row *row)
+{
+    double v1, v2;
+    double se;
+    double t;
+    double df;
+
+    if (base->n < 2 || row->n < 2)
+        return 0.0;
+
+    v1 = base->stddev * base->stddev / base->n;
+    v2 = row->stddev * row->stddev / row->n;
+    se = sqrt (v1 + v2);
+
+    if (se == 0.0)
+        return row->mean != base->mean ? 0.0 : 1.0;
+
+    t = fabs (row->mean - base->mean) / se;
+    df = (v1 + v2) * (v1 + v2) / (v1 * v1 / (base->n - 1) + v2 * v2 / (row->n - 1));
+    return 0.5 * incomplete_beta (df / 2.0, 0.5, df / (df + t * t));
+}
+
+static void
+usage (void)
+{
+    printf ("Usage: oclkit-compare [OPTION...] [RESULTS.csv...]\n"
+            "Compare oclkit-bench CSV results (default: stdin) against a baseline store\n\n"
+            "  -b, --baseline DIR     Baseline store (default: data)\n"
+            "  -t, --threshold PCT    Tolerated change in percent (default: 10)\n"
+            "  -a, --alpha P          Significance level of the t-test (default: 0.01)\n"
+            "  -s, --save             Replace the baselines with the results\n"
+            "      --strict           Fail on results without baseline\n"
+            "  -h, --help             Show this help\n");
+}
+
+int
+main (int argc, char **argv)
+{
+    Rows results = { NULL, 0, 0 };
+    Rows baselines = { NULL, 0, 0 };
+    const char *store = "data";
+    double threshold = 10.0;
+    double alpha = 0.01;
+    int save = 0;
+    int strict = 0;
+    unsigned num_compared = 0;
+    unsigned num_regressions = 0;
+    unsigned num_improvements = 0;
+    unsigned num_missing = 0;
+    int c;
+
+    static struct option options[] = {
+        { "baseline",   required_argument, NULL, 'b' },
+        { "threshold",  required_argument, NULL, 't' },
+        { "alpha",      required_argument, NULL, 'a' },
+        { "save",       no_argument,       NULL, 's' },
+        { "strict",     no_argument,       NULL, 'S' },
+        { "help",       no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    while ((c = getopt_long (argc, argv, "b:t:a:sh", options, NULL)) != -1) {
+        switch (c) {
+            case 'b':
+                store = optarg;
+                break;
+            case 't':
+                threshold = atof (optarg);
+                break;
+            case 'a':
+                alpha = atof (optarg);
+                break;
+            case 's':
+                save = 1;
+                break;
+            case 'S':
+                strict = 1;
+                break;
+            case 'h':
+                usage ();
+                return 0;
+            default:
+                usage ();
+                return 2;
+        }
+    }
+
+    if (optind == argc) {
+        if (read_csv_file ("-", &results) != 0)
+            return 2;
+    }
+
+    for (int i = optind; i < argc; i++) {
+        if (read_csv_file (argv[i], &results) != 0)
+            return 2;
+    }
+
+    if (save) {
+        int result = save_store (store, &results);
+
+        free_rows (&results);
+        return result == 0 ? 0 : 2;
+    }
+
+    if (read_store (store, &baselines) != 0) {
+        free_rows (&results);
+        return 2;
+    }
+
+    for (unsigned i = 0; i < results.num_rows; i++) {
+        const Row *row = &results.rows[i];
+        const Row *base;
+        const char *status;
+        double change;
+        double p;
+        int better;
+
+        base = find_baseline (&baselines, row);
+
+        if (base == NULL) {
+            printf ("%-10s  %s  %s  %s: %.6g %s\n", "new", row->benchmark,
+                    row->device_name, row->metric, row->mean, row->unit);
+            num_missing++;
+            continue;
+        }
+
+        num_compared++;
+
+        if (base->mean != 0.0)
+            change = (row->mean - base->mean) / fabs (base->mean) * 100.0;
+        else
+            change = row->mean != 0.0 ? (row->mean > 0.0 ? 100.0 : -100.0) : 0.0;
+
+        p = welch_p_value (base, row);
+        better = direction (row->unit) * (change > 0.0 ? 1 : -1);
+        status = "ok";
+
+        if (direction (row->unit) != 0 && fabs (change) > threshold && p < alpha) {
+            if (better > 0) {
+                status = "improved";
+                num_improvements++;
+            }
+            else {
+                status = "REGRESSION";
+                num_regressions++;
+            }
+        }
+
+        printf ("%-10s  %s  %s  %s", status, row->benchmark, row->device_name, row->metric);
+
+        if (row->size > 0)
+            printf (" %llu", row->size);
+
+        printf (": %.6g -> %.6g %s (%+.1f%%", base->mean, row->mean, row->unit, change);
+
+        if (base->n > 1 && row->n > 1)
+            printf (", p=%.3g", p);
+
+        if (strcmp (base->driver, row->driver))
+            printf (", driver %s -> %s", base->driver, row->driver);
+
+        printf (")\n");
+    }
+
+    printf ("\n%u compared, %u regressions, %u improvements, %u without baseline\n",
+            num_compared, num_regressions, num_improvements, num_missing);
+
+    free_rows (&results);
+    free_rows (&baselines);
+    return num_regressions > 0 || (strict && num_missing > 0) ? 1 : 0;
+}
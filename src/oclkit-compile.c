@@ -0,0 +1,80 @@
+/*
+ *  This file is part of oclkit.
+ *
+ *  oclkit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  oclkit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with oclkit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "ocl.h"
+#include "ocl-private.h"
+
+/*
+ * Build-time helper of oclkit_add_kernels: builds a kernel source for every
+ * device of every platform on this machine and writes the binaries as program
+ * cache entries. A machine without OpenCL produces an empty file, programs
+ * then fall back to the embedded source at runtime.
+ */
+int
+main (int argc, const char **argv)
+{
+    FILE *fp;
+    char *source;
+    const char *options;
+    cl_uint num_platforms = 0;
+
+    if (argc < 3) {
+        fprintf (stderr, "Usage: oclkit-compile OUTPUT SOURCE [OPTIONS]\n");
+        return 1;
+    }
+
+    source = ocl_read_program (argv[2]);
+
+    if (source == NULL) {
+        fprintf (stderr, "Could not read `%s'\n", argv[2]);
+        return 1;
+    }
+
+    if ((fp = fopen (argv[1], "wb")) == NULL) {
+        fprintf (stderr, "Could not write `%s'\n", argv[1]);
+        free (source);
+        return 1;
+    }
+
+    options = argc > 3 && argv[3][0] != '\0' ? argv[3] : NULL;
+
+    if (clGetPlatformIDs (0, NULL, &num_platforms) != CL_SUCCESS)
+        num_platforms = 0;
+
+    for (cl_uint i = 0; i < num_platforms; i++) {
+        OclPlatform *ocl;
+        cl_int errcode;
+
+        ocl = ocl_new (i, CL_DEVICE_TYPE_ALL);
+
+        if (ocl == NULL)
+            continue;
+
+        errcode = ocl_write_program_binaries (ocl, source, options, fp);
+
+        if (errcode != CL_SUCCESS)
+            fprintf (stderr, "Warning: not precompiling `%s' for platform %u: %s\n",
+                     argv[2], i, ocl_strerr (errcode));
+
+        ocl_free (ocl);
+    }
+
+    free (source);
+    return fclose (fp) == 0 ? 0 : 1;
+}